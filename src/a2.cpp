@@ -6,7 +6,16 @@
 Matrix4x4 rotation(double angle, char axis)
 {
   Matrix4x4 r;
-  // Fill me in!
+  double c = cos(angle * M_PI / 180.0);
+  double s = sin(angle * M_PI / 180.0);
+  // The two axes the rotation moves
+  int i = (axis == 'x') ? 1 : (axis == 'y') ? 2 : 0;
+  int j = (axis == 'x') ? 2 : (axis == 'y') ? 0 : 1;
+  r[i][i] = c;
+  r[i][j] = -s;
+  r[j][i] = s;
+  r[j][j] = c;
+  r.set_kind(Matrix4x4::ROTATION);
   return r;
 }
 
@@ -14,7 +23,10 @@ Matrix4x4 rotation(double angle, char axis)
 Matrix4x4 translation(const Vector3D& displacement)
 {
   Matrix4x4 t;
-  // Fill me in!
+  t[0][3] = displacement[0];
+  t[1][3] = displacement[1];
+  t[2][3] = displacement[2];
+  t.set_kind(Matrix4x4::RIGID);
   return t;
 }
 
@@ -22,6 +34,9 @@ Matrix4x4 translation(const Vector3D& displacement)
 Matrix4x4 scaling(const Vector3D& scale)
 {
   Matrix4x4 s;
-  // Fill me in!
+  s[0][0] = scale[0];
+  s[1][1] = scale[1];
+  s[2][2] = scale[2];
+  s.set_kind(Matrix4x4::AFFINE);
   return s;
 }
@@ -0,0 +1,54 @@
+//---------------------------------------------------------------------------
+//
+// a2-chunk
+//
+// Split a model into the spatial chunks the viewer pages in (see
+// chunkedmesh.hpp).  "a2-chunk bunny.ply" writes bunny.ply.a2chunks;
+// "-o FILE" names the output instead and "-v N" caps each chunk at N
+// vertices of its own (65536 by default).
+//
+//---------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include "mesh.hpp"
+#include "meshcache.hpp"
+#include "chunkedmesh.hpp"
+
+int main(int argc, char** argv)
+{
+  std::string in, out;
+  size_t max_vertices = 65536;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out = argv[++i];
+    } else if(strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+      max_vertices = (size_t)strtoul(argv[++i], 0, 10);
+    } else if(in.empty()) {
+      in = argv[i];
+    } else {
+      in.clear();
+      break;
+    }
+  }
+  if(in.empty() || max_vertices == 0) {
+    std::cerr << "Usage: a2-chunk [-o FILE] [-v N] MODEL" << std::endl;
+    return 1;
+  }
+  if(out.empty()) {
+    out = chunked_mesh_path(in);
+  }
+
+  Mesh mesh;
+  std::string error;
+  if(!load_mesh_cached(in, mesh, error) ||
+     !write_chunked_mesh(mesh, out, max_vertices, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  std::cout << out << ": " << mesh.num_vertices() << " vertices, "
+            << mesh.num_edges() << " edges" << std::endl;
+  return 0;
+}
@@ -0,0 +1,60 @@
+//---------------------------------------------------------------------------
+//
+// a2-lod
+//
+// Build the levels of detail of a model (see meshlod.hpp).
+// "a2-lod bunny.ply" writes bunny.ply.a2lod; "-o FILE" names the output
+// instead and "-e N" stops simplifying at N edges (256 by default).
+//
+//---------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include "mesh.hpp"
+#include "meshcache.hpp"
+#include "meshlod.hpp"
+
+int main(int argc, char** argv)
+{
+  std::string in, out;
+  size_t min_edges = 256;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out = argv[++i];
+    } else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      min_edges = (size_t)strtoul(argv[++i], 0, 10);
+    } else if(in.empty()) {
+      in = argv[i];
+    } else {
+      in.clear();
+      break;
+    }
+  }
+  if(in.empty()) {
+    std::cerr << "Usage: a2-lod [-o FILE] [-e N] MODEL" << std::endl;
+    return 1;
+  }
+  if(out.empty()) {
+    out = lod_chain_path(in);
+  }
+
+  Mesh mesh;
+  LodChain chain;
+  std::string error;
+  if(!load_mesh_cached(in, mesh, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  build_lod_chain(mesh, chain, min_edges);
+  if(!write_lod_chain(chain, out, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  for(size_t l = 0; l < chain.size(); ++l) {
+    std::cout << "level " << l << ": " << chain.levels[l].mesh.num_edges()
+              << " edges, error " << chain.levels[l].error << std::endl;
+  }
+  return 0;
+}
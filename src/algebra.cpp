@@ -14,51 +14,164 @@
 
 #include "algebra.hpp"
 
-double Vector3D::normalize()
+template<class T>
+T BasicVector3D<T>::normalize()
 {
-  double denom = 1.0;
-  double x = (v_[0] > 0.0) ? v_[0] : -v_[0];
-  double y = (v_[1] > 0.0) ? v_[1] : -v_[1];
-  double z = (v_[2] > 0.0) ? v_[2] : -v_[2];
+  T denom = 1;
+  T x = (v_[0] > 0) ? v_[0] : -v_[0];
+  T y = (v_[1] > 0) ? v_[1] : -v_[1];
+  T z = (v_[2] > 0) ? v_[2] : -v_[2];
 
   if(x > y) {
     if(x > z) {
-      if(1.0 + x > 1.0) {
+      if(T(1) + x > 1) {
         y = y / x;
         z = z / x;
-        denom = 1.0 / (x * sqrt(1.0 + y*y + z*z));
+        denom = 1 / (x * std::sqrt(T(1) + y*y + z*z));
       }
     } else { /* z > x > y */ 
-      if(1.0 + z > 1.0) {
+      if(T(1) + z > 1) {
         y = y / z;
         x = x / z;
-        denom = 1.0 / (z * sqrt(1.0 + y*y + x*x));
+        denom = 1 / (z * std::sqrt(T(1) + y*y + x*x));
       }
     }
   } else {
     if(y > z) {
-      if(1.0 + y > 1.0) {
+      if(T(1) + y > 1) {
         z = z / y;
         x = x / y;
-        denom = 1.0 / (y * sqrt(1.0 + z*z + x*x));
+        denom = 1 / (y * std::sqrt(T(1) + z*z + x*x));
       }
     } else { /* x < y < z */
-      if(1.0 + z > 1.0) {
+      if(T(1) + z > 1) {
         y = y / z;
         x = x / z;
-        denom = 1.0 / (z * sqrt(1.0 + y*y + x*x));
+        denom = 1 / (z * std::sqrt(T(1) + y*y + x*x));
       }
     }
   }
 
-  if(1.0 + x + y + z > 1.0) {
+  if(T(1) + x + y + z > 1) {
     v_[0] *= denom;
     v_[1] *= denom;
     v_[2] *= denom;
-    return 1.0 / denom;
+    return 1 / denom;
   }
 
-  return 0.0;
+  return 0;
+}
+
+template class BasicVector3D<double>;
+template class BasicVector3D<float>;
+
+/*
+ * Quaternions
+ */
+
+Quaternion Quaternion::axis_angle(const Vector3D& axis, double angle)
+{
+  Vector3D a = axis;
+  a.normalize();
+  double s = sin(angle / 2);
+  return Quaternion(cos(angle / 2), a[0] * s, a[1] * s, a[2] * s);
+}
+
+Quaternion Quaternion::from_matrix(const Matrix4x4& M)
+{
+  // Take the square root of whichever of w, x, y, z is largest, so
+  // it is never near zero, and get the others from it
+  double m00 = M[0][0], m11 = M[1][1], m22 = M[2][2];
+  double trace = m00 + m11 + m22;
+  Quaternion q;
+  if(trace > 0) {
+    double s = 2 * sqrt(1 + trace);
+    q = Quaternion(s / 4, (M[2][1] - M[1][2]) / s,
+                   (M[0][2] - M[2][0]) / s, (M[1][0] - M[0][1]) / s);
+  } else if(m00 > m11 && m00 > m22) {
+    double s = 2 * sqrt(1 + m00 - m11 - m22);
+    q = Quaternion((M[2][1] - M[1][2]) / s, s / 4,
+                   (M[0][1] + M[1][0]) / s, (M[0][2] + M[2][0]) / s);
+  } else if(m11 > m22) {
+    double s = 2 * sqrt(1 + m11 - m00 - m22);
+    q = Quaternion((M[0][2] - M[2][0]) / s, (M[0][1] + M[1][0]) / s,
+                   s / 4, (M[1][2] + M[2][1]) / s);
+  } else {
+    double s = 2 * sqrt(1 + m22 - m00 - m11);
+    q = Quaternion((M[1][0] - M[0][1]) / s, (M[0][2] + M[2][0]) / s,
+                   (M[1][2] + M[2][1]) / s, s / 4);
+  }
+  q.normalize();
+  return q;
+}
+
+void Quaternion::normalize()
+{
+  double len = sqrt(dot(*this));
+  if(len > 0) {
+    w_ /= len;
+    x_ /= len;
+    y_ /= len;
+    z_ /= len;
+  }
+}
+
+Vector3D Quaternion::rotate(const Vector3D& v) const
+{
+  // v + 2u x (u x v + w v), with u the vector part
+  Vector3D u(x_, y_, z_);
+  Vector3D t = 2.0 * u.cross(v);
+  return v + w_ * t + u.cross(t);
+}
+
+Matrix4x4 Quaternion::to_matrix() const
+{
+  const double xx = x_ * x_, yy = y_ * y_, zz = z_ * z_;
+  const double xy = x_ * y_, xz = x_ * z_, yz = y_ * z_;
+  const double wx = w_ * x_, wy = w_ * y_, wz = w_ * z_;
+
+  Matrix4x4 r;
+  r[0][0] = 1 - 2 * (yy + zz);
+  r[0][1] = 2 * (xy - wz);
+  r[0][2] = 2 * (xz + wy);
+  r[1][0] = 2 * (xy + wz);
+  r[1][1] = 1 - 2 * (xx + zz);
+  r[1][2] = 2 * (yz - wx);
+  r[2][0] = 2 * (xz - wy);
+  r[2][1] = 2 * (yz + wx);
+  r[2][2] = 1 - 2 * (xx + yy);
+  r.set_kind(Matrix4x4::ROTATION);
+  return r;
+}
+
+Quaternion slerp(const Quaternion& a, const Quaternion& b, double t)
+{
+  // q and -q are the same rotation; pick the one nearer a
+  double cosine = a.dot(b);
+  double sign = 1;
+  if(cosine < 0) {
+    cosine = -cosine;
+    sign = -1;
+  }
+
+  double wa, wb;
+  if(cosine > 0.9995) {
+    // Nearly parallel: lerp, which the normalize below makes exact
+    // enough and which avoids dividing by sin of a tiny angle
+    wa = 1 - t;
+    wb = t;
+  } else {
+    double theta = acos(cosine);
+    double s = sin(theta);
+    wa = sin((1 - t) * theta) / s;
+    wb = sin(t * theta) / s;
+  }
+  wb *= sign;
+
+  Quaternion q(wa * a.w() + wb * b.w(), wa * a.x() + wb * b.x(),
+               wa * a.y() + wb * b.y(), wa * a.z() + wb * b.z());
+  q.normalize();
+  return q;
 }
 
 /*
@@ -96,7 +209,8 @@ static void submultrow(Matrix4x4& a, size_t dest, size_t src, double fac)
  * from a different school.  I taught that course too, so I figured it
  * would be okay.
  */
-Matrix4x4 Matrix4x4::invert() const
+template<>
+Matrix4x4 Matrix4x4::invert_pivoting() const
 {
   /* The algorithm is plain old Gauss-Jordan elimination 
      with partial pivoting. */
@@ -139,5 +253,702 @@ Matrix4x4 Matrix4x4::invert() const
     }
   }
 
+  ret.set_kind(kind_);
   return ret;
 }
+
+/*
+ * Batched point transformation.
+ *
+ * Each kernel evaluates the rows of M in the same order as
+ * operator *(const Matrix4x4&, const Point3D&), so every kernel gives
+ * bit-identical results.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CS488_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef void (*transform_fn)(const double *m, size_t count,
+                             const double *x, const double *y,
+                             const double *z, double *ox, double *oy,
+                             double *oz, double *ow);
+
+static void transform_scalar(const double *m, size_t count,
+                             const double *x, const double *y,
+                             const double *z, double *ox, double *oy,
+                             double *oz, double *ow)
+{
+  for(size_t i = 0; i < count; ++i) {
+    double px = x[i], py = y[i], pz = z[i];
+    ox[i] = px * m[0] + py * m[1] + pz * m[2] + m[3];
+    oy[i] = px * m[4] + py * m[5] + pz * m[6] + m[7];
+    oz[i] = px * m[8] + py * m[9] + pz * m[10] + m[11];
+    if(ow) {
+      ow[i] = px * m[12] + py * m[13] + pz * m[14] + m[15];
+    }
+  }
+}
+
+#ifdef CS488_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void transform_sse2(const double *m, size_t count,
+                           const double *x, const double *y,
+                           const double *z, double *ox, double *oy,
+                           double *oz, double *ow)
+{
+  __m128d r[16];
+  for(size_t k = 0; k < 16; ++k) {
+    r[k] = _mm_set1_pd(m[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    __m128d px = _mm_loadu_pd(x + i);
+    __m128d py = _mm_loadu_pd(y + i);
+    __m128d pz = _mm_loadu_pd(z + i);
+
+    __m128d tx = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+      _mm_mul_pd(px, r[0]), _mm_mul_pd(py, r[1])), _mm_mul_pd(pz, r[2])), r[3]);
+    __m128d ty = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+      _mm_mul_pd(px, r[4]), _mm_mul_pd(py, r[5])), _mm_mul_pd(pz, r[6])), r[7]);
+    __m128d tz = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+      _mm_mul_pd(px, r[8]), _mm_mul_pd(py, r[9])), _mm_mul_pd(pz, r[10])), r[11]);
+    if(ow) {
+      __m128d tw = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+        _mm_mul_pd(px, r[12]), _mm_mul_pd(py, r[13])), _mm_mul_pd(pz, r[14])), r[15]);
+      _mm_storeu_pd(ow + i, tw);
+    }
+
+    _mm_storeu_pd(ox + i, tx);
+    _mm_storeu_pd(oy + i, ty);
+    _mm_storeu_pd(oz + i, tz);
+  }
+
+  transform_scalar(m, count - i, x + i, y + i, z + i,
+                   ox + i, oy + i, oz + i, ow ? ow + i : 0);
+}
+
+__attribute__((target("avx2")))
+static void transform_avx2(const double *m, size_t count,
+                           const double *x, const double *y,
+                           const double *z, double *ox, double *oy,
+                           double *oz, double *ow)
+{
+  __m256d r[16];
+  for(size_t k = 0; k < 16; ++k) {
+    r[k] = _mm256_set1_pd(m[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m256d px = _mm256_loadu_pd(x + i);
+    __m256d py = _mm256_loadu_pd(y + i);
+    __m256d pz = _mm256_loadu_pd(z + i);
+
+    // No FMA here: separate multiplies and adds keep the rounding
+    // identical to the scalar path.
+    __m256d tx = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+      _mm256_mul_pd(px, r[0]), _mm256_mul_pd(py, r[1])), _mm256_mul_pd(pz, r[2])), r[3]);
+    __m256d ty = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+      _mm256_mul_pd(px, r[4]), _mm256_mul_pd(py, r[5])), _mm256_mul_pd(pz, r[6])), r[7]);
+    __m256d tz = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+      _mm256_mul_pd(px, r[8]), _mm256_mul_pd(py, r[9])), _mm256_mul_pd(pz, r[10])), r[11]);
+    if(ow) {
+      __m256d tw = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+        _mm256_mul_pd(px, r[12]), _mm256_mul_pd(py, r[13])), _mm256_mul_pd(pz, r[14])), r[15]);
+      _mm256_storeu_pd(ow + i, tw);
+    }
+
+    _mm256_storeu_pd(ox + i, tx);
+    _mm256_storeu_pd(oy + i, ty);
+    _mm256_storeu_pd(oz + i, tz);
+  }
+
+  // The code we return to is plain SSE.  Leaving the upper halves of
+  // the registers dirty makes every SSE instruction after this pay for
+  // the transition, which costs more than the kernel saves on short
+  // batches.
+  _mm256_zeroupper();
+  transform_sse2(m, count - i, x + i, y + i, z + i,
+                 ox + i, oy + i, oz + i, ow ? ow + i : 0);
+}
+
+#endif // CS488_X86_KERNELS
+
+/*
+ * The same kernels in single precision.
+ */
+
+typedef void (*transform_f_fn)(const float *m, size_t count,
+                               const float *x, const float *y,
+                               const float *z, float *ox, float *oy,
+                               float *oz, float *ow);
+
+static void transform_scalar_f(const float *m, size_t count,
+                               const float *x, const float *y,
+                               const float *z, float *ox, float *oy,
+                               float *oz, float *ow)
+{
+  for(size_t i = 0; i < count; ++i) {
+    float px = x[i], py = y[i], pz = z[i];
+    ox[i] = px * m[0] + py * m[1] + pz * m[2] + m[3];
+    oy[i] = px * m[4] + py * m[5] + pz * m[6] + m[7];
+    oz[i] = px * m[8] + py * m[9] + pz * m[10] + m[11];
+    if(ow) {
+      ow[i] = px * m[12] + py * m[13] + pz * m[14] + m[15];
+    }
+  }
+}
+
+#ifdef CS488_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void transform_sse2_f(const float *m, size_t count,
+                             const float *x, const float *y,
+                             const float *z, float *ox, float *oy,
+                             float *oz, float *ow)
+{
+  __m128 r[16];
+  for(size_t k = 0; k < 16; ++k) {
+    r[k] = _mm_set1_ps(m[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 px = _mm_loadu_ps(x + i);
+    __m128 py = _mm_loadu_ps(y + i);
+    __m128 pz = _mm_loadu_ps(z + i);
+
+    __m128 tx = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(px, r[0]), _mm_mul_ps(py, r[1])), _mm_mul_ps(pz, r[2])), r[3]);
+    __m128 ty = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(px, r[4]), _mm_mul_ps(py, r[5])), _mm_mul_ps(pz, r[6])), r[7]);
+    __m128 tz = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(px, r[8]), _mm_mul_ps(py, r[9])), _mm_mul_ps(pz, r[10])), r[11]);
+    if(ow) {
+      __m128 tw = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(px, r[12]), _mm_mul_ps(py, r[13])), _mm_mul_ps(pz, r[14])), r[15]);
+      _mm_storeu_ps(ow + i, tw);
+    }
+
+    _mm_storeu_ps(ox + i, tx);
+    _mm_storeu_ps(oy + i, ty);
+    _mm_storeu_ps(oz + i, tz);
+  }
+
+  transform_scalar_f(m, count - i, x + i, y + i, z + i,
+                     ox + i, oy + i, oz + i, ow ? ow + i : 0);
+}
+
+__attribute__((target("avx2")))
+static void transform_avx2_f(const float *m, size_t count,
+                             const float *x, const float *y,
+                             const float *z, float *ox, float *oy,
+                             float *oz, float *ow)
+{
+  __m256 r[16];
+  for(size_t k = 0; k < 16; ++k) {
+    r[k] = _mm256_set1_ps(m[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m256 px = _mm256_loadu_ps(x + i);
+    __m256 py = _mm256_loadu_ps(y + i);
+    __m256 pz = _mm256_loadu_ps(z + i);
+
+    __m256 tx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(px, r[0]), _mm256_mul_ps(py, r[1])), _mm256_mul_ps(pz, r[2])), r[3]);
+    __m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(px, r[4]), _mm256_mul_ps(py, r[5])), _mm256_mul_ps(pz, r[6])), r[7]);
+    __m256 tz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(px, r[8]), _mm256_mul_ps(py, r[9])), _mm256_mul_ps(pz, r[10])), r[11]);
+    if(ow) {
+      __m256 tw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(px, r[12]), _mm256_mul_ps(py, r[13])), _mm256_mul_ps(pz, r[14])), r[15]);
+      _mm256_storeu_ps(ow + i, tw);
+    }
+
+    _mm256_storeu_ps(ox + i, tx);
+    _mm256_storeu_ps(oy + i, ty);
+    _mm256_storeu_ps(oz + i, tz);
+  }
+
+  _mm256_zeroupper();
+  transform_sse2_f(m, count - i, x + i, y + i, z + i,
+                   ox + i, oy + i, oz + i, ow ? ow + i : 0);
+}
+
+#endif // CS488_X86_KERNELS
+
+bool transform_kernel_supported(TransformKernel kernel)
+{
+  switch(kernel) {
+  case KERNEL_SCALAR:
+    return true;
+#ifdef CS488_X86_KERNELS
+  case KERNEL_SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+  case KERNEL_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+  default:
+    return false;
+#endif
+  }
+  return false;
+}
+
+const char *transform_kernel_name(TransformKernel kernel)
+{
+  switch(kernel) {
+  case KERNEL_SCALAR: return "scalar";
+  case KERNEL_SSE2: return "sse2";
+  case KERNEL_AVX2: return "avx2";
+  }
+  return "unknown";
+}
+
+static TransformKernel current_kernel = KERNEL_SCALAR;
+static transform_fn current_transform = 0;
+static transform_f_fn current_transform_f = 0;
+
+TransformKernel set_transform_kernel(TransformKernel kernel)
+{
+  while(!transform_kernel_supported(kernel)) {
+    kernel = TransformKernel(kernel - 1);
+  }
+
+  current_kernel = kernel;
+  switch(kernel) {
+#ifdef CS488_X86_KERNELS
+  case KERNEL_AVX2:
+    current_transform = transform_avx2;
+    current_transform_f = transform_avx2_f;
+    break;
+  case KERNEL_SSE2:
+    current_transform = transform_sse2;
+    current_transform_f = transform_sse2_f;
+    break;
+#endif
+  default:
+    current_transform = transform_scalar;
+    current_transform_f = transform_scalar_f;
+    break;
+  }
+  return current_kernel;
+}
+
+TransformKernel transform_kernel()
+{
+  if(!current_transform) {
+    set_transform_kernel(KERNEL_AVX2);
+  }
+  return current_kernel;
+}
+
+void transform_points(const Matrix4x4& M, size_t count,
+                      const double *x, const double *y, const double *z,
+                      double *ox, double *oy, double *oz, double *ow)
+{
+  if(!current_transform) {
+    set_transform_kernel(KERNEL_AVX2);
+  }
+  current_transform(M.begin(), count, x, y, z, ox, oy, oz, ow);
+}
+
+void transform_points(const Matrix4x4f& M, size_t count,
+                      const float *x, const float *y, const float *z,
+                      float *ox, float *oy, float *oz, float *ow)
+{
+  if(!current_transform_f) {
+    set_transform_kernel(KERNEL_AVX2);
+  }
+  current_transform_f(M.begin(), count, x, y, z, ox, oy, oz, ow);
+}
+
+/*
+ * Batched composition with affine matrices.
+ *
+ * Every kernel sums the terms of each entry in the same order, so they
+ * agree bit for bit.
+ */
+
+static void compose_scalar(const double *a, size_t begin, size_t count,
+                           const double *const b[12], double *const out[16])
+{
+  for(size_t i = begin; i < count; ++i) {
+    for(size_t r = 0; r < 4; ++r) {
+      const double *ar = a + 4 * r;
+      for(size_t c = 0; c < 4; ++c) {
+        double v = ar[0] * b[c][i] + ar[1] * b[4 + c][i] +
+          ar[2] * b[8 + c][i];
+        out[4 * r + c][i] = c == 3 ? v + ar[3] : v;
+      }
+    }
+  }
+}
+
+#ifdef CS488_X86_KERNELS
+
+__attribute__((target("sse2")))
+static size_t compose_sse2(const double *a, size_t count,
+                           const double *const b[12], double *const out[16])
+{
+  __m128d ar[16];
+  for(size_t k = 0; k < 16; ++k) {
+    ar[k] = _mm_set1_pd(a[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    __m128d bk[12];
+    for(size_t k = 0; k < 12; ++k) {
+      bk[k] = _mm_loadu_pd(b[k] + i);
+    }
+    for(size_t r = 0; r < 4; ++r) {
+      for(size_t c = 0; c < 4; ++c) {
+        __m128d v = _mm_add_pd(_mm_add_pd(
+          _mm_mul_pd(ar[4 * r], bk[c]), _mm_mul_pd(ar[4 * r + 1], bk[4 + c])),
+          _mm_mul_pd(ar[4 * r + 2], bk[8 + c]));
+        if(c == 3) {
+          v = _mm_add_pd(v, ar[4 * r + 3]);
+        }
+        _mm_storeu_pd(out[4 * r + c] + i, v);
+      }
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t compose_avx2(const double *a, size_t count,
+                           const double *const b[12], double *const out[16])
+{
+  __m256d ar[16];
+  for(size_t k = 0; k < 16; ++k) {
+    ar[k] = _mm256_set1_pd(a[k]);
+  }
+
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m256d bk[12];
+    for(size_t k = 0; k < 12; ++k) {
+      bk[k] = _mm256_loadu_pd(b[k] + i);
+    }
+    for(size_t r = 0; r < 4; ++r) {
+      for(size_t c = 0; c < 4; ++c) {
+        __m256d v = _mm256_add_pd(_mm256_add_pd(
+          _mm256_mul_pd(ar[4 * r], bk[c]),
+          _mm256_mul_pd(ar[4 * r + 1], bk[4 + c])),
+          _mm256_mul_pd(ar[4 * r + 2], bk[8 + c]));
+        if(c == 3) {
+          v = _mm256_add_pd(v, ar[4 * r + 3]);
+        }
+        _mm256_storeu_pd(out[4 * r + c] + i, v);
+      }
+    }
+  }
+  _mm256_zeroupper();
+  return i;
+}
+
+#endif // CS488_X86_KERNELS
+
+void compose_affine(const Matrix4x4& A, size_t count,
+                    const double *const b[12], double *const out[16])
+{
+  size_t done = 0;
+  switch(transform_kernel()) {
+#ifdef CS488_X86_KERNELS
+  case KERNEL_AVX2:
+    done = compose_avx2(A.begin(), count, b, out);
+    break;
+  case KERNEL_SSE2:
+    done = compose_sse2(A.begin(), count, b, out);
+    break;
+#endif
+  default:
+    break;
+  }
+  compose_scalar(A.begin(), done, count, b, out);
+}
+
+/*
+ * Closed-form inverses, picked by Matrix4x4::invert() from the kind.
+ * All take and fill 16 doubles in row-major order.
+ */
+
+// [R t; 0 1]^-1 = [R^T -R^T t; 0 1]; rotations have t = 0
+static void inverse_rigid(const double *m, double *out)
+{
+  for(int i = 0; i < 3; ++i) {
+    for(int j = 0; j < 3; ++j) {
+      out[4 * i + j] = m[4 * j + i];
+    }
+    out[4 * i + 3] = -(out[4 * i] * m[3] + out[4 * i + 1] * m[7] +
+                       out[4 * i + 2] * m[11]);
+  }
+  out[12] = out[13] = out[14] = 0.0;
+  out[15] = 1.0;
+}
+
+// [A t; 0 1]^-1 = [A^-1 -A^-1 t; 0 1], with A^-1 from its cofactors.
+// Returns false if A is singular.
+static bool inverse_affine(const double *m, double *out)
+{
+  const double a00 = m[0], a01 = m[1], a02 = m[2];
+  const double a10 = m[4], a11 = m[5], a12 = m[6];
+  const double a20 = m[8], a21 = m[9], a22 = m[10];
+
+  const double c00 = a11 * a22 - a12 * a21;
+  const double c01 = a12 * a20 - a10 * a22;
+  const double c02 = a10 * a21 - a11 * a20;
+  const double det = a00 * c00 + a01 * c01 + a02 * c02;
+  if(det == 0.0) {
+    return false;
+  }
+  const double inv = 1.0 / det;
+
+  out[0] = c00 * inv;
+  out[1] = (a02 * a21 - a01 * a22) * inv;
+  out[2] = (a01 * a12 - a02 * a11) * inv;
+  out[4] = c01 * inv;
+  out[5] = (a00 * a22 - a02 * a20) * inv;
+  out[6] = (a02 * a10 - a00 * a12) * inv;
+  out[8] = c02 * inv;
+  out[9] = (a01 * a20 - a00 * a21) * inv;
+  out[10] = (a00 * a11 - a01 * a10) * inv;
+  for(int i = 0; i < 3; ++i) {
+    out[4 * i + 3] = -(out[4 * i] * m[3] + out[4 * i + 1] * m[7] +
+                       out[4 * i + 2] * m[11]);
+  }
+  out[12] = out[13] = out[14] = 0.0;
+  out[15] = 1.0;
+  return true;
+}
+
+/*
+ * General 4x4 inverse from 2x2 minors.  With s(i,j) the minor of rows
+ * 0-1 and c(i,j) the minor of rows 2-3 on columns i and j, and
+ *
+ *   V_k = [ a1k, -a0k, a3k, -a2k ]
+ *   K_m = [ c_m, c_m, s_m, s_m ]   (m indexing the column pairs 01,
+ *                                   02, 03, 12, 13, 23)
+ *
+ * the rows of the adjugate are
+ *
+ *   V1 K5 - V2 K4 + V3 K3
+ *   V2 K2 - V0 K5 - V3 K1
+ *   V0 K4 - V1 K2 + V3 K0
+ *   V1 K1 - V0 K3 - V2 K0
+ *
+ * which is four-wide arithmetic throughout.  As with transform_points
+ * every kernel does the same operations in the same order, so they
+ * agree to the bit.  Each returns false if the matrix is singular.
+ */
+
+static bool inverse_scalar(const double *m, double *out)
+{
+  const int pairs[6][2] = { { 0, 1 }, { 0, 2 }, { 0, 3 },
+                            { 1, 2 }, { 1, 3 }, { 2, 3 } };
+  double s[6], c[6];
+  for(int p = 0; p < 6; ++p) {
+    int i = pairs[p][0], j = pairs[p][1];
+    s[p] = m[i] * m[4 + j] - m[4 + i] * m[j];
+    c[p] = m[8 + i] * m[12 + j] - m[12 + i] * m[8 + j];
+  }
+
+  double v[4][4];
+  for(int k = 0; k < 4; ++k) {
+    v[k][0] = m[4 + k];
+    v[k][1] = -m[k];
+    v[k][2] = m[12 + k];
+    v[k][3] = -m[8 + k];
+  }
+
+  double r[16];
+  for(int l = 0; l < 4; ++l) {
+    const double *K = (l < 2) ? c : s;
+    r[l] = (v[1][l] * K[5] - v[2][l] * K[4]) + v[3][l] * K[3];
+    r[4 + l] = (v[2][l] * K[2] - v[0][l] * K[5]) - v[3][l] * K[1];
+    r[8 + l] = (v[0][l] * K[4] - v[1][l] * K[2]) + v[3][l] * K[0];
+    r[12 + l] = (v[1][l] * K[1] - v[0][l] * K[3]) - v[2][l] * K[0];
+  }
+
+  const double det = m[0] * r[0] + m[1] * r[4] + m[2] * r[8] + m[3] * r[12];
+  if(det == 0.0) {
+    return false;
+  }
+  const double inv = 1.0 / det;
+  for(int k = 0; k < 16; ++k) {
+    out[k] = r[k] * inv;
+  }
+  return true;
+}
+
+#ifdef CS488_X86_KERNELS
+
+__attribute__((target("sse2")))
+static bool inverse_sse2(const double *m, double *out)
+{
+  // Column k of rows 0/2 and of rows 1/3
+  __m128d P[4], Q[4];
+  // The two halves of V_k
+  __m128d Vlo[4], Vhi[4];
+  for(int k = 0; k < 4; ++k) {
+    P[k] = _mm_set_pd(m[8 + k], m[k]);
+    Q[k] = _mm_set_pd(m[12 + k], m[4 + k]);
+    Vlo[k] = _mm_set_pd(-m[k], m[4 + k]);
+    Vhi[k] = _mm_set_pd(-m[8 + k], m[12 + k]);
+  }
+
+  // [s_m, c_m] for each column pair, then split into [c, c] and [s, s]
+  const int pairs[6][2] = { { 0, 1 }, { 0, 2 }, { 0, 3 },
+                            { 1, 2 }, { 1, 3 }, { 2, 3 } };
+  __m128d C[6], S[6];
+  for(int p = 0; p < 6; ++p) {
+    int i = pairs[p][0], j = pairs[p][1];
+    __m128d minor = _mm_sub_pd(_mm_mul_pd(P[i], Q[j]),
+                               _mm_mul_pd(Q[i], P[j]));
+    C[p] = _mm_unpackhi_pd(minor, minor);
+    S[p] = _mm_unpacklo_pd(minor, minor);
+  }
+
+  __m128d r[8];
+#define CS488_ROW(V, K, a, b, c, x, y, z, op)                       \
+  op(_mm_sub_pd(_mm_mul_pd(V[a], K[x]), _mm_mul_pd(V[b], K[y])),     \
+     _mm_mul_pd(V[c], K[z]))
+  r[0] = CS488_ROW(Vlo, C, 1, 2, 3, 5, 4, 3, _mm_add_pd);
+  r[1] = CS488_ROW(Vhi, S, 1, 2, 3, 5, 4, 3, _mm_add_pd);
+  r[2] = CS488_ROW(Vlo, C, 2, 0, 3, 2, 5, 1, _mm_sub_pd);
+  r[3] = CS488_ROW(Vhi, S, 2, 0, 3, 2, 5, 1, _mm_sub_pd);
+  r[4] = CS488_ROW(Vlo, C, 0, 1, 3, 4, 2, 0, _mm_add_pd);
+  r[5] = CS488_ROW(Vhi, S, 0, 1, 3, 4, 2, 0, _mm_add_pd);
+  r[6] = CS488_ROW(Vlo, C, 1, 0, 2, 1, 3, 0, _mm_sub_pd);
+  r[7] = CS488_ROW(Vhi, S, 1, 0, 2, 1, 3, 0, _mm_sub_pd);
+#undef CS488_ROW
+
+  const double det = m[0] * _mm_cvtsd_f64(r[0]) + m[1] * _mm_cvtsd_f64(r[2]) +
+    m[2] * _mm_cvtsd_f64(r[4]) + m[3] * _mm_cvtsd_f64(r[6]);
+  if(det == 0.0) {
+    return false;
+  }
+  const __m128d inv = _mm_set1_pd(1.0 / det);
+  for(int k = 0; k < 8; ++k) {
+    _mm_storeu_pd(out + 2 * k, _mm_mul_pd(r[k], inv));
+  }
+  return true;
+}
+
+__attribute__((target("avx2")))
+static bool inverse_avx2(const double *m, double *out)
+{
+  __m128d P[4], Q[4];
+  __m256d V[4];
+  for(int k = 0; k < 4; ++k) {
+    P[k] = _mm_set_pd(m[8 + k], m[k]);
+    Q[k] = _mm_set_pd(m[12 + k], m[4 + k]);
+    V[k] = _mm256_set_pd(-m[8 + k], m[12 + k], -m[k], m[4 + k]);
+  }
+
+  // [s_m, c_m] for each column pair, spread to [c, c, s, s]
+  const int pairs[6][2] = { { 0, 1 }, { 0, 2 }, { 0, 3 },
+                            { 1, 2 }, { 1, 3 }, { 2, 3 } };
+  __m256d K[6];
+  for(int p = 0; p < 6; ++p) {
+    int i = pairs[p][0], j = pairs[p][1];
+    __m128d minor = _mm_sub_pd(_mm_mul_pd(P[i], Q[j]),
+                               _mm_mul_pd(Q[i], P[j]));
+    K[p] = _mm256_permute4x64_pd(_mm256_castpd128_pd256(minor), 0x05);
+  }
+
+  __m256d r[4];
+  r[0] = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(V[1], K[5]),
+                                     _mm256_mul_pd(V[2], K[4])),
+                       _mm256_mul_pd(V[3], K[3]));
+  r[1] = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(V[2], K[2]),
+                                     _mm256_mul_pd(V[0], K[5])),
+                       _mm256_mul_pd(V[3], K[1]));
+  r[2] = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(V[0], K[4]),
+                                     _mm256_mul_pd(V[1], K[2])),
+                       _mm256_mul_pd(V[3], K[0]));
+  r[3] = _mm256_sub_pd(_mm256_sub_pd(_mm256_mul_pd(V[1], K[1]),
+                                     _mm256_mul_pd(V[0], K[3])),
+                       _mm256_mul_pd(V[2], K[0]));
+
+  const double det = m[0] * _mm256_cvtsd_f64(r[0]) +
+    m[1] * _mm256_cvtsd_f64(r[1]) + m[2] * _mm256_cvtsd_f64(r[2]) +
+    m[3] * _mm256_cvtsd_f64(r[3]);
+  if(det == 0.0) {
+    _mm256_zeroupper();
+    return false;
+  }
+  const __m256d inv = _mm256_set1_pd(1.0 / det);
+  for(int k = 0; k < 4; ++k) {
+    _mm256_storeu_pd(out + 4 * k, _mm256_mul_pd(r[k], inv));
+  }
+  _mm256_zeroupper();
+  return true;
+}
+
+#endif // CS488_X86_KERNELS
+
+template<>
+Matrix4x4 Matrix4x4::invert() const
+{
+  double out[16];
+  bool ok = true;
+
+  switch(kind_) {
+  case ROTATION:
+  case RIGID:
+    inverse_rigid(v_, out);
+    break;
+  case AFFINE:
+    ok = inverse_affine(v_, out);
+    break;
+  default:
+    switch(transform_kernel()) {
+#ifdef CS488_X86_KERNELS
+    case KERNEL_AVX2:
+      ok = inverse_avx2(v_, out);
+      break;
+    case KERNEL_SSE2:
+      ok = inverse_sse2(v_, out);
+      break;
+#endif
+    default:
+      ok = inverse_scalar(v_, out);
+      break;
+    }
+    break;
+  }
+
+  // Leave singular matrices to elimination, which behaves as it always
+  // has for them
+  if(!ok) {
+    return invert_pivoting();
+  }
+
+  Matrix4x4 ret(out);
+  ret.kind_ = kind_;
+  return ret;
+}
+
+template<>
+Matrix4x4f Matrix4x4f::invert() const
+{
+  return Matrix4x4f(Matrix4x4(*this).invert());
+}
+
+template<>
+Matrix4x4f Matrix4x4f::invert_pivoting() const
+{
+  return Matrix4x4f(Matrix4x4(*this).invert_pivoting());
+}
@@ -8,6 +8,12 @@
 // and colours.  You probably won't need to modify anything in these
 // two files.
 //
+// Every class is a template on its scalar type.  The familiar names
+// (Point3D, Matrix4x4, ...) are the double versions; the float ones,
+// for code that wants half the memory traffic and twice the SIMD
+// width, have an "f" on the end (Point3Df, Matrix4x4f, ...).  Values
+// convert between the two explicitly.
+//
 // University of Waterloo Computer Graphics Lab / 2003
 //
 //---------------------------------------------------------------------------
@@ -23,68 +29,86 @@
 #define M_PI 3.14159265358979323846
 #endif
 
-class Point2D
+template<class T>
+class BasicPoint2D
 {
 public:
-  Point2D()
+  typedef T Scalar;
+
+  BasicPoint2D()
   {
     v_[0] = 0.0;
     v_[1] = 0.0;
   }
-  Point2D(double x, double y)
+  BasicPoint2D(T x, T y)
   { 
     v_[0] = x;
     v_[1] = y;
   }
-  Point2D(const Point2D& other)
+  BasicPoint2D(const BasicPoint2D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
   }
 
-  Point2D& operator =(const Point2D& other)
+  BasicPoint2D& operator =(const BasicPoint2D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
     return *this;
   }
 
-  double& operator[](size_t idx) 
+  T& operator[](size_t idx) 
   {
     return v_[ idx ];
   }
-  double operator[](size_t idx) const 
+  T operator[](size_t idx) const 
   {
     return v_[ idx ];
   }
 
 private:
-  double v_[2];
+  T v_[2];
 };
 
-class Point3D
+typedef BasicPoint2D<double> Point2D;
+typedef BasicPoint2D<float> Point2Df;
+
+template<class T>
+class BasicPoint3D
 {
 public:
-  Point3D()
+  typedef T Scalar;
+
+  BasicPoint3D()
   {
     v_[0] = 0.0;
     v_[1] = 0.0;
     v_[2] = 0.0;
   }
-  Point3D(double x, double y, double z)
+  BasicPoint3D(T x, T y, T z)
   { 
     v_[0] = x;
     v_[1] = y;
     v_[2] = z;
   }
-  Point3D(const Point3D& other)
+  BasicPoint3D(const BasicPoint3D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
     v_[2] = other.v_[2];
   }
 
-  Point3D& operator =(const Point3D& other)
+  // Convert from another scalar type
+  template<class U>
+  explicit BasicPoint3D(const BasicPoint3D<U>& other)
+  {
+    v_[0] = T(other[0]);
+    v_[1] = T(other[1]);
+    v_[2] = T(other[2]);
+  }
+
+  BasicPoint3D& operator =(const BasicPoint3D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
@@ -92,42 +116,57 @@ public:
     return *this;
   }
 
-  double& operator[](size_t idx) 
+  T& operator[](size_t idx) 
   {
     return v_[ idx ];
   }
-  double operator[](size_t idx) const 
+  T operator[](size_t idx) const 
   {
     return v_[ idx ];
   }
 
 private:
-  double v_[3];
+  T v_[3];
 };
 
-class Vector3D
+typedef BasicPoint3D<double> Point3D;
+typedef BasicPoint3D<float> Point3Df;
+
+template<class T>
+class BasicVector3D
 {
 public:
-  Vector3D()
+  typedef T Scalar;
+
+  BasicVector3D()
   {
     v_[0] = 0.0;
     v_[1] = 0.0;
     v_[2] = 0.0;
   }
-  Vector3D(double x, double y, double z)
+  BasicVector3D(T x, T y, T z)
   { 
     v_[0] = x;
     v_[1] = y;
     v_[2] = z;
   }
-  Vector3D(const Vector3D& other)
+  BasicVector3D(const BasicVector3D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
     v_[2] = other.v_[2];
   }
 
-  Vector3D& operator =(const Vector3D& other)
+  // Convert from another scalar type
+  template<class U>
+  explicit BasicVector3D(const BasicVector3D<U>& other)
+  {
+    v_[0] = T(other[0]);
+    v_[1] = T(other[1]);
+    v_[2] = T(other[2]);
+  }
+
+  BasicVector3D& operator =(const BasicVector3D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
@@ -135,118 +174,140 @@ public:
     return *this;
   }
 
-  double& operator[](size_t idx) 
+  T& operator[](size_t idx) 
   {
     return v_[ idx ];
   }
-  double operator[](size_t idx) const 
+  T operator[](size_t idx) const 
   {
     return v_[ idx ];
   }
 
-  double dot(const Vector3D& other) const
+  T dot(const BasicVector3D& other) const
   {
     return v_[0]*other.v_[0] + v_[1]*other.v_[1] + v_[2]*other.v_[2];
   }
 
-  double length2() const
+  T length2() const
   {
     return v_[0]*v_[0] + v_[1]*v_[1] + v_[2]*v_[2];
   }
-  double length() const
+  T length() const
   {
-    return sqrt(length2());
+    return std::sqrt(length2());
   }
 
-  double normalize();
+  T normalize();
 
-  Vector3D cross(const Vector3D& other) const
+  BasicVector3D cross(const BasicVector3D& other) const
   {
-    return Vector3D(
+    return BasicVector3D(
                     v_[1]*other[2] - v_[2]*other[1],
                     v_[2]*other[0] - v_[0]*other[2],
                     v_[0]*other[1] - v_[1]*other[0]);
   }
 
 private:
-  double v_[3];
+  T v_[3];
 };
 
-inline Vector3D operator *(double s, const Vector3D& v)
+typedef BasicVector3D<double> Vector3D;
+typedef BasicVector3D<float> Vector3Df;
+
+template<class T>
+inline BasicVector3D<T> operator *(typename BasicVector3D<T>::Scalar s,
+                                   const BasicVector3D<T>& v)
 {
-  return Vector3D(s*v[0], s*v[1], s*v[2]);
+  return BasicVector3D<T>(s*v[0], s*v[1], s*v[2]);
 }
 
-inline Vector3D operator +(const Vector3D& a, const Vector3D& b)
+template<class T>
+inline BasicVector3D<T> operator +(const BasicVector3D<T>& a,
+                                   const BasicVector3D<T>& b)
 {
-  return Vector3D(a[0]+b[0], a[1]+b[1], a[2]+b[2]);
+  return BasicVector3D<T>(a[0]+b[0], a[1]+b[1], a[2]+b[2]);
 }
 
-inline Point3D operator +(const Point3D& a, const Vector3D& b)
+template<class T>
+inline BasicPoint3D<T> operator +(const BasicPoint3D<T>& a,
+                                  const BasicVector3D<T>& b)
 {
-  return Point3D(a[0]+b[0], a[1]+b[1], a[2]+b[2]);
+  return BasicPoint3D<T>(a[0]+b[0], a[1]+b[1], a[2]+b[2]);
 }
 
-inline Vector3D operator -(const Point3D& a, const Point3D& b)
+template<class T>
+inline BasicVector3D<T> operator -(const BasicPoint3D<T>& a,
+                                   const BasicPoint3D<T>& b)
 {
-  return Vector3D(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
+  return BasicVector3D<T>(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
 }
 
-inline Vector3D operator -(const Vector3D& a, const Vector3D& b)
+template<class T>
+inline BasicVector3D<T> operator -(const BasicVector3D<T>& a,
+                                   const BasicVector3D<T>& b)
 {
-  return Vector3D(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
+  return BasicVector3D<T>(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
 }
 
-inline Vector3D operator -(const Vector3D& a)
+template<class T>
+inline BasicVector3D<T> operator -(const BasicVector3D<T>& a)
 {
-  return Vector3D(-a[0], -a[1], -a[2]);
+  return BasicVector3D<T>(-a[0], -a[1], -a[2]);
 }
 
-inline Point3D operator -(const Point3D& a, const Vector3D& b)
+template<class T>
+inline BasicPoint3D<T> operator -(const BasicPoint3D<T>& a,
+                                  const BasicVector3D<T>& b)
 {
-  return Point3D(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
+  return BasicPoint3D<T>(a[0]-b[0], a[1]-b[1], a[2]-b[2]);
 }
 
-inline Vector3D cross(const Vector3D& a, const Vector3D& b) 
+template<class T>
+inline BasicVector3D<T> cross(const BasicVector3D<T>& a,
+                              const BasicVector3D<T>& b) 
 {
   return a.cross(b);
 }
 
-inline std::ostream& operator <<(std::ostream& os, const Point2D& p)
+template<class T>
+inline std::ostream& operator <<(std::ostream& os, const BasicPoint2D<T>& p)
 {
   return os << "p<" << p[0] << "," << p[1] << ">";
 }
 
-inline std::ostream& operator <<(std::ostream& os, const Point3D& p)
+template<class T>
+inline std::ostream& operator <<(std::ostream& os, const BasicPoint3D<T>& p)
 {
   return os << "p<" << p[0] << "," << p[1] << "," << p[2] << ">";
 }
 
-inline std::ostream& operator <<(std::ostream& os, const Vector3D& v)
+template<class T>
+inline std::ostream& operator <<(std::ostream& os, const BasicVector3D<T>& v)
 {
   return os << "v<" << v[0] << "," << v[1] << "," << v[2] << ">";
 }
 
-class Matrix4x4;
-
-class Vector4D
+template<class T>
+class BasicVector4D
 {
 public:
-  Vector4D()
+  typedef T Scalar;
+
+  BasicVector4D()
   {
     v_[0] = 0.0;
     v_[1] = 0.0;
     v_[2] = 0.0;
     v_[3] = 0.0;
   }
-  Vector4D(double x, double y, double z, double w)
+  BasicVector4D(T x, T y, T z, T w)
   { 
     v_[0] = x;
     v_[1] = y;
     v_[2] = z;
     v_[3] = w;
   }
-  Vector4D(const Vector4D& other)
+  BasicVector4D(const BasicVector4D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
@@ -254,7 +315,17 @@ public:
     v_[3] = other.v_[3];
   }
 
-  Vector4D& operator =(const Vector4D& other)
+  // Convert from another scalar type
+  template<class U>
+  explicit BasicVector4D(const BasicVector4D<U>& other)
+  {
+    v_[0] = T(other[0]);
+    v_[1] = T(other[1]);
+    v_[2] = T(other[2]);
+    v_[3] = T(other[3]);
+  }
+
+  BasicVector4D& operator =(const BasicVector4D& other)
   {
     v_[0] = other.v_[0];
     v_[1] = other.v_[1];
@@ -263,23 +334,43 @@ public:
     return *this;
   }
 
-  double& operator[](size_t idx) 
+  T& operator[](size_t idx) 
   {
     return v_[ idx ];
   }
-  double operator[](size_t idx) const 
+  T operator[](size_t idx) const 
   {
     return v_[ idx ];
   }
 
 private:
-  double v_[4];
+  T v_[4];
 };
 
-class Matrix4x4
+typedef BasicVector4D<double> Vector4D;
+typedef BasicVector4D<float> Vector4Df;
+
+template<class T>
+class BasicMatrix4x4
 {
 public:
-  Matrix4x4()
+  typedef T Scalar;
+
+  // What is known about a matrix, from most to least special.  Each
+  // kind is also every kind after it.  invert() uses the kind to pick
+  // a closed-form inverse instead of elimination.
+  enum Kind {
+    // Orthonormal upper 3x3, no translation, last row 0 0 0 1
+    ROTATION,
+    // A rotation followed by a translation
+    RIGID,
+    // Any upper 3x4, last row 0 0 0 1
+    AFFINE,
+    GENERAL
+  };
+
+  BasicMatrix4x4()
+    : kind_(ROTATION)
   {
     // Construct an identity matrix
     std::fill(v_, v_+16, 0.0);
@@ -288,12 +379,21 @@ public:
     v_[10] = 1.0;
     v_[15] = 1.0;
   }
-  Matrix4x4(const Matrix4x4& other)
+  BasicMatrix4x4(const BasicMatrix4x4& other)
+    : kind_(other.kind_)
   {
     std::copy(other.v_, other.v_+16, v_);
   }
-  Matrix4x4(const Vector4D row1, const Vector4D row2, const Vector4D row3, 
-             const Vector4D row4)
+  // Convert from another scalar type, keeping the kind
+  template<class U>
+  explicit BasicMatrix4x4(const BasicMatrix4x4<U>& other)
+    : kind_(Kind(other.kind()))
+  {
+    std::copy(other.begin(), other.end(), v_);
+  }
+  BasicMatrix4x4(const BasicVector4D<T> row1, const BasicVector4D<T> row2,
+                 const BasicVector4D<T> row3, const BasicVector4D<T> row4)
+    : kind_(GENERAL)
   {
     v_[0] = row1[0]; 
     v_[1] = row1[1]; 
@@ -315,66 +415,104 @@ public:
     v_[14] = row4[2]; 
     v_[15] = row4[3]; 
   }
-  Matrix4x4(double *vals)
+  BasicMatrix4x4(const T *vals)
+    : kind_(GENERAL)
   {
-    std::copy(vals, vals + 16, (double*)v_);
+    std::copy(vals, vals + 16, (T*)v_);
   }
 
-  Matrix4x4& operator=(const Matrix4x4& other)
+  BasicMatrix4x4& operator=(const BasicMatrix4x4& other)
   {
     std::copy(other.v_, other.v_+16, v_);
+    kind_ = other.kind_;
     return *this;
   }
 
-  Vector4D getRow(size_t row) const
+  // Writing through a row pointer may make the matrix anything, so
+  // the non-const accessors drop the kind to GENERAL.  Call set_kind()
+  // after filling in a matrix known to be more special.
+  BasicVector4D<T> getRow(size_t row) const
   {
-    return Vector4D(v_[4*row], v_[4*row+1], v_[4*row+2], v_[4*row+3]);
+    return BasicVector4D<T>(v_[4*row], v_[4*row+1], v_[4*row+2],
+                            v_[4*row+3]);
   }
-  double *getRow(size_t row) 
+  T *getRow(size_t row) 
   {
-    return (double*)v_ + 4*row;
+    kind_ = GENERAL;
+    return (T*)v_ + 4*row;
   }
 
-  Vector4D getColumn(size_t col) const
+  BasicVector4D<T> getColumn(size_t col) const
   {
-    return Vector4D(v_[col], v_[4+col], v_[8+col], v_[12+col]);
+    return BasicVector4D<T>(v_[col], v_[4+col], v_[8+col], v_[12+col]);
   }
 
-  Vector4D operator[](size_t row) const
+  BasicVector4D<T> operator[](size_t row) const
   {
     return getRow(row);
   }
-  double *operator[](size_t row) 
+  T *operator[](size_t row) 
   {
     return getRow(row);
   }
 
-  Matrix4x4 transpose() const
+  Kind kind() const
+  {
+    return kind_;
+  }
+  void set_kind(Kind kind)
   {
-    return Matrix4x4(getColumn(0), getColumn(1), 
-                      getColumn(2), getColumn(3));
+    kind_ = kind;
   }
-  Matrix4x4 invert() const;
 
-  const double *begin() const
+  BasicMatrix4x4 transpose() const
   {
-    return (double*)v_;
+    BasicMatrix4x4 ret(getColumn(0), getColumn(1), 
+                  getColumn(2), getColumn(3));
+    if(kind_ == ROTATION) {
+      ret.kind_ = ROTATION;
+    }
+    return ret;
   }
-  const double *end() const
+
+  // The inverse, computed the cheapest way the kind allows.  The result
+  // has the same kind.
+  BasicMatrix4x4 invert() const;
+  // The inverse by Gauss-Jordan elimination with partial pivoting,
+  // whatever the kind.  Slow, but the most robust.
+  BasicMatrix4x4 invert_pivoting() const;
+
+  const T *begin() const
+  {
+    return (T*)v_;
+  }
+  const T *end() const
   {
     return begin() + 16;
   }
 		
 private:
-  double v_[16];
+  T v_[16];
+  Kind kind_;
 };
 
-inline Matrix4x4 operator *(const Matrix4x4& a, const Matrix4x4& b)
+typedef BasicMatrix4x4<double> Matrix4x4;
+typedef BasicMatrix4x4<float> Matrix4x4f;
+
+// Both inverses are worked out in double precision (see algebra.cpp)
+template<> Matrix4x4 Matrix4x4::invert() const;
+template<> Matrix4x4 Matrix4x4::invert_pivoting() const;
+template<> Matrix4x4f Matrix4x4f::invert() const;
+template<> Matrix4x4f Matrix4x4f::invert_pivoting() const;
+
+template<class T>
+inline BasicMatrix4x4<T> operator *(const BasicMatrix4x4<T>& a,
+                                    const BasicMatrix4x4<T>& b)
 {
-  Matrix4x4 ret;
+  BasicMatrix4x4<T> ret;
 
   for(size_t i = 0; i < 4; ++i) {
-    Vector4D row = a.getRow(i);
+    BasicVector4D<T> row = a.getRow(i);
 		
     for(size_t j = 0; j < 4; ++j) {
       ret[i][j] = row[0] * b[0][j] + row[1] * b[1][j] + 
@@ -382,34 +520,78 @@ inline Matrix4x4 operator *(const Matrix4x4& a, const Matrix4x4& b)
     }
   }
 
+  // The product is as special as the less special factor
+  ret.set_kind(std::max(a.kind(), b.kind()));
   return ret;
 }
 
-inline Vector3D operator *(const Matrix4x4& M, const Vector3D& v)
+template<class T>
+inline BasicVector3D<T> operator *(const BasicMatrix4x4<T>& M,
+                                   const BasicVector3D<T>& v)
 {
-  return Vector3D(
+  return BasicVector3D<T>(
                   v[0] * M[0][0] + v[1] * M[0][1] + v[2] * M[0][2],
                   v[0] * M[1][0] + v[1] * M[1][1] + v[2] * M[1][2],
                   v[0] * M[2][0] + v[1] * M[2][1] + v[2] * M[2][2]);
 }
 
-inline Point3D operator *(const Matrix4x4& M, const Point3D& p)
+template<class T>
+inline BasicPoint3D<T> operator *(const BasicMatrix4x4<T>& M,
+                                  const BasicPoint3D<T>& p)
 {
-  return Point3D(
+  return BasicPoint3D<T>(
                  p[0] * M[0][0] + p[1] * M[0][1] + p[2] * M[0][2] + M[0][3],
                  p[0] * M[1][0] + p[1] * M[1][1] + p[2] * M[1][2] + M[1][3],
                  p[0] * M[2][0] + p[1] * M[2][1] + p[2] * M[2][2] + M[2][3]);
 }
 
-inline Vector3D transNorm(const Matrix4x4& M, const Vector3D& n)
+// Transform "count" points held in structure-of-arrays form (separate
+// x, y and z arrays) by M.  Each output point is the same as
+// M * Point3D(x[i], y[i], z[i]).  If ow is non-null the homogeneous
+// row of M is also evaluated and stored in ow[i].  Outputs may alias
+// the inputs, so a buffer can be transformed in place.
+void transform_points(const Matrix4x4& M, size_t count,
+                      const double *x, const double *y, const double *z,
+                      double *ox, double *oy, double *oz, double *ow = 0);
+// The same in single precision, twice as many points to a vector
+void transform_points(const Matrix4x4f& M, size_t count,
+                      const float *x, const float *y, const float *z,
+                      float *ox, float *oy, float *oz, float *ow = 0);
+
+// Compose A with "count" affine matrices held in structure-of-arrays
+// form: b[4 * r + c][i] is entry (r, c) of the i-th matrix, whose last
+// row is taken to be 0 0 0 1.  Entry (r, c) of A * B_i is stored in
+// out[4 * r + c][i].  Uses the same kernel as transform_points.
+void compose_affine(const Matrix4x4& A, size_t count,
+                    const double *const b[12], double *const out[16]);
+
+// The implementations transform_points can dispatch to.  The fastest
+// one the CPU supports is picked at runtime; set_transform_kernel can
+// force a slower one (requests for unsupported kernels fall back to
+// the best supported one).  It returns the kernel actually selected.
+enum TransformKernel {
+  KERNEL_SCALAR,
+  KERNEL_SSE2,
+  KERNEL_AVX2
+};
+
+TransformKernel transform_kernel();
+TransformKernel set_transform_kernel(TransformKernel kernel);
+bool transform_kernel_supported(TransformKernel kernel);
+const char *transform_kernel_name(TransformKernel kernel);
+
+template<class T>
+inline BasicVector3D<T> transNorm(const BasicMatrix4x4<T>& M,
+                                  const BasicVector3D<T>& n)
 {
-  return Vector3D(
+  return BasicVector3D<T>(
                   n[0] * M[0][0] + n[1] * M[1][0] + n[2] * M[2][0],
                   n[0] * M[0][1] + n[1] * M[1][1] + n[2] * M[2][1],
                   n[0] * M[0][2] + n[1] * M[1][2] + n[2] * M[2][2]);
 }
 
-inline std::ostream& operator <<(std::ostream& os, const Matrix4x4& M)
+template<class T>
+inline std::ostream& operator <<(std::ostream& os, const BasicMatrix4x4<T>& M)
 {
   return os << "[" << M[0][0] << " " << M[0][1] << " " 
             << M[0][2] << " " << M[0][3] << "]" << std::endl
@@ -421,26 +603,99 @@ inline std::ostream& operator <<(std::ostream& os, const Matrix4x4& M)
             << M[3][2] << " " << M[3][3] << "]";
 }
 
-class Colour
+// A rotation as a unit quaternion w + xi + yj + zk.  Composing
+// rotations is a quaternion product (16 multiplies against 64 for
+// 4x4 matrices) and keeping them exact rotations only takes
+// renormalizing four numbers, so orientations that are updated
+// constantly are kept as quaternions and turned into a matrix when
+// one is needed.
+class Quaternion
 {
 public:
-  Colour(double r, double g, double b)
+  Quaternion()
+    : w_(1.0), x_(0.0), y_(0.0), z_(0.0)
+  {}
+  Quaternion(double w, double x, double y, double z)
+    : w_(w), x_(x), y_(y), z_(z)
+  {}
+
+  // The rotation of "angle" radians counterclockwise about "axis"
+  static Quaternion axis_angle(const Vector3D& axis, double angle);
+  // The rotation in the upper 3x3 of M, which must be orthonormal
+  static Quaternion from_matrix(const Matrix4x4& M);
+
+  double w() const { return w_; }
+  double x() const { return x_; }
+  double y() const { return y_; }
+  double z() const { return z_; }
+
+  // The inverse rotation
+  Quaternion conjugate() const
+  {
+    return Quaternion(w_, -x_, -y_, -z_);
+  }
+
+  double dot(const Quaternion& other) const
+  {
+    return w_*other.w_ + x_*other.x_ + y_*other.y_ + z_*other.z_;
+  }
+
+  // Scale back to unit length against rounding drift
+  void normalize();
+
+  Vector3D rotate(const Vector3D& v) const;
+  // A ROTATION-kind matrix for the same rotation
+  Matrix4x4 to_matrix() const;
+
+private:
+  double w_, x_, y_, z_;
+};
+
+// Apply b, then a
+inline Quaternion operator *(const Quaternion& a, const Quaternion& b)
+{
+  return Quaternion(
+    a.w()*b.w() - a.x()*b.x() - a.y()*b.y() - a.z()*b.z(),
+    a.w()*b.x() + a.x()*b.w() + a.y()*b.z() - a.z()*b.y(),
+    a.w()*b.y() - a.x()*b.z() + a.y()*b.w() + a.z()*b.x(),
+    a.w()*b.z() + a.x()*b.y() - a.y()*b.x() + a.z()*b.w());
+}
+
+// Spherical linear interpolation from a (t = 0) to b (t = 1) along the
+// shorter arc, at constant angular speed.
+Quaternion slerp(const Quaternion& a, const Quaternion& b, double t);
+
+template<class T>
+class BasicColour
+{
+public:
+  typedef T Scalar;
+
+  BasicColour(T r, T g, T b)
     : r_(r)
     , g_(g)
     , b_(b)
   {}
-  Colour(double c)
+  BasicColour(T c)
     : r_(c)
     , g_(c)
     , b_(c)
   {}
-  Colour(const Colour& other)
+  BasicColour(const BasicColour& other)
     : r_(other.r_)
     , g_(other.g_)
     , b_(other.b_)
   {}
 
-  Colour& operator =(const Colour& other)
+  // Convert from another scalar type
+  template<class U>
+  explicit BasicColour(const BasicColour<U>& other)
+    : r_(T(other.R()))
+    , g_(T(other.G()))
+    , b_(T(other.B()))
+  {}
+
+  BasicColour& operator =(const BasicColour& other)
   {
     r_ = other.r_;
     g_ = other.g_;
@@ -448,41 +703,51 @@ public:
     return *this;
   }
 
-  double R() const 
+  T R() const 
   { 
     return r_;
   }
-  double G() const 
+  T G() const 
   { 
     return g_;
   }
-  double B() const 
+  T B() const 
   { 
     return b_;
   }
 
 private:
-  double r_;
-  double g_;
-  double b_;
+  T r_;
+  T g_;
+  T b_;
 };
 
-inline Colour operator *(double s, const Colour& a)
+typedef BasicColour<double> Colour;
+typedef BasicColour<float> Colourf;
+
+template<class T>
+inline BasicColour<T> operator *(typename BasicColour<T>::Scalar s,
+                                 const BasicColour<T>& a)
 {
-  return Colour(s*a.R(), s*a.G(), s*a.B());
+  return BasicColour<T>(s*a.R(), s*a.G(), s*a.B());
 }
 
-inline Colour operator *(const Colour& a, const Colour& b)
+template<class T>
+inline BasicColour<T> operator *(const BasicColour<T>& a,
+                                 const BasicColour<T>& b)
 {
-  return Colour(a.R()*b.R(), a.G()*b.G(), a.B()*b.B());
+  return BasicColour<T>(a.R()*b.R(), a.G()*b.G(), a.B()*b.B());
 }
 
-inline Colour operator +(const Colour& a, const Colour& b)
+template<class T>
+inline BasicColour<T> operator +(const BasicColour<T>& a,
+                                 const BasicColour<T>& b)
 {
-  return Colour(a.R()+b.R(), a.G()+b.G(), a.B()+b.B());
+  return BasicColour<T>(a.R()+b.R(), a.G()+b.G(), a.B()+b.B());
 }
 
-inline std::ostream& operator <<(std::ostream& os, const Colour& c)
+template<class T>
+inline std::ostream& operator <<(std::ostream& os, const BasicColour<T>& c)
 {
   return os << "c<" << c.R() << "," << c.G() << "," << c.B() << ">";
 }
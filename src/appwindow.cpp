@@ -18,6 +18,22 @@ AppWindow::AppWindow()
 	m_menu_app.items().push_back(MenuElem("_Quit", Gtk::AccelKey("q"),
 		sigc::mem_fun(*this, &AppWindow::hide)));
 	m_menu_app.items().push_back(MenuElem("_Reset", Gtk::AccelKey("a"),	reset_slot ) );
+	m_menu_app.items().push_back(MenuElem("_Single View", Gtk::AccelKey("1"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_quad_view), false)));
+	m_menu_app.items().push_back(MenuElem("Q_uad View", Gtk::AccelKey("4"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_quad_view), true)));
+	m_menu_app.items().push_back(MenuElem("_Merge Sub-pixel Edges", Gtk::AccelKey("m"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_merge_lines), true)));
+	m_menu_app.items().push_back(MenuElem("Draw _Every Edge", Gtk::AccelKey("e"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_merge_lines), false)));
+	m_menu_app.items().push_back(MenuElem("_Hide Hidden Lines", Gtk::AccelKey("h"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_hidden_lines), true)));
+	m_menu_app.items().push_back(MenuElem("Show Hidden _Lines", Gtk::AccelKey("l"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_hidden_lines), false)));
+	m_menu_app.items().push_back(MenuElem("_Creases and Silhouettes", Gtk::AccelKey("c"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_feature_edges), true)));
+	m_menu_app.items().push_back(MenuElem("Full _Wireframe", Gtk::AccelKey("w"),
+		sigc::bind(sigc::mem_fun(m_viewer, &Viewer::set_feature_edges), false)));
   
 
 // Set up the Mode Menu
@@ -38,7 +54,7 @@ AppWindow::AppWindow()
 	currentModeLabel.set_text("Current Mode:\t Rotate View");
 	nearFarLabel.set_text("Near Plane:\t0\tFar Plane:\t0");
 	
-	m_viewer.set_labels(&currentModeLabel, &nearFarLabel);
+	m_viewer.set_labels(&currentModeLabel, &nearFarLabel, &profileLabel);
 	
 	// Pack in our widgets
   
@@ -49,6 +65,7 @@ AppWindow::AppWindow()
 	m_vbox.pack_start(m_menubar, Gtk::PACK_SHRINK);
 	m_vbox.pack_start(currentModeLabel, Gtk::PACK_EXPAND_PADDING);
 	m_vbox.pack_start(nearFarLabel, Gtk::PACK_EXPAND_PADDING);
+	m_vbox.pack_start(profileLabel, Gtk::PACK_EXPAND_PADDING);
 
   // Put the viewer below the menubar. pack_start "grows" the widget
   // by default, so it'll take up the rest of the window.
@@ -57,3 +74,39 @@ AppWindow::AppWindow()
 
   show_all();
 }
+
+bool AppWindow::load_mesh(const std::string& path, std::string& error)
+{
+  return m_viewer.load_mesh(path, error);
+}
+
+void AppWindow::set_instances(unsigned count)
+{
+  m_viewer.set_instances(count);
+}
+
+void AppWindow::set_precision(Precision precision)
+{
+  m_viewer.set_precision(precision);
+}
+
+void AppWindow::set_chunk_budget(size_t bytes)
+{
+  m_viewer.set_chunk_budget(bytes);
+}
+
+void AppWindow::set_lod_pixels(double pixels)
+{
+  m_viewer.set_lod_pixels(pixels);
+}
+
+bool AppWindow::record_input(const std::string& path, std::string& error)
+{
+  return m_viewer.record_input(path, error);
+}
+
+bool AppWindow::replay_input(const std::string& path, bool fast,
+                             std::string& error)
+{
+  return m_viewer.replay_input(path, fast, error);
+}
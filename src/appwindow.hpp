@@ -7,6 +7,21 @@
 class AppWindow : public Gtk::Window {
 public:
   AppWindow();
+
+  // Show the mesh in "path" in the viewer
+  bool load_mesh(const std::string& path, std::string& error);
+  // Draw "count" copies of it
+  void set_instances(unsigned count);
+  // Transform it in single or double precision
+  void set_precision(Precision precision);
+  // Keep at most "bytes" of a chunk file's chunks in memory
+  void set_chunk_budget(size_t bytes);
+  // Draw levels of detail whose error covers at most "pixels" pixels
+  void set_lod_pixels(double pixels);
+
+  // Record input to, or replay it from, "path" (see Viewer)
+  bool record_input(const std::string& path, std::string& error);
+  bool replay_input(const std::string& path, bool fast, std::string& error);
   
 protected:
 
@@ -23,7 +38,7 @@ Gtk::RadioButtonGroup m_mode_group;
 
 
 // Label widgets
-Gtk::Label currentModeLabel, nearFarLabel;
+Gtk::Label currentModeLabel, nearFarLabel, profileLabel;
 
   // The main OpenGL area
   Viewer m_viewer;
@@ -0,0 +1,90 @@
+//---------------------------------------------------------------------------
+//
+// arena.hpp/arena.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "arena.hpp"
+#include <cstdlib>
+#include <new>
+
+const size_t Arena::ALIGN;
+
+// Blocks are never smaller than this
+static const size_t MIN_BLOCK = 64 * 1024;
+
+Arena::Arena(size_t capacity)
+  : m_offset(0)
+  , m_used(0)
+  , m_heap_allocations(0)
+{
+  // Room for the block list, so adding blocks in a frame doesn't
+  // allocate for the list as well
+  m_blocks.reserve(16);
+  if(capacity != 0) {
+    add_block(capacity);
+  }
+}
+
+Arena::~Arena()
+{
+  for(size_t i = 0; i < m_blocks.size(); ++i) {
+    free(m_blocks[i].data);
+  }
+}
+
+void Arena::add_block(size_t size)
+{
+  size = (size + ALIGN - 1) / ALIGN * ALIGN;
+  void *data = 0;
+  if(posix_memalign(&data, ALIGN, size) != 0) {
+    throw std::bad_alloc();
+  }
+  Block block = { (char*)data, size };
+  m_blocks.push_back(block);
+  m_offset = 0;
+  ++m_heap_allocations;
+}
+
+void *Arena::allocate_bytes(size_t bytes)
+{
+  bytes = (bytes + ALIGN - 1) / ALIGN * ALIGN;
+  if(m_blocks.empty() || m_offset + bytes > m_blocks.back().size) {
+    // Grow geometrically so a frame that keeps needing more settles
+    // after a few frames
+    size_t size = MIN_BLOCK;
+    if(!m_blocks.empty()) {
+      size = 2 * m_blocks.back().size;
+    }
+    add_block(size < bytes ? bytes : size);
+  }
+  char *p = m_blocks.back().data + m_offset;
+  m_offset += bytes;
+  m_used += bytes;
+  return p;
+}
+
+size_t Arena::capacity() const
+{
+  size_t total = 0;
+  for(size_t i = 0; i < m_blocks.size(); ++i) {
+    total += m_blocks[i].size;
+  }
+  return total;
+}
+
+void Arena::reset()
+{
+  // The frame fit in one block: just rewind
+  if(m_blocks.size() > 1) {
+    // It didn't: swap the blocks for one that holds them all
+    size_t total = capacity();
+    for(size_t i = 0; i < m_blocks.size(); ++i) {
+      free(m_blocks[i].data);
+    }
+    m_blocks.clear();
+    add_block(total);
+  }
+  m_offset = 0;
+  m_used = 0;
+}
@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+//
+// arena.hpp/arena.cpp
+//
+// A bump allocator for scratch memory that lives for one frame.
+// Allocating moves a pointer through a block; reset() moves it back,
+// releasing everything at once.  When a frame needs more than the block
+// holds, further blocks are taken from the heap, and the next reset()
+// replaces them all with one block big enough for the whole frame, so
+// after the first frame or two every frame runs out of a single block
+// and makes no heap allocations.
+//
+// Only plain data should be put in an arena: nothing allocated from it
+// is constructed or destroyed.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_ARENA_HPP
+#define CS488_ARENA_HPP
+
+#include <vector>
+#include <cstddef>
+
+class Arena {
+public:
+  // Everything is aligned to this, which suits SIMD loads and keeps
+  // arrays handed to different threads on different cache lines.
+  static const size_t ALIGN = 64;
+
+  explicit Arena(size_t capacity = 0);
+  ~Arena();
+
+  // Uninitialized room for "count" T's
+  template<class T>
+  T *allocate(size_t count)
+  {
+    return (T*)allocate_bytes(count * sizeof(T));
+  }
+  void *allocate_bytes(size_t bytes);
+
+  // Release everything allocated since the last reset
+  void reset();
+
+  // Bytes allocated since the last reset, and held in blocks
+  size_t used() const
+  {
+    return m_used;
+  }
+  size_t capacity() const;
+
+  // Blocks taken from the heap over the arena's life
+  unsigned long heap_allocations() const
+  {
+    return m_heap_allocations;
+  }
+
+private:
+  Arena(const Arena&);
+  Arena& operator =(const Arena&);
+
+  struct Block {
+    char *data;
+    size_t size;
+  };
+  void add_block(size_t size);
+
+  // The current block is the last one
+  std::vector<Block> m_blocks;
+  size_t m_offset;
+  size_t m_used;
+  unsigned long m_heap_allocations;
+};
+
+#endif
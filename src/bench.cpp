@@ -0,0 +1,1764 @@
+//---------------------------------------------------------------------------
+//
+// a2-bench
+//
+// Headless microbenchmarks for the parts of the viewer that don't need
+// a display.  Run "a2-bench" for every suite or "a2-bench <suite>..."
+// for a selection.
+//
+//---------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "algebra.hpp"
+#include "a2.hpp"
+#include "inputlog.hpp"
+#include "mesh.hpp"
+#include "meshcache.hpp"
+#include "meshlod.hpp"
+#include "chunkedmesh.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "scenegraph.hpp"
+#include "softdraw.hpp"
+#include "threadpool.hpp"
+
+// Keeps the optimizer from throwing away benchmark results.
+static volatile double sink;
+
+// Every heap allocation the benchmarks make, from any thread, so a
+// suite can check what a steady frame costs
+static std::atomic<unsigned long> heap_allocations(0);
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  ++heap_allocations;
+  void *p = malloc(size != 0 ? size : 1);
+  if(!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+// Both kept out of line, or GCC sees free() meet a new expression, or
+// malloc() meet a delete, and warns
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+static double frand()
+{
+  return (double)rand() / RAND_MAX * 2.0 - 1.0;
+}
+
+static Matrix4x4 random_matrix()
+{
+  Matrix4x4 m;
+  for(size_t i = 0; i < 4; ++i) {
+    for(size_t j = 0; j < 4; ++j) {
+      m[i][j] = frand();
+    }
+  }
+  return m;
+}
+
+/*
+ * transform: per-point operator * against the batched SoA kernels.
+ */
+static void bench_transform()
+{
+  const size_t count = 1 << 16;
+  const int reps = 200;
+
+  std::vector<double> x(count), y(count), z(count);
+  std::vector<double> ox(count), oy(count), oz(count), ow(count);
+  for(size_t i = 0; i < count; ++i) {
+    x[i] = frand();
+    y[i] = frand();
+    z[i] = frand();
+  }
+  Matrix4x4 M = random_matrix();
+
+  std::cout << "transform: " << count << " points x " << reps << std::endl;
+
+  double start = now_ns();
+  for(int r = 0; r < reps; ++r) {
+    for(size_t i = 0; i < count; ++i) {
+      Point3D p = M * Point3D(x[i], y[i], z[i]);
+      ox[i] = p[0];
+      oy[i] = p[1];
+      oz[i] = p[2];
+    }
+  }
+  double base = (now_ns() - start) / ((double)count * reps);
+  sink = ox[count / 2];
+  std::cout << "  " << std::setw(8) << "Point3D" << "  "
+            << std::fixed << std::setprecision(3) << base << " ns/point"
+            << std::endl;
+
+  TransformKernel saved = transform_kernel();
+  for(int k = KERNEL_SCALAR; k <= KERNEL_AVX2; ++k) {
+    TransformKernel kernel = TransformKernel(k);
+    if(!transform_kernel_supported(kernel)) {
+      std::cout << "  " << std::setw(8) << transform_kernel_name(kernel)
+                << "  (not supported)" << std::endl;
+      continue;
+    }
+    set_transform_kernel(kernel);
+
+    start = now_ns();
+    for(int r = 0; r < reps; ++r) {
+      transform_points(M, count, &x[0], &y[0], &z[0],
+                       &ox[0], &oy[0], &oz[0], &ow[0]);
+    }
+    double t = (now_ns() - start) / ((double)count * reps);
+    sink = ox[count / 2];
+    std::cout << "  " << std::setw(8) << transform_kernel_name(kernel) << "  "
+              << t << " ns/point  (" << std::setprecision(2) << base / t
+              << "x, with w)" << std::setprecision(3) << std::endl;
+  }
+  set_transform_kernel(saved);
+}
+
+/*
+ * invert: Matrix4x4::invert() on each kind of matrix against the
+ * Gauss-Jordan elimination it used for everything.
+ */
+static Matrix4x4 random_rotation()
+{
+  return rotation(180 * frand(), 'x') * rotation(180 * frand(), 'y') *
+    rotation(180 * frand(), 'z');
+}
+
+// Largest entry of a * b - I
+static double identity_error(const Matrix4x4& a, const Matrix4x4& b)
+{
+  Matrix4x4 p = a * b;
+  double err = 0;
+  for(size_t i = 0; i < 4; ++i) {
+    for(size_t j = 0; j < 4; ++j) {
+      err = std::max(err, fabs(p[i][j] - (i == j ? 1.0 : 0.0)));
+    }
+  }
+  return err;
+}
+
+static void bench_invert()
+{
+  const size_t count = 4096;
+  const int reps = 50;
+
+  std::vector<Matrix4x4> sets[4];
+  for(size_t i = 0; i < count; ++i) {
+    Vector3D t(10 * frand(), 10 * frand(), 10 * frand());
+    Vector3D sc(1.5 + frand(), 2 + frand(), 1.5 + frand());
+    sets[Matrix4x4::ROTATION].push_back(random_rotation());
+    sets[Matrix4x4::RIGID].push_back(translation(t) * random_rotation());
+    sets[Matrix4x4::AFFINE].push_back(translation(t) * random_rotation() *
+                                      scaling(sc));
+    sets[Matrix4x4::GENERAL].push_back(random_matrix());
+  }
+  const char *names[4] = { "rotation", "rigid", "affine", "general" };
+
+  std::cout << "invert: " << count << " matrices x " << reps << std::endl;
+  for(int k = 0; k < 4; ++k) {
+    const std::vector<Matrix4x4>& set = sets[k];
+
+    double pivot_best = 1e300, pivot_err = 0;
+    for(int r = 0; r < reps; ++r) {
+      double start = now_ns();
+      for(size_t i = 0; i < count; ++i) {
+        sink = sink + set[i].invert_pivoting().begin()[5];
+      }
+      pivot_best = std::min(pivot_best, now_ns() - start);
+    }
+    for(size_t i = 0; i < count; ++i) {
+      pivot_err = std::max(pivot_err,
+                           identity_error(set[i], set[i].invert_pivoting()));
+    }
+    std::cout << "  " << std::setw(8) << names[k] << "  pivoting "
+              << std::fixed << std::setprecision(2)
+              << pivot_best / count << " ns" << "  err "
+              << std::scientific << std::setprecision(1) << pivot_err
+              << std::endl;
+
+    // The general case has a kernel per SIMD width; the others don't
+    // depend on it
+    int first = KERNEL_SCALAR, last = KERNEL_AVX2;
+    if(k != Matrix4x4::GENERAL) {
+      first = last = transform_kernel();
+    }
+    for(int kernel = first; kernel <= last; ++kernel) {
+      if(!transform_kernel_supported(TransformKernel(kernel))) {
+        continue;
+      }
+      set_transform_kernel(TransformKernel(kernel));
+
+      double best = 1e300, err = 0;
+      for(int r = 0; r < reps; ++r) {
+        double start = now_ns();
+        for(size_t i = 0; i < count; ++i) {
+          sink = sink + set[i].invert().begin()[5];
+        }
+        best = std::min(best, now_ns() - start);
+      }
+      for(size_t i = 0; i < count; ++i) {
+        err = std::max(err, identity_error(set[i], set[i].invert()));
+      }
+      std::cout << "  " << std::setw(8) << "" << "  "
+                << std::setw(8) << (k == Matrix4x4::GENERAL ?
+                                    transform_kernel_name(TransformKernel(kernel)) :
+                                    names[k])
+                << " " << std::fixed << std::setprecision(2) << best / count
+                << " ns  err " << std::scientific << std::setprecision(1)
+                << err << std::fixed << "  (" << std::setprecision(2)
+                << pivot_best / best << "x)" << std::endl;
+    }
+  }
+  set_transform_kernel(KERNEL_AVX2);
+}
+
+/*
+ * raster: the software draw backend on random lines, for a range of
+ * thread counts.
+ */
+static void bench_raster()
+{
+  const int width = 1280, height = 720;
+  const size_t count = 1 << 20;
+  const int reps = 3;
+
+  std::vector<double> points(4 * count);
+  std::vector<float> colours(3 * count);
+  for(size_t i = 0; i < count; ++i) {
+    // Mostly short lines, like a dense mesh seen from a distance
+    double x = (frand() + 1.0) * 0.5 * width;
+    double y = (frand() + 1.0) * 0.5 * height;
+    points[4 * i] = x;
+    points[4 * i + 1] = y;
+    points[4 * i + 2] = x + 20.0 * frand();
+    points[4 * i + 3] = y + 20.0 * frand();
+    colours[3 * i] = (float)(i % 7) / 7.0f;
+    colours[3 * i + 1] = 0.2f;
+    colours[3 * i + 2] = 0.8f;
+  }
+
+  std::cout << "raster: " << count << " lines at " << width << "x"
+            << height << std::endl;
+
+  unsigned maxthreads = std::max(1u, std::thread::hardware_concurrency());
+  for(int aa = 1; aa >= 0; --aa) {
+    soft_set_antialias(aa != 0);
+    for(unsigned threads = 1; threads <= maxthreads; threads *= 2) {
+      soft_set_threads(threads);
+      double best = 1e300;
+      for(int r = 0; r < reps; ++r) {
+        double start = now_ns();
+        draw_init(width, height);
+        draw_lines(&points[0], &colours[0], count);
+        draw_complete();
+        best = std::min(best, now_ns() - start);
+      }
+      std::cout << "  " << (aa ? "wu       " : "bresenham") << " "
+                << std::setw(2) << threads << " threads  "
+                << std::fixed << std::setprecision(2) << best / count
+                << " ns/line  " << best / 1e6 << " ms/frame" << std::endl;
+      if(threads * 2 > maxthreads && threads != maxthreads) {
+        threads = maxthreads / 2;
+      }
+    }
+  }
+  soft_set_antialias(true);
+  soft_set_threads(0);
+}
+
+/*
+ * Synthetic scenes
+ */
+
+// A latitude/longitude sphere of radius 1 made of quads, with
+// rings * segments vertices (the poles are repeated per segment).
+static Mesh make_sphere(unsigned rings, unsigned segments)
+{
+  Mesh mesh;
+  for(unsigned i = 0; i < rings; ++i) {
+    double theta = M_PI * i / (rings - 1);
+    for(unsigned j = 0; j < segments; ++j) {
+      double phi = 2.0 * M_PI * j / segments;
+      mesh.x.push_back(sin(theta) * cos(phi));
+      mesh.y.push_back(sin(theta) * sin(phi));
+      mesh.z.push_back(cos(theta));
+    }
+  }
+
+  for(unsigned i = 0; i + 1 < rings; ++i) {
+    for(unsigned j = 0; j < segments; ++j) {
+      unsigned a = i * segments + j;
+      unsigned b = i * segments + (j + 1) % segments;
+      unsigned c = a + segments;
+      unsigned d = b + segments;
+      unsigned tris[6] = { a, c, d, a, d, b };
+      mesh.faces.insert(mesh.faces.end(), tris, tris + 6);
+      mesh.edges.push_back(std::min(a, b));
+      mesh.edges.push_back(std::max(a, b));
+      mesh.edges.push_back(a);
+      mesh.edges.push_back(c);
+    }
+  }
+  unsigned last = (rings - 1) * segments;
+  for(unsigned j = 0; j < segments; ++j) {
+    mesh.edges.push_back(std::min(last + j, last + (j + 1) % segments));
+    mesh.edges.push_back(std::max(last + j, last + (j + 1) % segments));
+  }
+
+  // Sort the edges the way the loader leaves them
+  std::vector< std::pair<unsigned, unsigned> > pairs;
+  for(size_t e = 0; e < mesh.edges.size(); e += 2) {
+    pairs.push_back(std::make_pair(mesh.edges[e], mesh.edges[e + 1]));
+  }
+  std::sort(pairs.begin(), pairs.end());
+  unsigned *edges = mesh.edges.writable();
+  for(size_t e = 0; e < pairs.size(); ++e) {
+    edges[2 * e] = pairs[e].first;
+    edges[2 * e + 1] = pairs[e].second;
+  }
+  mesh.update_bounds();
+  return mesh;
+}
+
+// The viewer's default camera (see Viewer::set_view)
+static Camera default_camera(double aspect)
+{
+  Vector3D lookFrom(0, 0, 17), lookAt(0, 0, 1), up(0, 1, 0);
+  Vector3D vZ = lookAt - lookFrom;
+  vZ.normalize();
+  Vector3D vX = up.cross(vZ);
+  vX.normalize();
+  Vector3D vY = vZ.cross(vX);
+  vY.normalize();
+
+  Camera camera;
+  for(int i = 0; i < 3; ++i) {
+    camera.view[i][0] = vX[i];
+    camera.view[i][1] = vY[i];
+    camera.view[i][2] = vZ[i];
+    camera.view[i][3] = lookFrom[i];
+  }
+  camera.view.set_kind(Matrix4x4::RIGID);
+  camera.near_plane = 6;
+  camera.far_plane = 20;
+  camera.proj = perspective(31.6, aspect, camera.near_plane,
+                            camera.far_plane);
+  return camera;
+}
+
+static Matrix4x4 rotation_y(double angle)
+{
+  Matrix4x4 r;
+  r[0][0] = cos(angle);
+  r[0][2] = sin(angle);
+  r[2][0] = -sin(angle);
+  r[2][2] = cos(angle);
+  r.set_kind(Matrix4x4::ROTATION);
+  return r;
+}
+
+// Value at fraction q of the sorted samples
+static double percentile(std::vector<double> samples, double q)
+{
+  if(samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t i = (size_t)(q * (samples.size() - 1) + 0.5);
+  return samples[i];
+}
+
+static void print_percentiles(const char *label,
+                              const std::vector<double>& ns)
+{
+  std::cout << "    " << label << " ms  p50 " << std::fixed
+            << std::setprecision(3) << percentile(ns, 0.5) / 1e6
+            << "  p90 " << percentile(ns, 0.9) / 1e6
+            << "  p99 " << percentile(ns, 0.99) / 1e6 << std::endl;
+}
+
+/*
+ * pipeline: the RenderPipeline on spinning spheres of increasing size,
+ * drawn with the software backend.  The last scene puts the eye inside
+ * a huge sphere so most edges are off-screen, behind the camera or
+ * cross the eye plane.
+ */
+static void bench_pipeline()
+{
+  const int width = 1280, height = 720;
+  const struct {
+    unsigned rings, segments;
+    // Radius of the sphere and how far along z it is moved
+    double scale, offset;
+  } scenes[] = {
+    { 64, 64, 1, 0 },
+    { 256, 512, 1, 0 },
+    { 1024, 1024, 1, 0 },
+    { 1024, 1024, 10, 17 },
+  };
+  const int frames = 60;
+
+  for(size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); ++s) {
+    Mesh mesh = make_sphere(scenes[s].rings, scenes[s].segments);
+    RenderPipeline pipeline;
+    pipeline.set_mesh(&mesh);
+    pipeline.set_camera(default_camera((double)width / height));
+    pipeline.set_viewport(Viewport(width, height));
+
+    Matrix4x4 place;
+    place[0][0] = place[1][1] = place[2][2] = scenes[s].scale;
+    place[2][3] = scenes[s].offset;
+
+    std::vector<double> pipe_ns, frame_ns;
+    double vertex_ns = 0, edge_ns = 0;
+    for(int f = 0; f < frames; ++f) {
+      pipeline.set_model(place * rotation_y(f * 0.05));
+
+      double start = now_ns();
+      const LineList& lines = pipeline.run();
+      double piped = now_ns();
+      draw_init(width, height);
+      draw_lines(lines.points.data(), lines.colours.data(), lines.size());
+      draw_complete();
+      double drawn = now_ns();
+
+      pipe_ns.push_back(piped - start);
+      frame_ns.push_back(drawn - start);
+      vertex_ns += pipeline.stats().transform_ns;
+      edge_ns += pipeline.stats().clip_ns;
+    }
+
+    // With no input changed the last frame's lines come straight back
+    double start = now_ns();
+    pipeline.run();
+    double reuse_ns = now_ns() - start;
+
+    const PipelineStats& st = pipeline.stats();
+    std::cout << "pipeline: sphere " << st.vertices << " vertices, "
+              << st.edges << " edges, " << st.lines << " lines drawn"
+              << (scenes[s].scale > 1 ? " (eye inside)" : "") << std::endl;
+    std::cout << "    accepted " << st.accepted << "  rejected "
+              << st.rejected << "  clipped " << st.clipped << std::endl;
+    std::cout << "    " << std::fixed << std::setprecision(2)
+              << vertex_ns / ((double)st.vertices * frames) << " ns/vertex  "
+              << edge_ns / ((double)st.edges * frames) << " ns/edge"
+              << std::endl;
+    print_percentiles("pipeline", pipe_ns);
+    print_percentiles("frame   ", frame_ns);
+    std::cout << "    unchanged frame " << std::setprecision(3)
+              << reuse_ns / 1e3 << " us" << (st.reused ? "" : " (not reused)")
+              << std::endl;
+  }
+}
+
+/*
+ * scaling: the pipeline and the rasterizer on the largest sphere with
+ * the shared pool resized from 1 thread up to one per core.
+ */
+static void bench_scaling()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  Mesh mesh = make_sphere(1024, 1024);
+
+  RenderPipeline pipeline;
+  pipeline.set_mesh(&mesh);
+  pipeline.set_camera(default_camera((double)width / height));
+  pipeline.set_viewport(Viewport(width, height));
+
+  std::cout << "scaling: sphere " << mesh.num_vertices() << " vertices, "
+            << mesh.num_edges() << " edges" << std::endl;
+
+  const unsigned maxthreads =
+    std::max(1u, std::thread::hardware_concurrency());
+  double base_pipe = 0, base_frame = 0;
+  for(unsigned threads = 1; threads <= maxthreads; threads *= 2) {
+    ThreadPool::shared().set_threads(threads);
+
+    std::vector<double> pipe_ns, frame_ns;
+    double transform_ns = 0, clip_ns = 0, emit_ns = 0;
+    for(int f = 0; f < frames; ++f) {
+      pipeline.set_model(rotation_y(f * 0.05));
+
+      double start = now_ns();
+      const LineList& lines = pipeline.run();
+      double piped = now_ns();
+      draw_init(width, height);
+      draw_lines(lines.points.data(), lines.colours.data(), lines.size());
+      draw_complete();
+      double drawn = now_ns();
+
+      pipe_ns.push_back(piped - start);
+      frame_ns.push_back(drawn - start);
+      transform_ns += pipeline.stats().transform_ns;
+      clip_ns += pipeline.stats().clip_ns;
+      emit_ns += pipeline.stats().emit_ns;
+    }
+
+    double pipe = percentile(pipe_ns, 0.5);
+    double frame = percentile(frame_ns, 0.5);
+    if(threads == 1) {
+      base_pipe = pipe;
+      base_frame = frame;
+    }
+    std::cout << "  " << std::setw(2) << threads << " threads  "
+              << std::fixed << std::setprecision(2)
+              << "pipeline " << pipe / 1e6 << " ms (x" << base_pipe / pipe
+              << ")  frame " << frame / 1e6 << " ms (x"
+              << base_frame / frame << ")" << std::endl;
+    std::cout << "              transform " << transform_ns / frames / 1e6
+              << " ms  clip " << clip_ns / frames / 1e6 << " ms  emit "
+              << emit_ns / frames / 1e6 << " ms" << std::endl;
+
+    if(threads * 2 > maxthreads && threads != maxthreads) {
+      threads = maxthreads / 2;
+    }
+  }
+  ThreadPool::shared().set_threads(0);
+}
+
+/*
+ * scene: SceneGraph::update() on 100k nodes, made of 1000 articulated
+ * objects of 100 nodes each, after editing the whole scene, one object
+ * and one leaf.
+ */
+static void bench_scene()
+{
+  const unsigned objects = 1000, parts = 100;
+  const int reps = 20;
+
+  SceneGraph scene;
+  std::vector<SceneGraph::Node> roots, leaves;
+  srand(7);
+  for(unsigned o = 0; o < objects; ++o) {
+    Vector3D place(100 * frand(), 100 * frand(), 100 * frand());
+    std::vector<SceneGraph::Node> nodes;
+    nodes.push_back(scene.add_node(SceneGraph::NONE, translation(place)));
+    for(unsigned p = 1; p < parts; ++p) {
+      // Each part hangs off an earlier one of the same object
+      SceneGraph::Node parent = nodes[rand() % nodes.size()];
+      Vector3D offset(frand(), frand(), frand());
+      nodes.push_back(scene.add_node(parent, translation(offset) *
+                                     rotation(30 * frand(), 'z')));
+    }
+    roots.push_back(nodes[0]);
+    leaves.push_back(nodes.back());
+  }
+
+  double start = now_ns();
+  size_t count = scene.update();
+  double build_ns = now_ns() - start;
+  std::cout << "scene: " << scene.size() << " nodes in " << objects
+            << " objects" << std::endl;
+  std::cout << "    layout + update  " << std::fixed << std::setprecision(3)
+            << build_ns / 1e6 << " ms  (" << count << " nodes)" << std::endl;
+
+  const struct {
+    const char *label;
+    const std::vector<SceneGraph::Node> *nodes;
+    size_t edits;
+  } cases[] = {
+    { "every object    ", &roots, objects },
+    { "one object      ", &roots, 1 },
+    { "one leaf        ", &leaves, 1 },
+  };
+  for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    double best = 1e300;
+    for(int r = 0; r < reps; ++r) {
+      for(size_t e = 0; e < cases[c].edits; ++e) {
+        SceneGraph::Node node = (*cases[c].nodes)[(r + e * 37) % objects];
+        scene.set_local(node, scene.local(node) * rotation_y(0.01));
+      }
+      start = now_ns();
+      count = scene.update();
+      best = std::min(best, now_ns() - start);
+    }
+    std::cout << "    " << cases[c].label << std::setprecision(3)
+              << best / 1e3 << " us  (" << count << " nodes)" << std::endl;
+  }
+
+  start = now_ns();
+  count = scene.update();
+  std::cout << "    nothing edited   " << std::setprecision(3)
+            << (now_ns() - start) / 1e3 << " us  (" << count << " nodes)"
+            << std::endl;
+}
+
+/*
+ * instances: 50k small cubes, each with its own matrix and colour,
+ * drawn as one instanced run and drawn one pipeline run per cube.
+ */
+static void bench_instances()
+{
+  const int width = 1280, height = 720;
+  const size_t count = 50000;
+  const int frames = 10;
+  Mesh cube = Mesh::cube();
+
+  InstanceBuffer instances;
+  srand(11);
+  for(size_t i = 0; i < count; ++i) {
+    Vector3D place(3 * frand(), 2 * frand(), 3 * frand());
+    instances.add(translation(place) * random_rotation() *
+                  scaling(Vector3D(0.05, 0.05, 0.05)),
+                  Colour(0.5 + 0.5 * frand(), 0.5 + 0.5 * frand(), 1));
+  }
+
+  RenderPipeline pipeline;
+  pipeline.set_mesh(&cube);
+  pipeline.set_camera(default_camera((double)width / height));
+  pipeline.set_viewport(Viewport(width, height));
+  pipeline.set_instances(&instances);
+
+  std::vector<double> pipe_ns, frame_ns;
+  size_t lines = 0;
+  for(int f = 0; f < frames; ++f) {
+    pipeline.set_model(rotation_y(f * 0.05));
+    double start = now_ns();
+    const LineList& out = pipeline.run();
+    double piped = now_ns();
+    draw_init(width, height);
+    draw_lines(out.points.data(), out.colours.data(), out.size());
+    draw_complete();
+    pipe_ns.push_back(piped - start);
+    frame_ns.push_back(now_ns() - start);
+    lines = out.size();
+  }
+  std::cout << "instances: " << count << " cubes, " << lines
+            << " lines drawn" << std::endl;
+  std::cout << "  instanced" << std::endl;
+  print_percentiles("pipeline", pipe_ns);
+  print_percentiles("frame   ", frame_ns);
+
+  // The same frames with the model matrix set and the pipeline run for
+  // each cube in turn, the way a single-object viewer would loop
+  RenderPipeline single;
+  single.set_mesh(&cube);
+  single.set_camera(default_camera((double)width / height));
+  single.set_viewport(Viewport(width, height));
+  pipe_ns.clear();
+  frame_ns.clear();
+  for(int f = 0; f < frames; ++f) {
+    Matrix4x4 spin = rotation_y(f * 0.05);
+    double start = now_ns(), piped = 0;
+    draw_init(width, height);
+    lines = 0;
+    for(size_t i = 0; i < count; ++i) {
+      double t = now_ns();
+      single.set_model(spin * instances.model(i));
+      const LineList& out = single.run();
+      piped += now_ns() - t;
+      draw_lines(out.points.data(), out.colours.data(), out.size());
+      lines += out.size();
+    }
+    draw_complete();
+    pipe_ns.push_back(piped);
+    frame_ns.push_back(now_ns() - start);
+  }
+  std::cout << "  one run per cube (" << lines << " lines)" << std::endl;
+  print_percentiles("pipeline", pipe_ns);
+  print_percentiles("frame   ", frame_ns);
+}
+
+/*
+ * views: a quad view of the 256x512 sphere, with the four quarters
+ * looking through one camera in one run, through four cameras in one
+ * run, and through one camera with a pipeline per quarter.
+ */
+static void bench_views()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  Mesh mesh = make_sphere(256, 512);
+  const Camera camera = default_camera((double)width / height);
+
+  std::vector<View> shared, separate;
+  for(unsigned q = 0; q < 4; ++q) {
+    Viewport quarter(q % 2 * width / 2, q / 2 * height / 2,
+                     width / 2, height / 2);
+    shared.push_back(View(0, quarter));
+    separate.push_back(View(q, quarter));
+  }
+
+  std::cout << "views: sphere " << mesh.num_vertices() << " vertices, "
+            << mesh.num_edges() << " edges, 4 viewports" << std::endl;
+  for(int k = 0; k < 3; ++k) {
+    // One pipeline per quarter in the last case, or one for all four
+    const size_t npipelines = k == 2 ? 4 : 1;
+    std::vector<RenderPipeline> pipelines(npipelines);
+    for(size_t p = 0; p < npipelines; ++p) {
+      RenderPipeline& pipeline = pipelines[p];
+      pipeline.set_mesh(&mesh);
+      if(k == 0) {
+        pipeline.set_camera(camera);
+        pipeline.set_views(shared);
+      } else if(k == 1) {
+        for(unsigned c = 0; c < 4; ++c) {
+          Camera turned = camera;
+          turned.view = camera.view * rotation_y(c * M_PI / 2);
+          pipeline.set_camera(c, turned);
+        }
+        pipeline.set_views(separate);
+      } else {
+        pipeline.set_camera(camera);
+        pipeline.set_viewport(shared[p].viewport);
+      }
+    }
+
+    std::vector<double> pipe_ns;
+    size_t vertices = 0, lines = 0;
+    double transform_ns = 0;
+    for(int f = 0; f < frames; ++f) {
+      double start = now_ns();
+      vertices = lines = 0;
+      for(size_t p = 0; p < npipelines; ++p) {
+        pipelines[p].set_model(rotation_y(f * 0.05));
+        lines += pipelines[p].run().size();
+        vertices += pipelines[p].stats().vertices;
+        transform_ns += pipelines[p].stats().transform_ns;
+        pipelines[p].end_frame();
+      }
+      pipe_ns.push_back(now_ns() - start);
+    }
+    static const char *const names[] = {
+      "one camera, one run", "four cameras, one run",
+      "one camera, a run per viewport"
+    };
+    std::cout << "  " << names[k] << ": " << vertices
+              << " vertices transformed, " << lines << " lines" << std::endl;
+    print_percentiles("pipeline", pipe_ns);
+    std::cout << "    transform " << std::fixed << std::setprecision(3)
+              << transform_ns / frames / 1e6 << " ms" << std::endl;
+  }
+}
+
+/*
+ * arena: heap allocations per frame once the pipeline has warmed up.
+ * Its scratch comes from a per-frame arena and its output keeps its
+ * capacity, so a steady frame should make none.
+ */
+static void bench_arena()
+{
+  const int width = 1280, height = 720;
+  const int warmup = 3, frames = 30;
+  Mesh sphere = make_sphere(256, 512);
+  Mesh cube = Mesh::cube();
+
+  InstanceBuffer instances;
+  srand(11);
+  for(size_t i = 0; i < 20000; ++i) {
+    Vector3D place(3 * frand(), 2 * frand(), 3 * frand());
+    instances.add(translation(place) * scaling(Vector3D(0.05, 0.05, 0.05)),
+                  Colour(1, 1, 1));
+  }
+
+  const struct {
+    const char *name;
+    const Mesh *mesh;
+    InstanceBuffer *instances;
+  } cases[] = {
+    { "sphere", &sphere, 0 },
+    { "instanced cubes", &cube, &instances },
+  };
+  for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    RenderPipeline pipeline;
+    pipeline.set_mesh(cases[c].mesh);
+    pipeline.set_camera(default_camera((double)width / height));
+    pipeline.set_viewport(Viewport(width, height));
+    pipeline.set_instances(cases[c].instances);
+
+    unsigned long first = 0, steady = 0;
+    for(int f = 0; f < warmup + frames; ++f) {
+      pipeline.set_model(rotation_y(f * 0.05));
+      unsigned long before = heap_allocations;
+      pipeline.run();
+      pipeline.end_frame();
+      unsigned long made = heap_allocations - before;
+      if(f == 0) {
+        first = made;
+      } else if(f >= warmup) {
+        steady += made;
+      }
+    }
+    std::cout << "arena: " << cases[c].name << ", "
+              << pipeline.stats().scratch_bytes / 1024 << " KiB scratch"
+              << std::endl;
+    std::cout << "    heap allocations  first frame " << first
+              << "  steady frame " << std::fixed << std::setprecision(2)
+              << (double)steady / frames << std::endl;
+  }
+}
+
+/*
+ * meshcache: time to the first frame for a large OBJ, parsed, parsed
+ * and cached, from an up to date cache, and from a cache whose source
+ * was only touched, then that a cache with a bad index is parsed
+ * again.  The model is written to $TMPDIR (or /tmp) and removed
+ * afterwards.
+ */
+static void bench_meshcache()
+{
+  const int width = 1280, height = 720;
+  Mesh sphere = make_sphere(512, 1024);
+  const char *dir = getenv("TMPDIR");
+  char name[64];
+  snprintf(name, sizeof(name), "/a2-bench-%ld.obj", (long)getpid());
+  const std::string path = std::string(dir ? dir : "/tmp") + name;
+
+  FILE *obj = fopen(path.c_str(), "w");
+  if(!obj) {
+    std::cerr << "meshcache: can't write " << path << std::endl;
+    return;
+  }
+  for(size_t v = 0; v < sphere.num_vertices(); ++v) {
+    fprintf(obj, "v %.17g %.17g %.17g\n", sphere.x[v], sphere.y[v],
+            sphere.z[v]);
+  }
+  for(size_t f = 0; f < sphere.faces.size(); f += 3) {
+    fprintf(obj, "f %u %u %u\n", sphere.faces[f] + 1,
+            sphere.faces[f + 1] + 1, sphere.faces[f + 2] + 1);
+  }
+  fclose(obj);
+
+  const char *names[] = { "parsed", "written", "hit", "revalidated" };
+  std::cout << "meshcache: " << sphere.num_vertices() << " vertices, "
+            << sphere.num_edges() << " edges" << std::endl;
+  Mesh parsed;
+  for(int pass = 0; pass < 5; ++pass) {
+    if(pass == 3) {
+      // Touch the source without changing it
+      utimes(path.c_str(), 0);
+    }
+    Mesh mesh;
+    std::string error;
+    MeshCacheResult how = MESH_CACHE_UNUSED;
+    double start = now_ns();
+    bool ok = pass == 0 ? load_mesh(path, mesh, error)
+                        : load_mesh_cached(path, mesh, error, 0, &how);
+    double loaded = now_ns();
+    if(!ok) {
+      std::cerr << "meshcache: " << error << std::endl;
+      break;
+    }
+    RenderPipeline pipeline;
+    pipeline.set_mesh(&mesh);
+    pipeline.set_camera(default_camera((double)width / height));
+    pipeline.set_viewport(Viewport(width, height));
+    pipeline.run();
+    double drawn = now_ns();
+
+    bool same = true;
+    if(pass == 0) {
+      parsed = mesh;
+    } else {
+      same = mesh.x.size() == parsed.x.size() &&
+             mesh.edges.size() == parsed.edges.size() &&
+             std::equal(mesh.x.begin(), mesh.x.end(), parsed.x.begin()) &&
+             std::equal(mesh.y.begin(), mesh.y.end(), parsed.y.begin()) &&
+             std::equal(mesh.z.begin(), mesh.z.end(), parsed.z.begin()) &&
+             std::equal(mesh.edges.begin(), mesh.edges.end(),
+                        parsed.edges.begin()) &&
+             std::equal(mesh.faces.begin(), mesh.faces.end(),
+                        parsed.faces.begin());
+    }
+    std::cout << "    " << std::setw(12)
+              << (pass == 0 ? names[0] : names[how == MESH_CACHE_HIT ? 2 :
+                  how == MESH_CACHE_REVALIDATED ? 3 : 1])
+              << std::fixed << std::setprecision(2)
+              << "  load " << std::setw(8) << (loaded - start) / 1e6
+              << " ms  first frame " << std::setw(8) << (drawn - start) / 1e6
+              << " ms" << (same ? "" : "  MISMATCH") << std::endl;
+  }
+
+  // The faces are the last array, so the file ends with a face index:
+  // point it past the vertices and the cache should be parsed again
+  const std::string cache_path = mesh_cache_path(path);
+  bool corrupted = false;
+  if(FILE *cache = fopen(cache_path.c_str(), "r+b")) {
+    const uint32_t bad = (uint32_t)sphere.num_vertices();
+    corrupted = fseek(cache, -(long)sizeof(bad), SEEK_END) == 0 &&
+                fwrite(&bad, sizeof(bad), 1, cache) == 1;
+    corrupted = fclose(cache) == 0 && corrupted;
+  }
+  Mesh mesh;
+  std::string error;
+  MeshCacheResult how = MESH_CACHE_HIT;
+  bool ok = corrupted && load_mesh_cached(path, mesh, error, 0, &how) &&
+            how == MESH_CACHE_WRITTEN &&
+            mesh.faces.size() == parsed.faces.size() &&
+            std::equal(mesh.faces.begin(), mesh.faces.end(),
+                       parsed.faces.begin());
+  std::cout << "    " << std::setw(12) << "corrupted"
+            << (ok ? "  parsed again" : "  FAILED") << std::endl;
+  remove(path.c_str());
+  remove(cache_path.c_str());
+  if(!ok) {
+    exit(1);
+  }
+}
+
+/*
+ * precision: the transform and the pipeline in double and in single
+ * precision.  The raw transform reports the memory it streams (three
+ * coordinates in, four out, per point); the pipeline reports how far
+ * the single precision lines land from the double ones, with the
+ * sphere at the origin and ten million units away.
+ */
+template<class T>
+static void time_transform(const char *label, size_t count, int reps)
+{
+  std::vector<T> in(3 * count), out(4 * count);
+  for(size_t i = 0; i < in.size(); ++i) {
+    in[i] = (T)frand();
+  }
+  const BasicMatrix4x4<T> m(random_matrix());
+  const T *x = &in[0], *y = x + count, *z = y + count;
+  T *ox = &out[0], *oy = ox + count, *oz = oy + count, *ow = oz + count;
+
+  double best = 1e300;
+  for(int r = 0; r < reps; ++r) {
+    double start = now_ns();
+    transform_points(m, count, x, y, z, ox, oy, oz, ow);
+    best = std::min(best, now_ns() - start);
+    sink += ox[r % count];
+  }
+  std::cout << "    " << label << std::fixed << std::setprecision(2)
+            << std::setw(7) << best / count << " ns/point  "
+            << std::setw(6) << 7.0 * sizeof(T) * count / best << " GB/s"
+            << std::endl;
+}
+
+static void bench_precision()
+{
+  const size_t points = 1 << 20;
+  std::cout << "precision: transform_points, " << points << " points, "
+            << transform_kernel_name(transform_kernel()) << std::endl;
+  time_transform<double>("double ", points, 20);
+  time_transform<float>("float  ", points, 20);
+
+  const int width = 1280, height = 720;
+  const int frames = 30;
+  const double offsets[] = { 0, 1e7 };
+  Mesh sphere = make_sphere(1024, 1024);
+  for(size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); ++o) {
+    // The sphere and the camera both moved along x
+    const double offset = offsets[o];
+    Mesh mesh = sphere;
+    double *x = mesh.x.writable();
+    for(size_t i = 0; i < mesh.num_vertices(); ++i) {
+      x[i] += offset;
+    }
+    mesh.update_bounds();
+    Camera camera = default_camera((double)width / height);
+    camera.view = camera.view * translation(Vector3D(-offset, 0, 0));
+
+    std::cout << "precision: pipeline, sphere " << mesh.num_vertices()
+              << " vertices " << std::defaultfloat
+              << offset << " from the origin" << std::endl;
+    LineList reference;
+    const Precision precisions[] = { PRECISION_DOUBLE, PRECISION_FLOAT };
+    for(size_t p = 0; p < 2; ++p) {
+      RenderPipeline pipeline;
+      pipeline.set_mesh(&mesh);
+      pipeline.set_camera(camera);
+      pipeline.set_viewport(Viewport(width, height));
+      pipeline.set_precision(precisions[p]);
+
+      double vertex_ns = 0, run_ns = 0;
+      for(int f = 0; f < frames; ++f) {
+        Vector3D centre(offset, 0, 0);
+        pipeline.set_model(translation(centre) * rotation_y(f * 0.05) *
+                           translation(-centre));
+        double start = now_ns();
+        pipeline.run();
+        run_ns += now_ns() - start;
+        vertex_ns += pipeline.stats().transform_ns;
+        if(f + 1 < frames) {
+          pipeline.end_frame();
+        }
+      }
+
+      const LineList& lines = pipeline.lines();
+      double error = 0;
+      if(p == 0) {
+        reference = lines;
+      } else if(lines.points.size() != reference.points.size()) {
+        error = -1;
+      } else {
+        for(size_t i = 0; i < lines.points.size(); ++i) {
+          error = std::max(error,
+                           fabs(lines.points[i] - reference.points[i]));
+        }
+      }
+      const PipelineStats& st = pipeline.stats();
+      std::cout << "    " << (p == 0 ? "double " : "float  ")
+                << std::fixed << std::setprecision(2)
+                << std::setw(7) << vertex_ns / ((double)st.vertices * frames)
+                << " ns/vertex  " << std::setw(7) << run_ns / frames / 1e6
+                << " ms/frame  " << std::setw(6)
+                << st.scratch_bytes / 1024 << " KiB scratch";
+      if(p != 0) {
+        std::cout << "  ";
+        if(error < 0) {
+          std::cout << "line count differs";
+        } else {
+          std::cout << std::scientific << std::setprecision(1) << error
+                    << " px from double";
+        }
+      }
+      std::cout << std::endl;
+      pipeline.end_frame();
+    }
+  }
+}
+
+/*
+ * merge: a dense sphere drawn ever smaller, as if further away, with
+ * and without merging the lines that coincide on the pixel grid.  With
+ * merging the lines drawn, and the time the software backend takes to
+ * draw them, should follow the sphere's size on screen rather than
+ * its edge count.
+ */
+static void bench_merge()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  const double scales[] = { 1, 0.25, 0.05, 0.01 };
+  Mesh mesh = make_sphere(1024, 1024);
+  std::cout << "merge: sphere " << mesh.num_vertices() << " vertices, "
+            << mesh.num_edges() << " edges" << std::endl;
+
+  for(size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); ++s) {
+    Matrix4x4 place;
+    place[0][0] = place[1][1] = place[2][2] = scales[s];
+    std::cout << "  scale " << std::setprecision(2) << scales[s]
+              << std::endl;
+    for(int merge = 0; merge < 2; ++merge) {
+      RenderPipeline pipeline;
+      pipeline.set_mesh(&mesh);
+      pipeline.set_camera(default_camera((double)width / height));
+      pipeline.set_viewport(Viewport(width, height));
+      pipeline.set_merge_lines(merge != 0);
+
+      double pipe_ns = 0, merge_ns = 0, draw_ns = 0;
+      size_t lines = 0, merged = 0;
+      for(int f = 0; f < frames; ++f) {
+        pipeline.set_model(place * rotation_y(f * 0.05));
+        double start = now_ns();
+        const LineList& out = pipeline.run();
+        double piped = now_ns();
+        draw_init(width, height);
+        draw_lines(out.points.data(), out.colours.data(), out.size());
+        draw_complete();
+        draw_ns += now_ns() - piped;
+        pipe_ns += piped - start;
+        merge_ns += pipeline.stats().merge_ns;
+        lines += pipeline.stats().lines;
+        merged += pipeline.stats().merged;
+        pipeline.end_frame();
+      }
+      std::cout << "    " << (merge ? "merged  " : "all     ")
+                << std::setw(8) << lines / frames << " lines  "
+                << std::setw(8) << merged / frames << " draw calls saved  "
+                << std::fixed << std::setprecision(2)
+                << "pipeline " << std::setw(6) << pipe_ns / frames / 1e6
+                << " ms (merge " << std::setw(5) << merge_ns / frames / 1e6
+                << ")  draw " << std::setw(6) << draw_ns / frames / 1e6
+                << " ms" << std::endl;
+      std::cout.unsetf(std::ios::floatfield);
+    }
+  }
+}
+
+/*
+ * paging: a dense sphere split into chunks and paged in under a memory
+ * budget as it slides, magnified, across the view.  Reports whether the
+ * chunks hold exactly the sphere's edges, how many chunks each frame
+ * wanted and had in memory, the most time request() took on the
+ * drawing thread, and the most memory the chunks took.  The chunk file
+ * is written to $TMPDIR (or /tmp) and removed afterwards.
+ */
+
+// An order-independent digest of the edges' end positions
+static uint64_t edge_digest(const Mesh& mesh)
+{
+  uint64_t digest = 0;
+  for(size_t e = 0; e < mesh.num_edges(); ++e) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(int j = 0; j < 2; ++j) {
+      const unsigned v = mesh.edges[2 * e + j];
+      const double c[3] = { mesh.x[v], mesh.y[v], mesh.z[v] };
+      for(int k = 0; k < 3; ++k) {
+        uint64_t bits;
+        memcpy(&bits, &c[k], sizeof(bits));
+        h = (h ^ bits) * 0x100000001b3ull;
+      }
+    }
+    digest += h;
+  }
+  return digest;
+}
+
+static void bench_paging()
+{
+  const int width = 1280, height = 720;
+  const int frames = 120;
+  const size_t budget = (size_t)8 << 20;
+  Mesh sphere = make_sphere(1024, 1024);
+  const char *dir = getenv("TMPDIR");
+  char name[64];
+  snprintf(name, sizeof(name), "/a2-bench-%ld.a2chunks", (long)getpid());
+  const std::string path = std::string(dir ? dir : "/tmp") + name;
+
+  std::string error;
+  double start = now_ns();
+  if(!write_chunked_mesh(sphere, path, 16384, error)) {
+    std::cerr << "paging: " << error << std::endl;
+    return;
+  }
+  double written = now_ns();
+  ChunkPager pager;
+  if(!pager.open(path, error)) {
+    std::cerr << "paging: " << error << std::endl;
+    remove(path.c_str());
+    return;
+  }
+  pager.set_budget(budget);
+
+  size_t edges = 0;
+  uint64_t digest = 0;
+  for(unsigned c = 0; c < pager.chunks(); ++c) {
+    edges += pager.mesh(c).num_edges();
+    digest += edge_digest(pager.mesh(c));
+  }
+  const bool same = edges == sphere.num_edges() &&
+                    digest == edge_digest(sphere);
+  std::cout << "paging: " << sphere.num_vertices() << " vertices, "
+            << sphere.num_edges() << " edges in " << pager.chunks()
+            << " chunks, written in " << std::fixed << std::setprecision(2)
+            << (written - start) / 1e6 << " ms"
+            << (same ? "" : "  MISMATCH") << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+
+  const Camera camera = default_camera((double)width / height);
+  RenderPipeline pipeline;
+  pipeline.set_camera(camera);
+  pipeline.set_viewport(Viewport(width, height));
+  std::vector<Matrix4x4> mvps(1);
+  std::vector<unsigned> visible, ready;
+  std::map<unsigned, std::unique_ptr<RenderPipeline> > chunks;
+  size_t wanted = 0, drawn = 0, lines = 0, most_bytes = 0;
+  double request_ns = 0, worst_request_ns = 0, pipe_ns = 0;
+  for(int f = 0; f < frames; ++f) {
+    // Slide across and back, six times the size that fills the view
+    const double t = (double)f / (frames - 1);
+    const Matrix4x4 model = translation(Vector3D(-10 + 20 * t, 0, 0)) *
+                            scaling(Vector3D(6, 6, 6));
+    pipeline.set_model(model);
+    mvps[0] = camera.proj * (camera.view * model);
+
+    visible.clear();
+    ready.clear();
+    double begin = now_ns();
+    pager.cull(mvps, visible);
+    pager.request(visible, ready);
+    double requested = now_ns() - begin;
+    request_ns += requested;
+    worst_request_ns = std::max(worst_request_ns, requested);
+    wanted += visible.size();
+    drawn += ready.size();
+
+    // A pipeline per chunk drawn, following the main one, as the viewer
+    // keeps them
+    begin = now_ns();
+    std::map<unsigned, std::unique_ptr<RenderPipeline> > kept;
+    for(size_t k = 0; k < ready.size(); ++k) {
+      std::unique_ptr<RenderPipeline>& chunk = kept[ready[k]];
+      auto found = chunks.find(ready[k]);
+      if(found != chunks.end()) {
+        chunk = std::move(found->second);
+      } else {
+        chunk.reset(new RenderPipeline);
+        chunk->set_mesh(&pager.mesh(ready[k]));
+      }
+      chunk->follow(pipeline);
+      lines += chunk->run().size();
+      chunk->end_frame();
+    }
+    chunks.swap(kept);
+    pipe_ns += now_ns() - begin;
+    most_bytes = std::max(most_bytes, pager.stats().resident_bytes);
+    // The rest of a 60 Hz frame, which the paging thread reads in
+    std::this_thread::sleep_for(std::chrono::milliseconds(16));
+  }
+  chunks.clear();
+
+  const PagerStats stats = pager.stats();
+  std::cout << "    " << frames << " frames  " << std::fixed
+            << std::setprecision(1) << (double)wanted / frames
+            << " chunks in view  " << (double)drawn / frames
+            << " in memory  " << lines / frames << " lines" << std::endl
+            << "    request " << std::setprecision(3)
+            << request_ns / frames / 1e3 << " us (worst "
+            << worst_request_ns / 1e3 << ")  pipeline "
+            << std::setprecision(2) << pipe_ns / frames / 1e6 << " ms"
+            << std::endl
+            << "    budget " << budget / 1048576.0 << " MiB  most resident "
+            << most_bytes / 1048576.0 << " MiB  " << stats.loads
+            << " loads  " << stats.evictions << " evictions" << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+  pager.close();
+  remove(path.c_str());
+}
+
+/*
+ * lod: the levels of detail of a dense sphere, then the sphere drawn
+ * ever smaller, as if further away, at full detail and at the coarsest
+ * level whose error covers under a pixel.  With levels of detail the
+ * vertices and edges through the pipeline, and its time, should follow
+ * the sphere's size on screen rather than its edge count.
+ */
+static void bench_lod()
+{
+  const int width = 1280, height = 720;
+  const int frames = 10;
+  const double scales[] = { 1, 0.25, 0.05, 0.01 };
+  Mesh sphere = make_sphere(256, 512);
+  LodChain chain;
+  double start = now_ns();
+  build_lod_chain(sphere, chain);
+  double built = now_ns();
+  std::cout << "lod: sphere " << sphere.num_vertices() << " vertices, "
+            << sphere.num_edges() << " edges, " << chain.size()
+            << " levels built in " << std::fixed << std::setprecision(0)
+            << (built - start) / 1e6 << " ms" << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+
+  // Through a file and back
+  const char *dir = getenv("TMPDIR");
+  char name[64];
+  snprintf(name, sizeof(name), "/a2-bench-%ld.a2lod", (long)getpid());
+  const std::string path = std::string(dir ? dir : "/tmp") + name;
+  LodChain loaded;
+  std::string error;
+  if(!write_lod_chain(chain, path, error) ||
+     !load_lod_chain(path, loaded, error)) {
+    std::cerr << "lod: " << error << std::endl;
+  }
+  remove(path.c_str());
+  for(size_t l = 0; l < chain.size(); ++l) {
+    const Mesh& mesh = chain.levels[l].mesh;
+    const bool same = l < loaded.size() &&
+      loaded.levels[l].error == chain.levels[l].error &&
+      std::equal(mesh.x.begin(), mesh.x.end(),
+                 loaded.levels[l].mesh.x.begin()) &&
+      std::equal(mesh.edges.begin(), mesh.edges.end(),
+                 loaded.levels[l].mesh.edges.begin()) &&
+      std::equal(mesh.faces.begin(), mesh.faces.end(),
+                 loaded.levels[l].mesh.faces.begin());
+    std::cout << "    level " << std::setw(2) << l << std::setw(9)
+              << mesh.num_edges() << " edges  error " << std::setprecision(3)
+              << std::setw(10)
+              << chain.levels[l].error << (same ? "" : "  MISMATCH")
+              << std::endl;
+  }
+
+  for(size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); ++s) {
+    Matrix4x4 place;
+    place[0][0] = place[1][1] = place[2][2] = scales[s];
+    std::cout << "  scale " << std::setprecision(2) << scales[s]
+              << std::endl;
+    for(int lod = 0; lod < 2; ++lod) {
+      RenderPipeline pipeline;
+      pipeline.set_mesh(&sphere);
+      pipeline.set_lods(lod ? &chain : 0);
+      pipeline.set_camera(default_camera((double)width / height));
+      pipeline.set_viewport(Viewport(width, height));
+
+      double pipe_ns = 0;
+      size_t vertices = 0, lines = 0;
+      for(int f = 0; f < frames; ++f) {
+        pipeline.set_model(place * rotation_y(f * 0.05));
+        double begin = now_ns();
+        pipeline.run();
+        pipe_ns += now_ns() - begin;
+        vertices += pipeline.stats().vertices;
+        lines += pipeline.stats().lines;
+        pipeline.end_frame();
+      }
+      const PipelineStats& stats = pipeline.stats();
+      std::cout << "    " << (lod ? "level " : "full  ") << std::setw(2)
+                << stats.lod << std::setw(9) << vertices / frames
+                << " vertices " << std::setw(8) << lines / frames
+                << " lines  " << std::fixed << std::setprecision(2)
+                << "error " << std::setw(5) << stats.lod_pixels
+                << " px  pipeline " << std::setw(6)
+                << pipe_ns / frames / 1e6 << " ms" << std::endl;
+      std::cout.unsetf(std::ios::floatfield);
+    }
+  }
+}
+
+/*
+ * cull: how much of the largest sphere, and of a field of cubes wider
+ * than the view, the bounding boxes cull before anything is
+ * transformed or clipped, and what a frame then costs.
+ */
+static void bench_cull()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  Mesh sphere = make_sphere(1024, 1024);
+  Mesh cube = Mesh::cube();
+
+  InstanceBuffer field;
+  srand(11);
+  for(size_t i = 0; i < 50000; ++i) {
+    Vector3D place(24 * frand() - 12, 12 * frand() - 6, 20 * frand() - 10);
+    field.add(translation(place) * random_rotation() *
+              scaling(Vector3D(0.1, 0.1, 0.1)), Colour(1, 1, 1));
+  }
+
+  const struct {
+    const char *name;
+    const Mesh *mesh;
+    InstanceBuffer *instances;
+    // Radius of the model and how far along z it is moved
+    double scale, offset;
+  } scenes[] = {
+    { "sphere in view", &sphere, 0, 1, 0 },
+    { "sphere close up", &sphere, 0, 4, 9 },
+    { "sphere, eye inside", &sphere, 0, 10, 17 },
+    { "field of cubes", &cube, &field, 1, 0 },
+  };
+  for(size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); ++s) {
+    RenderPipeline pipeline;
+    pipeline.set_mesh(scenes[s].mesh);
+    pipeline.set_instances(scenes[s].instances);
+    pipeline.set_camera(default_camera((double)width / height));
+    pipeline.set_viewport(Viewport(width, height));
+
+    Matrix4x4 place;
+    place[0][0] = place[1][1] = place[2][2] = scenes[s].scale;
+    place[2][3] = scenes[s].offset;
+
+    double pipe_ns = 0;
+    size_t vertices = 0, culled = 0, inside = 0, partial = 0;
+    for(int f = 0; f < frames; ++f) {
+      pipeline.set_model(place * rotation_y(f * 0.05));
+      double start = now_ns();
+      pipeline.run();
+      pipe_ns += now_ns() - start;
+      const PipelineStats& st = pipeline.stats();
+      vertices += st.vertices;
+      culled += st.boxes_culled;
+      inside += st.boxes_inside;
+      partial += st.boxes_partial;
+      pipeline.end_frame();
+    }
+    const size_t instances =
+      scenes[s].instances ? scenes[s].instances->size() : 1;
+    const double all = (double)scenes[s].mesh->num_vertices() * instances;
+    std::cout << "cull: " << scenes[s].name << std::endl;
+    std::cout << "    boxes culled " << culled / frames << "  inside "
+              << inside / frames << "  partial " << partial / frames
+              << std::endl;
+    std::cout << "    " << std::fixed << std::setprecision(1)
+              << 100 * vertices / (all * frames) << "% of vertices "
+              << "transformed  pipeline " << std::setprecision(2)
+              << pipe_ns / frames / 1e6 << " ms" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+  }
+}
+
+/*
+ * hidden: spinning spheres drawn with the lines behind their faces
+ * left out, against the same spheres drawn whole, and the share of
+ * the frame the depth buffer and line tests take.
+ */
+static void bench_hidden()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  const struct {
+    unsigned rings, segments;
+  } spheres[] = {
+    { 64, 128 },
+    { 256, 512 },
+    { 1024, 1024 },
+  };
+  for(size_t s = 0; s < sizeof(spheres) / sizeof(spheres[0]); ++s) {
+    Mesh mesh = make_sphere(spheres[s].rings, spheres[s].segments);
+    std::cout << "hidden: sphere " << mesh.num_faces() << " faces, "
+              << mesh.num_edges() << " edges" << std::endl;
+    for(int hide = 0; hide < 2; ++hide) {
+      RenderPipeline pipeline;
+      pipeline.set_mesh(&mesh);
+      pipeline.set_camera(default_camera((double)width / height));
+      pipeline.set_viewport(Viewport(width, height));
+      pipeline.set_hidden_lines(hide != 0);
+
+      double pipe_ns = 0, hide_ns = 0;
+      size_t lines = 0, hidden = 0;
+      for(int f = 0; f < frames; ++f) {
+        pipeline.set_model(rotation_y(f * 0.05));
+        double start = now_ns();
+        const LineList& out = pipeline.run();
+        pipe_ns += now_ns() - start;
+        lines += out.size();
+        hidden += pipeline.stats().hidden;
+        hide_ns += pipeline.stats().hide_ns;
+        pipeline.end_frame();
+      }
+      std::cout << (hide ? "    hidden lines " : "    every line   ")
+                << std::setw(8) << lines / frames << " lines  "
+                << std::setw(8) << hidden / frames << " hidden  "
+                << std::fixed << std::setprecision(2) << "hide "
+                << std::setw(6) << hide_ns / frames / 1e6
+                << " ms  pipeline " << std::setw(6)
+                << pipe_ns / frames / 1e6 << " ms" << std::endl;
+      std::cout.unsetf(std::ios::floatfield);
+    }
+  }
+}
+
+/*
+ * features: spinning spheres drawn with only their feature edges and
+ * silhouette against every edge, and a sphere cut into facets, whose
+ * every edge is a crease.
+ */
+static void bench_features()
+{
+  const int width = 1280, height = 720;
+  const int frames = 20;
+  const struct {
+    const char *name;
+    unsigned rings, segments;
+  } spheres[] = {
+    { "sphere", 256, 512 },
+    { "sphere", 1024, 1024 },
+    { "faceted sphere", 8, 8 },
+  };
+  for(size_t s = 0; s < sizeof(spheres) / sizeof(spheres[0]); ++s) {
+    Mesh mesh = make_sphere(spheres[s].rings, spheres[s].segments);
+    std::cout << "features: " << spheres[s].name << " "
+              << mesh.num_faces() << " faces, " << mesh.num_edges()
+              << " edges" << std::endl;
+    for(int features = 0; features < 2; ++features) {
+      RenderPipeline pipeline;
+      pipeline.set_mesh(&mesh);
+      pipeline.set_camera(default_camera((double)width / height));
+      pipeline.set_viewport(Viewport(width, height));
+      pipeline.set_feature_edges(features != 0);
+
+      // The first run finds the faces around the edges
+      pipeline.set_model(rotation_y(0));
+      double start = now_ns();
+      pipeline.run();
+      const double build_ns = now_ns() - start;
+      pipeline.end_frame();
+
+      double pipe_ns = 0, select_ns = 0;
+      size_t lines = 0, silhouettes = 0;
+      for(int f = 1; f <= frames; ++f) {
+        pipeline.set_model(rotation_y(f * 0.05));
+        start = now_ns();
+        const LineList& out = pipeline.run();
+        pipe_ns += now_ns() - start;
+        lines += out.size();
+        silhouettes += pipeline.stats().silhouettes;
+        select_ns += pipeline.stats().silhouette_ns;
+        pipeline.end_frame();
+      }
+      std::cout << (features ? "    features     " : "    every edge   ")
+                << std::setw(8) << lines / frames << " lines  "
+                << std::setw(6) << pipeline.stats().features
+                << " features  " << std::setw(6) << silhouettes / frames
+                << " silhouette  " << std::fixed << std::setprecision(2)
+                << "first run " << std::setw(6) << build_ns / 1e6
+                << " ms  silhouette " << std::setw(5)
+                << select_ns / frames / 1e6 << " ms  pipeline "
+                << std::setw(6) << pipe_ns / frames / 1e6 << " ms"
+                << std::endl;
+      std::cout.unsetf(std::ios::floatfield);
+    }
+  }
+}
+
+/*
+ * ply: small PLY files the loader has got wrong before, each loaded and
+ * checked: faces with per-face colours, more of them than vertices;
+ * vertices with a float list among their properties, in ASCII and in
+ * binary; and an ASCII file cut short.  Exits with status 1 if any
+ * loads wrongly.  The files are written to $TMPDIR (or /tmp) and
+ * removed afterwards.
+ */
+
+// Write "contents" to a file, load it, and check it loads, with
+// vertices at "positions" and "faces" faces, or, for a null
+// "positions", that it fails
+static bool check_ply(const char *name, const std::string& contents,
+                      const double *positions, size_t vertices,
+                      size_t faces)
+{
+  const char *dir = getenv("TMPDIR");
+  char file[64];
+  snprintf(file, sizeof(file), "/a2-bench-%ld.ply", (long)getpid());
+  const std::string path = std::string(dir ? dir : "/tmp") + file;
+  FILE *out = fopen(path.c_str(), "wb");
+  if(!out || fwrite(contents.data(), 1, contents.size(), out) !=
+     contents.size()) {
+    std::cerr << "ply: cannot write " << path << std::endl;
+    exit(1);
+  }
+  fclose(out);
+
+  Mesh mesh;
+  std::string error;
+  const bool loaded = load_mesh(path, mesh, error);
+  remove(path.c_str());
+
+  bool ok = loaded == (positions != 0);
+  if(ok && loaded) {
+    ok = mesh.num_vertices() == vertices && mesh.num_faces() == faces;
+    for(size_t i = 0; ok && i < vertices; ++i) {
+      ok = mesh.x[i] == positions[3 * i] &&
+           mesh.y[i] == positions[3 * i + 1] &&
+           mesh.z[i] == positions[3 * i + 2];
+    }
+  }
+  std::cout << "    " << std::left << std::setw(26) << name
+            << (ok ? "ok" : "FAILED") << (loaded ? "" : "  (") << error
+            << (loaded ? "" : ")") << std::endl;
+  return ok;
+}
+
+// Little-endian bytes of a float or an int
+static std::string ply_bytes(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  std::string out;
+  for(int k = 0; k < 4; ++k) {
+    out += (char)(bits >> (8 * k));
+  }
+  return out;
+}
+
+static std::string ply_bytes(int32_t value)
+{
+  std::string out;
+  for(int k = 0; k < 4; ++k) {
+    out += (char)((uint32_t)value >> (8 * k));
+  }
+  return out;
+}
+
+static void bench_ply()
+{
+  const double triangle[] = { 0, 0, 0, 1, 0, 0, 0, 1, 0 };
+  const std::string vertex_header =
+    "ply\nformat ascii 1.0\nelement vertex 3\n"
+    "property float x\nproperty float y\nproperty float z\n";
+  const std::string vertices = "0 0 0\n1 0 0\n0 1 0\n";
+  std::cout << "ply:" << std::endl;
+  bool ok = true;
+
+  // Per-face colours after the indices, on more faces than vertices
+  std::string coloured = vertex_header +
+    "element face 8\nproperty list uchar int vertex_indices\n"
+    "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+    "end_header\n" + vertices;
+  for(int f = 0; f < 8; ++f) {
+    coloured += "3 0 1 2 255 128 7\n";
+  }
+  ok = check_ply("face colours", coloured, triangle, 3, 8) && ok;
+
+  // Texture coordinates as a float list, skipped whatever their type
+  ok = check_ply("ascii vertex float list",
+    "ply\nformat ascii 1.0\nelement vertex 3\nproperty float x\n"
+    "property list uchar float uv\nproperty float y\nproperty float z\n"
+    "element face 1\nproperty list uchar int vertex_indices\n"
+    "end_header\n0 2 0.25 0.5 0 0\n1 0 0 0\n0 1 -1.5 1 0\n3 0 1 2\n",
+    triangle, 3, 1) && ok;
+
+  std::string binary =
+    "ply\nformat binary_little_endian 1.0\nelement vertex 3\n"
+    "property float x\nproperty list uchar float uv\nproperty float y\n"
+    "property float z\nelement face 1\n"
+    "property list uchar int vertex_indices\nend_header\n";
+  for(int v = 0; v < 3; ++v) {
+    binary += ply_bytes((float)triangle[3 * v]);
+    binary += (char)v;
+    for(int k = 0; k < v; ++k) {
+      binary += ply_bytes(0.5f * k);
+    }
+    binary += ply_bytes((float)triangle[3 * v + 1]);
+    binary += ply_bytes((float)triangle[3 * v + 2]);
+  }
+  binary += (char)3;
+  binary += ply_bytes((int32_t)0) + ply_bytes((int32_t)1) +
+            ply_bytes((int32_t)2);
+  ok = check_ply("binary vertex float list", binary, triangle, 3, 1) && ok;
+
+  ok = check_ply("ascii truncated", vertex_header +
+    "element face 1\nproperty list uchar int vertex_indices\n"
+    "end_header\n0 0 0\n1 0 0\n", 0, 0, 0) && ok;
+
+  if(!ok) {
+    std::cerr << "ply: FAILED" << std::endl;
+    exit(1);
+  }
+}
+
+/*
+ * replay: a short session recorded to an input log, starting well after
+ * the recorder was opened, and replayed in real time.  Checks that every
+ * event comes back, in order and unchanged, and that the replay takes
+ * as long as the session did without the wait before it; exits with
+ * status 1 if not.  The log is written to $TMPDIR (or /tmp) and removed
+ * afterwards.
+ */
+static void bench_replay()
+{
+  const int events = 200;
+  const double lead_ms = 100, interval_ms = 1;
+  const char *dir = getenv("TMPDIR");
+  char name[64];
+  snprintf(name, sizeof(name), "/a2-bench-%ld.a2in", (long)getpid());
+  const std::string path = std::string(dir ? dir : "/tmp") + name;
+
+  std::string error;
+  InputRecorder recorder;
+  if(!recorder.open(path, error)) {
+    std::cerr << "replay: " << error << std::endl;
+    exit(1);
+  }
+  std::this_thread::sleep_for(
+    std::chrono::microseconds((int)(lead_ms * 1e3)));
+  for(int i = 0; i < events; ++i) {
+    const InputEvent::Type type = i == 0 ? InputEvent::PRESS :
+      i == events - 1 ? InputEvent::RELEASE :
+      i % 50 == 0 ? InputEvent::MODE : InputEvent::MOTION;
+    recorder.add(type, type == InputEvent::MODE ? i / 50 : 1, i, 2 * i);
+    std::this_thread::sleep_for(
+      std::chrono::microseconds((int)(interval_ms * 1e3)));
+  }
+  recorder.close();
+
+  std::vector<InputEvent> log;
+  const bool loaded = load_input_log(path, log, error);
+  remove(path.c_str());
+  if(!loaded) {
+    std::cerr << "replay: " << error << std::endl;
+    exit(1);
+  }
+
+  std::vector<InputEvent> played;
+  InputReplay replay;
+  double start = now_ns();
+  replay.start(log);
+  while(!replay.done()) {
+    replay.play_due([&](const InputEvent& event) {
+      played.push_back(event);
+    });
+    std::this_thread::sleep_for(
+      std::chrono::nanoseconds((int64_t)replay.wait_ns()));
+  }
+  const double took = now_ns() - start;
+
+  bool same = played.size() == log.size();
+  for(size_t i = 0; same && i < log.size(); ++i) {
+    same = played[i].type == log[i].type &&
+           played[i].value == log[i].value &&
+           played[i].x == log[i].x && played[i].y == log[i].y;
+  }
+  const double span = log.empty() ? 0 : log.back().time_ns - log[0].time_ns;
+  std::cout << std::fixed << std::setprecision(2)
+            << "replay: " << played.size() << " of " << log.size()
+            << " events, recorded over " << span / 1e6 << " ms after "
+            << (log.empty() ? 0 : log[0].time_ns / 1e6)
+            << " ms, replayed in " << took / 1e6 << " ms" << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+  // Replaying can run late but never early, and shouldn't wait for the
+  // time before the first event
+  if(!same || (int)log.size() != events || took < span ||
+     took > span + lead_ms * 1e6 / 2) {
+    std::cerr << "replay: FAILED" << std::endl;
+    exit(1);
+  }
+}
+
+struct Suite {
+  const char *name;
+  void (*run)();
+};
+
+static const Suite suites[] = {
+  { "transform", bench_transform },
+  { "invert", bench_invert },
+  { "raster", bench_raster },
+  { "pipeline", bench_pipeline },
+  { "scaling", bench_scaling },
+  { "scene", bench_scene },
+  { "instances", bench_instances },
+  { "views", bench_views },
+  { "arena", bench_arena },
+  { "meshcache", bench_meshcache },
+  { "precision", bench_precision },
+  { "merge", bench_merge },
+  { "paging", bench_paging },
+  { "lod", bench_lod },
+  { "cull", bench_cull },
+  { "hidden", bench_hidden },
+  { "features", bench_features },
+  { "ply", bench_ply },
+  { "replay", bench_replay },
+};
+
+int main(int argc, char** argv)
+{
+  const size_t nsuites = sizeof(suites) / sizeof(suites[0]);
+
+  if(argc < 2) {
+    for(size_t i = 0; i < nsuites; ++i) {
+      suites[i].run();
+    }
+    return 0;
+  }
+
+  for(int a = 1; a < argc; ++a) {
+    size_t i = 0;
+    while(i < nsuites && strcmp(argv[a], suites[i].name) != 0) {
+      ++i;
+    }
+    if(i == nsuites) {
+      std::cerr << "Unknown suite: " << argv[a] << std::endl;
+      return 1;
+    }
+    suites[i].run();
+  }
+  return 0;
+}
@@ -0,0 +1,402 @@
+//---------------------------------------------------------------------------
+//
+// bvh.hpp/bvh.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "bvh.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CS488_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+Frustum::Frustum(const Matrix4x4& mvp, const ClipPlanes& walls,
+                 double tolerance, const Point3D& origin)
+  : tolerance(tolerance)
+{
+  // Each plane is a combination of two rows of the matrix, as each
+  // outcode test is of two clip space coordinates: x - left * w >= 0
+  // and so on
+  const struct {
+    int a;
+    double ka;
+    int b;
+    double kb;
+  } rows[6] = {
+    { 0, 1, 3, -walls.left },
+    { 3, walls.right, 0, -1 },
+    { 1, 1, 3, -walls.top },
+    { 3, walls.bottom, 1, -1 },
+    { 2, 1, 3, 1 },
+    { 3, 1, 2, -1 }
+  };
+  for(int p = 0; p < 6; ++p) {
+    const double ka = rows[p].ka, kb = rows[p].kb;
+    for(int k = 0; k < 4; ++k) {
+      const double a = mvp[rows[p].a][k], b = mvp[rows[p].b][k];
+      plane[p][k] = ka * a + kb * b;
+      scale[p][k] = std::fabs(ka * a) + std::fabs(kb * b);
+    }
+    for(int k = 0; k < 3; ++k) {
+      scale[p][3] += scale[p][k] * std::fabs(origin[k]);
+    }
+  }
+}
+
+BoxCounts::BoxCounts()
+  : outside(0)
+  , inside(0)
+  , partial(0)
+{
+}
+
+BoxTree::BoxTree()
+  : m_count(0)
+{
+}
+
+// Store the box from lo to hi in lane j of "node", the half extents
+// rounded up until centre plus or minus them covers the box
+static void set_lane(BoxNode& node, int j, const double lo[3],
+                     const double hi[3])
+{
+  double *c[3] = { node.cx, node.cy, node.cz };
+  double *e[3] = { node.ex, node.ey, node.ez };
+  for(int k = 0; k < 3; ++k) {
+    double centre = lo[k] + 0.5 * (hi[k] - lo[k]);
+    double extent = 0.5 * (hi[k] - lo[k]);
+    while(centre - extent > lo[k] || centre + extent < hi[k]) {
+      extent = std::nextafter(extent, HUGE_VAL);
+    }
+    c[k][j] = centre;
+    e[k][j] = extent;
+  }
+}
+
+// The box lane j of "node" covers
+static void get_lane(const BoxNode& node, int j, double lo[3], double hi[3])
+{
+  const double *c[3] = { node.cx, node.cy, node.cz };
+  const double *e[3] = { node.ex, node.ey, node.ez };
+  for(int k = 0; k < 3; ++k) {
+    lo[k] = c[k][j] - e[k][j];
+    hi[k] = c[k][j] + e[k][j];
+  }
+}
+
+// The low ten bits of v spread out to every third bit
+static uint32_t spread3(uint32_t v)
+{
+  v &= 0x3ff;
+  v = (v | v << 16) & 0x030000ff;
+  v = (v | v << 8) & 0x0300f00f;
+  v = (v | v << 4) & 0x030c30c3;
+  v = (v | v << 2) & 0x09249249;
+  return v;
+}
+
+void BoxTree::build(size_t count, const double *const lower[3],
+                    const double *const upper[3], bool sort)
+{
+  m_count = count;
+  m_lower = m_upper = Point3D();
+  m_order.clear();
+  if(count == 0) {
+    m_levels.clear();
+    return;
+  }
+
+  if(sort) {
+    // Each centre's place on a 1024 cube grid over the centres, its
+    // coordinates' bits interleaved, above the box number
+    double lo[3], step[3];
+    for(int k = 0; k < 3; ++k) {
+      double first = HUGE_VAL, last = -HUGE_VAL;
+      for(size_t i = 0; i < count; ++i) {
+        const double c = 0.5 * (lower[k][i] + upper[k][i]);
+        first = std::min(first, c);
+        last = std::max(last, c);
+      }
+      lo[k] = first;
+      step[k] = last > first ? 1023 / (last - first) : 0;
+    }
+    m_keys.resize(count);
+    for(size_t i = 0; i < count; ++i) {
+      uint32_t code = 0;
+      for(int k = 0; k < 3; ++k) {
+        const double c = 0.5 * (lower[k][i] + upper[k][i]);
+        code |= spread3((uint32_t)((c - lo[k]) * step[k])) << k;
+      }
+      m_keys[i] = (uint64_t)code << 32 | i;
+    }
+    std::sort(m_keys.begin(), m_keys.end());
+    m_order.resize(count);
+    for(size_t i = 0; i < count; ++i) {
+      m_order[i] = (unsigned)m_keys[i];
+    }
+  }
+
+  size_t depth = 1;
+  for(size_t n = (count + 3) / 4; n > 1; n = (n + 3) / 4) {
+    ++depth;
+  }
+  m_levels.resize(depth);
+
+  // The boxes themselves, four to a node, the lanes past the last box
+  // left empty
+  std::vector<BoxNode>& leaves = m_levels[0];
+  leaves.resize((count + 3) / 4);
+  memset(&leaves[0], 0, leaves.size() * sizeof(BoxNode));
+  for(size_t i = 0; i < count; ++i) {
+    const size_t b = sort ? m_order[i] : i;
+    const double lo[3] = { lower[0][b], lower[1][b], lower[2][b] };
+    const double hi[3] = { upper[0][b], upper[1][b], upper[2][b] };
+    set_lane(leaves[i / 4], (int)(i % 4), lo, hi);
+  }
+
+  // Then each level's nodes, each bounding four nodes of the level
+  // below in its lanes, up to the box around everything
+  for(size_t l = 1; l <= depth; ++l) {
+    const std::vector<BoxNode>& below = m_levels[l - 1];
+    // Lanes of the level below that hold boxes
+    const size_t span = (size_t)1 << (2 * (l - 1));
+    const size_t lanes = (count + span - 1) / span;
+    std::vector<BoxNode> *level = l < depth ? &m_levels[l] : 0;
+    if(level) {
+      level->resize((below.size() + 3) / 4);
+      memset(&(*level)[0], 0, level->size() * sizeof(BoxNode));
+    }
+    for(size_t i = 0; i < below.size(); ++i) {
+      double lo[3], hi[3];
+      get_lane(below[i], 0, lo, hi);
+      for(size_t j = 1; j < 4 && 4 * i + j < lanes; ++j) {
+        double jlo[3], jhi[3];
+        get_lane(below[i], (int)j, jlo, jhi);
+        for(int k = 0; k < 3; ++k) {
+          lo[k] = std::min(lo[k], jlo[k]);
+          hi[k] = std::max(hi[k], jhi[k]);
+        }
+      }
+      if(level) {
+        set_lane((*level)[i / 4], (int)(i % 4), lo, hi);
+      } else {
+        m_lower = Point3D(lo[0], lo[1], lo[2]);
+        m_upper = Point3D(hi[0], hi[1], hi[2]);
+      }
+    }
+  }
+}
+
+// A box centred on c with half extents e is outside the plane when the
+// plane's value at c plus the most the box reaches back towards it is
+// still negative, and inside when the value less that is still
+// positive, each by more than the rounding margin
+static void test_scalar(const Frustum& f, const BoxNode& node,
+                        unsigned& outside, unsigned& inside)
+{
+  outside = 0;
+  inside = 15;
+  for(int j = 0; j < 4; ++j) {
+    const double cx = node.cx[j], cy = node.cy[j], cz = node.cz[j];
+    const double ex = node.ex[j], ey = node.ey[j], ez = node.ez[j];
+    for(int p = 0; p < 6; ++p) {
+      const double *q = f.plane[p], *s = f.scale[p];
+      const double d = q[0] * cx + q[1] * cy + q[2] * cz + q[3];
+      const double r = std::fabs(q[0]) * ex + std::fabs(q[1]) * ey +
+                       std::fabs(q[2]) * ez;
+      const double m = f.tolerance * (s[0] * (std::fabs(cx) + ex) +
+                                      s[1] * (std::fabs(cy) + ey) +
+                                      s[2] * (std::fabs(cz) + ez) + s[3]);
+      if(d + r < -m) {
+        outside |= 1u << j;
+      }
+      if(d - r <= m) {
+        inside &= ~(1u << j);
+      }
+    }
+  }
+}
+
+#ifdef CS488_X86_KERNELS
+
+// Two lanes at a time
+__attribute__((target("sse2")))
+static void test_pair_sse2(const Frustum& f, const BoxNode& node, int j,
+                           unsigned& outside, unsigned& inside)
+{
+  const __m128d sign = _mm_set1_pd(-0.0);
+  const __m128d cx = _mm_loadu_pd(node.cx + j);
+  const __m128d cy = _mm_loadu_pd(node.cy + j);
+  const __m128d cz = _mm_loadu_pd(node.cz + j);
+  const __m128d ex = _mm_loadu_pd(node.ex + j);
+  const __m128d ey = _mm_loadu_pd(node.ey + j);
+  const __m128d ez = _mm_loadu_pd(node.ez + j);
+  // |c| + e per axis, what the margins scale
+  const __m128d ax = _mm_add_pd(_mm_andnot_pd(sign, cx), ex);
+  const __m128d ay = _mm_add_pd(_mm_andnot_pd(sign, cy), ey);
+  const __m128d az = _mm_add_pd(_mm_andnot_pd(sign, cz), ez);
+  const __m128d tolerance = _mm_set1_pd(f.tolerance);
+
+  int out = 0, in = 3;
+  for(int p = 0; p < 6; ++p) {
+    const double *q = f.plane[p], *s = f.scale[p];
+    __m128d d = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(q[0]), cx),
+                           _mm_mul_pd(_mm_set1_pd(q[1]), cy));
+    d = _mm_add_pd(d, _mm_add_pd(_mm_mul_pd(_mm_set1_pd(q[2]), cz),
+                                 _mm_set1_pd(q[3])));
+    __m128d r = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(std::fabs(q[0])), ex),
+                           _mm_mul_pd(_mm_set1_pd(std::fabs(q[1])), ey));
+    r = _mm_add_pd(r, _mm_mul_pd(_mm_set1_pd(std::fabs(q[2])), ez));
+    __m128d m = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(s[0]), ax),
+                           _mm_mul_pd(_mm_set1_pd(s[1]), ay));
+    m = _mm_add_pd(m, _mm_add_pd(_mm_mul_pd(_mm_set1_pd(s[2]), az),
+                                 _mm_set1_pd(s[3])));
+    m = _mm_mul_pd(tolerance, m);
+    out |= _mm_movemask_pd(_mm_cmplt_pd(_mm_add_pd(d, r),
+                                        _mm_sub_pd(_mm_setzero_pd(), m)));
+    in &= _mm_movemask_pd(_mm_cmpgt_pd(_mm_sub_pd(d, r), m));
+  }
+  outside |= (unsigned)out << j;
+  inside |= (unsigned)in << j;
+}
+
+__attribute__((target("sse2")))
+static void test_sse2(const Frustum& f, const BoxNode& node,
+                      unsigned& outside, unsigned& inside)
+{
+  outside = inside = 0;
+  test_pair_sse2(f, node, 0, outside, inside);
+  test_pair_sse2(f, node, 2, outside, inside);
+}
+
+// All four lanes in one register per coordinate
+__attribute__((target("avx2")))
+static void test_avx2(const Frustum& f, const BoxNode& node,
+                      unsigned& outside, unsigned& inside)
+{
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d cx = _mm256_loadu_pd(node.cx);
+  const __m256d cy = _mm256_loadu_pd(node.cy);
+  const __m256d cz = _mm256_loadu_pd(node.cz);
+  const __m256d ex = _mm256_loadu_pd(node.ex);
+  const __m256d ey = _mm256_loadu_pd(node.ey);
+  const __m256d ez = _mm256_loadu_pd(node.ez);
+  const __m256d ax = _mm256_add_pd(_mm256_andnot_pd(sign, cx), ex);
+  const __m256d ay = _mm256_add_pd(_mm256_andnot_pd(sign, cy), ey);
+  const __m256d az = _mm256_add_pd(_mm256_andnot_pd(sign, cz), ez);
+  const __m256d tolerance = _mm256_set1_pd(f.tolerance);
+
+  int out = 0, in = 15;
+  for(int p = 0; p < 6; ++p) {
+    const double *q = f.plane[p], *s = f.scale[p];
+    __m256d d = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(q[0]), cx),
+                              _mm256_mul_pd(_mm256_set1_pd(q[1]), cy));
+    d = _mm256_add_pd(d, _mm256_add_pd(
+      _mm256_mul_pd(_mm256_set1_pd(q[2]), cz), _mm256_set1_pd(q[3])));
+    __m256d r = _mm256_add_pd(
+      _mm256_mul_pd(_mm256_set1_pd(std::fabs(q[0])), ex),
+      _mm256_mul_pd(_mm256_set1_pd(std::fabs(q[1])), ey));
+    r = _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(std::fabs(q[2])), ez));
+    __m256d m = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(s[0]), ax),
+                              _mm256_mul_pd(_mm256_set1_pd(s[1]), ay));
+    m = _mm256_add_pd(m, _mm256_add_pd(
+      _mm256_mul_pd(_mm256_set1_pd(s[2]), az), _mm256_set1_pd(s[3])));
+    m = _mm256_mul_pd(tolerance, m);
+    out |= _mm256_movemask_pd(_mm256_cmp_pd(
+      _mm256_add_pd(d, r), _mm256_sub_pd(_mm256_setzero_pd(), m),
+      _CMP_LT_OQ));
+    in &= _mm256_movemask_pd(_mm256_cmp_pd(_mm256_sub_pd(d, r), m,
+                                           _CMP_GT_OQ));
+  }
+  outside = (unsigned)out;
+  inside = (unsigned)in;
+
+  // Back to SSE code (see transform_avx2 in algebra.cpp)
+  _mm256_zeroupper();
+}
+
+#endif // CS488_X86_KERNELS
+
+void BoxTree::fill(unsigned char *classes, size_t begin, size_t n,
+                   unsigned char box) const
+{
+  if(m_order.empty()) {
+    memset(classes + begin, box, n);
+    return;
+  }
+  for(size_t i = begin; i < begin + n; ++i) {
+    classes[m_order[i]] = box;
+  }
+}
+
+void BoxTree::visit(const Frustum& frustum, NodeTest test, size_t level,
+                    size_t node, unsigned char *classes,
+                    BoxCounts& counts) const
+{
+  unsigned outside, inside;
+  test(frustum, m_levels[level][node], outside, inside);
+
+  // The boxes themselves, one per lane
+  if(level == 0) {
+    for(size_t j = 0; j < 4 && 4 * node + j < m_count; ++j) {
+      unsigned char box = BOX_PARTIAL;
+      if(outside >> j & 1) {
+        box = BOX_OUTSIDE;
+        ++counts.outside;
+      } else if(inside >> j & 1) {
+        box = BOX_INSIDE;
+        ++counts.inside;
+      } else {
+        ++counts.partial;
+      }
+      fill(classes, 4 * node + j, 1, box);
+    }
+    return;
+  }
+
+  // Or the boxes under each lane
+  const size_t span = (size_t)1 << (2 * level);
+  for(size_t j = 0; j < 4; ++j) {
+    const size_t begin = (4 * node + j) * span;
+    if(begin >= m_count) {
+      break;
+    }
+    const size_t n = std::min(begin + span, m_count) - begin;
+    if(outside >> j & 1) {
+      fill(classes, begin, n, BOX_OUTSIDE);
+      counts.outside += n;
+    } else if(inside >> j & 1) {
+      fill(classes, begin, n, BOX_INSIDE);
+      counts.inside += n;
+    } else {
+      visit(frustum, test, level - 1, 4 * node + j, classes, counts);
+    }
+  }
+}
+
+void BoxTree::classify(const Frustum& frustum, unsigned char *classes,
+                       BoxCounts& counts) const
+{
+  if(m_count == 0) {
+    return;
+  }
+  NodeTest test = test_scalar;
+#ifdef CS488_X86_KERNELS
+  switch(transform_kernel()) {
+  case KERNEL_AVX2:
+    test = test_avx2;
+    break;
+  case KERNEL_SSE2:
+    test = test_sse2;
+    break;
+  default:
+    break;
+  }
+#endif
+  // From the top level's one node down
+  visit(frustum, test, m_levels.size() - 1, 0, classes, counts);
+}
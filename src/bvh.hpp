@@ -0,0 +1,127 @@
+//---------------------------------------------------------------------------
+//
+// bvh.hpp/bvh.cpp
+//
+// Bounding volume hierarchies for culling whole runs of edges, or whole
+// instances, against a view before their vertices are transformed.  A
+// BoxTree is built over a sequence of axis-aligned boxes in the order
+// given: each node bounds four consecutive nodes of the level below,
+// so every node covers a run of consecutive boxes and building it is
+// one pass over them.  Boxes that are close in the sequence should be
+// close in space (edges in mesh order usually are); boxes that come in
+// no useful order, like instances, can be sorted along a Morton curve
+// through their centres first.
+//
+// classify() walks the tree against a Frustum, testing a node's four
+// children together, plane by plane, in SIMD registers (one AVX2
+// register, or two SSE2 ones, per coordinate).  A child wholly outside
+// one of the planes is culled with every box under it, one wholly
+// inside all of them is accepted with every box under it, and only the
+// children straddling a plane are opened.
+//
+// The planes are those of clip.hpp's volume taken back through the
+// matrix to clip space, so the boxes are tested where they are, and
+// nothing is transformed to be tested.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_BVH_HPP
+#define CS488_BVH_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "algebra.hpp"
+#include "clip.hpp"
+
+// Where a box lies against a frustum
+enum BoxClass {
+  BOX_OUTSIDE,
+  BOX_PARTIAL,
+  BOX_INSIDE
+};
+
+// The six planes a x + b y + c z + d >= 0 of a view volume
+struct Frustum {
+  // The volume inside "walls" in the clip space "mvp" maps to.  A box
+  // is only outside (inside) when it is clear of a plane by more than
+  // "tolerance" times the size of the numbers that go into placing its
+  // points there, so rounding in the transform and the outcode tests
+  // can't put any of them on the other side.  Points transformed
+  // relative to "origin" count its size too.
+  Frustum(const Matrix4x4& mvp, const ClipPlanes& walls, double tolerance,
+          const Point3D& origin = Point3D());
+
+  double plane[6][4];
+  // The same sums with every term made positive, and the constant
+  // term's with the origin's
+  double scale[6][4];
+  double tolerance;
+};
+
+// How many boxes classify() put in each class
+struct BoxCounts {
+  BoxCounts();
+
+  size_t outside, inside, partial;
+};
+
+// Four sibling boxes as centres and half extents, lane by lane
+struct BoxNode {
+  double cx[4], cy[4], cz[4];
+  double ex[4], ey[4], ez[4];
+};
+
+class BoxTree {
+public:
+  BoxTree();
+
+  // Build over "count" boxes, box i from lower[k][i] to upper[k][i] on
+  // axis k, in Morton order if "sort".  Rebuilding over as many boxes
+  // makes no allocations.
+  void build(size_t count, const double *const lower[3],
+             const double *const upper[3], bool sort = false);
+
+  size_t size() const
+  {
+    return m_count;
+  }
+  // The box around them all (empty boxes at the origin if none)
+  const Point3D& lower() const
+  {
+    return m_lower;
+  }
+  const Point3D& upper() const
+  {
+    return m_upper;
+  }
+
+  // Set classes[i] to the BoxClass of box i against "frustum" and add
+  // how many went in each class to "counts"
+  void classify(const Frustum& frustum, unsigned char *classes,
+                BoxCounts& counts) const;
+
+private:
+  // Sets the bits of "outside" and "inside" of the node's lanes that
+  // are, against the frustum
+  typedef void (*NodeTest)(const Frustum& frustum, const BoxNode& node,
+                           unsigned& outside, unsigned& inside);
+
+  void visit(const Frustum& frustum, NodeTest test, size_t level,
+             size_t node, unsigned char *classes, BoxCounts& counts) const;
+  // Set the class of the boxes in places [begin, begin + n) of the tree
+  void fill(unsigned char *classes, size_t begin, size_t n,
+            unsigned char box) const;
+
+  // m_levels[0] holds the boxes four to a node, each level above bounds
+  // the one below four nodes to a node, and the last has one node
+  std::vector<std::vector<BoxNode> > m_levels;
+  size_t m_count;
+  // Sorted, the box in each place, found by sorting Morton codes over
+  // box numbers in m_keys; empty otherwise
+  std::vector<unsigned> m_order;
+  std::vector<uint64_t> m_keys;
+  Point3D m_lower, m_upper;
+};
+
+#endif
@@ -0,0 +1,554 @@
+//---------------------------------------------------------------------------
+//
+// chunkedmesh.hpp/chunkedmesh.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "chunkedmesh.hpp"
+#include "clip.hpp"
+#include <algorithm>
+#include <fstream>
+#include <utility>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <unistd.h>
+
+static const char MAGIC[4] = { 'A', '2', 'C', 'K' };
+static const uint32_t VERSION = 1;
+// Reads back differently on a machine of the other byte order
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Arrays start on multiples of this within their chunk
+static const uint64_t ALIGN = 64;
+// And chunks on multiples of this, a whole number of pages
+static const uint64_t CHUNK_ALIGN = 65536;
+
+static const size_t DEFAULT_BUDGET = (size_t)256 << 20;
+
+struct ChunkFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint64_t chunks;
+  // The whole mesh
+  uint64_t vertices, edges;
+  double lower[3], upper[3];
+};
+
+// One entry of the table that follows the header
+struct ChunkRecord {
+  double lower[3], upper[3];
+  uint64_t vertices, edges;
+  // Where the chunk starts, from the start of the file, and its size
+  uint64_t offset, bytes;
+};
+
+enum {
+  ARRAY_X,
+  ARRAY_Y,
+  ARRAY_Z,
+  ARRAY_EDGES,
+  ARRAYS
+};
+
+static uint64_t align_up(uint64_t n, uint64_t to)
+{
+  return (n + to - 1) / to * to;
+}
+
+// Where each array of a chunk with the given counts starts, from the
+// start of the chunk.  Returns the chunk's size.
+static uint64_t chunk_layout(uint64_t vertices, uint64_t edges,
+                             uint64_t offsets[ARRAYS])
+{
+  const uint64_t bytes[ARRAYS] = {
+    vertices * sizeof(double), vertices * sizeof(double),
+    vertices * sizeof(double), 2 * edges * sizeof(uint32_t)
+  };
+  uint64_t at = 0;
+  for(int k = 0; k < ARRAYS; ++k) {
+    at = align_up(at, ALIGN);
+    offsets[k] = at;
+    at += bytes[k];
+  }
+  return at;
+}
+
+std::string chunked_mesh_path(const std::string& path)
+{
+  return path + ".a2chunks";
+}
+
+/*
+ * Splitting
+ */
+
+// Cut "order" into runs of at most "max_vertices" vertices that lie
+// together, appending each as a [begin, end) pair to "leaves"
+static void split_vertices(const Mesh& mesh, std::vector<unsigned>& order,
+                           size_t max_vertices,
+                           std::vector<std::pair<size_t, size_t> >& leaves)
+{
+  const MeshArray<double> *axes[3] = { &mesh.x, &mesh.y, &mesh.z };
+  std::vector<std::pair<size_t, size_t> > stack;
+  if(!order.empty()) {
+    stack.push_back(std::make_pair((size_t)0, order.size()));
+  }
+  while(!stack.empty()) {
+    const size_t begin = stack.back().first, end = stack.back().second;
+    stack.pop_back();
+    if(end - begin <= max_vertices) {
+      leaves.push_back(std::make_pair(begin, end));
+      continue;
+    }
+
+    double lo[3], hi[3];
+    for(int k = 0; k < 3; ++k) {
+      lo[k] = hi[k] = (*axes[k])[order[begin]];
+    }
+    for(size_t i = begin + 1; i < end; ++i) {
+      for(int k = 0; k < 3; ++k) {
+        const double c = (*axes[k])[order[i]];
+        lo[k] = std::min(lo[k], c);
+        hi[k] = std::max(hi[k], c);
+      }
+    }
+    int axis = 0;
+    for(int k = 1; k < 3; ++k) {
+      if(hi[k] - lo[k] > hi[axis] - lo[axis]) {
+        axis = k;
+      }
+    }
+
+    const MeshArray<double>& c = *axes[axis];
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid,
+                     order.begin() + end,
+                     [&](unsigned a, unsigned b) { return c[a] < c[b]; });
+    // The first half is popped, so written out, first
+    stack.push_back(std::make_pair(mid, end));
+    stack.push_back(std::make_pair(begin, mid));
+  }
+}
+
+bool write_chunked_mesh(const Mesh& mesh, const std::string& path,
+                        size_t max_vertices, std::string& error)
+{
+  const size_t n = mesh.num_vertices();
+  const size_t m = mesh.num_edges();
+  if(n > UINT32_MAX) {
+    error = path + ": too many vertices";
+    return false;
+  }
+
+  std::vector<unsigned> order(n);
+  for(size_t i = 0; i < n; ++i) {
+    order[i] = (unsigned)i;
+  }
+  std::vector<std::pair<size_t, size_t> > leaves;
+  split_vertices(mesh, order, std::max(max_vertices, (size_t)1), leaves);
+  const size_t chunks = leaves.size();
+
+  std::vector<unsigned> owner(n);
+  for(size_t c = 0; c < chunks; ++c) {
+    for(size_t i = leaves[c].first; i < leaves[c].second; ++i) {
+      owner[order[i]] = (unsigned)c;
+    }
+  }
+
+  // The edges, bucketed by the chunk of their first vertex
+  std::vector<size_t> first_edge(chunks + 1, 0);
+  for(size_t e = 0; e < m; ++e) {
+    ++first_edge[owner[mesh.edges[2 * e]] + 1];
+  }
+  for(size_t c = 0; c < chunks; ++c) {
+    first_edge[c + 1] += first_edge[c];
+  }
+  std::vector<unsigned> by_chunk(m);
+  {
+    std::vector<size_t> at(first_edge.begin(), first_edge.end() - 1);
+    for(size_t e = 0; e < m; ++e) {
+      by_chunk[at[owner[mesh.edges[2 * e]]]++] = (unsigned)e;
+    }
+  }
+
+  ChunkFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = VERSION;
+  h.byte_order = BYTE_ORDER_MARK;
+  h.header_size = sizeof(h);
+  h.chunks = chunks;
+  h.vertices = n;
+  h.edges = m;
+  for(int k = 0; k < 3; ++k) {
+    h.lower[k] = mesh.lower[k];
+    h.upper[k] = mesh.upper[k];
+  }
+  std::vector<ChunkRecord> records(chunks);
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+  const std::string temp = path + suffix;
+  std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out) {
+    error = temp + ": can't be written";
+    return false;
+  }
+  // The table is written again once it is filled in
+  out.write((const char *)&h, sizeof(h));
+  out.write((const char *)records.data(), chunks * sizeof(ChunkRecord));
+  uint64_t written = sizeof(h) + chunks * sizeof(ChunkRecord);
+
+  // Each vertex's index in the chunk being written, valid where
+  // "stamp" holds that chunk
+  std::vector<unsigned> local(n), stamp(n, UINT32_MAX);
+  std::vector<unsigned> vertices;
+  std::vector<double> coords[3];
+  std::vector<uint32_t> edges;
+  static const char zeros[ALIGN] = { 0 };
+  std::vector<char> padding(CHUNK_ALIGN, 0);
+  for(size_t c = 0; c < chunks && out; ++c) {
+    vertices.assign(order.begin() + leaves[c].first,
+                    order.begin() + leaves[c].second);
+    for(size_t i = 0; i < vertices.size(); ++i) {
+      local[vertices[i]] = (unsigned)i;
+      stamp[vertices[i]] = (unsigned)c;
+    }
+    edges.clear();
+    for(size_t k = first_edge[c]; k < first_edge[c + 1]; ++k) {
+      const size_t e = by_chunk[k];
+      for(int j = 0; j < 2; ++j) {
+        const unsigned v = mesh.edges[2 * e + j];
+        if(stamp[v] != c) {
+          // An end in another chunk, copied into this one
+          local[v] = (unsigned)vertices.size();
+          stamp[v] = (unsigned)c;
+          vertices.push_back(v);
+        }
+        edges.push_back(local[v]);
+      }
+    }
+
+    ChunkRecord& r = records[c];
+    r.vertices = vertices.size();
+    r.edges = edges.size() / 2;
+    for(int k = 0; k < 3; ++k) {
+      const MeshArray<double>& axis = k == 0 ? mesh.x : k == 1 ? mesh.y :
+                                      mesh.z;
+      coords[k].resize(vertices.size());
+      for(size_t i = 0; i < vertices.size(); ++i) {
+        coords[k][i] = axis[vertices[i]];
+      }
+      r.lower[k] = r.upper[k] = vertices.empty() ? 0 : coords[k][0];
+      for(size_t i = 1; i < vertices.size(); ++i) {
+        r.lower[k] = std::min(r.lower[k], coords[k][i]);
+        r.upper[k] = std::max(r.upper[k], coords[k][i]);
+      }
+    }
+
+    r.offset = align_up(written, CHUNK_ALIGN);
+    out.write(padding.data(), r.offset - written);
+    uint64_t offsets[ARRAYS];
+    r.bytes = chunk_layout(r.vertices, r.edges, offsets);
+    const void *arrays[ARRAYS] = {
+      coords[0].data(), coords[1].data(), coords[2].data(), edges.data()
+    };
+    const uint64_t bytes[ARRAYS] = {
+      r.vertices * sizeof(double), r.vertices * sizeof(double),
+      r.vertices * sizeof(double), edges.size() * sizeof(uint32_t)
+    };
+    uint64_t at = 0;
+    for(int k = 0; k < ARRAYS; ++k) {
+      out.write(zeros, offsets[k] - at);
+      out.write((const char *)arrays[k], bytes[k]);
+      at = offsets[k] + bytes[k];
+    }
+    written = r.offset + r.bytes;
+  }
+
+  out.seekp(sizeof(h));
+  out.write((const char *)records.data(), chunks * sizeof(ChunkRecord));
+  out.close();
+  if(!out || rename(temp.c_str(), path.c_str()) != 0) {
+    remove(temp.c_str());
+    error = path + ": can't be written";
+    return false;
+  }
+  return true;
+}
+
+bool box_in_frustum(const Matrix4x4& mvp, const Point3D& lower,
+                    const Point3D& upper)
+{
+  double x[8], y[8], z[8], w[8];
+  for(int i = 0; i < 8; ++i) {
+    const double p[3] = {
+      (i & 1) ? upper[0] : lower[0],
+      (i & 2) ? upper[1] : lower[1],
+      (i & 4) ? upper[2] : lower[2]
+    };
+    double *out[4] = { &x[i], &y[i], &z[i], &w[i] };
+    for(int r = 0; r < 4; ++r) {
+      *out[r] = mvp[r][0] * p[0] + mvp[r][1] * p[1] + mvp[r][2] * p[2] +
+                mvp[r][3];
+    }
+  }
+  const ClipPlanes planes = { -1, 1, -1, 1 };
+  unsigned char codes[8];
+  compute_outcodes(planes, 8, x, y, z, w, codes);
+  unsigned char all = 0xff;
+  for(int i = 0; i < 8; ++i) {
+    all &= codes[i];
+  }
+  return all == 0;
+}
+
+/*
+ * Paging
+ */
+
+ChunkPager::ChunkPager()
+  : m_stopping(false)
+  , m_frame(0)
+  , m_wanted(0)
+  , m_budget(DEFAULT_BUDGET)
+  , m_resident_bytes(0)
+  , m_loads(0)
+  , m_evictions(0)
+{
+}
+
+ChunkPager::~ChunkPager()
+{
+  close();
+}
+
+bool ChunkPager::open(const std::string& path, std::string& error)
+{
+  close();
+
+  std::shared_ptr<MappedFile> file(new MappedFile);
+  if(!file->open(path, error)) {
+    return false;
+  }
+  ChunkFileHeader h;
+  if(file->size() < sizeof(h)) {
+    error = path + ": not a chunk file";
+    return false;
+  }
+  memcpy(&h, file->data(), sizeof(h));
+  if(memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+     h.byte_order != BYTE_ORDER_MARK || h.header_size != sizeof(h) ||
+     h.chunks > (file->size() - sizeof(h)) / sizeof(ChunkRecord)) {
+    error = path + ": not a chunk file this build can read";
+    return false;
+  }
+
+  std::vector<ChunkRecord> records(h.chunks);
+  memcpy(records.data(), file->data() + sizeof(h),
+         h.chunks * sizeof(ChunkRecord));
+  const uint64_t table_end = sizeof(h) + h.chunks * sizeof(ChunkRecord);
+  for(size_t c = 0; c < records.size(); ++c) {
+    const ChunkRecord& r = records[c];
+    uint64_t offsets[ARRAYS];
+    if(r.offset % CHUNK_ALIGN != 0 || r.offset < table_end ||
+       r.offset > file->size() ||
+       r.bytes != chunk_layout(r.vertices, r.edges, offsets) ||
+       r.bytes > file->size() - r.offset) {
+      error = path + ": damaged chunk table";
+      return false;
+    }
+  }
+
+  m_file = file;
+  m_chunks.resize(records.size());
+  for(size_t c = 0; c < records.size(); ++c) {
+    const ChunkRecord& r = records[c];
+    Chunk& chunk = m_chunks[c];
+    uint64_t offsets[ARRAYS];
+    chunk_layout(r.vertices, r.edges, offsets);
+    const char *base = file->data() + r.offset;
+    chunk.mesh.x.map(m_file, (const double *)(base + offsets[ARRAY_X]),
+                     r.vertices);
+    chunk.mesh.y.map(m_file, (const double *)(base + offsets[ARRAY_Y]),
+                     r.vertices);
+    chunk.mesh.z.map(m_file, (const double *)(base + offsets[ARRAY_Z]),
+                     r.vertices);
+    chunk.mesh.edges.map(m_file,
+                         (const unsigned *)(base + offsets[ARRAY_EDGES]),
+                         2 * r.edges);
+    chunk.mesh.lower = Point3D(r.lower[0], r.lower[1], r.lower[2]);
+    chunk.mesh.upper = Point3D(r.upper[0], r.upper[1], r.upper[2]);
+    chunk.offset = r.offset;
+    chunk.bytes = r.bytes;
+    chunk.wanted = 0;
+    chunk.queued = chunk.loading = chunk.resident = false;
+  }
+  m_lower = Point3D(h.lower[0], h.lower[1], h.lower[2]);
+  m_upper = Point3D(h.upper[0], h.upper[1], h.upper[2]);
+
+  m_frame = 0;
+  m_wanted = 0;
+  m_resident_bytes = 0;
+  m_loads = m_evictions = 0;
+  m_stopping = false;
+  m_thread = std::thread(&ChunkPager::page_in, this);
+  return true;
+}
+
+void ChunkPager::close()
+{
+  if(m_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+  m_queue.clear();
+  m_lru.clear();
+  m_chunks.clear();
+  m_file.reset();
+  m_resident_bytes = 0;
+  m_wanted = 0;
+}
+
+void ChunkPager::set_budget(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_budget = bytes;
+}
+
+void ChunkPager::set_on_paged(const std::function<void()>& on_paged)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_on_paged = on_paged;
+}
+
+void ChunkPager::cull(const std::vector<Matrix4x4>& mvps,
+                      std::vector<unsigned>& visible) const
+{
+  for(size_t c = 0; c < m_chunks.size(); ++c) {
+    const Mesh& mesh = m_chunks[c].mesh;
+    for(size_t i = 0; i < mvps.size(); ++i) {
+      if(box_in_frustum(mvps[i], mesh.lower, mesh.upper)) {
+        visible.push_back((unsigned)c);
+        break;
+      }
+    }
+  }
+}
+
+void ChunkPager::request(const std::vector<unsigned>& wanted,
+                         std::vector<unsigned>& ready)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_frame;
+    m_wanted = 0;
+    for(size_t k = 0; k < wanted.size(); ++k) {
+      const unsigned i = wanted[k];
+      if(i >= m_chunks.size()) {
+        continue;
+      }
+      Chunk& chunk = m_chunks[i];
+      chunk.wanted = m_frame;
+      ++m_wanted;
+      if(chunk.resident) {
+        m_lru.splice(m_lru.begin(), m_lru, chunk.lru);
+        ready.push_back(i);
+      } else if(!chunk.queued && !chunk.loading) {
+        chunk.queued = true;
+        m_queue.push_back(i);
+      }
+    }
+    // In case the budget shrank
+    make_room(0);
+  }
+  m_wake.notify_one();
+}
+
+PagerStats ChunkPager::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  PagerStats s;
+  s.chunks = m_chunks.size();
+  s.wanted = m_wanted;
+  s.resident = m_lru.size();
+  s.resident_bytes = m_resident_bytes;
+  s.budget = m_budget;
+  s.loads = m_loads;
+  s.evictions = m_evictions;
+  s.queued = m_queue.size();
+  return s;
+}
+
+bool ChunkPager::make_room(size_t bytes)
+{
+  if(bytes > m_budget) {
+    return false;
+  }
+  while(m_resident_bytes + bytes > m_budget) {
+    // What is wanted this frame is at the front, so once the back is
+    // wanted everything is
+    if(m_lru.empty() || m_chunks[m_lru.back()].wanted == m_frame) {
+      return false;
+    }
+    evict(m_lru.back());
+  }
+  return true;
+}
+
+void ChunkPager::evict(unsigned i)
+{
+  Chunk& chunk = m_chunks[i];
+  // The padding up to the next chunk goes with it
+  m_file->release(chunk.offset, align_up(chunk.bytes, CHUNK_ALIGN));
+  m_lru.erase(chunk.lru);
+  chunk.resident = false;
+  m_resident_bytes -= chunk.bytes;
+  ++m_evictions;
+}
+
+// The paging thread: read in the queued chunks still wanted, one at a
+// time, making room for each
+void ChunkPager::page_in()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;) {
+    m_wake.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+    if(m_stopping) {
+      return;
+    }
+    const unsigned i = m_queue.front();
+    m_queue.pop_front();
+    Chunk& chunk = m_chunks[i];
+    chunk.queued = false;
+    // Skip it if the camera moved off it while it waited; if there is
+    // no room it is asked for again next frame
+    if(chunk.wanted != m_frame || !make_room(chunk.bytes)) {
+      continue;
+    }
+    chunk.loading = true;
+    m_resident_bytes += chunk.bytes;
+
+    lock.unlock();
+    m_file->load(chunk.offset, chunk.bytes);
+    lock.lock();
+
+    chunk.loading = false;
+    chunk.resident = true;
+    m_lru.push_front(i);
+    chunk.lru = m_lru.begin();
+    ++m_loads;
+    if(m_on_paged) {
+      std::function<void()> on_paged = m_on_paged;
+      lock.unlock();
+      on_paged();
+      lock.lock();
+    }
+  }
+}
@@ -0,0 +1,167 @@
+//---------------------------------------------------------------------------
+//
+// chunkedmesh.hpp/chunkedmesh.cpp
+//
+// Meshes too large to keep in memory, split into spatial chunks that
+// are paged in as the camera comes to them.
+//
+// write_chunked_mesh() does the split, offline (see a2chunk.cpp): the
+// vertices are cut in two across the longest side of their bounding
+// box, at the median, until each piece has at most a given number.
+// Each edge goes to the chunk of its first vertex, which also gets a
+// copy of its second vertex if that lies in another chunk, so every
+// chunk is a mesh on its own with its own bounding box and edge list.
+//
+// The file ("bunny.ply.a2chunks") is a header and a table of the
+// chunks' bounding boxes, counts and places in the file, followed by
+// the chunks.  Each chunk is its x, y and z as doubles and its edges
+// as 32-bit indices into them, the arrays starting on 64-byte
+// boundaries and the chunk on a 64 KiB one, so it can be dropped from
+// memory without touching its neighbours wherever pages are 64 KiB or
+// smaller.  Faces are left out: only edges are drawn.
+//
+// A ChunkPager maps the file.  Each frame the viewer culls the chunks'
+// boxes against the view frustum and request()s the ones in view.
+// Those already in memory come back at once to be drawn; the others
+// are read in by a background thread, which calls back when one is
+// ready so the viewer can draw again.  Chunks in memory are kept in
+// least recently wanted order, and once they take more than the
+// memory budget the ones wanted longest ago are dropped.  Nothing the
+// drawing thread does waits on the disk.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_CHUNKEDMESH_HPP
+#define CS488_CHUNKEDMESH_HPP
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <cstddef>
+#include "algebra.hpp"
+#include "mesh.hpp"
+
+// The chunk file of the mesh file "path"
+std::string chunked_mesh_path(const std::string& path);
+
+// Split "mesh" into chunks of at most "max_vertices" vertices of their
+// own (plus the copies their edges need) and write them to "path".
+// On failure returns false and says why in "error".
+bool write_chunked_mesh(const Mesh& mesh, const std::string& path,
+                        size_t max_vertices, std::string& error);
+
+// True unless the box lies wholly outside one of the planes of the
+// frustum "mvp" (a model-view-projection matrix) maps to clip space
+bool box_in_frustum(const Matrix4x4& mvp, const Point3D& lower,
+                    const Point3D& upper);
+
+struct PagerStats {
+  // Chunks in the file, wanted by the last request() and in memory
+  size_t chunks, wanted, resident;
+  // Bytes of chunks in memory and the most there may be
+  size_t resident_bytes, budget;
+  // Chunks read in and dropped since the file was opened, and waiting
+  // to be read in
+  size_t loads, evictions, queued;
+};
+
+class ChunkPager {
+public:
+  ChunkPager();
+  ~ChunkPager();
+
+  // Map the chunk file "path" and start the paging thread.  On failure
+  // returns false and says why in "error".
+  bool open(const std::string& path, std::string& error);
+  void close();
+  bool is_open() const
+  {
+    return m_file != 0;
+  }
+
+  // The most chunk data to keep in memory (256 MiB by default).  A
+  // chunk larger than this on its own is never read in.
+  void set_budget(size_t bytes);
+  // Called from the paging thread each time a chunk has been read in
+  void set_on_paged(const std::function<void()>& on_paged);
+
+  size_t chunks() const
+  {
+    return m_chunks.size();
+  }
+  // The bounding box of the whole mesh
+  const Point3D& lower() const
+  {
+    return m_lower;
+  }
+  const Point3D& upper() const
+  {
+    return m_upper;
+  }
+
+  // Append to "visible" the chunks whose boxes are in any of the
+  // frusta in "mvps"
+  void cull(const std::vector<Matrix4x4>& mvps,
+            std::vector<unsigned>& visible) const;
+
+  // Start a frame wanting the chunks in "wanted", and append to
+  // "ready" the ones among them that are in memory.  The rest are
+  // queued to be read in.  Never waits on the disk.
+  void request(const std::vector<unsigned>& wanted,
+               std::vector<unsigned>& ready);
+  // The mesh of chunk "i".  Only those request() said were ready can
+  // be read without waiting on the disk, until the next request().
+  const Mesh& mesh(unsigned i) const
+  {
+    return m_chunks[i].mesh;
+  }
+
+  PagerStats stats() const;
+
+private:
+  ChunkPager(const ChunkPager&);
+  ChunkPager& operator =(const ChunkPager&);
+
+  struct Chunk {
+    Mesh mesh;
+    // Where it lies in the file
+    size_t offset, bytes;
+    // The last frame it was wanted in
+    unsigned long wanted;
+    bool queued, loading, resident;
+    // Its place in m_lru while resident
+    std::list<unsigned>::iterator lru;
+  };
+
+  void page_in();
+  // Drop least recently wanted chunks not wanted this frame until
+  // "bytes" more fit in the budget.  False if they can't be made to.
+  bool make_room(size_t bytes);
+  void evict(unsigned i);
+
+  std::shared_ptr<const MappedFile> m_file;
+  std::vector<Chunk> m_chunks;
+  Point3D m_lower, m_upper;
+
+  // Everything below is shared with the paging thread
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::thread m_thread;
+  bool m_stopping;
+  std::deque<unsigned> m_queue;
+  // Resident chunks, most recently wanted first
+  std::list<unsigned> m_lru;
+  unsigned long m_frame;
+  size_t m_wanted;
+  size_t m_budget, m_resident_bytes;
+  size_t m_loads, m_evictions;
+  std::function<void()> m_on_paged;
+};
+
+#endif
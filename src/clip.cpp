@@ -0,0 +1,292 @@
+//---------------------------------------------------------------------------
+//
+// clip.hpp/clip.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "clip.hpp"
+#include "algebra.hpp"
+#include <cstring>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CS488_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static void outcodes_scalar(const ClipPlanes& p, size_t count,
+                            const double *x, const double *y,
+                            const double *z, const double *w,
+                            unsigned char *codes)
+{
+  for(size_t i = 0; i < count; ++i) {
+    double wi = w[i];
+    unsigned char c = 0;
+    c |= (x[i] < p.left * wi) ? CLIP_LEFT : 0;
+    c |= (x[i] > p.right * wi) ? CLIP_RIGHT : 0;
+    c |= (y[i] < p.top * wi) ? CLIP_TOP : 0;
+    c |= (y[i] > p.bottom * wi) ? CLIP_BOTTOM : 0;
+    c |= (z[i] < -wi) ? CLIP_NEAR : 0;
+    c |= (z[i] > wi) ? CLIP_FAR : 0;
+    codes[i] = c;
+  }
+}
+
+static void outcodes_scalar_f(const ClipPlanes& planes, size_t count,
+                              const float *x, const float *y,
+                              const float *z, const float *w,
+                              unsigned char *codes)
+{
+  const float l = (float)planes.left, r = (float)planes.right;
+  const float t = (float)planes.top, b = (float)planes.bottom;
+  for(size_t i = 0; i < count; ++i) {
+    float wi = w[i];
+    unsigned char c = 0;
+    c |= (x[i] < l * wi) ? CLIP_LEFT : 0;
+    c |= (x[i] > r * wi) ? CLIP_RIGHT : 0;
+    c |= (y[i] < t * wi) ? CLIP_TOP : 0;
+    c |= (y[i] > b * wi) ? CLIP_BOTTOM : 0;
+    c |= (z[i] < -wi) ? CLIP_NEAR : 0;
+    c |= (z[i] > wi) ? CLIP_FAR : 0;
+    codes[i] = c;
+  }
+}
+
+#ifdef CS488_X86_KERNELS
+
+// A movemask's lane bits spread out to the low bit of one byte per
+// lane, so a plane's bits land in every lane's outcode with one OR
+// instead of a loop over the lanes
+static const uint16_t SPREAD2[4] = { 0x0000, 0x0001, 0x0100, 0x0101 };
+static const uint32_t SPREAD4[16] = {
+  0x00000000, 0x00000001, 0x00000100, 0x00000101,
+  0x00010000, 0x00010001, 0x00010100, 0x00010101,
+  0x01000000, 0x01000001, 0x01000100, 0x01000101,
+  0x01010000, 0x01010001, 0x01010100, 0x01010101
+};
+
+__attribute__((target("sse2")))
+static void outcodes_sse2(const ClipPlanes& p, size_t count,
+                          const double *x, const double *y,
+                          const double *z, const double *w,
+                          unsigned char *codes)
+{
+  const __m128d l = _mm_set1_pd(p.left), r = _mm_set1_pd(p.right);
+  const __m128d t = _mm_set1_pd(p.top), b = _mm_set1_pd(p.bottom);
+  const __m128d zero = _mm_setzero_pd();
+
+  size_t i = 0;
+  for(; i + 2 <= count; i += 2) {
+    __m128d px = _mm_loadu_pd(x + i), py = _mm_loadu_pd(y + i);
+    __m128d pz = _mm_loadu_pd(z + i), pw = _mm_loadu_pd(w + i);
+
+    // Each movemask gives one bit per lane for one plane
+    uint16_t c = SPREAD2[_mm_movemask_pd(_mm_cmplt_pd(px, _mm_mul_pd(l, pw)))];
+    c |= SPREAD2[_mm_movemask_pd(_mm_cmpgt_pd(px, _mm_mul_pd(r, pw)))] << 1;
+    c |= SPREAD2[_mm_movemask_pd(_mm_cmplt_pd(py, _mm_mul_pd(t, pw)))] << 2;
+    c |= SPREAD2[_mm_movemask_pd(_mm_cmpgt_pd(py, _mm_mul_pd(b, pw)))] << 3;
+    c |= SPREAD2[_mm_movemask_pd(
+      _mm_cmplt_pd(pz, _mm_sub_pd(zero, pw)))] << 4;
+    c |= SPREAD2[_mm_movemask_pd(_mm_cmpgt_pd(pz, pw))] << 5;
+    // x86 is little-endian, so lane 0's byte goes first
+    memcpy(codes + i, &c, sizeof(c));
+  }
+
+  outcodes_scalar(p, count - i, x + i, y + i, z + i, w + i, codes + i);
+}
+
+__attribute__((target("avx2")))
+static void outcodes_avx2(const ClipPlanes& p, size_t count,
+                          const double *x, const double *y,
+                          const double *z, const double *w,
+                          unsigned char *codes)
+{
+  const __m256d l = _mm256_set1_pd(p.left), r = _mm256_set1_pd(p.right);
+  const __m256d t = _mm256_set1_pd(p.top), b = _mm256_set1_pd(p.bottom);
+  const __m256d zero = _mm256_setzero_pd();
+
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m256d px = _mm256_loadu_pd(x + i), py = _mm256_loadu_pd(y + i);
+    __m256d pz = _mm256_loadu_pd(z + i), pw = _mm256_loadu_pd(w + i);
+
+    // Four bits (one per lane) per plane
+    uint32_t c = SPREAD4[_mm256_movemask_pd(
+      _mm256_cmp_pd(px, _mm256_mul_pd(l, pw), _CMP_LT_OQ))];
+    c |= SPREAD4[_mm256_movemask_pd(
+      _mm256_cmp_pd(px, _mm256_mul_pd(r, pw), _CMP_GT_OQ))] << 1;
+    c |= SPREAD4[_mm256_movemask_pd(
+      _mm256_cmp_pd(py, _mm256_mul_pd(t, pw), _CMP_LT_OQ))] << 2;
+    c |= SPREAD4[_mm256_movemask_pd(
+      _mm256_cmp_pd(py, _mm256_mul_pd(b, pw), _CMP_GT_OQ))] << 3;
+    c |= SPREAD4[_mm256_movemask_pd(
+      _mm256_cmp_pd(pz, _mm256_sub_pd(zero, pw), _CMP_LT_OQ))] << 4;
+    c |= SPREAD4[_mm256_movemask_pd(_mm256_cmp_pd(pz, pw, _CMP_GT_OQ))] << 5;
+    memcpy(codes + i, &c, sizeof(c));
+  }
+
+  // Back to SSE code (see transform_avx2 in algebra.cpp)
+  _mm256_zeroupper();
+  outcodes_sse2(p, count - i, x + i, y + i, z + i, w + i, codes + i);
+}
+
+// An eight lane movemask spread the same way
+static inline uint64_t spread8(int mask)
+{
+  return SPREAD4[mask & 15] | (uint64_t)SPREAD4[mask >> 4] << 32;
+}
+
+__attribute__((target("sse2")))
+static void outcodes_sse2_f(const ClipPlanes& p, size_t count,
+                            const float *x, const float *y,
+                            const float *z, const float *w,
+                            unsigned char *codes)
+{
+  const __m128 l = _mm_set1_ps((float)p.left);
+  const __m128 r = _mm_set1_ps((float)p.right);
+  const __m128 t = _mm_set1_ps((float)p.top);
+  const __m128 b = _mm_set1_ps((float)p.bottom);
+  const __m128 zero = _mm_setzero_ps();
+
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+    __m128 pz = _mm_loadu_ps(z + i), pw = _mm_loadu_ps(w + i);
+
+    uint32_t c = SPREAD4[_mm_movemask_ps(_mm_cmplt_ps(px, _mm_mul_ps(l, pw)))];
+    c |= SPREAD4[_mm_movemask_ps(_mm_cmpgt_ps(px, _mm_mul_ps(r, pw)))] << 1;
+    c |= SPREAD4[_mm_movemask_ps(_mm_cmplt_ps(py, _mm_mul_ps(t, pw)))] << 2;
+    c |= SPREAD4[_mm_movemask_ps(_mm_cmpgt_ps(py, _mm_mul_ps(b, pw)))] << 3;
+    c |= SPREAD4[_mm_movemask_ps(
+      _mm_cmplt_ps(pz, _mm_sub_ps(zero, pw)))] << 4;
+    c |= SPREAD4[_mm_movemask_ps(_mm_cmpgt_ps(pz, pw))] << 5;
+    memcpy(codes + i, &c, sizeof(c));
+  }
+
+  outcodes_scalar_f(p, count - i, x + i, y + i, z + i, w + i, codes + i);
+}
+
+__attribute__((target("avx2")))
+static void outcodes_avx2_f(const ClipPlanes& p, size_t count,
+                            const float *x, const float *y,
+                            const float *z, const float *w,
+                            unsigned char *codes)
+{
+  const __m256 l = _mm256_set1_ps((float)p.left);
+  const __m256 r = _mm256_set1_ps((float)p.right);
+  const __m256 t = _mm256_set1_ps((float)p.top);
+  const __m256 b = _mm256_set1_ps((float)p.bottom);
+  const __m256 zero = _mm256_setzero_ps();
+
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+    __m256 pz = _mm256_loadu_ps(z + i), pw = _mm256_loadu_ps(w + i);
+
+    uint64_t c = spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(px, _mm256_mul_ps(l, pw), _CMP_LT_OQ)));
+    c |= spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(px, _mm256_mul_ps(r, pw), _CMP_GT_OQ))) << 1;
+    c |= spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(py, _mm256_mul_ps(t, pw), _CMP_LT_OQ))) << 2;
+    c |= spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(py, _mm256_mul_ps(b, pw), _CMP_GT_OQ))) << 3;
+    c |= spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(pz, _mm256_sub_ps(zero, pw), _CMP_LT_OQ))) << 4;
+    c |= spread8(_mm256_movemask_ps(
+      _mm256_cmp_ps(pz, pw, _CMP_GT_OQ))) << 5;
+    memcpy(codes + i, &c, sizeof(c));
+  }
+
+  _mm256_zeroupper();
+  outcodes_sse2_f(p, count - i, x + i, y + i, z + i, w + i, codes + i);
+}
+
+#endif // CS488_X86_KERNELS
+
+void compute_outcodes(const ClipPlanes& planes, size_t count,
+                      const double *x, const double *y, const double *z,
+                      const double *w, unsigned char *codes)
+{
+  switch(transform_kernel()) {
+#ifdef CS488_X86_KERNELS
+  case KERNEL_AVX2:
+    outcodes_avx2(planes, count, x, y, z, w, codes);
+    return;
+  case KERNEL_SSE2:
+    outcodes_sse2(planes, count, x, y, z, w, codes);
+    return;
+#endif
+  default:
+    outcodes_scalar(planes, count, x, y, z, w, codes);
+    return;
+  }
+}
+
+void compute_outcodes(const ClipPlanes& planes, size_t count,
+                      const float *x, const float *y, const float *z,
+                      const float *w, unsigned char *codes)
+{
+  switch(transform_kernel()) {
+#ifdef CS488_X86_KERNELS
+  case KERNEL_AVX2:
+    outcodes_avx2_f(planes, count, x, y, z, w, codes);
+    return;
+  case KERNEL_SSE2:
+    outcodes_sse2_f(planes, count, x, y, z, w, codes);
+    return;
+#endif
+  default:
+    outcodes_scalar_f(planes, count, x, y, z, w, codes);
+    return;
+  }
+}
+
+bool clip_segment(const ClipPlanes& planes, double a[4], double b[4])
+{
+  // Signed distances to each plane, positive inside
+  const double da[6] = {
+    a[0] - planes.left * a[3], planes.right * a[3] - a[0],
+    a[1] - planes.top * a[3], planes.bottom * a[3] - a[1],
+    a[2] + a[3], a[3] - a[2]
+  };
+  const double db[6] = {
+    b[0] - planes.left * b[3], planes.right * b[3] - b[0],
+    b[1] - planes.top * b[3], planes.bottom * b[3] - b[1],
+    b[2] + b[3], b[3] - b[2]
+  };
+
+  // Liang-Barsky in four dimensions
+  double t0 = 0.0, t1 = 1.0;
+  for(int k = 0; k < 6; ++k) {
+    if(da[k] < 0 && db[k] < 0) {
+      return false;
+    }
+    if(da[k] < 0) {
+      double t = da[k] / (da[k] - db[k]);
+      if(t > t0) {
+        t0 = t;
+      }
+    } else if(db[k] < 0) {
+      double t = da[k] / (da[k] - db[k]);
+      if(t < t1) {
+        t1 = t;
+      }
+    }
+  }
+  if(t0 > t1) {
+    return false;
+  }
+
+  double na[4], nb[4];
+  for(int k = 0; k < 4; ++k) {
+    double d = b[k] - a[k];
+    na[k] = a[k] + t0 * d;
+    nb[k] = a[k] + t1 * d;
+  }
+  for(int k = 0; k < 4; ++k) {
+    a[k] = na[k];
+    b[k] = nb[k];
+  }
+  return true;
+}
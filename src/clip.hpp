@@ -0,0 +1,54 @@
+//---------------------------------------------------------------------------
+//
+// clip.hpp/clip.cpp
+//
+// Clipping in homogeneous clip space, before the perspective divide.
+// A point (x, y, z, w) is inside when
+//
+//     left * w <= x <= right * w
+//     top * w <= y <= bottom * w
+//     -w <= z <= w
+//
+// where left/right/top/bottom are the viewport walls in normalized
+// device coordinates.  Points behind the eye fail the near test, so no
+// divide by a zero or negative w ever happens.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_CLIP_HPP
+#define CS488_CLIP_HPP
+
+#include <cstddef>
+
+// One outcode bit per plane
+enum {
+  CLIP_LEFT = 1,
+  CLIP_RIGHT = 2,
+  CLIP_TOP = 4,
+  CLIP_BOTTOM = 8,
+  CLIP_NEAR = 16,
+  CLIP_FAR = 32
+};
+
+// The x and y walls in normalized device coordinates (y down, as on
+// screen: top < bottom).
+struct ClipPlanes {
+  double left, right, top, bottom;
+};
+
+// Compute the outcode of each of "count" clip-space points.  Runs on
+// the same SIMD width transform_points() is currently using.
+void compute_outcodes(const ClipPlanes& planes, size_t count,
+                      const double *x, const double *y, const double *z,
+                      const double *w, unsigned char *codes);
+// The same for single precision points, tested against the walls
+// rounded to single precision
+void compute_outcodes(const ClipPlanes& planes, size_t count,
+                      const float *x, const float *y, const float *z,
+                      const float *w, unsigned char *codes);
+
+// Clip the clip-space segment a-b against all six planes.  On success
+// returns true and overwrites a and b with the visible part.
+bool clip_segment(const ClipPlanes& planes, double a[4], double b[4]);
+
+#endif
@@ -0,0 +1,262 @@
+//---------------------------------------------------------------------------
+//
+// depthbuffer.hpp/depthbuffer.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "depthbuffer.hpp"
+#include "threadpool.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Tiles are TILE x TILE cells
+static const int TILE = 32;
+// Triangles binned by a thread at a time
+static const size_t FACE_GRAIN = 16384;
+// How much farther than the surface, as a fraction of its depth, a
+// point must be to be hidden.  Lines lying on a curved surface can be
+// a little behind the plane through the samples around them.
+static const double DEPTH_BIAS = 0.005;
+// How far past an edge, in cells, a triangle's rows reach
+static const double SPAN_SLACK = 1e-6;
+
+DepthBuffer::DepthBuffer()
+  : m_x(0)
+  , m_y(0)
+  , m_cols(0)
+  , m_rows(0)
+  , m_tiles_x(0)
+  , m_tiles_y(0)
+  , m_depth(0)
+{
+}
+
+void DepthBuffer::reset(int x, int y, int width, int height, Arena& arena)
+{
+  m_x = x;
+  m_y = y;
+  m_cols = std::max(0, (width + CELL - 1) / CELL);
+  m_rows = std::max(0, (height + CELL - 1) / CELL);
+  m_tiles_x = (m_cols + TILE - 1) / TILE;
+  m_tiles_y = (m_rows + TILE - 1) / TILE;
+  const size_t cells = (size_t)m_cols * m_rows;
+  m_depth = arena.allocate<float>(cells);
+  std::fill(m_depth, m_depth + cells, 0.0f);
+}
+
+bool DepthBuffer::cell_box(size_t i, const unsigned *faces, const float *px,
+                           const float *py, const float *q,
+                           CellBox& box) const
+{
+  const unsigned a = faces[3 * i], b = faces[3 * i + 1], c = faces[3 * i + 2];
+  if(!(q[a] > 0 && q[b] > 0 && q[c] > 0)) {
+    return false;
+  }
+  const double x[3] = { px[a], px[b], px[c] };
+  const double y[3] = { py[a], py[b], py[c] };
+  const double lo_x = (std::min(std::min(x[0], x[1]), x[2]) - m_x) / CELL;
+  const double hi_x = (std::max(std::max(x[0], x[1]), x[2]) - m_x) / CELL;
+  const double lo_y = (std::min(std::min(y[0], y[1]), y[2]) - m_y) / CELL;
+  const double hi_y = (std::max(std::max(y[0], y[1]), y[2]) - m_y) / CELL;
+
+  // The centres, at i + 0.5, inside the triangle's bounds and the
+  // buffer's
+  const double x0 = std::max(std::ceil(lo_x - 0.5), 0.0);
+  const double x1 = std::min(std::floor(hi_x - 0.5), m_cols - 1.0);
+  const double y0 = std::max(std::ceil(lo_y - 0.5), 0.0);
+  const double y1 = std::min(std::floor(hi_y - 0.5), m_rows - 1.0);
+  if(!(x0 <= x1 && y0 <= y1)) {
+    return false;
+  }
+  box.x0 = (uint16_t)x0;
+  box.x1 = (uint16_t)x1;
+  box.y0 = (uint16_t)y0;
+  box.y1 = (uint16_t)y1;
+  return true;
+}
+
+// Each cell centre the triangle covers, edges included, takes the
+// triangle's 1/w there if it is nearer.  The weights and 1/w are linear
+// along a row, so each row's covered cells are found from where the
+// three weights cross 0, and only those are visited.
+void DepthBuffer::raster_tile(size_t tile, const unsigned *faces,
+                              const float *px, const float *py,
+                              const float *q, const CellBox *boxes,
+                              const unsigned *list, size_t first,
+                              size_t last)
+{
+  const int tx0 = (int)(tile % m_tiles_x) * TILE;
+  const int ty0 = (int)(tile / m_tiles_x) * TILE;
+  const int tx1 = std::min(tx0 + TILE, m_cols) - 1;
+  const int ty1 = std::min(ty0 + TILE, m_rows) - 1;
+
+  for(size_t k = first; k < last; ++k) {
+    const size_t i = list[k];
+    const CellBox& box = boxes[i];
+    const int x0 = std::max<int>(box.x0, tx0), x1 = std::min<int>(box.x1, tx1);
+    const int y0 = std::max<int>(box.y0, ty0), y1 = std::min<int>(box.y1, ty1);
+
+    const unsigned a = faces[3 * i], b = faces[3 * i + 1], c = faces[3 * i + 2];
+    const double ax = (px[a] - m_x) / CELL, ay = (py[a] - m_y) / CELL;
+    const double bx = (px[b] - m_x) / CELL, by = (py[b] - m_y) / CELL;
+    const double cx = (px[c] - m_x) / CELL, cy = (py[c] - m_y) / CELL;
+    const double area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    if(area == 0) {
+      continue;
+    }
+    // Facing either way, the weights are kept positive inside
+    const double sign = area > 0 ? 1 : -1;
+    const double scale = 1 / area;
+    const double qa = q[a] * scale, qb = q[b] * scale, qc = q[c] * scale;
+
+    // Weight of a is the edge function of b-c, and so on.  At the
+    // centre of cell x of row y each is base[e] + down[e] y + step[e] x.
+    const double step[3] = {
+      sign * (by - cy), sign * (cy - ay), sign * (ay - by)
+    };
+    const double down[3] = {
+      sign * (cx - bx), sign * (ax - cx), sign * (bx - ax)
+    };
+    const double base[3] = {
+      sign * ((cx - bx) * (0.5 - by) - (cy - by) * (0.5 - bx)),
+      sign * ((ax - cx) * (0.5 - cy) - (ay - cy) * (0.5 - cx)),
+      sign * ((bx - ax) * (0.5 - ay) - (by - ay) * (0.5 - ax))
+    };
+    const double inverse[3] = {
+      step[0] != 0 ? -1 / step[0] : 0, step[1] != 0 ? -1 / step[1] : 0,
+      step[2] != 0 ? -1 / step[2] : 0
+    };
+    // And 1/w is sign times their sum weighted by qa, qb and qc
+    const double q0 = sign * (qa * base[0] + qb * base[1] + qc * base[2]);
+    const double dqy = sign * (qa * down[0] + qb * down[1] + qc * down[2]);
+    const double dq = sign * (qa * step[0] + qb * step[1] + qc * step[2]);
+
+    for(int y = y0; y <= y1; ++y) {
+      // Between where the weights rising along the row cross 0 and
+      // where the falling ones do, widened by SPAN_SLACK so a centre on
+      // an edge two triangles share is covered by at least one of them
+      // whichever way rounding goes
+      double lo = x0 - SPAN_SLACK, hi = x1 + SPAN_SLACK;
+      for(int e = 0; e < 3; ++e) {
+        const double weight = base[e] + down[e] * y;
+        if(step[e] > 0) {
+          lo = std::max(lo, weight * inverse[e]);
+        } else if(step[e] < 0) {
+          hi = std::min(hi, weight * inverse[e]);
+        } else if(weight < -SPAN_SLACK) {
+          hi = lo - 1;
+        }
+      }
+      lo -= SPAN_SLACK;
+      hi += SPAN_SLACK;
+      if(!(lo <= hi)) {
+        continue;
+      }
+      // Both are within a cell of [x0, x1], so above -1
+      int first_x = (int)(lo + 1), last_x = (int)(hi + 1) - 1;
+      if(first_x - 1 >= lo) {
+        --first_x;
+      }
+
+      const double row_q = q0 + dqy * y;
+      float *row = m_depth + (size_t)y * m_cols;
+      for(int x = first_x; x <= last_x; ++x) {
+        row[x] = std::max(row[x], (float)(row_q + dq * x));
+      }
+    }
+  }
+}
+
+void DepthBuffer::draw(size_t count, const unsigned *faces, const float *px,
+                       const float *py, const float *q, Arena& arena,
+                       unsigned threads)
+{
+  if(count == 0 || m_cols == 0 || m_rows == 0) {
+    return;
+  }
+  ThreadPool& pool = ThreadPool::shared();
+  const size_t ntiles = (size_t)m_tiles_x * m_tiles_y;
+  const size_t nchunks = (count + FACE_GRAIN - 1) / FACE_GRAIN;
+
+  // Each chunk's count of triangles in each tile, and every triangle's
+  // cells
+  CellBox *boxes = arena.allocate<CellBox>(count);
+  size_t *counts = arena.allocate<size_t>(nchunks * ntiles);
+  std::fill(counts, counts + nchunks * ntiles, (size_t)0);
+  pool.parallel_for(count, FACE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    size_t *tiles = counts + begin / FACE_GRAIN * ntiles;
+    for(size_t i = begin; i < end; ++i) {
+      CellBox& box = boxes[i];
+      if(!cell_box(i, faces, px, py, q, box)) {
+        box.x0 = 1;
+        box.x1 = 0;
+        continue;
+      }
+      for(int ty = box.y0 / TILE; ty <= box.y1 / TILE; ++ty) {
+        for(int tx = box.x0 / TILE; tx <= box.x1 / TILE; ++tx) {
+          ++tiles[ty * m_tiles_x + tx];
+        }
+      }
+    }
+  }, threads);
+
+  // A tile's list is its triangles chunk by chunk, so in face order;
+  // each count becomes where its chunk writes next in the tile's list
+  size_t *starts = arena.allocate<size_t>(ntiles + 1);
+  size_t total = 0;
+  for(size_t t = 0; t < ntiles; ++t) {
+    starts[t] = total;
+    for(size_t c = 0; c < nchunks; ++c) {
+      const size_t n = counts[c * ntiles + t];
+      counts[c * ntiles + t] = total;
+      total += n;
+    }
+  }
+  starts[ntiles] = total;
+
+  unsigned *list = arena.allocate<unsigned>(total);
+  pool.parallel_for(count, FACE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    size_t *next = counts + begin / FACE_GRAIN * ntiles;
+    for(size_t i = begin; i < end; ++i) {
+      const CellBox& box = boxes[i];
+      if(box.x0 > box.x1) {
+        continue;
+      }
+      for(int ty = box.y0 / TILE; ty <= box.y1 / TILE; ++ty) {
+        for(int tx = box.x0 / TILE; tx <= box.x1 / TILE; ++tx) {
+          list[next[ty * m_tiles_x + tx]++] = (unsigned)i;
+        }
+      }
+    }
+  }, threads);
+
+  // Tiles are handed out one at a time since how many triangles they
+  // hold varies a lot
+  pool.parallel_for(ntiles, 1, [&](size_t tile, size_t, unsigned) {
+    raster_tile(tile, faces, px, py, q, boxes, list, starts[tile],
+                starts[tile + 1]);
+  }, threads);
+}
+
+bool DepthBuffer::hidden(double x, double y, double q) const
+{
+  if(m_cols == 0 || m_rows == 0) {
+    return false;
+  }
+  // The cell centres either side on each axis, clamped to the buffer
+  const double fx = std::min(std::max((x - m_x) / CELL - 0.5, 0.0),
+                             m_cols - 1.0);
+  const double fy = std::min(std::max((y - m_y) / CELL - 0.5, 0.0),
+                             m_rows - 1.0);
+  const int x0 = (int)fx, y0 = (int)fy;
+  const int x1 = std::min(x0 + 1, m_cols - 1);
+  const int y1 = std::min(y0 + 1, m_rows - 1);
+  const float *row0 = m_depth + (size_t)y0 * m_cols;
+  const float *row1 = m_depth + (size_t)y1 * m_cols;
+  const double farthest = std::min(std::min(row0[x0], row0[x1]),
+                                   std::min(row1[x0], row1[x1]));
+  return q < farthest * (1 - DEPTH_BIAS);
+}
@@ -0,0 +1,80 @@
+//---------------------------------------------------------------------------
+//
+// depthbuffer.hpp/depthbuffer.cpp
+//
+// A coarse software depth buffer for hidden-line drawing.  The mesh's
+// triangles are rasterized into cells of CELL x CELL pixels, each
+// keeping the nearest surface sampled at its centre, and points of the
+// lines are then tested against it.
+//
+// Depth is kept as 1/w, which unlike w varies linearly across the
+// screen, so it can be interpolated over a triangle and along a line
+// from their corners alone; larger is nearer and 0 is nothing drawn.
+//
+// Drawing is tile-parallel: the triangles are binned by the tiles of
+// TILE x TILE cells their cells fall in (each chunk of triangles
+// counts its own, a prefix sum gives every chunk its slots in every
+// tile's list, and the chunks fill them), then the tiles rasterize
+// their lists on the shared pool with no two threads writing a cell.
+// A point counts as hidden only when it lies behind all four cell
+// centres around it, so a line lying on the surface is never hidden
+// by the surface's own samples, and neither is one next to a
+// silhouette, where some of the four see past it.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_DEPTHBUFFER_HPP
+#define CS488_DEPTHBUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "arena.hpp"
+
+class DepthBuffer {
+public:
+  // Pixels per cell, across and down
+  static const int CELL = 2;
+
+  DepthBuffer();
+
+  // Cover the width by height pixels at x, y (in the window) with
+  // empty cells, from "arena"
+  void reset(int x, int y, int width, int height, Arena& arena);
+
+  // Draw the "count" triangles faces[3 i], faces[3 i + 1], faces[3 i +
+  // 2] of vertices at window pixel (px, py) with 1/w "q".  Triangles
+  // with a vertex whose q isn't above 0 (behind the eye, or not
+  // transformed) are left out.  Scratch comes from "arena"; the work is
+  // spread over up to "threads" threads of the shared pool (0 for all
+  // of them).
+  void draw(size_t count, const unsigned *faces, const float *px,
+            const float *py, const float *q, Arena& arena,
+            unsigned threads);
+
+  // Whether the point at window pixel (x, y) with 1/w "q" is farther
+  // than everything drawn at the four cell centres around it, by more
+  // than a small fraction of its depth
+  bool hidden(double x, double y, double q) const;
+
+private:
+  // The cells a triangle's samples fall in, first and last on each
+  // axis; first beyond last if none
+  struct CellBox {
+    uint16_t x0, y0, x1, y1;
+  };
+
+  // Find the cells of triangle i, in cell coordinates
+  bool cell_box(size_t i, const unsigned *faces, const float *px,
+                const float *py, const float *q, CellBox& box) const;
+  void raster_tile(size_t tile, const unsigned *faces, const float *px,
+                   const float *py, const float *q, const CellBox *boxes,
+                   const unsigned *list, size_t first, size_t last);
+
+  int m_x, m_y;
+  int m_cols, m_rows;
+  int m_tiles_x, m_tiles_y;
+  // m_cols * m_rows cells, a row at a time, each the largest 1/w drawn
+  float *m_depth;
+};
+
+#endif
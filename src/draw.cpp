@@ -19,18 +19,71 @@
 
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <vector>
 
 #include "draw.hpp"
 
+// One vertex of the frame's line batch, laid out for GL_C4UB_V2F
+struct BatchVertex {
+  GLubyte r, g, b, a;
+  GLfloat x, y;
+};
+
+// The batch keeps its storage between frames, so steady-state frames
+// don't allocate.
+static std::vector<BatchVertex> batch;
+static GLubyte current[4] = { 255, 255, 255, 255 };
+
+static inline GLubyte to_byte(double c)
+{
+  if(c <= 0.0) {
+    return 0;
+  }
+  if(c >= 1.0) {
+    return 255;
+  }
+  return (GLubyte)(c * 255.0 + 0.5);
+}
+
+static inline void add_vertex(const GLubyte *rgba, double x, double y)
+{
+  BatchVertex v;
+  v.r = rgba[0];
+  v.g = rgba[1];
+  v.b = rgba[2];
+  v.a = rgba[3];
+  v.x = (GLfloat)x;
+  v.y = (GLfloat)y;
+  batch.push_back(v);
+}
+
 void draw_line(const Point2D& p, const Point2D& q)
 {
-  glVertex2d(p[0], p[1]);
-  glVertex2d(q[0], q[1]);
+  add_vertex(current, p[0], p[1]);
+  add_vertex(current, q[0], q[1]);
+}
+
+void draw_lines(const double *points, const float *colours, size_t count)
+{
+  batch.reserve(batch.size() + 2 * count);
+
+  GLubyte rgba[4] = { current[0], current[1], current[2], 255 };
+  for(size_t i = 0; i < count; ++i) {
+    if(colours) {
+      rgba[0] = to_byte(colours[3 * i]);
+      rgba[1] = to_byte(colours[3 * i + 1]);
+      rgba[2] = to_byte(colours[3 * i + 2]);
+    }
+    add_vertex(rgba, points[4 * i], points[4 * i + 1]);
+    add_vertex(rgba, points[4 * i + 2], points[4 * i + 3]);
+  }
 }
 
 void set_colour(const Colour& col)
 {
-  glColor3f((float)col.R(), (float)col.G(), (float)col.B());
+  current[0] = to_byte(col.R());
+  current[1] = to_byte(col.G());
+  current[2] = to_byte(col.B());
 }
 
 void draw_init(int width, int height)
@@ -54,10 +107,18 @@ void draw_init(int width, int height)
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   glLineWidth(1.0);
 
-  glBegin(GL_LINES);
+  batch.clear();
 }
 
 void draw_complete()
 {
-  glEnd();
+  if(batch.empty()) {
+    return;
+  }
+
+  // Submit the whole frame with a single draw call
+  glInterleavedArrays(GL_C4UB_V2F, 0, &batch[0]);
+  glDrawArrays(GL_LINES, 0, (GLsizei)batch.size());
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -16,11 +16,21 @@
 #ifndef CS488_DRAW_HPP
 #define CS488_DRAW_HPP
 
+#include <cstddef>
 #include "algebra.hpp"
 
-// Draw a line -- call draw_init first!
+// Lines are batched and submitted to OpenGL together when
+// draw_complete is called, so nothing appears before then.
+
+// Draw a line -- call draw_init first!  The line uses the colour most
+// recently passed to set_colour.
 void draw_line(const Point2D& p, const Point2D& q);
 
+// Draw "count" lines at once.  "points" holds four values per line
+// (x1, y1, x2, y2) and "colours" three per line (r, g, b).  If
+// "colours" is null, every line uses the current colour.
+void draw_lines(const double *points, const float *colours, size_t count);
+
 // Set the current colour
 void set_colour(const Colour& col);
 
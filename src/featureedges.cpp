@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------------
+//
+// featureedges.hpp/featureedges.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "featureedges.hpp"
+#include "threadpool.hpp"
+#include <cmath>
+
+// Faces and edges handed to a thread at a time
+static const size_t FACE_GRAIN = 16384;
+static const size_t EDGE_GRAIN = 16384;
+
+// The faces with an area around edge a-b, up to three (a third makes
+// it a feature whatever the rest are), and whether each runs from a to
+// b, going round its corners
+static size_t edge_faces(unsigned a, unsigned b, const unsigned *faces,
+                         const unsigned *starts, const unsigned *around,
+                         unsigned found[3], bool forward[3])
+{
+  size_t n = 0;
+  for(unsigned k = starts[a]; k < starts[a + 1] && n < 3; ++k) {
+    const unsigned f = around[k];
+    const unsigned *corners = faces + 3 * f;
+    for(int j = 0; j < 3; ++j) {
+      if(corners[j] != a) {
+        continue;
+      }
+      const unsigned next = corners[(j + 1) % 3];
+      if(next == b || corners[(j + 2) % 3] == b) {
+        found[n] = f;
+        forward[n] = next == b;
+        ++n;
+      }
+      break;
+    }
+  }
+  return n;
+}
+
+FeatureEdges::FeatureEdges()
+  : m_feature_count(0)
+{
+}
+
+void FeatureEdges::build(const Mesh& mesh, double crease_angle,
+                         unsigned threads)
+{
+  ThreadPool& pool = ThreadPool::shared();
+  const size_t count = mesh.num_vertices();
+  const size_t nfaces = mesh.num_faces();
+  const size_t nedges = mesh.num_edges();
+  const unsigned *faces = mesh.faces.data();
+  const unsigned *edges = mesh.edges.data();
+
+  // Each face's plane
+  m_centre = mesh.lower + 0.5 * (mesh.upper - mesh.lower);
+  m_planes.resize(4 * nfaces);
+  pool.parallel_for(nfaces, FACE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    for(size_t f = begin; f < end; ++f) {
+      const Point3D a = mesh.vertex(faces[3 * f]);
+      const Vector3D normal = (mesh.vertex(faces[3 * f + 1]) - a).cross(
+        mesh.vertex(faces[3 * f + 2]) - a);
+      const Vector3D offset = a - m_centre;
+      float *plane = &m_planes[4 * f];
+      plane[0] = (float)normal[0];
+      plane[1] = (float)normal[1];
+      plane[2] = (float)normal[2];
+      plane[3] = (float)normal.dot(offset);
+    }
+  }, threads);
+
+  // The faces with an area around each vertex, in face order: counted
+  // per vertex, a prefix sum over the counts, then filled in
+  std::vector<unsigned> starts(count + 1, 0);
+  for(size_t f = 0; f < nfaces; ++f) {
+    const float *plane = &m_planes[4 * f];
+    if(plane[0] != 0 || plane[1] != 0 || plane[2] != 0) {
+      for(int k = 0; k < 3; ++k) {
+        ++starts[faces[3 * f + k] + 1];
+      }
+    }
+  }
+  for(size_t v = 0; v < count; ++v) {
+    starts[v + 1] += starts[v];
+  }
+  std::vector<unsigned> around(starts[count]);
+  std::vector<unsigned> next(starts.begin(), starts.end() - 1);
+  for(size_t f = 0; f < nfaces; ++f) {
+    const float *plane = &m_planes[4 * f];
+    if(plane[0] != 0 || plane[1] != 0 || plane[2] != 0) {
+      for(int k = 0; k < 3; ++k) {
+        around[next[faces[3 * f + k]]++] = (unsigned)f;
+      }
+    }
+  }
+
+  // Sort the edges, each chunk counting its features
+  const double limit = std::cos(crease_angle * M_PI / 180);
+  const size_t nchunks = (nedges + EDGE_GRAIN - 1) / EDGE_GRAIN;
+  std::vector<size_t> counts(nchunks);
+  m_kinds.resize(nedges);
+  m_faces.resize(2 * nedges);
+  pool.parallel_for(nedges, EDGE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    size_t features = 0;
+    for(size_t e = begin; e < end; ++e) {
+      unsigned found[3];
+      bool forward[3];
+      const size_t n = edge_faces(edges[2 * e], edges[2 * e + 1], faces,
+                                  starts.data(), around.data(), found,
+                                  forward);
+      m_kinds[e] = EDGE_FEATURE;
+      if(n == 2) {
+        const float *p = &m_planes[4 * found[0]];
+        const float *q = &m_planes[4 * found[1]];
+        const bool flipped = forward[0] == forward[1];
+        const double dot =
+          ((double)p[0] * q[0] + (double)p[1] * q[1] + (double)p[2] * q[2]) *
+          (flipped ? -1 : 1);
+        const double lengths = std::sqrt(
+          ((double)p[0] * p[0] + (double)p[1] * p[1] + (double)p[2] * p[2]) *
+          ((double)q[0] * q[0] + (double)q[1] * q[1] + (double)q[2] * q[2]));
+        if(dot >= limit * lengths) {
+          m_kinds[e] = flipped ? EDGE_FLIPPED : EDGE_SMOOTH;
+          m_faces[2 * e] = found[0];
+          m_faces[2 * e + 1] = found[1];
+        }
+      }
+      features += m_kinds[e] == EDGE_FEATURE;
+    }
+    counts[begin / EDGE_GRAIN] = features;
+  }, threads);
+
+  m_feature_count = 0;
+  for(size_t c = 0; c < nchunks; ++c) {
+    m_feature_count += counts[c];
+  }
+}
+
+size_t FeatureEdges::select(const Point3D& eye, unsigned char *drawn,
+                            Arena& arena, unsigned threads) const
+{
+  ThreadPool& pool = ThreadPool::shared();
+  const size_t nfaces = m_planes.size() / 4;
+
+  // Which faces are turned towards the eye
+  const Vector3D offset = eye - m_centre;
+  const float ex = (float)offset[0], ey = (float)offset[1];
+  const float ez = (float)offset[2];
+  unsigned char *front = arena.allocate<unsigned char>(nfaces);
+  pool.parallel_for(nfaces, FACE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    for(size_t f = begin; f < end; ++f) {
+      const float *plane = &m_planes[4 * f];
+      front[f] = plane[0] * ex + plane[1] * ey + plane[2] * ez > plane[3];
+    }
+  }, threads);
+
+  // Then which smooth edges have one face turned each way
+  const size_t nedges = m_kinds.size();
+  const size_t nchunks = (nedges + EDGE_GRAIN - 1) / EDGE_GRAIN;
+  size_t *counts = arena.allocate<size_t>(nchunks);
+  pool.parallel_for(nedges, EDGE_GRAIN,
+                    [&](size_t begin, size_t end, unsigned) {
+    size_t silhouettes = 0;
+    for(size_t e = begin; e < end; ++e) {
+      const unsigned char kind = m_kinds[e];
+      if(kind == EDGE_FEATURE) {
+        drawn[e] = 1;
+        continue;
+      }
+      const unsigned char on = front[m_faces[2 * e]] ^
+        front[m_faces[2 * e + 1]] ^ (kind == EDGE_FLIPPED);
+      drawn[e] = on;
+      silhouettes += on;
+    }
+    counts[begin / EDGE_GRAIN] = silhouettes;
+  }, threads);
+
+  size_t silhouettes = 0;
+  for(size_t c = 0; c < nchunks; ++c) {
+    silhouettes += counts[c];
+  }
+  return silhouettes;
+}
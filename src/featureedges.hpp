@@ -0,0 +1,89 @@
+//---------------------------------------------------------------------------
+//
+// featureedges.hpp/featureedges.cpp
+//
+// Feature edges and silhouettes of a triangle mesh.  Most edges of a
+// dense model lie on nearly flat stretches of surface and add nothing
+// to its outline; the ones that matter are its boundaries, its creases
+// and, depending on where it is seen from, its silhouette.
+//
+// build() finds the faces around each edge and sorts the edges once per
+// mesh: an edge with one face is a boundary, one whose two faces meet
+// at more than the crease angle is a crease, and one with no faces (a
+// wireframe-only mesh) or more than two is kept as well, there being
+// no surface to judge it by.  That leaves the smooth edges, each with
+// its pair of faces.
+//
+// select() then marks, for one eye position, the features and those
+// smooth edges on the silhouette: the ones with one face turned towards
+// the eye and the other away.  Each face's plane is kept, so the test
+// is a dot product per face, and then a lookup of the two faces of
+// each edge.  The planes are kept in single precision, relative to the
+// centre of the mesh's box so they stay accurate far from the origin,
+// which halves what the test reads.  Faces wound the opposite way to
+// their neighbour across an edge are allowed for.
+//
+// Both passes run on the shared thread pool.  Edges are matched to
+// faces by the vertex they start at, through a table of the faces
+// around each vertex, so the result doesn't depend on the thread count.
+// Fan diagonals, which aren't in Mesh::edges, are ignored, and faces
+// with no area are left out.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_FEATUREEDGES_HPP
+#define CS488_FEATUREEDGES_HPP
+
+#include <vector>
+#include <cstddef>
+#include "algebra.hpp"
+#include "arena.hpp"
+#include "mesh.hpp"
+
+class FeatureEdges {
+public:
+  FeatureEdges();
+
+  // Sort the edges of "mesh", creases being edges whose faces' normals
+  // are more than "crease_angle" degrees apart.  The work is spread
+  // over up to "threads" threads of the shared pool (0 for all of
+  // them).
+  void build(const Mesh& mesh, double crease_angle, unsigned threads);
+
+  // Edges of the mesh last built, and features among them
+  size_t edges() const
+  {
+    return m_kinds.size();
+  }
+  size_t features() const
+  {
+    return m_feature_count;
+  }
+
+  // Set drawn[e] to 1 for each feature edge and each smooth edge on
+  // the silhouette seen from "eye", in model space, and to 0 for the
+  // rest.  Scratch comes from "arena".  Returns how many silhouette
+  // edges there were.
+  size_t select(const Point3D& eye, unsigned char *drawn, Arena& arena,
+                unsigned threads) const;
+
+private:
+  // What an edge is; a flipped smooth edge's faces are wound the same
+  // way round it, so one of them faces backwards
+  enum {
+    EDGE_FEATURE,
+    EDGE_SMOOTH,
+    EDGE_FLIPPED
+  };
+
+  // a x + b y + c z = d of each face, relative to m_centre, (a, b, c)
+  // its unnormalized normal
+  Point3D m_centre;
+  std::vector<float> m_planes;
+  // Per edge its kind and, if smooth, the faces either side of it
+  std::vector<unsigned char> m_kinds;
+  std::vector<unsigned> m_faces;
+  size_t m_feature_count;
+};
+
+#endif
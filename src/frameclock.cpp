@@ -0,0 +1,54 @@
+//---------------------------------------------------------------------------
+//
+// frameclock.hpp/frameclock.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "frameclock.hpp"
+#include "profile.hpp"
+
+FrameClock::FrameClock(double refresh_hz)
+  : m_interval_ns(1e9 / refresh_hz)
+  , m_last_frame_ns(0)
+  , m_pending(false)
+  , m_events(0)
+  , m_last_events(0)
+  , m_total_events(0)
+  , m_frames(0)
+{
+}
+
+bool FrameClock::add_event()
+{
+  ++m_events;
+  if(m_pending) {
+    return false;
+  }
+  m_pending = true;
+  return true;
+}
+
+unsigned FrameClock::delay_ms() const
+{
+  double wait = m_last_frame_ns + m_interval_ns - now_ns();
+  if(wait <= 0) {
+    return 0;
+  }
+  // Round up so the frame never comes early
+  return (unsigned)(wait / 1e6) + 1;
+}
+
+void FrameClock::frame_done()
+{
+  m_last_frame_ns = now_ns();
+  m_pending = false;
+  m_last_events = m_events;
+  m_total_events += m_events;
+  m_events = 0;
+  ++m_frames;
+}
+
+double FrameClock::average_events() const
+{
+  return m_frames ? (double)m_total_events / m_frames : 0.0;
+}
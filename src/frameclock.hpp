@@ -0,0 +1,54 @@
+//---------------------------------------------------------------------------
+//
+// frameclock.hpp/frameclock.cpp
+//
+// Paces redraws driven by input.  Events only mark a frame as wanted;
+// the frame itself is produced at most once per display refresh, and
+// the clock counts how many events each frame absorbed.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_FRAMECLOCK_HPP
+#define CS488_FRAMECLOCK_HPP
+
+class FrameClock {
+public:
+  explicit FrameClock(double refresh_hz = 60);
+
+  // Note an input event.  Returns true if no frame was pending yet, in
+  // which case the caller should schedule one delay_ms() from now.
+  bool add_event();
+
+  // Milliseconds until the next frame may be presented
+  unsigned delay_ms() const;
+
+  // The pending frame was produced: reset the event count.
+  void frame_done();
+
+  bool pending() const
+  {
+    return m_pending;
+  }
+
+  // Events absorbed by the last frame, and on average over all frames
+  unsigned last_events() const
+  {
+    return m_last_events;
+  }
+  double average_events() const;
+  unsigned long frames() const
+  {
+    return m_frames;
+  }
+
+private:
+  double m_interval_ns;
+  double m_last_frame_ns;
+  bool m_pending;
+  unsigned m_events;
+  unsigned m_last_events;
+  unsigned long m_total_events;
+  unsigned long m_frames;
+};
+
+#endif
@@ -0,0 +1,265 @@
+//---------------------------------------------------------------------------
+//
+// inputlog.hpp/inputlog.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "inputlog.hpp"
+#include "mappedfile.hpp"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+static const char MAGIC[4] = { 'A', '2', 'I', 'N' };
+static const unsigned char VERSION = 1;
+
+InputRecorder::InputRecorder()
+  : m_start_ns(0)
+  , m_last_us(0)
+{
+}
+
+bool InputRecorder::open(const std::string& path, std::string& error)
+{
+  close();
+  m_file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+  if(!m_file) {
+    error = path + ": cannot open for writing";
+    return false;
+  }
+  m_file.write(MAGIC, sizeof(MAGIC));
+  m_file.put((char)VERSION);
+  m_start_ns = now_ns();
+  m_last_us = 0;
+  return true;
+}
+
+void InputRecorder::close()
+{
+  if(m_file.is_open()) {
+    m_file.close();
+  }
+}
+
+static void put_float(std::ofstream& out, double value)
+{
+  float f = (float)value;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  for(int k = 0; k < 4; ++k) {
+    out.put((char)(bits >> (8 * k)));
+  }
+}
+
+void InputRecorder::add(InputEvent::Type type, unsigned value,
+                        double x, double y)
+{
+  if(!m_file.is_open()) {
+    return;
+  }
+
+  // Whole microseconds, measured from the start so rounding never
+  // accumulates
+  double us = (double)(uint64_t)((now_ns() - m_start_ns) / 1e3);
+  uint64_t delta = (uint64_t)std::max(0.0, us - m_last_us);
+  m_last_us = us;
+
+  m_file.put((char)type);
+  do {
+    unsigned char byte = delta & 0x7f;
+    delta >>= 7;
+    m_file.put((char)(delta ? byte | 0x80 : byte));
+  } while(delta);
+
+  switch(type) {
+  case InputEvent::PRESS:
+  case InputEvent::RELEASE:
+    m_file.put((char)value);
+    put_float(m_file, x);
+    put_float(m_file, y);
+    break;
+  case InputEvent::MOTION:
+    put_float(m_file, x);
+    put_float(m_file, y);
+    break;
+  case InputEvent::MODE:
+    m_file.put((char)value);
+    break;
+  case InputEvent::RESET:
+    break;
+  }
+  // Keep the log usable if the viewer is killed
+  m_file.flush();
+}
+
+bool load_input_log(const std::string& path, std::vector<InputEvent>& events,
+                    std::string& error)
+{
+  events.clear();
+
+  MappedFile file;
+  if(!file.open(path, error)) {
+    return false;
+  }
+  const unsigned char *p = (const unsigned char *)file.data();
+  const unsigned char *end = p + file.size();
+
+  if(file.size() < sizeof(MAGIC) + 1 ||
+     memcmp(p, MAGIC, sizeof(MAGIC)) != 0) {
+    error = path + ": not an input log";
+    return false;
+  }
+  if(p[sizeof(MAGIC)] != VERSION) {
+    error = path + ": unsupported input log version";
+    return false;
+  }
+  p += sizeof(MAGIC) + 1;
+
+  double us = 0;
+  while(p < end) {
+    InputEvent event;
+    event.type = InputEvent::Type(*p++);
+    event.value = 0;
+    event.x = event.y = 0;
+
+    uint64_t delta = 0;
+    int shift = 0;
+    bool more = true;
+    while(more && p < end && shift < 64) {
+      delta |= (uint64_t)(*p & 0x7f) << shift;
+      more = (*p++ & 0x80) != 0;
+      shift += 7;
+    }
+    us += (double)delta;
+    event.time_ns = us * 1e3;
+
+    size_t need = 0;
+    bool button = false;
+    switch(event.type) {
+    case InputEvent::PRESS:
+    case InputEvent::RELEASE:
+      need = 9;
+      button = true;
+      break;
+    case InputEvent::MOTION:
+      need = 8;
+      break;
+    case InputEvent::MODE:
+      need = 1;
+      break;
+    case InputEvent::RESET:
+      break;
+    default:
+      events.clear();
+      error = path + ": corrupt input log";
+      return false;
+    }
+    if(more || (size_t)(end - p) < need) {
+      events.clear();
+      error = path + ": input log is truncated";
+      return false;
+    }
+
+    if(event.type == InputEvent::MODE || button) {
+      event.value = *p++;
+    }
+    if(need >= 8) {
+      float f[2];
+      for(int i = 0; i < 2; ++i) {
+        uint32_t bits = 0;
+        for(int k = 0; k < 4; ++k) {
+          bits |= (uint32_t)p[k] << (8 * k);
+        }
+        memcpy(&f[i], &bits, sizeof(bits));
+        p += 4;
+      }
+      event.x = f[0];
+      event.y = f[1];
+    }
+    events.push_back(event);
+  }
+  return true;
+}
+
+InputReplay::InputReplay()
+  : m_events(0)
+  , m_next(0)
+  , m_start_ns(0)
+  , m_origin_ns(0)
+{
+}
+
+void InputReplay::start(const std::vector<InputEvent>& events)
+{
+  m_events = &events;
+  m_next = 0;
+  m_start_ns = now_ns();
+  m_origin_ns = events.empty() ? 0 : events[0].time_ns;
+}
+
+double InputReplay::wait_ns() const
+{
+  if(done()) {
+    return 0;
+  }
+  return std::max(0.0, due_ns(m_next) - (now_ns() - m_start_ns));
+}
+
+ReplayStats::ReplayStats()
+  : m_start_ns(0)
+  , m_frame_start_ns(0)
+  , m_events(0)
+{
+}
+
+void ReplayStats::start()
+{
+  m_start_ns = now_ns();
+  m_events = 0;
+  m_frame_ns.clear();
+}
+
+double ReplayStats::elapsed_ns() const
+{
+  return now_ns() - m_start_ns;
+}
+
+void ReplayStats::begin_frame()
+{
+  m_frame_start_ns = now_ns();
+}
+
+void ReplayStats::end_frame()
+{
+  m_frame_ns.push_back(now_ns() - m_frame_start_ns);
+}
+
+std::string ReplayStats::summary() const
+{
+  std::vector<double> ns = m_frame_ns;
+  std::sort(ns.begin(), ns.end());
+
+  double sum = 0;
+  for(size_t i = 0; i < ns.size(); ++i) {
+    sum += ns[i];
+  }
+  struct Percentile {
+    const std::vector<double>& ns;
+    double operator()(double q) const
+    {
+      return ns.empty() ? 0.0 : ns[(size_t)(q * (ns.size() - 1) + 0.5)];
+    }
+  } at = { ns };
+
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(3) << "replay: " << m_events
+     << " events, " << ns.size() << " frames in "
+     << elapsed_ns() / 1e9 << " s\n"
+     << "  frame ms  avg " << (ns.empty() ? 0.0 : sum / ns.size() / 1e6)
+     << "  p50 " << at(0.5) / 1e6 << "  p95 " << at(0.95) / 1e6
+     << "  p99 " << at(0.99) / 1e6 << "  max "
+     << (ns.empty() ? 0.0 : ns.back() / 1e6);
+  return ss.str();
+}
@@ -0,0 +1,169 @@
+//---------------------------------------------------------------------------
+//
+// inputlog.hpp/inputlog.cpp
+//
+// Recording and replaying the viewer's input, so an interactive
+// session can be run again exactly as it was, e.g. to compare the
+// frame times of two builds on the same workload.
+//
+// The log is a binary file: the magic "A2IN" and a version byte, then
+// one record per event.  A record is a type byte, the time since the
+// previous event in microseconds as a base-128 varint, and the event's
+// data: the button and the pointer position as two little-endian
+// floats for presses and releases, the position for motion, the mode
+// for mode switches and nothing for resets.  A motion record is
+// usually 10 or 11 bytes.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_INPUTLOG_HPP
+#define CS488_INPUTLOG_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include "profile.hpp"
+
+struct InputEvent {
+  enum Type {
+    PRESS,
+    RELEASE,
+    MOTION,
+    MODE,
+    RESET
+  };
+
+  Type type;
+  // Nanoseconds since recording started
+  double time_ns;
+  // The button for PRESS and RELEASE, the mode for MODE
+  unsigned value;
+  // The pointer position for PRESS, RELEASE and MOTION
+  double x, y;
+};
+
+class InputRecorder {
+public:
+  InputRecorder();
+
+  // Start writing events to "path", replacing it.  On failure returns
+  // false and describes why in "error".
+  bool open(const std::string& path, std::string& error);
+  void close();
+  bool recording() const
+  {
+    return m_file.is_open();
+  }
+
+  // Append an event stamped with the time now.  Does nothing unless
+  // recording.
+  void add(InputEvent::Type type, unsigned value = 0,
+           double x = 0, double y = 0);
+
+private:
+  std::ofstream m_file;
+  double m_start_ns;
+  double m_last_us;
+};
+
+// Read a log written by InputRecorder into "events".  On failure
+// returns false, leaves "events" empty and describes the problem in
+// "error".
+bool load_input_log(const std::string& path, std::vector<InputEvent>& events,
+                    std::string& error);
+
+// Hands out the events of a log as they fall due.  Played in real time
+// the events are timed from the first, so the wait before it was
+// recorded is skipped.
+class InputReplay {
+public:
+  InputReplay();
+
+  // Play "events", which must outlive the replay, from the first,
+  // starting the clock now
+  void start(const std::vector<InputEvent>& events);
+
+  // Pass each event that is due by now to "handle" and return how many
+  // there were
+  template<class F>
+  size_t play_due(F handle)
+  {
+    return play_until(now_ns() - m_start_ns, handle);
+  }
+
+  // Pass the events up to "span_ns" after the next one to "handle",
+  // whatever the time, and return how many there were
+  template<class F>
+  size_t play_span(double span_ns, F handle)
+  {
+    return done() ? 0 : play_until(due_ns(m_next) + span_ns, handle);
+  }
+
+  bool done() const
+  {
+    return !m_events || m_next == m_events->size();
+  }
+
+  // Nanoseconds until the next event is due, 0 if it is already
+  double wait_ns() const;
+
+private:
+  // How far into the replay event i is due
+  double due_ns(size_t i) const
+  {
+    return (*m_events)[i].time_ns - m_origin_ns;
+  }
+
+  // Pass the events due up to "elapsed_ns" into the replay to "handle"
+  template<class F>
+  size_t play_until(double elapsed_ns, F handle)
+  {
+    const size_t first = m_next;
+    while(!done() && due_ns(m_next) <= elapsed_ns) {
+      handle((*m_events)[m_next++]);
+    }
+    return m_next - first;
+  }
+
+  const std::vector<InputEvent> *m_events;
+  size_t m_next;
+  // When the replay started, and when in the recording its first event
+  // was
+  double m_start_ns;
+  double m_origin_ns;
+};
+
+// Frame times gathered while a log is replayed
+class ReplayStats {
+public:
+  ReplayStats();
+
+  // Forget earlier frames and start the clock
+  void start();
+  // Nanoseconds since start()
+  double elapsed_ns() const;
+
+  void begin_frame();
+  void end_frame();
+  void add_events(size_t count)
+  {
+    m_events += count;
+  }
+
+  size_t frames() const
+  {
+    return m_frame_ns.size();
+  }
+
+  // Events, frames, wall time and the frame time average, percentiles
+  // and maximum
+  std::string summary() const;
+
+private:
+  double m_start_ns;
+  double m_frame_start_ns;
+  size_t m_events;
+  std::vector<double> m_frame_ns;
+};
+
+#endif
@@ -1,9 +1,19 @@
 #include <gtkmm.h>
 #include <gtkglmm.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include "appwindow.hpp"
+#include "threadpool.hpp"
+#include "profile.hpp"
 
 int main(int argc, char** argv)
 {
+  // Chunk files are paged in on a thread of their own, which wakes the
+  // main loop through a Glib::Dispatcher
+  if (!Glib::thread_supported())
+    Glib::thread_init();
+
   // Construct our main loop
   Gtk::Main kit(argc, argv);
 
@@ -13,6 +23,66 @@ int main(int argc, char** argv)
   // Construct our (only) window
   AppWindow window;
 
+  // "-j N" runs the per-frame work on N threads (default: one per
+  // core), "-n N" draws N copies of the model, "-f" transforms it in
+  // single precision, "-m MB" keeps at most MB megabytes of a chunk
+  // file in memory, "-l PX" draws the level of detail whose error
+  // covers at most PX pixels, "-p FILE" writes each frame's stage
+  // timings to FILE as CSV, "-w FILE" records the input to FILE and
+  // "-r FILE" ("-R FILE") replays it at its own (the highest) speed;
+  // any other argument is a mesh, chunk or level of detail file to
+  // view instead of the cube
+  for (int i = 1; i < argc; ++i) {
+    if ((strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "-r") == 0 ||
+         strcmp(argv[i], "-R") == 0) && i + 1 < argc) {
+      std::string error;
+      bool ok = argv[i][1] == 'w' ?
+        window.record_input(argv[i + 1], error) :
+        window.replay_input(argv[i + 1], argv[i][1] == 'R', error);
+      if (!ok) {
+        std::cerr << error << std::endl;
+      }
+      ++i;
+      continue;
+    }
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      std::string error;
+#ifndef CS488_NO_PROFILE
+      if (!Profiler::shared().open_csv(argv[++i], error)) {
+        std::cerr << error << std::endl;
+      }
+#else
+      ++i;
+      std::cerr << "-p: frame timing was compiled out" << std::endl;
+#endif
+      continue;
+    }
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      ThreadPool::shared().set_threads((unsigned)atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "-f") == 0) {
+      window.set_precision(PRECISION_FLOAT);
+      continue;
+    }
+    if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      window.set_chunk_budget((size_t)atol(argv[++i]) << 20);
+      continue;
+    }
+    if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      window.set_lod_pixels(atof(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      window.set_instances((unsigned)atoi(argv[++i]));
+      continue;
+    }
+    std::string error;
+    if (!window.load_mesh(argv[i], error)) {
+      std::cerr << error << std::endl;
+    }
+  }
+
   // And run the application!
   Gtk::Main::run(window);
 }
@@ -0,0 +1,126 @@
+#include "mappedfile.hpp"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile()
+  : m_data(0)
+  , m_size(0)
+  , m_open(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::string& path, std::string& error)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0) {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    error = path + ": " + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+
+  m_size = (size_t)st.st_size;
+  if(m_size > 0) {
+    void *p = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED) {
+      error = path + ": " + strerror(errno);
+      ::close(fd);
+      m_size = 0;
+      return false;
+    }
+    m_data = p;
+    // Loaders read front to back
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  m_open = true;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if(m_data) {
+    munmap(m_data, m_size);
+  }
+  m_data = 0;
+  m_size = 0;
+  m_open = false;
+}
+
+void MappedFile::prefetch()
+{
+  if(m_data) {
+    madvise(m_data, m_size, MADV_NORMAL);
+    madvise(m_data, m_size, MADV_WILLNEED);
+  }
+}
+
+// The range [offset, offset + length) of a mapping at "base", widened
+// (or, if "inward", narrowed) to whole pages
+static bool page_range(const void *base, size_t size, size_t offset,
+                       size_t length, bool inward, char *&begin, char *&end)
+{
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  if(offset > size) {
+    return false;
+  }
+  length = std::min(length, size - offset);
+  size_t first = inward ? (offset + page - 1) / page * page
+                        : offset / page * page;
+  // The mapping runs on to the end of the file's last page
+  size_t last = inward && offset + length < size ?
+    (offset + length) / page * page :
+    (offset + length + page - 1) / page * page;
+  if(first >= last) {
+    return false;
+  }
+  begin = (char *)base + first;
+  end = (char *)base + last;
+  return true;
+}
+
+void MappedFile::load(size_t offset, size_t length) const
+{
+  char *begin, *end;
+  if(!m_data || !page_range(m_data, m_size, offset, length, false,
+                            begin, end)) {
+    return;
+  }
+  madvise(begin, end - begin, MADV_WILLNEED);
+  // The advice only starts the reads; touching each page waits for them
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  volatile char sink = 0;
+  for(const char *p = begin; p < end && p < (char *)m_data + m_size;
+      p += page) {
+    sink += *p;
+  }
+  (void)sink;
+}
+
+void MappedFile::release(size_t offset, size_t length) const
+{
+  char *begin, *end;
+  if(m_data && page_range(m_data, m_size, offset, length, true,
+                          begin, end)) {
+    madvise(begin, end - begin, MADV_DONTNEED);
+  }
+}
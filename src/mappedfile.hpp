@@ -0,0 +1,51 @@
+#ifndef CS488_MAPPEDFILE_HPP
+#define CS488_MAPPEDFILE_HPP
+
+#include <string>
+#include <cstddef>
+
+// A read-only memory mapping of a whole file.  The mapping is released
+// when the object is destroyed or close() is called.
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+
+  // Map "path".  On failure returns false and describes the problem
+  // in "error".
+  bool open(const std::string& path, std::string& error);
+  void close();
+  // Ask for the whole file to be read in now, for a mapping that is
+  // read over and over rather than once front to back
+  void prefetch();
+  // Read the pages holding [offset, offset + length) in now, and wait
+  // for them
+  void load(size_t offset, size_t length) const;
+  // Let the pages that lie wholly inside [offset, offset + length) go.
+  // They are read back from the file if touched again.
+  void release(size_t offset, size_t length) const;
+
+  bool is_open() const
+  {
+    return m_open;
+  }
+  const char *data() const
+  {
+    return (const char*)m_data;
+  }
+  size_t size() const
+  {
+    return m_size;
+  }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator =(const MappedFile&);
+
+  void *m_data;
+  size_t m_size;
+  // Empty files can't be mapped but are still "open"
+  bool m_open;
+};
+
+#endif
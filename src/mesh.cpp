@@ -0,0 +1,966 @@
+#include "mesh.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <stdint.h>
+
+Mesh::Mesh()
+  : default_colour(0.1, 0.1, 1)
+{
+}
+
+void Mesh::clear()
+{
+  x.clear();
+  y.clear();
+  z.clear();
+  faces.clear();
+  edges.clear();
+  edge_colours.clear();
+  lower = upper = Point3D();
+}
+
+void Mesh::update_bounds()
+{
+  const size_t n = num_vertices();
+  if(n == 0) {
+    lower = upper = Point3D();
+    return;
+  }
+  for(int k = 0; k < 3; ++k) {
+    const MeshArray<double>& c = (k == 0) ? x : (k == 1) ? y : z;
+    const double *p = c.data();
+    double lo = p[0], hi = p[0];
+    for(size_t i = 1; i < n; ++i) {
+      lo = std::min(lo, p[i]);
+      hi = std::max(hi, p[i]);
+    }
+    lower[k] = lo;
+    upper[k] = hi;
+  }
+}
+
+Mesh Mesh::cube()
+{
+  Mesh mesh;
+
+  // Corner i has x = -1 when i is odd, y = -1 for corners 2, 3, 6, 7
+  // and z = -1 for corners 4 to 7.
+  for(unsigned i = 0; i < 8; ++i) {
+    mesh.x.push_back((i % 2 == 1) ? -1 : 1);
+    mesh.y.push_back(((i > 1 && i < 4) || i > 5) ? -1 : 1);
+    mesh.z.push_back((i > 3) ? -1 : 1);
+  }
+
+  // Counter-clockwise quads seen from outside
+  static const unsigned quads[6][4] = {
+    { 0, 1, 3, 2 }, { 4, 6, 7, 5 },
+    { 0, 2, 6, 4 }, { 1, 5, 7, 3 },
+    { 0, 4, 5, 1 }, { 2, 3, 7, 6 }
+  };
+  for(size_t q = 0; q < 6; ++q) {
+    const unsigned *v = quads[q];
+    unsigned tris[6] = { v[0], v[1], v[2], v[0], v[2], v[3] };
+    mesh.faces.insert(mesh.faces.end(), tris, tris + 6);
+  }
+
+  // The z = 1 face is grey, the z = -1 face red and the edges joining
+  // them blue.
+  static const unsigned edges[12][2] = {
+    { 0, 1 }, { 0, 2 }, { 0, 4 }, { 1, 3 }, { 1, 5 }, { 2, 3 },
+    { 2, 6 }, { 3, 7 }, { 4, 5 }, { 4, 6 }, { 5, 7 }, { 6, 7 }
+  };
+  for(size_t e = 0; e < 12; ++e) {
+    mesh.edges.push_back(edges[e][0]);
+    mesh.edges.push_back(edges[e][1]);
+
+    if(edges[e][1] == edges[e][0] + 4) {
+      mesh.edge_colours.push_back(Colour(0.1, 0.1, 1));
+    } else if(edges[e][0] < 4) {
+      mesh.edge_colours.push_back(Colour(0.1, 0.1, 0.1));
+    } else {
+      mesh.edge_colours.push_back(Colour(1, 0, 0));
+    }
+  }
+
+  mesh.update_bounds();
+  return mesh;
+}
+
+/*
+ * Parsing helpers.  These work directly on the mapped file, which is
+ * not NUL terminated, so every one of them takes an end pointer.
+ */
+
+static inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skip_blanks(const char *p, const char *end)
+{
+  while(p < end && is_blank(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+static inline const char *line_end(const char *p, const char *end)
+{
+  const char *nl = (const char*)memchr(p, '\n', end - p);
+  return nl ? nl : end;
+}
+
+static inline bool parse_long(const char *&p, const char *end, long& out)
+{
+  bool neg = false;
+  if(p < end && (*p == '-' || *p == '+')) {
+    neg = (*p == '-');
+    ++p;
+  }
+  if(p >= end || *p < '0' || *p > '9') {
+    return false;
+  }
+  long v = 0;
+  while(p < end && *p >= '0' && *p <= '9') {
+    v = v * 10 + (*p - '0');
+    ++p;
+  }
+  out = neg ? -v : v;
+  return true;
+}
+
+static inline bool parse_double(const char *&p, const char *end, double& out)
+{
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  bool neg = false;
+  if(p < end && (*p == '-' || *p == '+')) {
+    neg = (*p == '-');
+    ++p;
+  }
+
+  uint64_t mant = 0;
+  int digits = 0;
+  int exp10 = 0;
+  bool any = false;
+
+  while(p < end && *p >= '0' && *p <= '9') {
+    if(digits < 19) {
+      mant = mant * 10 + (*p - '0');
+      if(mant) {
+        ++digits;
+      }
+    } else {
+      ++exp10;
+    }
+    any = true;
+    ++p;
+  }
+  if(p < end && *p == '.') {
+    ++p;
+    while(p < end && *p >= '0' && *p <= '9') {
+      if(digits < 19) {
+        mant = mant * 10 + (*p - '0');
+        if(mant) {
+          ++digits;
+        }
+        --exp10;
+      }
+      any = true;
+      ++p;
+    }
+  }
+  if(!any) {
+    return false;
+  }
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    long e;
+    if(!parse_long(p, end, e)) {
+      return false;
+    }
+    exp10 += (int)e;
+  }
+
+  double v = (double)mant;
+  if(exp10 < 0) {
+    v = (exp10 >= -22) ? v / pow10[-exp10] : v * pow(10.0, exp10);
+  } else if(exp10 > 0) {
+    v = (exp10 <= 22) ? v * pow10[exp10] : v * pow(10.0, exp10);
+  }
+  out = neg ? -v : v;
+  return true;
+}
+
+// Run fn(0) ... fn(n - 1) across the shared thread pool
+template<class F>
+static void run_chunks(unsigned n, F fn)
+{
+  ThreadPool::shared().run(n, fn);
+}
+
+// Split [begin, end) into n pieces that each start at a line start
+static std::vector<const char*> split_lines(const char *begin,
+                                            const char *end, unsigned n)
+{
+  std::vector<const char*> bounds(n + 1);
+  bounds[0] = begin;
+  bounds[n] = end;
+  for(unsigned k = 1; k < n; ++k) {
+    const char *p = begin + (end - begin) / n * k;
+    p = std::max(p, bounds[k - 1]);
+    if(p > begin && p < end && p[-1] != '\n') {
+      p = line_end(p, end);
+      if(p < end) {
+        ++p;
+      }
+    }
+    bounds[k] = p;
+  }
+  return bounds;
+}
+
+// Don't bother splitting small files
+static unsigned chunk_count(size_t bytes, unsigned threads)
+{
+  const size_t min_chunk = 1 << 20;
+  size_t n = bytes / min_chunk + 1;
+  return (unsigned)std::min<size_t>(n, threads);
+}
+
+static inline uint64_t edge_key(unsigned a, unsigned b)
+{
+  if(a > b) {
+    std::swap(a, b);
+  }
+  return ((uint64_t)a << 32) | b;
+}
+
+// What one thread produces while parsing its part of a file
+struct MeshChunk {
+  std::vector<unsigned> faces;
+  std::vector<uint64_t> edges;
+  std::vector<long> poly;
+  std::string error;
+};
+
+// Add a polygon (or, if "closed" is false, a polyline) whose vertices
+// are in chunk.poly.
+static void add_polygon(MeshChunk& chunk, bool closed)
+{
+  const std::vector<long>& v = chunk.poly;
+  size_t n = v.size();
+  if(n < 2) {
+    return;
+  }
+
+  size_t nedges = (closed && n > 2) ? n : n - 1;
+  for(size_t i = 0; i < nedges; ++i) {
+    unsigned a = (unsigned)v[i];
+    unsigned b = (unsigned)v[(i + 1) % n];
+    if(a != b) {
+      chunk.edges.push_back(edge_key(a, b));
+    }
+  }
+
+  if(closed) {
+    for(size_t i = 2; i < n; ++i) {
+      chunk.faces.push_back((unsigned)v[0]);
+      chunk.faces.push_back((unsigned)v[i - 1]);
+      chunk.faces.push_back((unsigned)v[i]);
+    }
+  }
+}
+
+// Gather the chunks' faces and de-duplicated edges into "mesh".  Each
+// chunk sorts its own edges, then sorted runs are merged pairwise, all
+// in parallel.
+static bool finish_mesh(std::vector<MeshChunk>& chunks, Mesh& mesh,
+                        std::string& error)
+{
+  for(size_t i = 0; i < chunks.size(); ++i) {
+    if(!chunks[i].error.empty()) {
+      error = chunks[i].error;
+      return false;
+    }
+  }
+
+  size_t nfaces = 0;
+  for(size_t i = 0; i < chunks.size(); ++i) {
+    nfaces += chunks[i].faces.size();
+  }
+  mesh.faces.reserve(nfaces);
+  for(size_t i = 0; i < chunks.size(); ++i) {
+    mesh.faces.insert(mesh.faces.end(), chunks[i].faces.begin(),
+                      chunks[i].faces.end());
+    std::vector<unsigned>().swap(chunks[i].faces);
+  }
+
+  std::vector< std::vector<uint64_t> > runs(chunks.size());
+  for(size_t i = 0; i < chunks.size(); ++i) {
+    runs[i].swap(chunks[i].edges);
+  }
+  run_chunks((unsigned)runs.size(), [&](unsigned i) {
+    std::sort(runs[i].begin(), runs[i].end());
+    runs[i].erase(std::unique(runs[i].begin(), runs[i].end()), runs[i].end());
+  });
+  while(runs.size() > 1) {
+    std::vector< std::vector<uint64_t> > merged((runs.size() + 1) / 2);
+    run_chunks((unsigned)merged.size(), [&](unsigned i) {
+      if(2 * i + 1 == runs.size()) {
+        merged[i].swap(runs[2 * i]);
+        return;
+      }
+      const std::vector<uint64_t>& a = runs[2 * i];
+      const std::vector<uint64_t>& b = runs[2 * i + 1];
+      merged[i].resize(a.size() + b.size());
+      merged[i].erase(std::unique(merged[i].begin(),
+                                  std::merge(a.begin(), a.end(),
+                                             b.begin(), b.end(),
+                                             merged[i].begin())),
+                      merged[i].end());
+    });
+    runs.swap(merged);
+  }
+
+  if(!runs.empty()) {
+    const std::vector<uint64_t>& keys = runs[0];
+    mesh.edges.resize(keys.size() * 2);
+    unsigned *edges = mesh.edges.writable();
+    for(size_t i = 0; i < keys.size(); ++i) {
+      edges[2 * i] = (unsigned)(keys[i] >> 32);
+      edges[2 * i + 1] = (unsigned)(keys[i] & 0xffffffffu);
+    }
+  }
+  return true;
+}
+
+static std::string at_offset(const char *what, const char *base,
+                             const char *p)
+{
+  std::ostringstream ss;
+  ss << what << " at byte " << (p - base);
+  return ss.str();
+}
+
+/*
+ * OBJ
+ *
+ * Two passes over the chunks: the first counts "v" lines so every
+ * chunk knows the index of its first vertex, the second parses
+ * vertices straight into place and collects faces and edges.
+ */
+
+static inline bool is_obj_tag(const char *p, const char *end, char tag)
+{
+  return p + 1 < end && p[0] == tag && is_blank(p[1]);
+}
+
+static bool load_obj(const char *data, size_t size, Mesh& mesh,
+                     std::string& error, unsigned threads)
+{
+  const char *end = data + size;
+  unsigned n = chunk_count(size, threads);
+  std::vector<const char*> bounds = split_lines(data, end, n);
+
+  std::vector<size_t> base(n + 1, 0);
+  run_chunks(n, [&](unsigned k) {
+    size_t count = 0;
+    for(const char *p = bounds[k]; p < bounds[k + 1]; ) {
+      const char *q = skip_blanks(p, bounds[k + 1]);
+      if(is_obj_tag(q, bounds[k + 1], 'v')) {
+        ++count;
+      }
+      p = line_end(q, bounds[k + 1]) + 1;
+    }
+    base[k + 1] = count;
+  });
+  for(unsigned k = 0; k < n; ++k) {
+    base[k + 1] += base[k];
+  }
+
+  const size_t nverts = base[n];
+  mesh.x.resize(nverts);
+  mesh.y.resize(nverts);
+  mesh.z.resize(nverts);
+  double *vx = mesh.x.writable(), *vy = mesh.y.writable();
+  double *vz = mesh.z.writable();
+
+  std::vector<MeshChunk> chunks(n);
+  run_chunks(n, [&](unsigned k) {
+    MeshChunk& chunk = chunks[k];
+    size_t vi = base[k];
+    const char *cend = bounds[k + 1];
+
+    for(const char *p = bounds[k]; p < cend; ) {
+      p = skip_blanks(p, cend);
+      const char *eol = line_end(p, cend);
+
+      if(is_obj_tag(p, eol, 'v')) {
+        p += 2;
+        double c[3];
+        for(int i = 0; i < 3; ++i) {
+          p = skip_blanks(p, eol);
+          if(!parse_double(p, eol, c[i])) {
+            chunk.error = at_offset("Malformed vertex", data, p);
+            return;
+          }
+        }
+        vx[vi] = c[0];
+        vy[vi] = c[1];
+        vz[vi] = c[2];
+        ++vi;
+      } else if(is_obj_tag(p, eol, 'f') || is_obj_tag(p, eol, 'l')) {
+        bool face = (*p == 'f');
+        p += 2;
+        chunk.poly.clear();
+        for(;;) {
+          p = skip_blanks(p, eol);
+          if(p >= eol || *p == '#') {
+            break;
+          }
+          long idx;
+          if(!parse_long(p, eol, idx) || idx == 0) {
+            chunk.error = at_offset("Malformed index", data, p);
+            return;
+          }
+          // Skip any texture/normal references
+          while(p < eol && !is_blank(*p)) {
+            ++p;
+          }
+          idx = (idx > 0) ? idx - 1 : (long)vi + idx;
+          if(idx < 0 || (size_t)idx >= nverts) {
+            chunk.error = at_offset("Vertex index out of range", data, p);
+            return;
+          }
+          chunk.poly.push_back(idx);
+        }
+        add_polygon(chunk, face);
+      }
+
+      p = eol + 1;
+    }
+  });
+
+  return finish_mesh(chunks, mesh, error);
+}
+
+/*
+ * PLY
+ */
+
+enum PlyType {
+  PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+  PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_BAD
+};
+
+static const size_t ply_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+
+static PlyType ply_type(const std::string& name)
+{
+  static const char *names[][2] = {
+    { "char", "int8" }, { "uchar", "uint8" },
+    { "short", "int16" }, { "ushort", "uint16" },
+    { "int", "int32" }, { "uint", "uint32" },
+    { "float", "float32" }, { "double", "float64" }
+  };
+  for(int t = 0; t < PLY_BAD; ++t) {
+    if(name == names[t][0] || name == names[t][1]) {
+      return PlyType(t);
+    }
+  }
+  return PLY_BAD;
+}
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  // For list properties, the type of the leading count
+  PlyType count_type;
+  bool is_list;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> props;
+};
+
+enum PlyFormat { PLY_ASCII, PLY_LITTLE, PLY_BIG };
+
+static bool parse_ply_header(const char *data, size_t size,
+                             PlyFormat& format,
+                             std::vector<PlyElement>& elements,
+                             size_t& body, std::string& error)
+{
+  const char *end = data + size;
+  const char *p = data;
+  bool have_format = false;
+
+  for(;;) {
+    if(p >= end) {
+      error = "PLY header has no end_header";
+      return false;
+    }
+    const char *eol = line_end(p, end);
+    std::istringstream line(std::string(p, eol));
+    p = eol + 1;
+
+    std::string word;
+    line >> word;
+    if(word == "end_header") {
+      break;
+    } else if(word == "format") {
+      std::string fmt;
+      line >> fmt;
+      if(fmt == "ascii") {
+        format = PLY_ASCII;
+      } else if(fmt == "binary_little_endian") {
+        format = PLY_LITTLE;
+      } else if(fmt == "binary_big_endian") {
+        format = PLY_BIG;
+      } else {
+        error = "Unknown PLY format " + fmt;
+        return false;
+      }
+      have_format = true;
+    } else if(word == "element") {
+      PlyElement e;
+      line >> e.name >> e.count;
+      elements.push_back(e);
+    } else if(word == "property") {
+      if(elements.empty()) {
+        error = "PLY property before any element";
+        return false;
+      }
+      PlyProperty prop;
+      std::string type;
+      line >> type;
+      prop.is_list = (type == "list");
+      if(prop.is_list) {
+        std::string count_type;
+        line >> count_type >> type;
+        prop.count_type = ply_type(count_type);
+      } else {
+        prop.count_type = PLY_UINT8;
+      }
+      prop.type = ply_type(type);
+      line >> prop.name;
+      if(prop.type == PLY_BAD || prop.count_type == PLY_BAD) {
+        error = "Unknown PLY property type in " + prop.name;
+        return false;
+      }
+      elements.back().props.push_back(prop);
+    }
+    // "ply", "comment" and "obj_info" lines need nothing
+  }
+
+  if(!have_format) {
+    error = "PLY header has no format";
+    return false;
+  }
+  body = p - data;
+  return true;
+}
+
+// Index of the named property in e, or -1
+static int ply_find(const PlyElement& e, const char *name,
+                    const char *alt = 0)
+{
+  for(size_t i = 0; i < e.props.size(); ++i) {
+    if(e.props[i].name == name || (alt && e.props[i].name == alt)) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+static inline double ply_read(const char *p, PlyType type, bool swap)
+{
+  unsigned char b[8];
+  size_t n = ply_sizes[type];
+  for(size_t i = 0; i < n; ++i) {
+    b[i] = (unsigned char)p[swap ? n - 1 - i : i];
+  }
+
+  switch(type) {
+  case PLY_INT8: { int8_t v; memcpy(&v, b, 1); return v; }
+  case PLY_UINT8: { uint8_t v; memcpy(&v, b, 1); return v; }
+  case PLY_INT16: { int16_t v; memcpy(&v, b, 2); return v; }
+  case PLY_UINT16: { uint16_t v; memcpy(&v, b, 2); return v; }
+  case PLY_INT32: { int32_t v; memcpy(&v, b, 4); return v; }
+  case PLY_UINT32: { uint32_t v; memcpy(&v, b, 4); return v; }
+  case PLY_FLOAT32: { float v; memcpy(&v, b, 4); return v; }
+  case PLY_FLOAT64: { double v; memcpy(&v, b, 8); return v; }
+  default: return 0;
+  }
+}
+
+// Size of the binary element record at p, or 0 if it runs past end
+static size_t ply_record_size(const char *p, const char *end,
+                              const PlyElement& e, bool swap)
+{
+  const char *q = p;
+  for(size_t i = 0; i < e.props.size(); ++i) {
+    const PlyProperty& prop = e.props[i];
+    if(prop.is_list) {
+      if(q + ply_sizes[prop.count_type] > end) {
+        return 0;
+      }
+      size_t count = (size_t)ply_read(q, prop.count_type, swap);
+      q += ply_sizes[prop.count_type] + count * ply_sizes[prop.type];
+    } else {
+      q += ply_sizes[prop.type];
+    }
+    if(q > end) {
+      return 0;
+    }
+  }
+  return q - p;
+}
+
+static bool load_ply(const char *data, size_t size, Mesh& mesh,
+                     std::string& error, unsigned threads)
+{
+  PlyFormat format = PLY_ASCII;
+  std::vector<PlyElement> elements;
+  size_t body;
+  if(!parse_ply_header(data, size, format, elements, body, error)) {
+    return false;
+  }
+
+  int vertex_elem = -1, face_elem = -1;
+  for(size_t i = 0; i < elements.size(); ++i) {
+    if(elements[i].name == "vertex") {
+      vertex_elem = (int)i;
+    } else if(elements[i].name == "face") {
+      face_elem = (int)i;
+    }
+  }
+  if(vertex_elem < 0) {
+    error = "PLY file has no vertex element";
+    return false;
+  }
+
+  const PlyElement& ve = elements[vertex_elem];
+  int px = ply_find(ve, "x"), py = ply_find(ve, "y"), pz = ply_find(ve, "z");
+  if(px < 0 || py < 0 || pz < 0 || ve.props[px].is_list ||
+     ve.props[py].is_list || ve.props[pz].is_list) {
+    error = "PLY vertices need x, y and z";
+    return false;
+  }
+  int pidx = -1;
+  if(face_elem >= 0) {
+    pidx = ply_find(elements[face_elem], "vertex_indices", "vertex_index");
+    if(pidx < 0 || !elements[face_elem].props[pidx].is_list) {
+      error = "PLY faces need a vertex_indices list";
+      return false;
+    }
+  }
+
+  const size_t nverts = ve.count;
+  mesh.x.resize(nverts);
+  mesh.y.resize(nverts);
+  mesh.z.resize(nverts);
+  double *vx = mesh.x.writable(), *vy = mesh.y.writable();
+  double *vz = mesh.z.writable();
+
+  const char *end = data + size;
+  const char *start = data + body;
+
+  if(format == PLY_ASCII) {
+    // One record per line, so a line number says which element and
+    // which record it is.
+    std::vector<size_t> first_line(elements.size() + 1, 0);
+    for(size_t i = 0; i < elements.size(); ++i) {
+      first_line[i + 1] = first_line[i] + elements[i].count;
+    }
+
+    unsigned n = chunk_count(end - start, threads);
+    std::vector<const char*> bounds = split_lines(start, end, n);
+    std::vector<size_t> line_base(n + 1, 0);
+    run_chunks(n, [&](unsigned k) {
+      size_t count = 0;
+      for(const char *p = bounds[k]; p < bounds[k + 1]; ++p) {
+        p = (const char*)memchr(p, '\n', bounds[k + 1] - p);
+        if(!p) {
+          break;
+        }
+        ++count;
+      }
+      line_base[k + 1] = count;
+    });
+    for(unsigned k = 0; k < n; ++k) {
+      line_base[k + 1] += line_base[k];
+    }
+    // The last line needn't end in a newline, but there must be a line
+    // for every record the header declares
+    const size_t lines = line_base[n] + (end > start && end[-1] != '\n');
+    if(lines < first_line[elements.size()]) {
+      error = "PLY file is truncated";
+      return false;
+    }
+
+    std::vector<MeshChunk> chunks(n);
+    run_chunks(n, [&](unsigned k) {
+      MeshChunk& chunk = chunks[k];
+      size_t line = line_base[k];
+      size_t elem = 0;
+
+      for(const char *p = bounds[k]; p < bounds[k + 1]; ++line) {
+        const char *eol = line_end(p, bounds[k + 1]);
+        while(elem < elements.size() && line >= first_line[elem + 1]) {
+          ++elem;
+        }
+        if(elem == elements.size()) {
+          break;
+        }
+
+        const PlyElement& e = elements[elem];
+        size_t record = line - first_line[elem];
+        if((int)elem == vertex_elem || (int)elem == face_elem) {
+          chunk.poly.clear();
+          for(size_t i = 0; i < e.props.size(); ++i) {
+            const PlyProperty& prop = e.props[i];
+            double v;
+            p = skip_blanks(p, eol);
+            if(!parse_double(p, eol, v)) {
+              chunk.error = at_offset("Malformed PLY record", data, p);
+              return;
+            }
+            if(!prop.is_list) {
+              if((int)elem != vertex_elem) {
+                continue;
+              }
+              if((int)i == px) {
+                vx[record] = v;
+              } else if((int)i == py) {
+                vy[record] = v;
+              } else if((int)i == pz) {
+                vz[record] = v;
+              }
+              continue;
+            }
+
+            // Only the faces' vertex indices are used; the items of any
+            // other list, of whatever type, are just stepped over
+            size_t count = (size_t)v;
+            const bool indices = (int)elem == face_elem && (int)i == pidx;
+            for(size_t j = 0; j < count; ++j) {
+              p = skip_blanks(p, eol);
+              if(!indices) {
+                const char *item = p;
+                while(p < eol && !is_blank(*p)) {
+                  ++p;
+                }
+                if(p == item) {
+                  chunk.error = at_offset("Malformed PLY list", data, p);
+                  return;
+                }
+                continue;
+              }
+              long idx;
+              if(!parse_long(p, eol, idx)) {
+                chunk.error = at_offset("Malformed PLY list", data, p);
+                return;
+              }
+              if(idx < 0 || (size_t)idx >= nverts) {
+                chunk.error = at_offset("Vertex index out of range", data, p);
+                return;
+              }
+              chunk.poly.push_back(idx);
+            }
+          }
+          if((int)elem == face_elem) {
+            add_polygon(chunk, true);
+          }
+        }
+
+        p = eol + 1;
+      }
+    });
+    return finish_mesh(chunks, mesh, error);
+  }
+
+  // Binary.  Fixed-size records (vertices, usually) can be split by
+  // index; records containing lists are walked once to find where
+  // each thread's share starts, or, for vertices, read as they are.
+  bool host_little = true;
+  {
+    uint16_t probe = 1;
+    unsigned char b;
+    memcpy(&b, &probe, 1);
+    host_little = (b == 1);
+  }
+  const bool swap = ((format == PLY_LITTLE) != host_little);
+
+  std::vector<MeshChunk> chunks;
+  const char *p = start;
+  for(size_t ei = 0; ei < elements.size(); ++ei) {
+    const PlyElement& e = elements[ei];
+    bool fixed = true;
+    size_t stride = 0;
+    for(size_t i = 0; i < e.props.size(); ++i) {
+      fixed = fixed && !e.props[i].is_list;
+      stride += ply_sizes[e.props[i].type];
+    }
+
+    if(fixed) {
+      if((size_t)(end - p) / (stride ? stride : 1) < e.count) {
+        error = "PLY file is truncated";
+        return false;
+      }
+      if((int)ei == vertex_elem) {
+        size_t ox = 0, oy = 0, oz = 0, off = 0;
+        for(size_t i = 0; i < e.props.size(); ++i) {
+          if((int)i == px) ox = off;
+          if((int)i == py) oy = off;
+          if((int)i == pz) oz = off;
+          off += ply_sizes[e.props[i].type];
+        }
+        PlyType tx = e.props[px].type, ty = e.props[py].type;
+        PlyType tz = e.props[pz].type;
+        const char *vdata = p;
+        unsigned n = chunk_count(e.count * stride, threads);
+        run_chunks(n, [&](unsigned k) {
+          size_t lo = e.count / n * k;
+          size_t hi = (k + 1 == n) ? e.count : e.count / n * (k + 1);
+          for(size_t r = lo; r < hi; ++r) {
+            const char *rec = vdata + r * stride;
+            vx[r] = ply_read(rec + ox, tx, swap);
+            vy[r] = ply_read(rec + oy, ty, swap);
+            vz[r] = ply_read(rec + oz, tz, swap);
+          }
+        });
+      }
+      p += e.count * stride;
+      continue;
+    }
+
+    // Other elements are skipped, but vertices with a list among their
+    // properties are read a record at a time on the way
+    if((int)ei != face_elem) {
+      for(size_t r = 0; r < e.count; ++r) {
+        size_t len = ply_record_size(p, end, e, swap);
+        if(!len) {
+          error = "PLY file is truncated";
+          return false;
+        }
+        const char *q = p;
+        for(size_t i = 0; (int)ei == vertex_elem && i < e.props.size(); ++i) {
+          const PlyProperty& prop = e.props[i];
+          if(prop.is_list) {
+            size_t count = (size_t)ply_read(q, prop.count_type, swap);
+            q += ply_sizes[prop.count_type] + count * ply_sizes[prop.type];
+            continue;
+          }
+          if((int)i == px) {
+            vx[r] = ply_read(q, prop.type, swap);
+          } else if((int)i == py) {
+            vy[r] = ply_read(q, prop.type, swap);
+          } else if((int)i == pz) {
+            vz[r] = ply_read(q, prop.type, swap);
+          }
+          q += ply_sizes[prop.type];
+        }
+        p += len;
+      }
+      continue;
+    }
+
+    if(e.count == 0) {
+      continue;
+    }
+
+    // Find the first record of each chunk
+    unsigned n = chunk_count(end - p, threads);
+    n = (unsigned)std::min<size_t>(n, e.count);
+    std::vector<const char*> bounds(n + 1);
+    std::vector<size_t> first(n + 1);
+    size_t per_chunk = e.count / n;
+    for(size_t r = 0, k = 0; r < e.count; ++r) {
+      if(k < n && r == per_chunk * k) {
+        bounds[k] = p;
+        first[k] = r;
+        ++k;
+      }
+      size_t len = ply_record_size(p, end, e, swap);
+      if(!len) {
+        error = "PLY file is truncated";
+        return false;
+      }
+      p += len;
+    }
+    first[n] = e.count;
+
+    chunks.resize(n);
+    run_chunks(n, [&](unsigned k) {
+      MeshChunk& chunk = chunks[k];
+      const char *q = bounds[k];
+      for(size_t r = first[k]; r < first[k + 1]; ++r) {
+        chunk.poly.clear();
+        for(size_t i = 0; i < e.props.size(); ++i) {
+          const PlyProperty& prop = e.props[i];
+          if(!prop.is_list) {
+            q += ply_sizes[prop.type];
+            continue;
+          }
+          size_t count = (size_t)ply_read(q, prop.count_type, swap);
+          q += ply_sizes[prop.count_type];
+          if((int)i != pidx) {
+            q += count * ply_sizes[prop.type];
+            continue;
+          }
+          for(size_t j = 0; j < count; ++j) {
+            long idx = (long)ply_read(q, prop.type, swap);
+            q += ply_sizes[prop.type];
+            if(idx < 0 || (size_t)idx >= nverts) {
+              chunk.error = at_offset("Vertex index out of range", data, q);
+              return;
+            }
+            chunk.poly.push_back(idx);
+          }
+        }
+        add_polygon(chunk, true);
+      }
+    });
+  }
+
+  return finish_mesh(chunks, mesh, error);
+}
+
+bool load_mesh(const std::string& path, Mesh& mesh, std::string& error,
+               unsigned threads)
+{
+  mesh.clear();
+
+  if(threads == 0) {
+    threads = ThreadPool::shared().threads();
+  }
+
+  MappedFile file;
+  if(!file.open(path, error)) {
+    return false;
+  }
+
+  bool ok;
+  if(file.size() >= 3 && memcmp(file.data(), "ply", 3) == 0) {
+    ok = load_ply(file.data(), file.size(), mesh, error, threads);
+  } else {
+    ok = load_obj(file.data(), file.size(), mesh, error, threads);
+  }
+
+  if(!ok) {
+    error = path + ": " + error;
+    mesh.clear();
+  } else {
+    mesh.update_bounds();
+  }
+  return ok;
+}
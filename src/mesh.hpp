@@ -0,0 +1,238 @@
+#ifndef CS488_MESH_HPP
+#define CS488_MESH_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include "algebra.hpp"
+#include "mappedfile.hpp"
+
+// An array of mesh data that is either owned, in a vector, or read in
+// place from a mapped file (see meshcache.hpp), which it keeps open.
+// Reading works the same either way.  Writing goes through writable()
+// or the vector-like calls below it, the first of which copies a mapped
+// array out of the file.
+template<class T>
+class MeshArray {
+public:
+  typedef const T *const_iterator;
+
+  MeshArray()
+    : m_data(0)
+    , m_size(0)
+  {
+  }
+  MeshArray(const MeshArray& other)
+    : m_owned(other.m_owned)
+    , m_file(other.m_file)
+  {
+    point_at(other);
+  }
+  MeshArray(MeshArray&& other)
+    : m_owned(std::move(other.m_owned))
+    , m_file(std::move(other.m_file))
+  {
+    point_at(other);
+    other.sync();
+  }
+  MeshArray& operator =(const MeshArray& other)
+  {
+    if(this != &other) {
+      m_owned = other.m_owned;
+      m_file = other.m_file;
+      point_at(other);
+    }
+    return *this;
+  }
+  MeshArray& operator =(MeshArray&& other)
+  {
+    if(this != &other) {
+      m_owned = std::move(other.m_owned);
+      m_file = std::move(other.m_file);
+      point_at(other);
+      other.m_file.reset();
+      other.sync();
+    }
+    return *this;
+  }
+
+  size_t size() const
+  {
+    return m_size;
+  }
+  bool empty() const
+  {
+    return m_size == 0;
+  }
+  const T *data() const
+  {
+    return m_data;
+  }
+  const T& operator [](size_t i) const
+  {
+    return m_data[i];
+  }
+  const_iterator begin() const
+  {
+    return m_data;
+  }
+  const_iterator end() const
+  {
+    return m_data + m_size;
+  }
+
+  // True when the data is read from a mapped file
+  bool mapped() const
+  {
+    return m_file != 0;
+  }
+  // Read "size" T's at "data", which must lie in "file", in place
+  void map(const std::shared_ptr<const MappedFile>& file, const T *data,
+           size_t size)
+  {
+    std::vector<T>().swap(m_owned);
+    m_file = file;
+    m_data = data;
+    m_size = size;
+  }
+
+  T *writable()
+  {
+    own();
+    return m_owned.data();
+  }
+  void clear()
+  {
+    m_file.reset();
+    m_owned.clear();
+    sync();
+  }
+  void reserve(size_t n)
+  {
+    own();
+    m_owned.reserve(n);
+    sync();
+  }
+  void resize(size_t n)
+  {
+    own();
+    m_owned.resize(n);
+    sync();
+  }
+  void push_back(const T& value)
+  {
+    own();
+    m_owned.push_back(value);
+    sync();
+  }
+  template<class It>
+  void insert(const_iterator pos, It first, It last)
+  {
+    size_t at = pos - m_data;
+    own();
+    m_owned.insert(m_owned.begin() + at, first, last);
+    sync();
+  }
+
+private:
+  void own()
+  {
+    if(m_file) {
+      m_owned.assign(m_data, m_data + m_size);
+      m_file.reset();
+      sync();
+    }
+  }
+  void sync()
+  {
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+  }
+  // After copying or moving "other"'s members into this one
+  void point_at(const MeshArray& other)
+  {
+    if(m_file) {
+      m_data = other.m_data;
+      m_size = other.m_size;
+    } else {
+      sync();
+    }
+  }
+
+  std::vector<T> m_owned;
+  std::shared_ptr<const MappedFile> m_file;
+  const T *m_data;
+  size_t m_size;
+};
+
+// An indexed wireframe mesh.  Positions are kept as separate x, y and z
+// arrays so they can be fed straight to transform_points().
+class Mesh {
+public:
+  Mesh();
+
+  size_t num_vertices() const
+  {
+    return x.size();
+  }
+  size_t num_edges() const
+  {
+    return edges.size() / 2;
+  }
+  size_t num_faces() const
+  {
+    return faces.size() / 3;
+  }
+
+  Point3D vertex(size_t i) const
+  {
+    return Point3D(x[i], y[i], z[i]);
+  }
+
+  // Colour of edge i, or the default colour if the mesh has no per-edge
+  // colours.
+  Colour edge_colour(size_t i) const
+  {
+    return edge_colours.empty() ? default_colour : edge_colours[i];
+  }
+
+  void clear();
+
+  // Set lower and upper to the corners of the smallest box holding
+  // every vertex
+  void update_bounds();
+
+  // The unit cube from the original assignment, with its back, front
+  // and side edges coloured the way the viewer always drew them.
+  static Mesh cube();
+
+  // Vertex positions
+  MeshArray<double> x, y, z;
+
+  // Triangles, three vertex indices each.  Polygons are fanned.
+  MeshArray<unsigned> faces;
+
+  // Unique undirected edges, two vertex indices each with the smaller
+  // index first, sorted.  These are the polygon boundary edges; the
+  // diagonals introduced by fanning polygons into triangles are not
+  // included.
+  MeshArray<unsigned> edges;
+
+  // Optional per-edge colours, parallel to edges
+  std::vector<Colour> edge_colours;
+  Colour default_colour;
+
+  // The bounding box, as of the last update_bounds(); the loaders and
+  // cube() keep it up to date
+  Point3D lower, upper;
+};
+
+// Load an ASCII OBJ, or an ASCII or binary PLY, file into "mesh".  The
+// format is picked from the file contents (PLY files start with "ply").
+// The file is mapped rather than read and parsed in "threads" chunks
+// on the shared thread pool (0 means one per pool thread).  On failure returns false,
+// leaves "mesh" empty and describes the problem in "error".
+bool load_mesh(const std::string& path, Mesh& mesh, std::string& error,
+               unsigned threads = 0);
+
+#endif
@@ -0,0 +1,292 @@
+//---------------------------------------------------------------------------
+//
+// meshcache.hpp/meshcache.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "meshcache.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char MAGIC[4] = { 'A', '2', 'M', 'C' };
+static const uint32_t VERSION = 1;
+// Reads back differently on a machine of the other byte order
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Arrays start on multiples of this
+static const uint64_t ALIGN = 64;
+
+enum {
+  ARRAY_X,
+  ARRAY_Y,
+  ARRAY_Z,
+  ARRAY_EDGES,
+  ARRAY_FACES,
+  ARRAYS
+};
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  // The source file
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t source_hash;
+  // The mesh
+  uint64_t vertices, edges, faces;
+  double lower[3], upper[3];
+  // Where each array starts, from the start of the file
+  uint64_t offsets[ARRAYS];
+};
+
+static uint64_t align_up(uint64_t n)
+{
+  return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+std::string mesh_cache_path(const std::string& path)
+{
+  return path + ".a2cache";
+}
+
+// The size and modification time of "path"
+static bool source_stamp(const std::string& path, uint64_t& size,
+                         int64_t& mtime_ns)
+{
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+  mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+             st.st_mtimespec.tv_nsec;
+#else
+  mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+// A 64-bit FNV-1a style hash taken a word at a time, which is fast
+// enough to run over a large source file when its time changes
+static bool source_hash(const std::string& path, uint64_t& hash)
+{
+  MappedFile file;
+  std::string error;
+  if(!file.open(path, error)) {
+    return false;
+  }
+  const unsigned char *p = (const unsigned char *)file.data();
+  const size_t size = file.size();
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t h = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for(; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    h = (h ^ word) * prime;
+  }
+  for(; i < size; ++i) {
+    h = (h ^ p[i]) * prime;
+  }
+  hash = h;
+  return true;
+}
+
+// The array sizes in bytes for a mesh with the header's counts
+static void array_bytes(const CacheHeader& h, uint64_t bytes[ARRAYS])
+{
+  bytes[ARRAY_X] = bytes[ARRAY_Y] = bytes[ARRAY_Z] =
+    h.vertices * sizeof(double);
+  bytes[ARRAY_EDGES] = 2 * h.edges * sizeof(uint32_t);
+  bytes[ARRAY_FACES] = 3 * h.faces * sizeof(uint32_t);
+}
+
+// Check a mapped cache's header describes a file of its size that this
+// build can read
+static bool valid_header(const MappedFile& file, CacheHeader& h)
+{
+  if(file.size() < sizeof(h)) {
+    return false;
+  }
+  memcpy(&h, file.data(), sizeof(h));
+  if(memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+     h.byte_order != BYTE_ORDER_MARK || h.header_size != sizeof(h)) {
+    return false;
+  }
+  // Counts too large for the file, which also keeps their byte sizes
+  // from overflowing, and vertices the 32-bit indices can't all reach
+  if(h.vertices > file.size() / sizeof(double) ||
+     h.vertices > (uint64_t)UINT32_MAX + 1 ||
+     h.edges > file.size() / (2 * sizeof(uint32_t)) ||
+     h.faces > file.size() / (3 * sizeof(uint32_t))) {
+    return false;
+  }
+  uint64_t bytes[ARRAYS];
+  array_bytes(h, bytes);
+  for(int k = 0; k < ARRAYS; ++k) {
+    if(h.offsets[k] % ALIGN != 0 || h.offsets[k] < sizeof(h) ||
+       h.offsets[k] > file.size() || bytes[k] > file.size() - h.offsets[k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Check every edge and face index in a mapped cache with a valid
+// header names one of its vertices, so a damaged cache can't send the
+// pipeline outside its arrays
+static bool valid_indices(const MappedFile& file, const CacheHeader& h)
+{
+  const uint32_t *edges =
+    (const uint32_t *)(file.data() + h.offsets[ARRAY_EDGES]);
+  const uint32_t *faces =
+    (const uint32_t *)(file.data() + h.offsets[ARRAY_FACES]);
+  uint32_t top = 0;
+  for(uint64_t i = 0; i < 2 * h.edges; ++i) {
+    top = std::max(top, edges[i]);
+  }
+  for(uint64_t i = 0; i < 3 * h.faces; ++i) {
+    top = std::max(top, faces[i]);
+  }
+  return (h.edges == 0 && h.faces == 0) || top < h.vertices;
+}
+
+// Write "mesh" to "cache_path" as the cache of a source with the given
+// stamp and hash.  The file is written under a temporary name and
+// renamed into place, so a reader never sees half of one.
+static bool write_cache(const std::string& cache_path, const Mesh& mesh,
+                        uint64_t size, int64_t mtime_ns, uint64_t hash)
+{
+  CacheHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = VERSION;
+  h.byte_order = BYTE_ORDER_MARK;
+  h.header_size = sizeof(h);
+  h.source_size = size;
+  h.source_mtime_ns = mtime_ns;
+  h.source_hash = hash;
+  h.vertices = mesh.num_vertices();
+  h.edges = mesh.num_edges();
+  h.faces = mesh.num_faces();
+  for(int k = 0; k < 3; ++k) {
+    h.lower[k] = mesh.lower[k];
+    h.upper[k] = mesh.upper[k];
+  }
+
+  uint64_t bytes[ARRAYS];
+  array_bytes(h, bytes);
+  const void *arrays[ARRAYS] = {
+    mesh.x.data(), mesh.y.data(), mesh.z.data(),
+    mesh.edges.data(), mesh.faces.data()
+  };
+  uint64_t at = align_up(sizeof(h));
+  for(int k = 0; k < ARRAYS; ++k) {
+    h.offsets[k] = at;
+    at = align_up(at + bytes[k]);
+  }
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+  const std::string temp = cache_path + suffix;
+  std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out) {
+    return false;
+  }
+  static const char zeros[ALIGN] = { 0 };
+  out.write((const char *)&h, sizeof(h));
+  uint64_t written = sizeof(h);
+  for(int k = 0; k < ARRAYS; ++k) {
+    out.write(zeros, h.offsets[k] - written);
+    out.write((const char *)arrays[k], bytes[k]);
+    written = h.offsets[k] + bytes[k];
+  }
+  out.close();
+  if(!out || rename(temp.c_str(), cache_path.c_str()) != 0) {
+    remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Point "mesh"'s arrays into the mapped cache
+static void map_cache(const std::shared_ptr<const MappedFile>& file,
+                      const CacheHeader& h, Mesh& mesh)
+{
+  mesh.clear();
+  const char *base = file->data();
+  mesh.x.map(file, (const double *)(base + h.offsets[ARRAY_X]),
+             h.vertices);
+  mesh.y.map(file, (const double *)(base + h.offsets[ARRAY_Y]),
+             h.vertices);
+  mesh.z.map(file, (const double *)(base + h.offsets[ARRAY_Z]),
+             h.vertices);
+  mesh.edges.map(file, (const unsigned *)(base + h.offsets[ARRAY_EDGES]),
+                 2 * h.edges);
+  mesh.faces.map(file, (const unsigned *)(base + h.offsets[ARRAY_FACES]),
+                 3 * h.faces);
+  mesh.lower = Point3D(h.lower[0], h.lower[1], h.lower[2]);
+  mesh.upper = Point3D(h.upper[0], h.upper[1], h.upper[2]);
+}
+
+bool load_mesh_cached(const std::string& path, Mesh& mesh,
+                      std::string& error, unsigned threads,
+                      MeshCacheResult *result)
+{
+  MeshCacheResult how = MESH_CACHE_UNUSED;
+  const std::string cache_path = mesh_cache_path(path);
+  uint64_t size = 0, hash = 0;
+  int64_t mtime_ns = 0;
+  bool stamped = source_stamp(path, size, mtime_ns);
+  bool hashed = false;
+
+  std::shared_ptr<MappedFile> file(new MappedFile);
+  std::string ignored;
+  CacheHeader h;
+  if(stamped && file->open(cache_path, ignored) && valid_header(*file, h) &&
+     h.source_size == size && valid_indices(*file, h)) {
+    if(h.source_mtime_ns == mtime_ns) {
+      how = MESH_CACHE_HIT;
+    } else if(source_hash(path, hash)) {
+      hashed = true;
+      if(hash == h.source_hash) {
+        // Touched but not changed: keep the cache, with the new time
+        how = MESH_CACHE_REVALIDATED;
+        h.source_mtime_ns = mtime_ns;
+        std::fstream out(cache_path.c_str(),
+                         std::ios::in | std::ios::out | std::ios::binary);
+        out.write((const char *)&h, sizeof(h));
+      }
+    }
+  }
+  if(how == MESH_CACHE_HIT || how == MESH_CACHE_REVALIDATED) {
+    // Every frame reads the whole mesh, not just once front to back
+    file->prefetch();
+    map_cache(file, h, mesh);
+    if(result) {
+      *result = how;
+    }
+    return true;
+  }
+  file.reset();
+
+  if(!load_mesh(path, mesh, error, threads)) {
+    return false;
+  }
+  if(stamped && (hashed || source_hash(path, hash)) &&
+     write_cache(cache_path, mesh, size, mtime_ns, hash)) {
+    how = MESH_CACHE_WRITTEN;
+  }
+  if(result) {
+    *result = how;
+  }
+  return true;
+}
@@ -0,0 +1,59 @@
+//---------------------------------------------------------------------------
+//
+// meshcache.hpp/meshcache.cpp
+//
+// A binary cache of loaded meshes, so a large model is parsed once
+// rather than at every launch.  The cache of "bunny.ply" is
+// "bunny.ply.a2cache" next to it, written the first time the model is
+// loaded.  Loading from it maps the file and points the mesh's arrays
+// into the mapping: nothing is parsed or copied, and the pipeline
+// transforms the vertices straight out of the page cache.
+//
+// The file is a header followed by the arrays, each starting on a
+// 64-byte boundary: x, y and z as doubles, then the edges and the faces
+// as 32-bit indices, all in the machine's byte order.  The header holds
+// a magic number, a version, a byte order mark, the counts, the
+// bounding box, where each array starts, and the size, modification
+// time and a hash of the source file it was made from.
+//
+// A cache is used as it is while the source's size and modification
+// time match.  If only the time changed, the source is hashed: if the
+// contents are the same the cache's time is brought up to date and it
+// is still used, otherwise the source is parsed and the cache rewritten.
+// So is a cache whose counts don't fit the file or whose edges and
+// faces name vertices it doesn't have, which are checked once as it is
+// mapped.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_MESHCACHE_HPP
+#define CS488_MESHCACHE_HPP
+
+#include <string>
+#include "mesh.hpp"
+
+// How load_mesh_cached() got its mesh
+enum MeshCacheResult {
+  // Mapped from an up to date cache
+  MESH_CACHE_HIT,
+  // Mapped from a cache whose source was touched but not changed
+  MESH_CACHE_REVALIDATED,
+  // Parsed, and a cache written for next time
+  MESH_CACHE_WRITTEN,
+  // Parsed, but no cache could be written (e.g. the directory is
+  // read-only)
+  MESH_CACHE_UNUSED
+};
+
+// The cache file of the mesh file "path"
+std::string mesh_cache_path(const std::string& path);
+
+// Load "path" like load_mesh(), through its cache.  If "result" isn't
+// null it is set to how the mesh was loaded.  Failing to read or write
+// the cache only costs the time to parse the source; the function
+// fails, as load_mesh() does, only if the source can't be loaded.
+bool load_mesh_cached(const std::string& path, Mesh& mesh,
+                      std::string& error, unsigned threads = 0,
+                      MeshCacheResult *result = 0);
+
+#endif
@@ -0,0 +1,604 @@
+//---------------------------------------------------------------------------
+//
+// meshlod.hpp/meshlod.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "meshlod.hpp"
+#include "mappedfile.hpp"
+#include <algorithm>
+#include <queue>
+#include <fstream>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <unistd.h>
+
+static const char MAGIC[4] = { 'A', '2', 'L', 'D' };
+static const uint32_t VERSION = 1;
+// Reads back differently on a machine of the other byte order
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Arrays start on multiples of this
+static const uint64_t ALIGN = 64;
+
+// How much more straying from a boundary costs than from a face, so
+// outlines are the last to go
+static const double BOUNDARY_WEIGHT = 100;
+
+enum {
+  ARRAY_X,
+  ARRAY_Y,
+  ARRAY_Z,
+  ARRAY_EDGES,
+  ARRAY_FACES,
+  ARRAYS
+};
+
+struct LodHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint64_t levels;
+};
+
+// One entry of the table that follows the header
+struct LodRecord {
+  double error;
+  uint64_t vertices, edges, faces;
+  double lower[3], upper[3];
+  // Where each array starts, from the start of the file
+  uint64_t offsets[ARRAYS];
+};
+
+static uint64_t align_up(uint64_t n)
+{
+  return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+std::string lod_chain_path(const std::string& path)
+{
+  return path + ".a2lod";
+}
+
+/*
+ * Simplification
+ */
+
+// A symmetric 4x4 matrix, the upper triangle row by row, whose value
+// at a point is the weighted sum of its squared distances to planes
+struct Quadric {
+  double q[10];
+
+  Quadric()
+  {
+    std::fill(q, q + 10, 0.0);
+  }
+  // The plane a x + b y + c z + d = 0, (a, b, c) of unit length
+  void add_plane(double a, double b, double c, double d, double weight)
+  {
+    const double p[4] = { a, b, c, d };
+    int k = 0;
+    for(int i = 0; i < 4; ++i) {
+      for(int j = i; j < 4; ++j) {
+        q[k++] += weight * p[i] * p[j];
+      }
+    }
+  }
+  Quadric& operator +=(const Quadric& other)
+  {
+    for(int k = 0; k < 10; ++k) {
+      q[k] += other.q[k];
+    }
+    return *this;
+  }
+  double cost(const Point3D& p) const
+  {
+    const double x = p[0], y = p[1], z = p[2];
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+           2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+           q[7] * z * z + 2 * q[8] * z + q[9];
+  }
+};
+
+// Moving "from" onto "to", valid while neither end has changed since
+// it was queued
+struct Collapse {
+  double cost;
+  unsigned from, to;
+  unsigned from_version, to_version;
+
+  // The cheapest on top of a std::priority_queue
+  bool operator <(const Collapse& other) const
+  {
+    return cost > other.cost;
+  }
+};
+
+static void remove_value(std::vector<unsigned>& list, unsigned value)
+{
+  std::vector<unsigned>::iterator it =
+    std::find(list.begin(), list.end(), value);
+  if(it != list.end()) {
+    *it = list.back();
+    list.pop_back();
+  }
+}
+
+class Simplifier {
+public:
+  explicit Simplifier(const Mesh& mesh);
+  void run(LodChain& chain, size_t min_edges);
+
+private:
+  Point3D position(unsigned v) const
+  {
+    return m_mesh.vertex(v);
+  }
+  bool has(unsigned f, unsigned v) const
+  {
+    return m_faces[3 * f] == v || m_faces[3 * f + 1] == v ||
+           m_faces[3 * f + 2] == v;
+  }
+  Vector3D normal(unsigned f) const;
+  void queue(unsigned from, unsigned to);
+  bool flips(unsigned from, unsigned to) const;
+  void collapse(unsigned from, unsigned to);
+  void keep_level(LodChain& chain, double error);
+
+  const Mesh& m_mesh;
+  std::vector<Quadric> m_quadrics;
+  std::vector<unsigned> m_faces;
+  std::vector<bool> m_face_alive;
+  // Per vertex: the faces around it (some maybe dead), its neighbours
+  // along the edges left, and whether it is still there
+  std::vector< std::vector<unsigned> > m_vertex_faces, m_neighbours;
+  std::vector<bool> m_alive;
+  std::vector<unsigned> m_version;
+  std::priority_queue<Collapse> m_queue;
+  size_t m_edges;
+  std::vector<unsigned> m_remap;
+};
+
+Simplifier::Simplifier(const Mesh& mesh)
+  : m_mesh(mesh)
+  , m_faces(mesh.faces.begin(), mesh.faces.end())
+  , m_face_alive(mesh.num_faces(), true)
+  , m_alive(mesh.num_vertices(), true)
+  , m_version(mesh.num_vertices(), 0)
+  , m_edges(0)
+{
+  const size_t n = mesh.num_vertices();
+  const size_t nfaces = mesh.num_faces();
+  m_quadrics.resize(n);
+  m_vertex_faces.resize(n);
+  m_neighbours.resize(n);
+
+  // Every face's plane, and every edge of a face with the faces on
+  // each side
+  std::vector< std::pair<std::pair<unsigned, unsigned>, unsigned> > sides;
+  sides.reserve(3 * nfaces);
+  for(unsigned f = 0; f < nfaces; ++f) {
+    Vector3D nf = normal(f);
+    const double length = nf.length();
+    for(int k = 0; k < 3; ++k) {
+      const unsigned a = m_faces[3 * f + k], b = m_faces[3 * f + (k + 1) % 3];
+      m_vertex_faces[a].push_back(f);
+      sides.push_back(std::make_pair(std::make_pair(std::min(a, b),
+                                                    std::max(a, b)), f));
+    }
+    if(length == 0) {
+      continue;
+    }
+    nf = (1 / length) * nf;
+    const Point3D p = position(m_faces[3 * f]);
+    const double d = -(nf[0] * p[0] + nf[1] * p[1] + nf[2] * p[2]);
+    for(int k = 0; k < 3; ++k) {
+      m_quadrics[m_faces[3 * f + k]].add_plane(nf[0], nf[1], nf[2], d, 1);
+    }
+  }
+
+  // An edge of only one face is on the boundary: hold its ends to the
+  // plane through it square to the face
+  std::sort(sides.begin(), sides.end());
+  for(size_t i = 0; i < sides.size(); ) {
+    size_t j = i + 1;
+    while(j < sides.size() && sides[j].first == sides[i].first) {
+      ++j;
+    }
+    if(j == i + 1) {
+      const unsigned a = sides[i].first.first, b = sides[i].first.second;
+      const Point3D pa = position(a);
+      Vector3D side = (position(b) - pa).cross(normal(sides[i].second));
+      const double length = side.length();
+      if(length != 0) {
+        side = (1 / length) * side;
+        const double d = -(side[0] * pa[0] + side[1] * pa[1] +
+                           side[2] * pa[2]);
+        m_quadrics[a].add_plane(side[0], side[1], side[2], d,
+                                BOUNDARY_WEIGHT);
+        m_quadrics[b].add_plane(side[0], side[1], side[2], d,
+                                BOUNDARY_WEIGHT);
+      }
+    }
+    i = j;
+  }
+
+  for(size_t e = 0; e < mesh.num_edges(); ++e) {
+    const unsigned a = mesh.edges[2 * e], b = mesh.edges[2 * e + 1];
+    if(a == b) {
+      continue;
+    }
+    m_neighbours[a].push_back(b);
+    m_neighbours[b].push_back(a);
+    ++m_edges;
+  }
+  for(unsigned v = 0; v < n; ++v) {
+    for(size_t k = 0; k < m_neighbours[v].size(); ++k) {
+      queue(v, m_neighbours[v][k]);
+    }
+  }
+}
+
+Vector3D Simplifier::normal(unsigned f) const
+{
+  const Point3D a = position(m_faces[3 * f]);
+  return (position(m_faces[3 * f + 1]) - a).cross(
+           position(m_faces[3 * f + 2]) - a);
+}
+
+void Simplifier::queue(unsigned from, unsigned to)
+{
+  // Vertices on no face have nothing to say where they may go, so they
+  // stay
+  if(m_vertex_faces[from].empty()) {
+    return;
+  }
+  Quadric q = m_quadrics[from];
+  q += m_quadrics[to];
+  Collapse c;
+  c.cost = q.cost(position(to));
+  c.from = from;
+  c.to = to;
+  c.from_version = m_version[from];
+  c.to_version = m_version[to];
+  m_queue.push(c);
+}
+
+// Would moving "from" onto "to" turn one of its faces over?
+bool Simplifier::flips(unsigned from, unsigned to) const
+{
+  const Point3D p = position(to);
+  const std::vector<unsigned>& faces = m_vertex_faces[from];
+  for(size_t k = 0; k < faces.size(); ++k) {
+    const unsigned f = faces[k];
+    if(!m_face_alive[f] || has(f, to)) {
+      continue;
+    }
+    const Vector3D before = normal(f);
+    Point3D corners[3];
+    for(int i = 0; i < 3; ++i) {
+      const unsigned v = m_faces[3 * f + i];
+      corners[i] = v == from ? p : position(v);
+    }
+    const Vector3D after = (corners[1] - corners[0]).cross(
+                             corners[2] - corners[0]);
+    if(before.length2() != 0 && before.dot(after) <= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Simplifier::collapse(unsigned from, unsigned to)
+{
+  m_quadrics[to] += m_quadrics[from];
+  m_alive[from] = false;
+  ++m_version[to];
+
+  // Faces with both ends go; the rest take "to" in place of "from"
+  std::vector<unsigned>& faces = m_vertex_faces[to];
+  const std::vector<unsigned>& moved = m_vertex_faces[from];
+  for(size_t k = 0; k < moved.size(); ++k) {
+    const unsigned f = moved[k];
+    if(!m_face_alive[f]) {
+      continue;
+    }
+    if(has(f, to)) {
+      m_face_alive[f] = false;
+      continue;
+    }
+    for(int i = 0; i < 3; ++i) {
+      if(m_faces[3 * f + i] == from) {
+        m_faces[3 * f + i] = to;
+      }
+    }
+    faces.push_back(f);
+  }
+  std::vector<unsigned>().swap(m_vertex_faces[from]);
+  size_t kept = 0;
+  for(size_t k = 0; k < faces.size(); ++k) {
+    if(m_face_alive[faces[k]]) {
+      faces[kept++] = faces[k];
+    }
+  }
+  faces.resize(kept);
+
+  // The edge itself goes, and so does one of each pair of edges that
+  // end up joining the same vertices
+  std::vector<unsigned>& neighbours = m_neighbours[to];
+  remove_value(neighbours, from);
+  --m_edges;
+  const std::vector<unsigned>& others = m_neighbours[from];
+  for(size_t k = 0; k < others.size(); ++k) {
+    const unsigned w = others[k];
+    if(w == to) {
+      continue;
+    }
+    remove_value(m_neighbours[w], from);
+    if(std::find(neighbours.begin(), neighbours.end(), w) !=
+       neighbours.end()) {
+      --m_edges;
+    } else {
+      neighbours.push_back(w);
+      m_neighbours[w].push_back(to);
+    }
+  }
+  std::vector<unsigned>().swap(m_neighbours[from]);
+
+  for(size_t k = 0; k < neighbours.size(); ++k) {
+    queue(to, neighbours[k]);
+    queue(neighbours[k], to);
+  }
+}
+
+// Append what is left as a level
+void Simplifier::keep_level(LodChain& chain, double error)
+{
+  const size_t n = m_alive.size();
+  m_remap.assign(n, 0);
+  for(unsigned v = 0; v < n; ++v) {
+    m_remap[v] = m_alive[v] && !m_neighbours[v].empty();
+  }
+  for(size_t f = 0; f < m_face_alive.size(); ++f) {
+    if(m_face_alive[f]) {
+      for(int i = 0; i < 3; ++i) {
+        m_remap[m_faces[3 * f + i]] = 1;
+      }
+    }
+  }
+  // Renumber in the original order, so the new indices keep it
+  size_t count = 0;
+  for(unsigned v = 0; v < n; ++v) {
+    m_remap[v] = m_remap[v] ? (unsigned)count++ : UINT32_MAX;
+  }
+
+  chain.levels.push_back(LodLevel());
+  LodLevel& level = chain.levels.back();
+  level.error = error;
+  Mesh& mesh = level.mesh;
+  mesh.default_colour = m_mesh.default_colour;
+  mesh.x.resize(count);
+  mesh.y.resize(count);
+  mesh.z.resize(count);
+  double *x = mesh.x.writable(), *y = mesh.y.writable(),
+         *z = mesh.z.writable();
+  for(unsigned v = 0; v < n; ++v) {
+    if(m_remap[v] != UINT32_MAX) {
+      x[m_remap[v]] = m_mesh.x[v];
+      y[m_remap[v]] = m_mesh.y[v];
+      z[m_remap[v]] = m_mesh.z[v];
+    }
+  }
+
+  // Smaller index first and sorted, as the loaders leave them
+  std::vector< std::pair<unsigned, unsigned> > pairs;
+  pairs.reserve(m_edges);
+  for(unsigned v = 0; v < n; ++v) {
+    for(size_t k = 0; k < m_neighbours[v].size(); ++k) {
+      const unsigned w = m_neighbours[v][k];
+      if(v < w) {
+        pairs.push_back(std::make_pair(m_remap[v], m_remap[w]));
+      }
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  mesh.edges.resize(2 * pairs.size());
+  unsigned *edges = mesh.edges.writable();
+  for(size_t e = 0; e < pairs.size(); ++e) {
+    edges[2 * e] = pairs[e].first;
+    edges[2 * e + 1] = pairs[e].second;
+  }
+
+  for(size_t f = 0; f < m_face_alive.size(); ++f) {
+    if(m_face_alive[f]) {
+      for(int i = 0; i < 3; ++i) {
+        mesh.faces.push_back(m_remap[m_faces[3 * f + i]]);
+      }
+    }
+  }
+  mesh.update_bounds();
+}
+
+void Simplifier::run(LodChain& chain, size_t min_edges)
+{
+  double error = 0;
+  size_t target = m_edges / 2;
+  while(!m_queue.empty() && m_edges > min_edges) {
+    const Collapse c = m_queue.top();
+    m_queue.pop();
+    if(!m_alive[c.from] || !m_alive[c.to] ||
+       m_version[c.from] != c.from_version ||
+       m_version[c.to] != c.to_version || flips(c.from, c.to)) {
+      continue;
+    }
+    collapse(c.from, c.to);
+    error = std::max(error, std::sqrt(std::max(c.cost, 0.0)));
+    if(m_edges <= target) {
+      keep_level(chain, error);
+      target = m_edges / 2;
+    }
+  }
+  if(m_edges < chain.levels.back().mesh.num_edges()) {
+    keep_level(chain, error);
+  }
+}
+
+void build_lod_chain(const Mesh& mesh, LodChain& chain, size_t min_edges)
+{
+  chain.levels.clear();
+  chain.levels.push_back(LodLevel());
+  chain.levels[0].mesh = mesh;
+  chain.levels[0].mesh.edge_colours.clear();
+  chain.levels[0].error = 0;
+  if(mesh.num_faces() == 0) {
+    return;
+  }
+  Simplifier simplifier(mesh);
+  simplifier.run(chain, min_edges);
+}
+
+/*
+ * Files
+ */
+
+// The array sizes in bytes of a level with the record's counts
+static void array_bytes(const LodRecord& r, uint64_t bytes[ARRAYS])
+{
+  bytes[ARRAY_X] = bytes[ARRAY_Y] = bytes[ARRAY_Z] =
+    r.vertices * sizeof(double);
+  bytes[ARRAY_EDGES] = 2 * r.edges * sizeof(uint32_t);
+  bytes[ARRAY_FACES] = 3 * r.faces * sizeof(uint32_t);
+}
+
+bool write_lod_chain(const LodChain& chain, const std::string& path,
+                     std::string& error)
+{
+  LodHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = VERSION;
+  h.byte_order = BYTE_ORDER_MARK;
+  h.header_size = sizeof(h);
+  h.levels = chain.size();
+
+  std::vector<LodRecord> records(chain.size());
+  uint64_t at = align_up(sizeof(h) + records.size() * sizeof(LodRecord));
+  for(size_t l = 0; l < chain.size(); ++l) {
+    const Mesh& mesh = chain.levels[l].mesh;
+    LodRecord& r = records[l];
+    memset(&r, 0, sizeof(r));
+    r.error = chain.levels[l].error;
+    r.vertices = mesh.num_vertices();
+    r.edges = mesh.num_edges();
+    r.faces = mesh.num_faces();
+    for(int k = 0; k < 3; ++k) {
+      r.lower[k] = mesh.lower[k];
+      r.upper[k] = mesh.upper[k];
+    }
+    uint64_t bytes[ARRAYS];
+    array_bytes(r, bytes);
+    for(int k = 0; k < ARRAYS; ++k) {
+      r.offsets[k] = at;
+      at = align_up(at + bytes[k]);
+    }
+  }
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+  const std::string temp = path + suffix;
+  std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out) {
+    error = temp + ": can't be written";
+    return false;
+  }
+  static const char zeros[ALIGN] = { 0 };
+  out.write((const char *)&h, sizeof(h));
+  out.write((const char *)records.data(), records.size() * sizeof(LodRecord));
+  uint64_t written = sizeof(h) + records.size() * sizeof(LodRecord);
+  for(size_t l = 0; l < chain.size(); ++l) {
+    const Mesh& mesh = chain.levels[l].mesh;
+    const LodRecord& r = records[l];
+    uint64_t bytes[ARRAYS];
+    array_bytes(r, bytes);
+    const void *arrays[ARRAYS] = {
+      mesh.x.data(), mesh.y.data(), mesh.z.data(),
+      mesh.edges.data(), mesh.faces.data()
+    };
+    for(int k = 0; k < ARRAYS; ++k) {
+      out.write(zeros, r.offsets[k] - written);
+      out.write((const char *)arrays[k], bytes[k]);
+      written = r.offsets[k] + bytes[k];
+    }
+  }
+  out.close();
+  if(!out || rename(temp.c_str(), path.c_str()) != 0) {
+    remove(temp.c_str());
+    error = path + ": can't be written";
+    return false;
+  }
+  return true;
+}
+
+bool load_lod_chain(const std::string& path, LodChain& chain,
+                    std::string& error)
+{
+  std::shared_ptr<MappedFile> file(new MappedFile);
+  if(!file->open(path, error)) {
+    return false;
+  }
+  LodHeader h;
+  if(file->size() < sizeof(h)) {
+    error = path + ": not a level of detail file";
+    return false;
+  }
+  memcpy(&h, file->data(), sizeof(h));
+  if(memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+     h.byte_order != BYTE_ORDER_MARK || h.header_size != sizeof(h) ||
+     h.levels == 0 ||
+     h.levels > (file->size() - sizeof(h)) / sizeof(LodRecord)) {
+    error = path + ": not a level of detail file this build can read";
+    return false;
+  }
+  std::vector<LodRecord> records(h.levels);
+  memcpy(records.data(), file->data() + sizeof(h),
+         h.levels * sizeof(LodRecord));
+  for(size_t l = 0; l < records.size(); ++l) {
+    uint64_t bytes[ARRAYS];
+    array_bytes(records[l], bytes);
+    for(int k = 0; k < ARRAYS; ++k) {
+      const uint64_t offset = records[l].offsets[k];
+      if(offset % ALIGN != 0 || offset < sizeof(h) || offset > file->size() ||
+         bytes[k] > file->size() - offset) {
+        error = path + ": damaged level table";
+        return false;
+      }
+    }
+  }
+
+  // Any level may be drawn from one frame to the next
+  file->prefetch();
+  chain.levels.clear();
+  chain.levels.resize(records.size());
+  const char *base = file->data();
+  for(size_t l = 0; l < records.size(); ++l) {
+    const LodRecord& r = records[l];
+    Mesh& mesh = chain.levels[l].mesh;
+    chain.levels[l].error = r.error;
+    mesh.x.map(file, (const double *)(base + r.offsets[ARRAY_X]),
+               r.vertices);
+    mesh.y.map(file, (const double *)(base + r.offsets[ARRAY_Y]),
+               r.vertices);
+    mesh.z.map(file, (const double *)(base + r.offsets[ARRAY_Z]),
+               r.vertices);
+    mesh.edges.map(file, (const unsigned *)(base + r.offsets[ARRAY_EDGES]),
+                   2 * r.edges);
+    mesh.faces.map(file, (const unsigned *)(base + r.offsets[ARRAY_FACES]),
+                   3 * r.faces);
+    mesh.lower = Point3D(r.lower[0], r.lower[1], r.lower[2]);
+    mesh.upper = Point3D(r.upper[0], r.upper[1], r.upper[2]);
+  }
+  return true;
+}
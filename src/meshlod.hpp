@@ -0,0 +1,70 @@
+//---------------------------------------------------------------------------
+//
+// meshlod.hpp/meshlod.cpp
+//
+// Levels of detail for drawing a dense mesh that covers little of the
+// screen.  build_lod_chain() simplifies the mesh by quadric edge
+// collapse (Garland and Heckbert), offline (see a2lod.cpp): every
+// vertex carries the sum of the squared distances to the planes of
+// the faces around it (and, with a heavy weight, to planes standing on
+// the boundary edges), and the edge whose collapse adds the least to
+// that is collapsed first.  Each collapse moves one end of an edge
+// onto the other, so a level's vertices are some of the original ones
+// where they were, and collapses that would turn a face over are left
+// out.  A level is kept each time the edges left halve.
+//
+// A level's error is the square root of the largest quadric cost of
+// any collapse up to it: how far, in model units, a moved vertex may
+// be from the planes of the faces it stood on.  RenderPipeline::
+// set_lods() draws the coarsest level whose error covers less than a
+// pixel or so on screen.
+//
+// The chain is written to "bunny.ply.a2lod" as a header, a table of
+// the levels' errors, counts, bounding boxes and array places, and the
+// arrays: x, y and z as doubles, then edges and faces as 32-bit
+// indices, each on a 64-byte boundary.  Loading it maps the file.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_MESHLOD_HPP
+#define CS488_MESHLOD_HPP
+
+#include <vector>
+#include <string>
+#include "mesh.hpp"
+
+// One level of a chain: the mesh and how far its surface may stray
+// from the original's
+struct LodLevel {
+  Mesh mesh;
+  double error;
+};
+
+// The original mesh (error 0) first, then ever coarser levels
+struct LodChain {
+  std::vector<LodLevel> levels;
+
+  size_t size() const
+  {
+    return levels.size();
+  }
+};
+
+// The level of detail file of the mesh file "path"
+std::string lod_chain_path(const std::string& path);
+
+// Fill "chain" with "mesh" and its simplifications, each with about
+// half the edges of the one before, stopping at "min_edges" edges or
+// when no more edges can be collapsed.  Per-edge colours are dropped.
+// A mesh without faces gets only the one level.
+void build_lod_chain(const Mesh& mesh, LodChain& chain,
+                     size_t min_edges = 256);
+
+// Write "chain" to "path", or read one back by mapping it.  On failure
+// returns false and says why in "error".
+bool write_lod_chain(const LodChain& chain, const std::string& path,
+                     std::string& error);
+bool load_lod_chain(const std::string& path, LodChain& chain,
+                    std::string& error);
+
+#endif
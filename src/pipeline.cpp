@@ -0,0 +1,1738 @@
+//---------------------------------------------------------------------------
+//
+// pipeline.hpp/pipeline.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "pipeline.hpp"
+#include "threadpool.hpp"
+#include "profile.hpp"
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+Camera::Camera()
+  : near_plane(1)
+  , far_plane(10)
+{
+}
+
+Viewport::Viewport()
+  : x(0)
+  , y(0)
+  , width(0)
+  , height(0)
+  , left(0)
+  , right(0)
+  , top(0)
+  , bottom(0)
+{
+}
+
+Viewport::Viewport(int width, int height)
+  : x(0)
+  , y(0)
+  , width(width)
+  , height(height)
+  , left(0.05 * width)
+  , right(0.95 * width)
+  , top(0.05 * height)
+  , bottom(0.95 * height)
+{
+}
+
+Viewport::Viewport(int x, int y, int width, int height)
+  : x(x)
+  , y(y)
+  , width(width)
+  , height(height)
+  , left(x)
+  , right(x + width)
+  , top(y)
+  , bottom(y + height)
+{
+}
+
+View::View()
+  : camera(0)
+{
+}
+
+View::View(unsigned camera, const Viewport& viewport)
+  : camera(camera)
+  , viewport(viewport)
+{
+}
+
+Matrix4x4 perspective(double fov, double aspect, double near, double far)
+{
+  Matrix4x4 proj;
+  proj[0][0] = 1 / (tan(fov / 2)) / aspect;
+  proj[1][1] = 1 / (tan(fov / 2));
+  proj[2][2] = (far + near) / (far - near);
+  proj[2][3] = (-2 * far * near) / (far - near);
+  proj[3][2] = 1;
+  proj[3][3] = 0;
+  return proj;
+}
+
+void InstanceBuffer::clear()
+{
+  for(size_t k = 0; k < 12; ++k) {
+    m[k].clear();
+  }
+  colours.clear();
+}
+
+void InstanceBuffer::add(const Matrix4x4& model, const Colour& colour)
+{
+  for(size_t k = 0; k < 12; ++k) {
+    m[k].push_back(model.begin()[k]);
+  }
+  colours.push_back((float)colour.R());
+  colours.push_back((float)colour.G());
+  colours.push_back((float)colour.B());
+}
+
+void InstanceBuffer::set_model(size_t i, const Matrix4x4& model)
+{
+  for(size_t k = 0; k < 12; ++k) {
+    m[k][i] = model.begin()[k];
+  }
+}
+
+Matrix4x4 InstanceBuffer::model(size_t i) const
+{
+  Matrix4x4 ret;
+  for(size_t r = 0; r < 3; ++r) {
+    for(size_t c = 0; c < 4; ++c) {
+      ret[r][c] = m[4 * r + c][i];
+    }
+  }
+  ret.set_kind(Matrix4x4::AFFINE);
+  return ret;
+}
+
+// Vertices and edges handed to a thread at a time
+static const size_t VERTEX_GRAIN = 8192;
+static const size_t EDGE_GRAIN = 16384;
+// Instanced drawing hands out instances a chunk at a time, sized so a
+// chunk is around this many vertices.
+static const size_t INSTANCE_VERTICES = 4096;
+// Edges are culled in runs of this many, and the vertices a camera
+// needs flagged in blocks of this many; the grains are multiples of
+// both, so no chunk splits a run or a block
+static const size_t CLUSTER_EDGES = 256;
+static const size_t VERTEX_BLOCK = 1024;
+// How far past a plane, relative to the size of the numbers that place
+// a point there, a box must be for every point in it to get the same
+// outcode: far above the rounding of the transform in either precision
+static const double CULL_TOLERANCE = 1e-9;
+static const double CULL_TOLERANCE_FLOAT = 1e-4;
+// Lines split against a depth buffer, and faces checked against the
+// near plane, by a thread at a time
+static const size_t LINE_GRAIN = 4096;
+static const size_t FACE_GRAIN = 16384;
+// Smooth edges' faces meet at no more than this many degrees
+static const double CREASE_ANGLE = 30;
+
+PipelineStats::PipelineStats()
+  : vertices(0)
+  , edges(0)
+  , lines(0)
+  , instances(0)
+  , views(0)
+  , cameras(0)
+  , accepted(0)
+  , rejected(0)
+  , clipped(0)
+  , boxes_culled(0)
+  , boxes_inside(0)
+  , boxes_partial(0)
+  , transform_ns(0)
+  , clip_ns(0)
+  , emit_ns(0)
+  , merged(0)
+  , merge_ns(0)
+  , hidden(0)
+  , hide_ns(0)
+  , features(0)
+  , silhouettes(0)
+  , silhouette_ns(0)
+  , lod(0)
+  , lod_pixels(0)
+  , scratch_bytes(0)
+  , reused(false)
+{
+}
+
+void PipelineStats::add(const PipelineStats& other)
+{
+  vertices += other.vertices;
+  edges += other.edges;
+  lines += other.lines;
+  instances += other.instances;
+  accepted += other.accepted;
+  rejected += other.rejected;
+  clipped += other.clipped;
+  boxes_culled += other.boxes_culled;
+  boxes_inside += other.boxes_inside;
+  boxes_partial += other.boxes_partial;
+  transform_ns += other.transform_ns;
+  clip_ns += other.clip_ns;
+  emit_ns += other.emit_ns;
+  merged += other.merged;
+  merge_ns += other.merge_ns;
+  hidden += other.hidden;
+  hide_ns += other.hide_ns;
+  features += other.features;
+  silhouettes += other.silhouettes;
+  silhouette_ns += other.silhouette_ns;
+  scratch_bytes += other.scratch_bytes;
+  views = std::max(views, other.views);
+  cameras = std::max(cameras, other.cameras);
+  lod = std::min(lod, other.lod);
+  lod_pixels = std::max(lod_pixels, other.lod_pixels);
+  reused = reused && other.reused;
+}
+
+RenderPipeline::RenderPipeline()
+  : m_mesh(0)
+  , m_source(0)
+  , m_lods(0)
+  , m_lod_pixels(1)
+  , m_instances(0)
+  , m_cameras(1)
+  , m_views(1)
+  , m_threads(0)
+  , m_dirty(DIRTY_MESH | DIRTY_MVP | DIRTY_VIEWPORT)
+  , m_clock(0)
+  , m_followed(0)
+  , m_precision(PRECISION_DOUBLE)
+  , m_merge(false)
+  , m_hidden(false)
+  , m_feature_edges(false)
+  , m_features_mesh(0)
+  , m_chunks(0)
+  , m_offsets(0)
+  , m_scratch(0)
+  , m_instance_chunks(0)
+  , m_line_depths(0)
+{
+  std::fill(m_changed, m_changed + DIRTY_KINDS, 0);
+}
+
+void RenderPipeline::changed(unsigned flags)
+{
+  m_dirty |= flags;
+  ++m_clock;
+  for(unsigned k = 0; k < DIRTY_KINDS; ++k) {
+    if(flags & 1u << k) {
+      m_changed[k] = m_clock;
+    }
+  }
+}
+
+void RenderPipeline::follow(const RenderPipeline& leader)
+{
+  m_threads = leader.m_threads;
+  unsigned flags = 0;
+  for(unsigned k = 0; k < DIRTY_KINDS; ++k) {
+    if(leader.m_changed[k] > m_followed) {
+      flags |= 1u << k;
+    }
+  }
+  m_followed = leader.m_clock;
+
+  // Only set_precision() changes the mesh's kind of setting
+  if(flags & DIRTY_MESH) {
+    m_precision = leader.m_precision;
+  }
+  if(flags & DIRTY_MVP) {
+    m_M = leader.m_M;
+    m_cameras = leader.m_cameras;
+  }
+  if(flags & DIRTY_VIEWPORT) {
+    m_views = leader.m_views;
+    m_merge = leader.m_merge;
+    m_hidden = leader.m_hidden;
+    m_feature_edges = leader.m_feature_edges;
+    m_lod_pixels = leader.m_lod_pixels;
+  }
+  if(flags & DIRTY_INSTANCES) {
+    m_instances = leader.m_instances;
+  }
+  m_dirty |= flags;
+}
+
+void RenderPipeline::set_mesh(const Mesh *mesh)
+{
+  m_source = mesh;
+  if(!m_lods) {
+    m_mesh = mesh;
+  }
+  m_dirty |= DIRTY_MESH;
+}
+
+void RenderPipeline::set_model(const Matrix4x4& model)
+{
+  m_M = model;
+  changed(DIRTY_MVP);
+}
+
+void RenderPipeline::set_camera(const Camera& camera)
+{
+  set_camera(0, camera);
+}
+
+void RenderPipeline::set_camera(unsigned index, const Camera& camera)
+{
+  if(index >= m_cameras.size()) {
+    m_cameras.resize(index + 1);
+  }
+  m_cameras[index] = camera;
+  changed(DIRTY_MVP);
+}
+
+void RenderPipeline::set_viewport(const Viewport& viewport)
+{
+  m_views.assign(1, View(0, viewport));
+  changed(DIRTY_VIEWPORT);
+}
+
+void RenderPipeline::set_views(const std::vector<View>& views)
+{
+  m_views = views;
+  changed(DIRTY_VIEWPORT);
+}
+
+void RenderPipeline::set_instances(const InstanceBuffer *instances)
+{
+  m_instances = instances;
+  changed(DIRTY_INSTANCES);
+}
+
+void RenderPipeline::set_threads(unsigned threads)
+{
+  m_threads = threads;
+}
+
+void RenderPipeline::set_merge_lines(bool merge)
+{
+  if(merge != m_merge) {
+    m_merge = merge;
+    changed(DIRTY_VIEWPORT);
+  }
+}
+
+void RenderPipeline::set_hidden_lines(bool hidden)
+{
+  if(hidden != m_hidden) {
+    m_hidden = hidden;
+    changed(DIRTY_VIEWPORT);
+  }
+}
+
+void RenderPipeline::set_feature_edges(bool features)
+{
+  if(features != m_feature_edges) {
+    m_feature_edges = features;
+    changed(DIRTY_VIEWPORT);
+  }
+}
+
+void RenderPipeline::set_lods(const LodChain *lods)
+{
+  m_lods = lods && !lods->levels.empty() ? lods : 0;
+  if(!m_lods) {
+    m_mesh = m_source;
+  }
+  m_stats.lod = 0;
+  m_dirty |= DIRTY_MESH;
+}
+
+void RenderPipeline::set_lod_pixels(double pixels)
+{
+  m_lod_pixels = pixels;
+  changed(DIRTY_VIEWPORT);
+}
+
+void RenderPipeline::set_precision(Precision precision)
+{
+  if(precision != m_precision) {
+    m_precision = precision;
+    changed(DIRTY_MESH | DIRTY_MVP);
+  }
+}
+
+// The viewport walls in normalized device coordinates
+static ClipPlanes clip_planes(const Viewport& viewport)
+{
+  const double hw = viewport.width / 2.0;
+  const double hh = viewport.height / 2.0;
+  const double cx = viewport.x + hw;
+  const double cy = viewport.y + hh;
+
+  ClipPlanes planes;
+  planes.left = (viewport.left - cx) / hw;
+  planes.right = (viewport.right - cx) / hw;
+  planes.top = (viewport.top - cy) / hh;
+  planes.bottom = (viewport.bottom - cy) / hh;
+  return planes;
+}
+
+// Classify "count" clip space points against a view's walls and map
+// the ones inside its frustum to the window.  Only those are divided
+// here; clipped edges divide their new endpoints themselves.
+template<class S>
+static void map_to_window(double sx, double tx, double sy, double ty,
+                          const ClipPlanes& planes, size_t count,
+                          const S *x, const S *y, const S *z, const S *w,
+                          unsigned char *codes, double *wx, double *wy)
+{
+  compute_outcodes(planes, count, x, y, z, w, codes);
+  for(size_t i = 0; i < count; ++i) {
+    if(codes[i] == 0) {
+      wx[i] = (double)x[i] / w[i] * sx + tx;
+      wy[i] = (double)y[i] / w[i] * sy + ty;
+    }
+  }
+}
+
+void RenderPipeline::allocate_clip(ClipArrays& clip, size_t count)
+{
+  if(m_precision == PRECISION_FLOAT) {
+    clip.fx = m_arena.allocate<float>(count);
+    clip.fy = m_arena.allocate<float>(count);
+    clip.fz = m_arena.allocate<float>(count);
+    clip.fw = m_arena.allocate<float>(count);
+    clip.x = clip.y = clip.z = clip.w = 0;
+  } else {
+    clip.x = m_arena.allocate<double>(count);
+    clip.y = m_arena.allocate<double>(count);
+    clip.z = m_arena.allocate<double>(count);
+    clip.w = m_arena.allocate<double>(count);
+    clip.fx = clip.fy = clip.fz = clip.fw = 0;
+  }
+}
+
+void RenderPipeline::map_view(const ViewPass& view, const ClipArrays& clip,
+                              size_t begin, size_t count,
+                              unsigned char *codes, double *wx,
+                              double *wy) const
+{
+  if(clip.fx) {
+    map_to_window(view.sx, view.tx, view.sy, view.ty, view.planes, count,
+                  clip.fx + begin, clip.fy + begin, clip.fz + begin,
+                  clip.fw + begin, codes, wx, wy);
+  } else {
+    map_to_window(view.sx, view.tx, view.sy, view.ty, view.planes, count,
+                  clip.x + begin, clip.y + begin, clip.z + begin,
+                  clip.w + begin, codes, wx, wy);
+  }
+}
+
+// The translation taking points relative to "origin" back to where
+// they are
+static Matrix4x4 rebasing(const Point3D& origin)
+{
+  Matrix4x4 rebase;
+  for(size_t k = 0; k < 3; ++k) {
+    rebase[k][3] = origin[k];
+  }
+  rebase.set_kind(Matrix4x4::RIGID);
+  return rebase;
+}
+
+void RenderPipeline::rebase_mesh()
+{
+  const Mesh& mesh = *m_mesh;
+  const size_t count = mesh.num_vertices();
+  Point3D lower, upper;
+  if(count > 0) {
+    lower = upper = Point3D(mesh.x[0], mesh.y[0], mesh.z[0]);
+  }
+  for(size_t i = 1; i < count; ++i) {
+    lower[0] = std::min(lower[0], mesh.x[i]);
+    lower[1] = std::min(lower[1], mesh.y[i]);
+    lower[2] = std::min(lower[2], mesh.z[i]);
+    upper[0] = std::max(upper[0], mesh.x[i]);
+    upper[1] = std::max(upper[1], mesh.y[i]);
+    upper[2] = std::max(upper[2], mesh.z[i]);
+  }
+  m_origin = lower + 0.5 * (upper - lower);
+
+  m_fx.resize(count);
+  m_fy.resize(count);
+  m_fz.resize(count);
+  for(size_t i = 0; i < count; ++i) {
+    m_fx[i] = (float)(mesh.x[i] - m_origin[0]);
+    m_fy[i] = (float)(mesh.y[i] - m_origin[1]);
+    m_fz[i] = (float)(mesh.z[i] - m_origin[2]);
+  }
+}
+
+void RenderPipeline::build_clusters()
+{
+  const Mesh& mesh = *m_mesh;
+  const unsigned *edges = mesh.edges.data();
+  const size_t nedges = mesh.num_edges();
+  const size_t count = (nedges + CLUSTER_EDGES - 1) / CLUSTER_EDGES;
+  m_cluster_first.resize(count);
+  m_cluster_last.resize(count);
+  for(int k = 0; k < 3; ++k) {
+    m_box_lower[k].resize(count);
+    m_box_upper[k].resize(count);
+  }
+
+  ThreadPool::shared().parallel_for(count, 64,
+                                    [&](size_t begin, size_t end, unsigned) {
+    for(size_t c = begin; c < end; ++c) {
+      const size_t first = 2 * c * CLUSTER_EDGES;
+      const size_t last = 2 * std::min((c + 1) * CLUSTER_EDGES, nedges);
+      unsigned lowest = edges[first], highest = edges[first];
+      double lo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+      double hi[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+      for(size_t i = first; i < last; ++i) {
+        const unsigned v = edges[i];
+        lowest = std::min(lowest, v);
+        highest = std::max(highest, v);
+        const double p[3] = { mesh.x[v], mesh.y[v], mesh.z[v] };
+        for(int k = 0; k < 3; ++k) {
+          lo[k] = std::min(lo[k], p[k]);
+          hi[k] = std::max(hi[k], p[k]);
+        }
+      }
+      m_cluster_first[c] = lowest;
+      m_cluster_last[c] = highest;
+      for(int k = 0; k < 3; ++k) {
+        m_box_lower[k][c] = lo[k];
+        m_box_upper[k][c] = hi[k];
+      }
+    }
+  }, m_threads);
+
+  const double *const lower[3] = {
+    m_box_lower[0].data(), m_box_lower[1].data(), m_box_lower[2].data()
+  };
+  const double *const upper[3] = {
+    m_box_upper[0].data(), m_box_upper[1].data(), m_box_upper[2].data()
+  };
+  m_clusters.build(count, lower, upper);
+
+  const unsigned *faces = mesh.faces.data();
+  const size_t corners = 3 * mesh.num_faces();
+  m_face_blocks.assign(
+    (mesh.num_vertices() + VERTEX_BLOCK - 1) / VERTEX_BLOCK, 0);
+  for(size_t i = 0; i < corners; ++i) {
+    m_face_blocks[faces[i] / VERTEX_BLOCK] = 1;
+  }
+}
+
+// Each instance's box is the box around the mesh's edges taken through
+// its matrix.  Instances come in any order, so the tree sorts them.
+void RenderPipeline::build_instance_boxes()
+{
+  const InstanceBuffer& instances = *m_instances;
+  const size_t count = instances.size();
+  const Point3D& lower = m_clusters.lower();
+  const Point3D& upper = m_clusters.upper();
+  const Point3D centre = lower + 0.5 * (upper - lower);
+  const Vector3D extent = 0.5 * (upper - lower);
+  for(int k = 0; k < 3; ++k) {
+    m_box_lower[k].resize(count);
+    m_box_upper[k].resize(count);
+  }
+
+  for(size_t i = 0; i < count; ++i) {
+    for(int r = 0; r < 3; ++r) {
+      double c = instances.m[4 * r + 3][i], e = 0;
+      for(int k = 0; k < 3; ++k) {
+        const double m = instances.m[4 * r + k][i];
+        c += m * centre[k];
+        e += std::fabs(m) * extent[k];
+      }
+      m_box_lower[r][i] = c - e;
+      m_box_upper[r][i] = c + e;
+    }
+  }
+
+  const double *const boxes_lower[3] = {
+    m_box_lower[0].data(), m_box_lower[1].data(), m_box_lower[2].data()
+  };
+  const double *const boxes_upper[3] = {
+    m_box_upper[0].data(), m_box_upper[1].data(), m_box_upper[2].data()
+  };
+  m_instance_boxes.build(count, boxes_lower, boxes_upper, true);
+}
+
+double RenderPipeline::cull_tolerance() const
+{
+  return m_precision == PRECISION_FLOAT ? CULL_TOLERANCE_FLOAT :
+                                          CULL_TOLERANCE;
+}
+
+// Whether "drawn" flags any edge of run k
+static bool run_drawn(const unsigned char *drawn, size_t k, size_t nedges)
+{
+  const unsigned char *first = drawn + k * CLUSTER_EDGES;
+  const unsigned char *last =
+    drawn + std::min((k + 1) * CLUSTER_EDGES, nedges);
+  return std::find(first, last, 1) != last;
+}
+
+size_t RenderPipeline::cull_clusters()
+{
+  const size_t count = m_mesh->num_vertices();
+  const size_t nclusters = m_clusters.size();
+  const size_t nblocks = (count + VERTEX_BLOCK - 1) / VERTEX_BLOCK;
+  // Single precision points are transformed relative to m_origin, so
+  // their rounding grows with their distance from it
+  const Point3D origin =
+    m_precision == PRECISION_FLOAT ? m_origin : Point3D();
+
+  BoxCounts counts;
+  for(size_t v = 0; v < m_view_passes.size(); ++v) {
+    ViewPass& view = m_view_passes[v];
+    view.classes = m_arena.allocate<unsigned char>(nclusters);
+    const Frustum frustum(m_camera_passes[view.camera].mvp, view.planes,
+                          cull_tolerance(), origin);
+    m_clusters.classify(frustum, view.classes, counts);
+  }
+  m_stats.boxes_culled = counts.outside;
+  m_stats.boxes_inside = counts.inside;
+  m_stats.boxes_partial = counts.partial;
+
+  // A run not culled by some view of a camera, with an edge the camera
+  // draws, needs the blocks from its first vertex's to its last's:
+  // count one in at the first and one out after the last, and the
+  // blocks needed are those with a count running over them.  Hiding
+  // lines, every face is drawn into the depth buffer, seen or not, so
+  // the blocks with a face's corner in are needed too.
+  const size_t nedges = m_mesh->num_edges();
+  const bool faces = m_hidden && m_mesh->num_faces() != 0;
+  int *marks = m_arena.allocate<int>(nblocks + 1);
+  size_t transformed = 0;
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    CameraPass& camera = m_camera_passes[c];
+    if(!camera.used) {
+      continue;
+    }
+    std::fill(marks, marks + nblocks + 1, 0);
+    for(size_t v = 0; v < m_view_passes.size(); ++v) {
+      const ViewPass& view = m_view_passes[v];
+      if(view.camera != c) {
+        continue;
+      }
+      for(size_t k = 0; k < nclusters; ++k) {
+        if(view.classes[k] != BOX_OUTSIDE &&
+           (!camera.drawn || run_drawn(camera.drawn, k, nedges))) {
+          ++marks[m_cluster_first[k] / VERTEX_BLOCK];
+          --marks[m_cluster_last[k] / VERTEX_BLOCK + 1];
+        }
+      }
+    }
+    camera.needed = m_arena.allocate<unsigned char>(nblocks);
+    int running = 0;
+    for(size_t b = 0; b < nblocks; ++b) {
+      running += marks[b];
+      camera.needed[b] = running > 0 || (faces && m_face_blocks[b]);
+      if(camera.needed[b]) {
+        transformed += std::min(VERTEX_BLOCK, count - b * VERTEX_BLOCK);
+      }
+    }
+  }
+  return transformed;
+}
+
+// The eye is where the camera's view matrix, built from lookFrom and
+// lookAt (see Viewer::set_view), puts the centre of projection: the
+// origin of eye space, taken back through the view and model matrices
+// to the mesh.
+void RenderPipeline::select_edges()
+{
+  double start = now_ns();
+  if(m_features_mesh != m_mesh) {
+    m_features.build(*m_mesh, CREASE_ANGLE, m_threads);
+    m_features_mesh = m_mesh;
+  }
+  m_stats.features = m_features.features();
+  // Nothing to leave out when every edge is a feature
+  if(m_features.features() == m_features.edges()) {
+    m_stats.silhouette_ns = now_ns() - start;
+    return;
+  }
+
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    CameraPass& camera = m_camera_passes[c];
+    if(!camera.used) {
+      continue;
+    }
+    const Point3D eye =
+      (m_cameras[c].view * m_M).invert() * Point3D();
+    camera.drawn = m_arena.allocate<unsigned char>(m_features.edges());
+    m_stats.silhouettes += m_features.select(eye, camera.drawn, m_arena,
+                                             m_threads);
+  }
+  m_stats.silhouette_ns = now_ns() - start;
+}
+
+// Take the needed vertices of [begin, end) to the camera's clip space,
+// then classify and map them for each view looking through it while
+// they are still in cache.
+void RenderPipeline::transform_chunk(unsigned camera, size_t begin,
+                                     size_t end)
+{
+  const Mesh& mesh = *m_mesh;
+  const CameraPass& pass = m_camera_passes[camera];
+  const ClipArrays& clip = pass.clip;
+
+  // Each run of needed blocks in one go
+  for(size_t first = begin; first < end; ) {
+    if(!pass.needed[first / VERTEX_BLOCK]) {
+      first += VERTEX_BLOCK;
+      continue;
+    }
+    size_t last = first + VERTEX_BLOCK;
+    while(last < end && pass.needed[last / VERTEX_BLOCK]) {
+      last += VERTEX_BLOCK;
+    }
+    last = std::min(last, end);
+    const size_t n = last - first;
+
+    if(clip.fx) {
+      transform_points(pass.mvp_f, n, &m_fx[first], &m_fy[first],
+                       &m_fz[first], clip.fx + first, clip.fy + first,
+                       clip.fz + first, clip.fw + first);
+    } else {
+      transform_points(pass.mvp, n, &mesh.x[first], &mesh.y[first],
+                       &mesh.z[first], clip.x + first, clip.y + first,
+                       clip.z + first, clip.w + first);
+    }
+    for(size_t v = 0; v < m_view_passes.size(); ++v) {
+      const ViewPass& view = m_view_passes[v];
+      if(view.camera != camera) {
+        continue;
+      }
+      map_view(view, clip, first, n, view.codes + first, view.wx + first,
+               view.wy + first);
+    }
+    first = last;
+  }
+}
+
+// First pass over a view's edges [begin, end): classify them and count
+// the lines they will produce.  Runs of edges culled or accepted whole
+// are counted as they are; in the rest, the few edges that need
+// clipping are clipped to see whether anything is left of them.
+void RenderPipeline::count_chunk(size_t view, size_t begin, size_t end,
+                                 EdgeChunk& chunk)
+{
+  const unsigned *edges = m_mesh->edges.data();
+  const ViewPass& pass = m_view_passes[view];
+  const unsigned char *codes = pass.codes;
+  const unsigned char *classes = pass.classes;
+  const unsigned char *drawn = m_camera_passes[pass.camera].drawn;
+
+  size_t accepted = 0, rejected = 0, clipped = 0;
+  for(size_t first = begin; first < end; first += CLUSTER_EDGES) {
+    const size_t last = std::min(first + CLUSTER_EDGES, end);
+    const unsigned char box = classes[first / CLUSTER_EDGES];
+    if(box == BOX_OUTSIDE) {
+      rejected += last - first;
+      continue;
+    }
+    if(box == BOX_INSIDE) {
+      if(!drawn) {
+        accepted += last - first;
+        continue;
+      }
+      for(size_t i = first; i < last; ++i) {
+        accepted += drawn[i];
+      }
+      continue;
+    }
+
+    for(size_t i = first; i < last; ++i) {
+      if(drawn && !drawn[i]) {
+        continue;
+      }
+      unsigned a = edges[2 * i];
+      unsigned b = edges[2 * i + 1];
+      unsigned char ca = codes[a], cb = codes[b];
+
+      // Both ends outside the same plane
+      if(ca & cb) {
+        ++rejected;
+        continue;
+      }
+
+      // Both ends inside every plane
+      if((ca | cb) == 0) {
+        ++accepted;
+        continue;
+      }
+
+      double pa[4], pb[4];
+      if(clip_edge(view, a, b, pa, pb)) {
+        ++clipped;
+      } else {
+        ++rejected;
+      }
+    }
+  }
+  chunk.accepted = accepted;
+  chunk.rejected = rejected;
+  chunk.clipped = clipped;
+}
+
+// Clip edge a-b to a view, leaving the clipped clip space endpoints in
+// pa and pb.  Returns false if nothing of it is left.
+bool RenderPipeline::clip_edge(size_t view, unsigned a, unsigned b,
+                               double pa[4], double pb[4]) const
+{
+  const CameraPass& pass = m_camera_passes[m_view_passes[view].camera];
+  pass.clip.get(a, pa);
+  pass.clip.get(b, pb);
+  return clip_segment(m_view_passes[view].planes, pa, pb) &&
+         pa[3] > 0 && pb[3] > 0;
+}
+
+// Second pass: write the chunk's lines, in edge order, to its slice of
+// the output starting at line "first", and for hidden-line drawing the
+// 1/w of their ends.  Clipped edges are clipped again; they are few,
+// and keeping their lines from the first pass would need memory per
+// chunk sized for the worst case.
+void RenderPipeline::emit_chunk(size_t view, size_t begin, size_t end,
+                                size_t first)
+{
+  const Mesh& mesh = *m_mesh;
+  const ViewPass& pass = m_view_passes[view];
+  const unsigned char *codes = pass.codes;
+  const unsigned char *classes = pass.classes;
+  const unsigned *edges = mesh.edges.data();
+  const double *wx = pass.wx, *wy = pass.wy;
+  const ClipArrays& clip = m_camera_passes[pass.camera].clip;
+  const unsigned char *drawn = m_camera_passes[pass.camera].drawn;
+  double *points = m_out.points.data() + 4 * first;
+  float *colours = m_out.colours.data() + 3 * first;
+  float *depths = m_line_depths ? m_line_depths + 2 * first : 0;
+  const double sx = pass.sx, tx = pass.tx;
+  const double sy = pass.sy, ty = pass.ty;
+
+  for(size_t run = begin; run < end; run += CLUSTER_EDGES) {
+    const size_t last = std::min(run + CLUSTER_EDGES, end);
+    const unsigned char box = classes[run / CLUSTER_EDGES];
+    if(box == BOX_OUTSIDE) {
+      continue;
+    }
+
+    for(size_t i = run; i < last; ++i) {
+      if(drawn && !drawn[i]) {
+        continue;
+      }
+      unsigned a = edges[2 * i];
+      unsigned b = edges[2 * i + 1];
+
+      double wa = 0, wb = 0;
+      if(box == BOX_INSIDE || (codes[a] | codes[b]) == 0) {
+        points[0] = wx[a];
+        points[1] = wy[a];
+        points[2] = wx[b];
+        points[3] = wy[b];
+        if(depths) {
+          wa = clip.get_w(a);
+          wb = clip.get_w(b);
+        }
+      } else {
+        double pa[4], pb[4];
+        if((codes[a] & codes[b]) || !clip_edge(view, a, b, pa, pb)) {
+          continue;
+        }
+        points[0] = pa[0] / pa[3] * sx + tx;
+        points[1] = pa[1] / pa[3] * sy + ty;
+        points[2] = pb[0] / pb[3] * sx + tx;
+        points[3] = pb[1] / pb[3] * sy + ty;
+        wa = pa[3];
+        wb = pb[3];
+      }
+      Colour c = mesh.edge_colour(i);
+      colours[0] = (float)c.R();
+      colours[1] = (float)c.G();
+      colours[2] = (float)c.B();
+      points += 4;
+      colours += 3;
+      if(depths) {
+        depths[0] = (float)(1 / wa);
+        depths[1] = (float)(1 / wb);
+        depths += 2;
+      }
+    }
+  }
+}
+
+// Draw instances [begin, end): each one is transformed once per camera
+// some view of which sees it, then classified, clipped and mapped to
+// the window for each view in the thread's scratch, and its lines
+// appended to the view's chunk in edge order.  Instances wholly inside
+// a view skip the classification and clipping.
+void RenderPipeline::instance_chunk(size_t begin, size_t end,
+                                    InstanceScratch& scratch,
+                                    InstanceChunk *chunks, size_t stride)
+{
+  const Mesh& mesh = *m_mesh;
+  const size_t count = mesh.num_vertices();
+  const size_t nedges = mesh.num_edges();
+  const unsigned *edges = mesh.edges.data();
+  const size_t nviews = m_view_passes.size();
+
+  const ClipArrays& clip = scratch.clip;
+  const Matrix4x4 rebase = rebasing(m_origin);
+  double *wx = scratch.sx, *wy = scratch.sy;
+  unsigned char *codes = scratch.codes;
+
+  for(size_t v = 0; v < nviews; ++v) {
+    InstanceChunk& chunk = chunks[v * stride];
+    chunk.lines = chunk.accepted = chunk.rejected = chunk.clipped = 0;
+  }
+
+  for(size_t n = begin; n < end; ++n) {
+    const float *rgb = &m_instances->colours[3 * n];
+    for(unsigned c = 0; c < m_camera_passes.size(); ++c) {
+      const CameraPass& camera = m_camera_passes[c];
+      if(!camera.used) {
+        continue;
+      }
+      bool seen = false;
+      for(size_t v = 0; v < nviews && !seen; ++v) {
+        const ViewPass& view = m_view_passes[v];
+        seen = view.camera == c && view.classes[n] != BOX_OUTSIDE;
+      }
+      if(!seen) {
+        for(size_t v = 0; v < nviews; ++v) {
+          if(m_view_passes[v].camera == c) {
+            chunks[v * stride].rejected += nedges;
+          }
+        }
+        continue;
+      }
+      double mvp[16];
+      for(size_t k = 0; k < 16; ++k) {
+        mvp[k] = camera.instance_mvp[k][n];
+      }
+      if(clip.fx) {
+        // The rebasing is composed in double precision, per instance
+        Matrix4x4 rebased = Matrix4x4(mvp) * rebase;
+        transform_points(Matrix4x4f(rebased), count, m_fx.data(),
+                         m_fy.data(), m_fz.data(), clip.fx, clip.fy,
+                         clip.fz, clip.fw);
+      } else {
+        transform_points(Matrix4x4(mvp), count, mesh.x.data(),
+                         mesh.y.data(), mesh.z.data(), clip.x, clip.y,
+                         clip.z, clip.w);
+      }
+
+      for(size_t v = 0; v < nviews; ++v) {
+        const ViewPass& view = m_view_passes[v];
+        if(view.camera != c) {
+          continue;
+        }
+        InstanceChunk& chunk = chunks[v * stride];
+        if(view.classes[n] == BOX_OUTSIDE) {
+          chunk.rejected += nedges;
+          continue;
+        }
+        const double sx = view.sx, tx = view.tx;
+        const double sy = view.sy, ty = view.ty;
+        map_view(view, clip, 0, count, codes, wx, wy);
+
+        double *points = chunk.points + 4 * chunk.lines;
+        float *colours = chunk.colours + 3 * chunk.lines;
+        size_t accepted = 0, rejected = 0, clipped = 0;
+        if(view.classes[n] == BOX_INSIDE) {
+          for(size_t i = 0; i < nedges; ++i) {
+            unsigned a = edges[2 * i];
+            unsigned b = edges[2 * i + 1];
+            points[0] = wx[a];
+            points[1] = wy[a];
+            points[2] = wx[b];
+            points[3] = wy[b];
+            colours[0] = rgb[0];
+            colours[1] = rgb[1];
+            colours[2] = rgb[2];
+            points += 4;
+            colours += 3;
+          }
+          accepted = nedges;
+        } else {
+          for(size_t i = 0; i < nedges; ++i) {
+            unsigned a = edges[2 * i];
+            unsigned b = edges[2 * i + 1];
+            unsigned char ca = codes[a], cb = codes[b];
+
+            if(ca & cb) {
+              ++rejected;
+              continue;
+            }
+            if((ca | cb) == 0) {
+              ++accepted;
+              points[0] = wx[a];
+              points[1] = wy[a];
+              points[2] = wx[b];
+              points[3] = wy[b];
+            } else {
+              double pa[4], pb[4];
+              clip.get(a, pa);
+              clip.get(b, pb);
+              if(!clip_segment(view.planes, pa, pb) ||
+                 pa[3] <= 0 || pb[3] <= 0) {
+                ++rejected;
+                continue;
+              }
+              ++clipped;
+              points[0] = pa[0] / pa[3] * sx + tx;
+              points[1] = pa[1] / pa[3] * sy + ty;
+              points[2] = pb[0] / pb[3] * sx + tx;
+              points[3] = pb[1] / pb[3] * sy + ty;
+            }
+            colours[0] = rgb[0];
+            colours[1] = rgb[1];
+            colours[2] = rgb[2];
+            points += 4;
+            colours += 3;
+          }
+        }
+        chunk.lines = (points - chunk.points) / 4;
+        chunk.accepted += accepted;
+        chunk.rejected += rejected;
+        chunk.clipped += clipped;
+      }
+    }
+  }
+}
+
+void RenderPipeline::run_instances(double start)
+{
+  ThreadPool& pool = ThreadPool::shared();
+  const InstanceBuffer& instances = *m_instances;
+  const size_t ninstances = instances.size();
+  const size_t nviews = m_view_passes.size();
+
+  // Compose every instance's matrix with each camera and the model in
+  // one batched pass per camera
+  const double *in[12];
+  for(size_t k = 0; k < 12; ++k) {
+    in[k] = instances.m[k].data();
+  }
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    CameraPass& camera = m_camera_passes[c];
+    if(!camera.used) {
+      continue;
+    }
+    for(size_t k = 0; k < 16; ++k) {
+      camera.instance_mvp[k] = m_arena.allocate<double>(ninstances);
+    }
+    compose_affine(camera.mvp, ninstances, in, camera.instance_mvp);
+  }
+
+  // Which instances each view sees, and how many vertices that has the
+  // cameras transform
+  const size_t nvertices = m_mesh->num_vertices();
+  BoxCounts counts;
+  for(size_t v = 0; v < nviews; ++v) {
+    ViewPass& view = m_view_passes[v];
+    view.classes = m_arena.allocate<unsigned char>(ninstances);
+    const Frustum frustum(m_camera_passes[view.camera].mvp, view.planes,
+                          cull_tolerance());
+    m_instance_boxes.classify(frustum, view.classes, counts);
+  }
+  m_stats.boxes_culled = counts.outside;
+  m_stats.boxes_inside = counts.inside;
+  m_stats.boxes_partial = counts.partial;
+  size_t transformed = 0;
+  for(size_t n = 0; n < ninstances; ++n) {
+    for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+      for(size_t v = 0; v < nviews; ++v) {
+        const ViewPass& view = m_view_passes[v];
+        if(view.camera == c && view.classes[n] != BOX_OUTSIDE) {
+          transformed += nvertices;
+          break;
+        }
+      }
+    }
+  }
+
+  const size_t nedges = m_mesh->num_edges();
+  const size_t grain =
+    std::max<size_t>(1, INSTANCE_VERTICES / std::max<size_t>(1, nvertices));
+  const size_t nchunks = (ninstances + grain - 1) / grain;
+  m_instance_chunks = m_arena.allocate<InstanceChunk>(nviews * nchunks);
+  for(size_t v = 0; v < nviews; ++v) {
+    for(size_t c = 0; c < nchunks; ++c) {
+      const size_t n = std::min(grain, ninstances - c * grain) * nedges;
+      InstanceChunk& chunk = m_instance_chunks[v * nchunks + c];
+      chunk.points = m_arena.allocate<double>(4 * n);
+      chunk.colours = m_arena.allocate<float>(3 * n);
+    }
+  }
+  m_scratch = m_arena.allocate<InstanceScratch>(pool.threads());
+  for(unsigned t = 0; t < pool.threads(); ++t) {
+    InstanceScratch& scratch = m_scratch[t];
+    allocate_clip(scratch.clip, nvertices);
+    scratch.sx = m_arena.allocate<double>(nvertices);
+    scratch.sy = m_arena.allocate<double>(nvertices);
+    scratch.codes = m_arena.allocate<unsigned char>(nvertices);
+  }
+  pool.parallel_for(ninstances, grain,
+                    [&](size_t begin, size_t end, unsigned thread) {
+    instance_chunk(begin, end, m_scratch[thread],
+                   &m_instance_chunks[begin / grain], nchunks);
+  }, m_threads);
+
+  double clipped = now_ns();
+
+  // Copy each chunk's lines to its slice of the output, view by view
+  const size_t total = nviews * nchunks;
+  size_t *offsets = m_offsets = m_arena.allocate<size_t>(total + 1);
+  offsets[0] = 0;
+  for(size_t c = 0; c < total; ++c) {
+    const InstanceChunk& chunk = m_instance_chunks[c];
+    offsets[c + 1] = offsets[c] + chunk.lines;
+    m_stats.accepted += chunk.accepted;
+    m_stats.rejected += chunk.rejected;
+    m_stats.clipped += chunk.clipped;
+  }
+  m_out.points.resize(4 * offsets[total]);
+  m_out.colours.resize(3 * offsets[total]);
+  pool.run((unsigned)total, [&](unsigned c) {
+    const InstanceChunk& chunk = m_instance_chunks[c];
+    if(chunk.lines != 0) {
+      memcpy(&m_out.points[4 * offsets[c]], chunk.points,
+             4 * chunk.lines * sizeof(double));
+      memcpy(&m_out.colours[3 * offsets[c]], chunk.colours,
+             3 * chunk.lines * sizeof(float));
+    }
+  }, m_threads);
+
+  m_stats.vertices = transformed;
+  m_stats.edges = nedges * ninstances * nviews;
+  m_stats.instances = ninstances;
+  // Instances go through every stage at once, so the transform and
+  // clip time is reported together as clip time
+  m_stats.transform_ns = 0;
+  m_stats.clip_ns = clipped - start;
+  m_stats.emit_ns = now_ns() - clipped;
+  m_stats.hidden = 0;
+  m_stats.hide_ns = 0;
+  m_stats.merged = 0;
+  m_stats.merge_ns = 0;
+  if(m_merge) {
+    merge_lines();
+  }
+  m_stats.lines = m_out.size();
+  m_stats.scratch_bytes = m_arena.used();
+  PROFILE_RECORD(PROFILE_CLIP, m_stats.clip_ns);
+  PROFILE_RECORD(PROFILE_EMIT, m_stats.emit_ns);
+}
+
+// The pixel a window position falls in, as 16 bits of x over 16 of y.
+// Positions are clamped so the all-ones pixel pair never occurs.
+static inline uint32_t pixel_of(double x, double y)
+{
+  // Truncation is floor once negatives are clamped away
+  const double top = 65534;
+  uint32_t px = (uint32_t)std::min(std::max(x, 0.0), top);
+  uint32_t py = (uint32_t)std::min(std::max(y, 0.0), top);
+  return px << 16 | py;
+}
+
+// Where to look for a pixel pair first in a set of 2^bits slots:
+// multiplied by 2^64 / phi, the top bits
+static inline size_t first_slot(uint64_t key, unsigned bits)
+{
+  return (size_t)((key * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+}
+
+// Put "key" in the open addressed set "seen" of 2^bits slots (empty
+// ones all ones) unless it is there already; returns whether it was
+// added
+static inline bool insert_pixels(uint64_t *seen, unsigned bits,
+                                 size_t slot, uint64_t key)
+{
+  const size_t mask = ((size_t)1 << bits) - 1;
+  while(seen[slot] != key) {
+    if(seen[slot] == ~(uint64_t)0) {
+      seen[slot] = key;
+      return true;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return false;
+}
+
+// A length l in model space at eye depth z covers about l * s * k / z
+// pixels, where s is the most the model-view matrix stretches it by
+// and k the projection's focal length times half the viewport.  Taking
+// z as the depth of the near side of the mesh's bounding sphere, but
+// no nearer than the near plane, bounds it for every part of the mesh
+// in view.
+size_t RenderPipeline::select_lod(double& pixels) const
+{
+  const Mesh& finest = m_lods->levels[0].mesh;
+  const Point3D centre = finest.lower + 0.5 * (finest.upper - finest.lower);
+  const double radius = 0.5 * (finest.upper - finest.lower).length();
+  const size_t instances = m_instances ? m_instances->size() : 1;
+
+  // The most pixels one unit of model space covers, over every view
+  // and instance
+  double most = 0;
+  for(size_t v = 0; v < m_view_passes.size(); ++v) {
+    const ViewPass& view = m_view_passes[v];
+    const Camera& camera = m_cameras[view.camera];
+    const double focal = std::max(std::fabs(camera.proj[0][0]) * view.sx,
+                                  std::fabs(camera.proj[1][1]) * view.sy);
+    const Matrix4x4 viewModel = camera.view * m_M;
+    for(size_t i = 0; i < instances; ++i) {
+      const Matrix4x4 mv = m_instances ?
+        viewModel * m_instances->model(i) : viewModel;
+      double stretch = 0;
+      for(int c = 0; c < 3; ++c) {
+        stretch = std::max(stretch, mv[0][c] * mv[0][c] +
+                           mv[1][c] * mv[1][c] + mv[2][c] * mv[2][c]);
+      }
+      stretch = std::sqrt(stretch);
+      const double depth = std::max((mv * centre)[2] - radius * stretch,
+                                    camera.near_plane);
+      most = std::max(most, focal * stretch / depth);
+    }
+  }
+
+  size_t level = m_lods->size() - 1;
+  while(level > 0 && m_lods->levels[level].error * most > m_lod_pixels) {
+    --level;
+  }
+  pixels = m_lods->levels[level].error * most;
+  return level;
+}
+
+void RenderPipeline::merge_lines()
+{
+  double start = now_ns();
+  const size_t count = m_out.size();
+  double *points = m_out.points.data();
+  float *colours = m_out.colours.data();
+
+  // The pixel pairs seen so far.  The set starts small, so a model
+  // covering few pixels stays in cache, and doubles whenever it gets
+  // half full.
+  unsigned bits = 12;
+  uint64_t *seen = m_arena.allocate<uint64_t>((size_t)1 << bits);
+  std::fill(seen, seen + ((size_t)1 << bits), ~(uint64_t)0);
+  size_t used = 0;
+
+  // Lines are taken a batch at a time: the batch's slots are fetched
+  // ahead, so the cache misses of a large set overlap
+  const size_t BATCH = 16;
+  uint64_t keys[BATCH];
+  size_t slots[BATCH];
+  size_t kept = 0;
+  for(size_t first = 0; first < count; first += BATCH) {
+    const size_t n = std::min(BATCH, count - first);
+    if(2 * (used + n) > ((size_t)1 << bits)) {
+      const size_t old = (size_t)1 << bits;
+      uint64_t *grown = m_arena.allocate<uint64_t>(2 * old);
+      std::fill(grown, grown + 2 * old, ~(uint64_t)0);
+      ++bits;
+      for(size_t s = 0; s < old; ++s) {
+        if(seen[s] != ~(uint64_t)0) {
+          insert_pixels(grown, bits, first_slot(seen[s], bits), seen[s]);
+        }
+      }
+      seen = grown;
+    }
+    for(size_t k = 0; k < n; ++k) {
+      const double *p = points + 4 * (first + k);
+      uint64_t a = pixel_of(p[0], p[1]), b = pixel_of(p[2], p[3]);
+      keys[k] = a < b ? a << 32 | b : b << 32 | a;
+      slots[k] = first_slot(keys[k], bits);
+      __builtin_prefetch(seen + slots[k]);
+    }
+    for(size_t k = 0; k < n; ++k) {
+      if(!insert_pixels(seen, bits, slots[k], keys[k])) {
+        continue;
+      }
+      ++used;
+      const size_t i = first + k;
+      if(kept != i) {
+        memcpy(points + 4 * kept, points + 4 * i, 4 * sizeof(double));
+        memcpy(colours + 3 * kept, colours + 3 * i, 3 * sizeof(float));
+      }
+      ++kept;
+    }
+  }
+  m_out.points.resize(4 * kept);
+  m_out.colours.resize(3 * kept);
+
+  m_stats.merged = count - kept;
+  m_stats.merge_ns = now_ns() - start;
+  PROFILE_RECORD(PROFILE_MERGE, m_stats.merge_ns);
+}
+
+// Points are taken a cell apart along the line, and each covers the
+// stretch of line around it; runs of points not hidden become the
+// parts.  A line hidden nowhere is kept exactly as it was.
+size_t RenderPipeline::visible_parts(const DepthBuffer& depth, size_t i,
+                                     double *points, float *colours,
+                                     bool& whole) const
+{
+  const double *p = &m_out.points[4 * i];
+  const float *q = m_line_depths + 2 * i;
+  const double dx = p[2] - p[0], dy = p[3] - p[1];
+  const double dq = (double)q[1] - q[0];
+  const double length = std::max(std::fabs(dx), std::fabs(dy));
+  const size_t n =
+    std::max<size_t>(1, (size_t)std::ceil(length / DepthBuffer::CELL));
+
+  size_t parts = 0, start = 0;
+  bool open = false;
+  whole = false;
+  for(size_t k = 0; k <= n; ++k) {
+    const double t = (k + 0.5) / n;
+    const bool visible =
+      k < n && !depth.hidden(p[0] + t * dx, p[1] + t * dy, q[0] + t * dq);
+    if(visible && !open) {
+      start = k;
+      open = true;
+    } else if(!visible && open) {
+      open = false;
+      ++parts;
+      whole = start == 0 && k == n;
+      if(!points) {
+        continue;
+      }
+      if(whole) {
+        memcpy(points, p, 4 * sizeof(double));
+      } else {
+        const double t0 = (double)start / n, t1 = (double)k / n;
+        points[0] = p[0] + t0 * dx;
+        points[1] = p[1] + t0 * dy;
+        points[2] = p[0] + t1 * dx;
+        points[3] = p[1] + t1 * dy;
+      }
+      memcpy(colours, &m_out.colours[3 * i], 3 * sizeof(float));
+      points += 4;
+      colours += 3;
+    }
+  }
+  return parts;
+}
+
+void RenderPipeline::hide_lines(size_t nchunks)
+{
+  double start = now_ns();
+  ThreadPool& pool = ThreadPool::shared();
+  const Mesh& mesh = *m_mesh;
+  const size_t count = mesh.num_vertices();
+  const size_t nviews = m_view_passes.size();
+
+  // Each view's depth buffer, from the window positions and 1/w of the
+  // vertices in front of the near plane, and then the faces crossing
+  // it cut back to it: each chunk of faces counts those, and a prefix
+  // sum over the counts gives each chunk its slots for what is left
+  const size_t nfaces = mesh.num_faces();
+  const unsigned *faces = mesh.faces.data();
+  const size_t nface_chunks = (nfaces + FACE_GRAIN - 1) / FACE_GRAIN;
+  float *px = m_arena.allocate<float>(count);
+  float *py = m_arena.allocate<float>(count);
+  float *q = m_arena.allocate<float>(count);
+  size_t *crossing = m_arena.allocate<size_t>(nface_chunks + 1);
+  m_depths.resize(nviews);
+  for(size_t v = 0; v < nviews; ++v) {
+    const ViewPass& view = m_view_passes[v];
+    const CameraPass& camera = m_camera_passes[view.camera];
+    pool.parallel_for(count, VERTEX_GRAIN,
+                      [&](size_t begin, size_t end, unsigned) {
+      for(size_t i = begin; i < end; ++i) {
+        const double w = camera.needed[i / VERTEX_BLOCK] &&
+          !(view.codes[i] & CLIP_NEAR) ? camera.clip.get_w(i) : 0;
+        if(!(w > 0)) {
+          q[i] = 0;
+          continue;
+        }
+        double p[4];
+        camera.clip.get(i, p);
+        px[i] = (float)(p[0] / w * view.sx + view.tx);
+        py[i] = (float)(p[1] / w * view.sy + view.ty);
+        q[i] = (float)(1 / w);
+      }
+    }, m_threads);
+    m_depths[v].reset((int)(view.tx - view.sx), (int)(view.ty - view.sy),
+                      (int)(2 * view.sx), (int)(2 * view.sy), m_arena);
+    m_depths[v].draw(nfaces, faces, px, py, q, m_arena, m_threads);
+
+    pool.parallel_for(nfaces, FACE_GRAIN,
+                      [&](size_t begin, size_t end, unsigned) {
+      size_t n = 0;
+      for(size_t f = begin; f < end; ++f) {
+        const unsigned *face = faces + 3 * f;
+        const int behind = (view.codes[face[0]] & CLIP_NEAR ? 1 : 0) +
+          (view.codes[face[1]] & CLIP_NEAR ? 1 : 0) +
+          (view.codes[face[2]] & CLIP_NEAR ? 1 : 0);
+        n += behind == 1 || behind == 2;
+      }
+      crossing[begin / FACE_GRAIN + 1] = n;
+    }, m_threads);
+    crossing[0] = 0;
+    for(size_t c = 0; c < nface_chunks; ++c) {
+      crossing[c + 1] += crossing[c];
+    }
+    const size_t ncrossing = crossing[nface_chunks];
+    if(ncrossing == 0) {
+      continue;
+    }
+    float *cut_x = m_arena.allocate<float>(4 * ncrossing);
+    float *cut_y = m_arena.allocate<float>(4 * ncrossing);
+    float *cut_q = m_arena.allocate<float>(4 * ncrossing);
+    unsigned *cut = m_arena.allocate<unsigned>(6 * ncrossing);
+    pool.parallel_for(nfaces, FACE_GRAIN,
+                      [&](size_t begin, size_t end, unsigned) {
+      size_t k = crossing[begin / FACE_GRAIN];
+      for(size_t f = begin; f < end; ++f) {
+        const unsigned *face = faces + 3 * f;
+        const int behind = (view.codes[face[0]] & CLIP_NEAR ? 1 : 0) +
+          (view.codes[face[1]] & CLIP_NEAR ? 1 : 0) +
+          (view.codes[face[2]] & CLIP_NEAR ? 1 : 0);
+        if(behind == 1 || behind == 2) {
+          near_face(view, face, (unsigned)(4 * k), cut_x, cut_y, cut_q,
+                    cut + 6 * k);
+          ++k;
+        }
+      }
+    }, m_threads);
+    m_depths[v].draw(2 * ncrossing, cut, cut_x, cut_y, cut_q, m_arena,
+                     m_threads);
+  }
+
+  // Then each view's lines, LINE_GRAIN at a time: count their parts,
+  // noting which lines are hidden, whole or split, and with a prefix sum
+  // over the counts write them to the new output, testing only the
+  // split lines again
+  size_t nruns = 0;
+  for(size_t v = 0; v < nviews; ++v) {
+    const size_t lines = m_offsets[(v + 1) * nchunks] - m_offsets[v * nchunks];
+    nruns += (lines + LINE_GRAIN - 1) / LINE_GRAIN;
+  }
+  LineChunk *runs = m_arena.allocate<LineChunk>(nruns);
+  size_t r = 0;
+  for(size_t v = 0; v < nviews; ++v) {
+    const size_t end = m_offsets[(v + 1) * nchunks];
+    for(size_t begin = m_offsets[v * nchunks]; begin < end;
+        begin += LINE_GRAIN) {
+      runs[r].view = v;
+      runs[r].begin = begin;
+      runs[r].end = std::min(begin + LINE_GRAIN, end);
+      ++r;
+    }
+  }
+  enum { LINE_HIDDEN, LINE_WHOLE, LINE_SPLIT };
+  unsigned char *states = m_arena.allocate<unsigned char>(m_out.size());
+  pool.run((unsigned)nruns, [&](unsigned k) {
+    LineChunk& run = runs[k];
+    run.parts = run.hidden = 0;
+    for(size_t i = run.begin; i < run.end; ++i) {
+      bool whole;
+      const size_t parts = visible_parts(m_depths[run.view], i, 0, 0, whole);
+      run.parts += parts;
+      run.hidden += parts == 0;
+      states[i] = parts == 0 ? LINE_HIDDEN : whole ? LINE_WHOLE : LINE_SPLIT;
+    }
+  }, m_threads);
+
+  size_t *firsts = m_arena.allocate<size_t>(nruns + 1);
+  firsts[0] = 0;
+  m_stats.hidden = 0;
+  for(size_t k = 0; k < nruns; ++k) {
+    firsts[k + 1] = firsts[k] + runs[k].parts;
+    m_stats.hidden += runs[k].hidden;
+  }
+  m_visible.points.resize(4 * firsts[nruns]);
+  m_visible.colours.resize(3 * firsts[nruns]);
+  pool.run((unsigned)nruns, [&](unsigned k) {
+    const LineChunk& run = runs[k];
+    double *points = m_visible.points.data() + 4 * firsts[k];
+    float *colours = m_visible.colours.data() + 3 * firsts[k];
+    for(size_t i = run.begin; i < run.end; ++i) {
+      if(states[i] == LINE_WHOLE) {
+        memcpy(points, &m_out.points[4 * i], 4 * sizeof(double));
+        memcpy(colours, &m_out.colours[3 * i], 3 * sizeof(float));
+        points += 4;
+        colours += 3;
+      } else if(states[i] == LINE_SPLIT) {
+        bool whole;
+        const size_t parts = visible_parts(m_depths[run.view], i, points,
+                                           colours, whole);
+        points += 4 * parts;
+        colours += 3 * parts;
+      }
+    }
+  }, m_threads);
+  m_out.points.swap(m_visible.points);
+  m_out.colours.swap(m_visible.colours);
+
+  m_stats.hide_ns = now_ns() - start;
+  PROFILE_RECORD(PROFILE_HIDE, m_stats.hide_ns);
+}
+
+// The polygon left of a triangle in front of the near plane, z >= -w,
+// has the corners in front and the points where the sides cross it,
+// in order round it: three or four of them, fanned from the first.
+void RenderPipeline::near_face(const ViewPass& view, const unsigned *face,
+                               unsigned slot, float *px, float *py,
+                               float *q, unsigned *triangles) const
+{
+  const ClipArrays& clip = m_camera_passes[view.camera].clip;
+  double corners[3][4];
+  for(int k = 0; k < 3; ++k) {
+    clip.get(face[k], corners[k]);
+  }
+
+  unsigned n = 0;
+  auto put = [&](const double p[4]) {
+    const double w = p[3];
+    px[slot + n] = (float)(p[0] / w * view.sx + view.tx);
+    py[slot + n] = (float)(p[1] / w * view.sy + view.ty);
+    q[slot + n] = w > 0 ? (float)(1 / w) : 0;
+    ++n;
+  };
+  for(int k = 0; k < 3; ++k) {
+    const double *a = corners[k], *b = corners[(k + 1) % 3];
+    const double da = a[2] + a[3], db = b[2] + b[3];
+    if(da >= 0) {
+      put(a);
+    }
+    if((da >= 0) != (db >= 0)) {
+      const double t = da / (da - db);
+      double p[4];
+      for(int j = 0; j < 4; ++j) {
+        p[j] = a[j] + t * (b[j] - a[j]);
+      }
+      put(p);
+    }
+  }
+
+  triangles[0] = slot;
+  triangles[1] = slot + 1;
+  triangles[2] = slot + 2;
+  triangles[3] = slot;
+  triangles[4] = n == 4 ? slot + 2 : slot;
+  triangles[5] = n == 4 ? slot + 3 : slot;
+  if(n == 3) {
+    q[slot + 3] = 0;
+  }
+}
+
+void RenderPipeline::end_frame()
+{
+  m_arena.reset();
+}
+
+const LineList& RenderPipeline::run()
+{
+  if(m_dirty == 0) {
+    m_stats.reused = true;
+    m_stats.transform_ns = 0;
+    m_stats.clip_ns = 0;
+    m_stats.emit_ns = 0;
+    m_stats.merge_ns = 0;
+    m_stats.hide_ns = 0;
+    return m_out;
+  }
+
+  m_stats.accepted = 0;
+  m_stats.rejected = 0;
+  m_stats.clipped = 0;
+  m_stats.boxes_culled = 0;
+  m_stats.boxes_inside = 0;
+  m_stats.boxes_partial = 0;
+  m_stats.reused = false;
+  m_arena.reset();
+
+  // The views there is something to draw for, their camera set and
+  // their viewport not empty, with normalized device coordinates mapped
+  // onto the viewport
+  m_view_passes.clear();
+  for(size_t v = 0; v < m_views.size(); ++v) {
+    const View& view = m_views[v];
+    const Viewport& viewport = view.viewport;
+    if(view.camera >= m_cameras.size() || viewport.width <= 0 ||
+       viewport.height <= 0) {
+      continue;
+    }
+    ViewPass pass;
+    pass.camera = view.camera;
+    pass.sx = viewport.width / 2.0;
+    pass.tx = viewport.x + viewport.width / 2.0;
+    pass.sy = viewport.height / 2.0;
+    pass.ty = viewport.y + viewport.height / 2.0;
+    pass.planes = clip_planes(viewport);
+    m_view_passes.push_back(pass);
+  }
+  // The level of detail these views need, a new mesh to the rest of
+  // the run if it changed
+  if(m_lods) {
+    m_stats.lod = select_lod(m_stats.lod_pixels);
+    const Mesh *level = &m_lods->levels[m_stats.lod].mesh;
+    if(level != m_mesh) {
+      m_mesh = level;
+      m_dirty |= DIRTY_MESH;
+    }
+  }
+  if(!m_mesh || m_view_passes.empty()) {
+    m_out.clear();
+    return m_out;
+  }
+
+  double start = now_ns();
+  ThreadPool& pool = ThreadPool::shared();
+
+  if(m_precision == PRECISION_FLOAT && (m_dirty & DIRTY_MESH)) {
+    rebase_mesh();
+  }
+  m_camera_passes.resize(m_cameras.size());
+  if(m_dirty & (DIRTY_MVP | DIRTY_MESH)) {
+    const Matrix4x4 rebase = rebasing(m_origin);
+    for(size_t c = 0; c < m_cameras.size(); ++c) {
+      const Camera& camera = m_cameras[c];
+      CameraPass& pass = m_camera_passes[c];
+      pass.mvp = camera.proj * (camera.view * m_M);
+      // Composed with the rebasing in double precision first, so the
+      // translation that reaches single precision is the mesh centre's
+      // position relative to the camera
+      pass.mvp_f = Matrix4x4f(camera.proj * (camera.view * m_M * rebase));
+    }
+  }
+  if(m_dirty & DIRTY_MESH) {
+    build_clusters();
+    m_features_mesh = 0;
+  }
+  if(m_instances && (m_dirty & (DIRTY_MESH | DIRTY_INSTANCES))) {
+    build_instance_boxes();
+  }
+  m_dirty = 0;
+
+  // Only the cameras some view looks through are worth transforming
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    m_camera_passes[c].used = false;
+  }
+  m_stats.cameras = 0;
+  for(size_t v = 0; v < m_view_passes.size(); ++v) {
+    CameraPass& camera = m_camera_passes[m_view_passes[v].camera];
+    if(!camera.used) {
+      camera.used = true;
+      ++m_stats.cameras;
+    }
+  }
+  m_stats.views = m_view_passes.size();
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    m_camera_passes[c].drawn = 0;
+  }
+  m_stats.features = 0;
+  m_stats.silhouettes = 0;
+  m_stats.silhouette_ns = 0;
+
+  if(m_instances) {
+    run_instances(start);
+    return m_out;
+  }
+  m_stats.instances = 1;
+
+  const size_t count = m_mesh->num_vertices();
+  for(size_t c = 0; c < m_camera_passes.size(); ++c) {
+    CameraPass& camera = m_camera_passes[c];
+    if(camera.used) {
+      allocate_clip(camera.clip, count);
+    }
+  }
+  for(size_t v = 0; v < m_view_passes.size(); ++v) {
+    ViewPass& view = m_view_passes[v];
+    view.codes = m_arena.allocate<unsigned char>(count);
+    view.wx = m_arena.allocate<double>(count);
+    view.wy = m_arena.allocate<double>(count);
+  }
+  if(m_feature_edges) {
+    select_edges();
+  }
+  const size_t vertices = cull_clusters();
+
+  for(unsigned c = 0; c < m_camera_passes.size(); ++c) {
+    if(!m_camera_passes[c].used) {
+      continue;
+    }
+    pool.parallel_for(count, VERTEX_GRAIN,
+                      [&](size_t begin, size_t end, unsigned) {
+      transform_chunk(c, begin, end);
+    }, m_threads);
+  }
+
+  double transformed = now_ns();
+
+  // Each view's edges are split into fixed chunks.  Each chunk first
+  // counts its lines; a prefix sum over the counts then gives every
+  // chunk its own slice of the output to write, so threads never share
+  // a buffer and no copying or locking is needed to put the list
+  // together.
+  const size_t nviews = m_view_passes.size();
+  const size_t nedges = m_mesh->num_edges();
+  const size_t nchunks = (nedges + EDGE_GRAIN - 1) / EDGE_GRAIN;
+  const size_t total = nviews * nchunks;
+  m_chunks = m_arena.allocate<EdgeChunk>(total);
+  pool.run((unsigned)total, [&](unsigned c) {
+    size_t begin = c % nchunks * EDGE_GRAIN;
+    count_chunk(c / nchunks, begin, std::min(begin + EDGE_GRAIN, nedges),
+                m_chunks[c]);
+  }, m_threads);
+
+  double clipped = now_ns();
+
+  size_t *offsets = m_offsets = m_arena.allocate<size_t>(total + 1);
+  offsets[0] = 0;
+  for(size_t c = 0; c < total; ++c) {
+    const EdgeChunk& chunk = m_chunks[c];
+    offsets[c + 1] = offsets[c] + chunk.accepted + chunk.clipped;
+    m_stats.accepted += chunk.accepted;
+    m_stats.rejected += chunk.rejected;
+    m_stats.clipped += chunk.clipped;
+  }
+  m_out.points.resize(4 * offsets[total]);
+  m_out.colours.resize(3 * offsets[total]);
+  const bool hide = m_hidden && m_mesh->num_faces() != 0;
+  m_line_depths = hide ? m_arena.allocate<float>(2 * offsets[total]) : 0;
+  pool.run((unsigned)total, [&](unsigned c) {
+    size_t begin = c % nchunks * EDGE_GRAIN;
+    emit_chunk(c / nchunks, begin, std::min(begin + EDGE_GRAIN, nedges),
+               offsets[c]);
+  }, m_threads);
+
+  m_stats.vertices = vertices;
+  m_stats.edges = nedges * nviews;
+  m_stats.transform_ns = transformed - start;
+  m_stats.clip_ns = clipped - transformed;
+  m_stats.emit_ns = now_ns() - clipped;
+  m_stats.hidden = 0;
+  m_stats.hide_ns = 0;
+  if(hide) {
+    hide_lines(nchunks);
+  }
+  m_stats.merged = 0;
+  m_stats.merge_ns = 0;
+  if(m_merge) {
+    merge_lines();
+  }
+  m_stats.lines = m_out.size();
+  m_stats.scratch_bytes = m_arena.used();
+  PROFILE_RECORD(PROFILE_TRANSFORM, m_stats.transform_ns);
+  PROFILE_RECORD(PROFILE_CLIP, m_stats.clip_ns);
+  PROFILE_RECORD(PROFILE_EMIT, m_stats.emit_ns);
+  return m_out;
+}
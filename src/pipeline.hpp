@@ -0,0 +1,518 @@
+//---------------------------------------------------------------------------
+//
+// pipeline.hpp/pipeline.cpp
+//
+// The viewer's render pipeline, kept free of GTK and OpenGL so it can
+// be driven headlessly (see bench.cpp).  Given a mesh, a model matrix,
+// a camera and a viewport it produces the clipped screen-space lines to
+// hand to draw_lines().  It can also draw several views at once, each
+// a viewport looking through one of several cameras.
+//
+// Before anything is transformed, the mesh's edges, in runs of a few
+// hundred, and the instances are culled against each view through a
+// BoxTree (see bvh.hpp) around them: the vertices of runs no view of a
+// camera sees aren't transformed for it, nor are instances no view
+// sees, and the edges of runs or instances wholly inside a view skip
+// the outcode tests and clipping.
+//
+// Drawing only feature edges, each camera's silhouette is found from
+// the eye before anything is transformed too (see featureedges.hpp),
+// and the other edges are skipped.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_PIPELINE_HPP
+#define CS488_PIPELINE_HPP
+
+#include <vector>
+#include "algebra.hpp"
+#include "clip.hpp"
+#include "mesh.hpp"
+#include "meshlod.hpp"
+#include "bvh.hpp"
+#include "depthbuffer.hpp"
+#include "featureedges.hpp"
+#include "arena.hpp"
+
+// Where the scene is looked at from
+struct Camera {
+  Camera();
+
+  // Viewing and projection matrices
+  Matrix4x4 view;
+  Matrix4x4 proj;
+  // Near and far plane distances
+  double near_plane, far_plane;
+};
+
+// The rectangle of the window the view volume is mapped onto, its top
+// left corner at x, y, and the walls clipping the lines inside it, all
+// in window pixels (y grows downwards).
+struct Viewport {
+  Viewport();
+  // The whole of a width by height window, walled 5% in from its edges
+  Viewport(int width, int height);
+  // A width by height rectangle at x, y, walled at its edges
+  Viewport(int x, int y, int width, int height);
+
+  int x, y;
+  int width, height;
+  double left, right, top, bottom;
+};
+
+// A viewport and which of the pipeline's cameras it looks through
+struct View {
+  View();
+  View(unsigned camera, const Viewport& viewport);
+
+  unsigned camera;
+  Viewport viewport;
+};
+
+// Screen-space lines packed the way draw_lines() takes them
+struct LineList {
+  // x1, y1, x2, y2 per line
+  std::vector<double> points;
+  // r, g, b per line
+  std::vector<float> colours;
+
+  size_t size() const
+  {
+    return colours.size() / 3;
+  }
+  void clear()
+  {
+    points.clear();
+    colours.clear();
+  }
+  void add(double x1, double y1, double x2, double y2, const Colour& c)
+  {
+    points.push_back(x1);
+    points.push_back(y1);
+    points.push_back(x2);
+    points.push_back(y2);
+    colours.push_back((float)c.R());
+    colours.push_back((float)c.G());
+    colours.push_back((float)c.B());
+  }
+};
+
+// Model matrices and colours for drawing one mesh many times in a
+// single run().  The matrices are affine and kept as structure of
+// arrays, m[4 * r + c][i] being entry (r, c) of instance i's matrix
+// (the last row is always 0 0 0 1), so the pipeline can compose them
+// all with the camera in one vectorized sweep.
+struct InstanceBuffer {
+  std::vector<double> m[12];
+  // r, g, b per instance
+  std::vector<float> colours;
+
+  size_t size() const
+  {
+    return colours.size() / 3;
+  }
+  void clear();
+  void add(const Matrix4x4& model, const Colour& colour);
+  void set_model(size_t i, const Matrix4x4& model);
+  Matrix4x4 model(size_t i) const;
+};
+
+// What the last run() did and how long each stage took
+struct PipelineStats {
+  // All zero
+  PipelineStats();
+
+  // Add what another run with the same views did, as when a model is
+  // drawn in pieces.  The counts and times are summed, the level of
+  // detail is the finest and the lines count as reused only if both
+  // runs' were.
+  void add(const PipelineStats& other);
+
+  // Vertices transformed, over all instances and cameras, and edges
+  // clipped, over all instances and views
+  size_t vertices;
+  size_t edges;
+  size_t lines;
+  size_t instances;
+  // Views drawn and the cameras they looked through
+  size_t views;
+  size_t cameras;
+  // How clipping classified the edges
+  size_t accepted;
+  size_t rejected;
+  size_t clipped;
+  // How the culling boxes, the runs of edges or the instances, fell
+  // against the views, over all views: outside and culled, inside and
+  // accepted unclipped, or across a wall and left to the edge tests
+  size_t boxes_culled;
+  size_t boxes_inside;
+  size_t boxes_partial;
+  double transform_ns;
+  double clip_ns;
+  // Writing the lines to the output in edge order
+  double emit_ns;
+  // Lines dropped by set_merge_lines() (each a draw call saved) and
+  // how long finding them took
+  size_t merged;
+  double merge_ns;
+  // Lines set_hidden_lines() left out whole (others may have lost a
+  // part) and how long drawing the depth buffers and testing took
+  size_t hidden;
+  double hide_ns;
+  // Edges set_feature_edges() kept as boundaries and creases, those it
+  // found on a silhouette, over all cameras, and how long finding the
+  // silhouettes took (part of transform_ns)
+  size_t features;
+  size_t silhouettes;
+  double silhouette_ns;
+  // The level of detail drawn (0 without set_lods()) and how many
+  // pixels its error covered at most
+  size_t lod;
+  double lod_pixels;
+  // Per-frame scratch memory used by the run
+  size_t scratch_bytes;
+  // True when nothing had changed and the previous lines were reused
+  bool reused;
+};
+
+// What the pipeline transforms and classifies vertices in.  Single
+// precision halves the memory the transform streams through and
+// doubles the points per SIMD vector.  To keep it accurate far from
+// the world origin the mesh is kept relative to its own centre and the
+// matrix taking it to clip space is composed in double precision
+// before being rounded, so the single precision arithmetic only ever
+// sees coordinates relative to the camera.  Clipping and the window
+// positions are still computed in double precision.
+enum Precision {
+  PRECISION_DOUBLE,
+  PRECISION_FLOAT
+};
+
+// Build a projection matrix with the semantics of gluPerspective()
+// (the fov is in the same units Viewer::set_perspective uses).
+Matrix4x4 perspective(double fov, double aspect, double near, double far);
+
+class RenderPipeline {
+public:
+  RenderPipeline();
+
+  // Each setter marks what depends on its input as out of date; run()
+  // only recomputes that.  Call set_mesh() again if the mesh's
+  // contents change in place.
+  void set_mesh(const Mesh *mesh);
+  void set_model(const Matrix4x4& model);
+  // Cameras are numbered from 0; setting one makes room for all those
+  // before it.  The one-argument form sets camera 0.
+  void set_camera(const Camera& camera);
+  void set_camera(unsigned index, const Camera& camera);
+  // Draw a single view through camera 0
+  void set_viewport(const Viewport& viewport);
+  // Draw each of "views" instead, their lines one after another in the
+  // output.  The vertices are transformed once per camera in use, and
+  // only the clipping and the mapping to the window is done per view,
+  // so views sharing a camera are cheap.  Views of a camera that was
+  // never set are skipped.
+  void set_views(const std::vector<View>& views);
+  // Draw the mesh once per instance, with the instance's matrix
+  // applied before the model matrix and its colour in place of the
+  // mesh's, instead of once.  Null goes back to drawing it once.  Call
+  // again if the instances change in place.
+  void set_instances(const InstanceBuffer *instances);
+  // How many threads of the shared pool run() may use (0, the default,
+  // for all of them).
+  void set_threads(unsigned threads);
+  // The precision of the transform and classification (double by
+  // default)
+  void set_precision(Precision precision);
+  Precision precision() const
+  {
+    return m_precision;
+  }
+  // Snap the ends of each line to the pixel grid and keep only the
+  // first of the lines that then coincide, either way round, which
+  // includes all but one of the lines inside any one pixel.  The lines
+  // kept are unchanged, ends and colour; a dropped line's colour is
+  // lost even if it differed.  A dense model far away then costs about
+  // its footprint in pixels to draw rather than its edge count.  Off
+  // by default.
+  void set_merge_lines(bool merge);
+  // Leave out the parts of lines behind the mesh's faces: the faces are
+  // rasterized into a coarse depth buffer per view (see depthbuffer.hpp)
+  // and points along each line tested against it, a line being split
+  // where it goes behind a face.  Every vertex of a face is transformed
+  // for it, culled or not, and faces crossing the near plane are cut
+  // back to it.  Meshes without faces, and instanced drawing, are drawn
+  // whole.  Off by default.
+  void set_hidden_lines(bool hidden);
+  bool hidden_lines() const
+  {
+    return m_hidden;
+  }
+  // Draw only the mesh's boundaries, its creases (edges whose faces'
+  // normals are more than 30 degrees apart) and, for each camera, the
+  // smooth edges on its silhouette, rather than every edge.
+  // The faces around each edge are found once per mesh; the
+  // silhouettes every run.  Edges of meshes without faces are all
+  // kept, and instanced drawing draws every edge.  Off by default.
+  void set_feature_edges(bool features);
+  bool feature_edges() const
+  {
+    return m_feature_edges;
+  }
+  // Draw, in place of the set_mesh() mesh, the coarsest level of
+  // "lods" whose error, projected into every view (and instance),
+  // covers at most set_lod_pixels() pixels.  The level is picked again
+  // whenever the model, a camera, a viewport or the instances change.
+  // Null goes back to the set_mesh() mesh.
+  void set_lods(const LodChain *lods);
+  // The most pixels a level's error may cover (1 by default)
+  void set_lod_pixels(double pixels);
+
+  // Transform the mesh to clip space, clip it against the view frustum
+  // and the viewport walls, then divide and map the survivors to the
+  // window, for every view.  Vertices and edges are processed in
+  // chunks across the shared thread pool; the lines come out in view
+  // and then edge order regardless of the thread count.  If no input
+  // was set since the last call, the previous lines are returned as
+  // they are.  The result stays valid until the next call.
+  //
+  // All the scratch memory a run uses comes from a per-frame arena, so
+  // once the arena has grown to fit, frames make no heap allocations.
+  const LineList& run();
+
+  // Release the last run's scratch memory (run() does this too if it
+  // wasn't done).  Call once the frame's lines have been drawn.
+  void end_frame();
+
+  const LineList& lines() const
+  {
+    return m_out;
+  }
+  const PipelineStats& stats() const
+  {
+    return m_stats;
+  }
+
+  // Take every setting of "leader" but the mesh and its levels of
+  // detail: the cameras, model, views, instances, threads, precision,
+  // merging, hiding and feature edges.  Only what the leader changed
+  // since the last follow() has to be recomputed, so a pipeline kept
+  // for each piece of a model, e.g. each chunk of a chunk file, reuses
+  // its work as well as the leader would.
+  void follow(const RenderPipeline& leader);
+
+private:
+  // What run() has to recompute
+  enum {
+    DIRTY_MESH = 1,
+    DIRTY_MVP = 2,
+    DIRTY_VIEWPORT = 4,
+    DIRTY_INSTANCES = 8,
+    DIRTY_KINDS = 4
+  };
+  // Mark "flags" dirty and note when those settings changed, for
+  // follow()
+  void changed(unsigned flags);
+
+  // How one chunk of edges was classified
+  struct EdgeChunk {
+    size_t accepted, rejected, clipped;
+  };
+  // Lines [begin, end) of a view, how many parts of them the view's
+  // depth buffer leaves, and how many lines it hides whole
+  struct LineChunk {
+    size_t view, begin, end;
+    size_t parts, hidden;
+  };
+
+  // Vertices in clip space: x, y, z and w in double precision, or fx,
+  // fy, fz and fw in single precision, the other set null
+  struct ClipArrays {
+    double *x, *y, *z, *w;
+    float *fx, *fy, *fz, *fw;
+
+    // Point i's w
+    double get_w(size_t i) const
+    {
+      return fx ? fw[i] : w[i];
+    }
+    // Point i as doubles
+    void get(size_t i, double p[4]) const
+    {
+      if(fx) {
+        p[0] = fx[i];
+        p[1] = fy[i];
+        p[2] = fz[i];
+        p[3] = fw[i];
+      } else {
+        p[0] = x[i];
+        p[1] = y[i];
+        p[2] = z[i];
+        p[3] = w[i];
+      }
+    }
+  };
+
+  // A camera's part of a run, shared by every view looking through it:
+  // proj * view * model (and, in single precision, that taking points
+  // relative to m_origin, rounded) and the mesh in its clip space or,
+  // drawing instanced, the matrix composed with each instance's in the
+  // layout of InstanceBuffer but all 16 rows.  "needed" flags the
+  // blocks of VERTEX_BLOCK vertices some view of the camera uses, and
+  // "drawn", drawing feature edges, the edges it draws (null for all).
+  struct CameraPass {
+    Matrix4x4 mvp;
+    Matrix4x4f mvp_f;
+    bool used;
+    ClipArrays clip;
+    unsigned char *needed;
+    unsigned char *drawn;
+    double *instance_mvp[16];
+  };
+  // A view's part: its camera, the mapping from normalized device
+  // coordinates to the window (x * sx + tx, y * sy + ty), its walls,
+  // the BoxClass of each run of edges or instance, and the outcodes
+  // and, for points inside its frustum, the window positions of the
+  // camera's vertices
+  struct ViewPass {
+    unsigned camera;
+    double sx, tx, sy, ty;
+    ClipPlanes planes;
+    unsigned char *classes;
+    unsigned char *codes;
+    double *wx, *wy;
+  };
+
+  // Make room for "count" vertices in the current precision
+  void allocate_clip(ClipArrays& clip, size_t count);
+  // Classify vertices [begin, begin + count) of "clip" against a view
+  // and map those inside to the window
+  void map_view(const ViewPass& view, const ClipArrays& clip, size_t begin,
+                size_t count, unsigned char *codes, double *wx,
+                double *wy) const;
+  // Keep the mesh in single precision, relative to its centre
+  void rebase_mesh();
+  // Bound the mesh's runs of edges, or the instances, for culling
+  void build_clusters();
+  void build_instance_boxes();
+  // How far a box must be past a plane to be culled or accepted whole
+  double cull_tolerance() const;
+  // Classify the runs of edges against each view and flag the vertex
+  // blocks each camera needs; returns how many vertices those hold
+  size_t cull_clusters();
+  // Do what set_feature_edges() describes for each camera's edges
+  void select_edges();
+  void transform_chunk(unsigned camera, size_t begin, size_t end);
+  void count_chunk(size_t view, size_t begin, size_t end, EdgeChunk& chunk);
+  bool clip_edge(size_t view, unsigned a, unsigned b,
+                 double pa[4], double pb[4]) const;
+  void emit_chunk(size_t view, size_t begin, size_t end, size_t first);
+
+  // Instanced drawing runs the whole pipeline for a chunk of instances
+  // on one thread, with that thread's scratch, into the chunk's own
+  // lines, one set per view; the chunks are then copied to the output
+  // in order.
+  struct InstanceScratch {
+    ClipArrays clip;
+    double *sx, *sy;
+    unsigned char *codes;
+  };
+  struct InstanceChunk {
+    size_t accepted, rejected, clipped;
+    // Room for every edge of every instance in the chunk; "lines" of
+    // them are used
+    size_t lines;
+    double *points;
+    float *colours;
+  };
+  void run_instances(double start);
+  // Do what set_merge_lines() describes to the output
+  void merge_lines();
+  // And set_hidden_lines(), with the lines of view v starting at chunk
+  // v * nchunks of m_offsets
+  void hide_lines(size_t nchunks);
+  // Cut "face", which crosses the near plane of "view", back to it: the
+  // window positions and 1/w of what is left go to slots [slot, slot +
+  // 4) of px, py and q, and two triangles over them, the second empty
+  // if only a corner was left, to "triangles"
+  void near_face(const ViewPass& view, const unsigned *face, unsigned slot,
+                 float *px, float *py, float *q, unsigned *triangles) const;
+  // Write the parts of line i of m_out "depth" doesn't hide to
+  // "points" and "colours", unless null, and return how many there are;
+  // "whole" is set if that is the line as it was
+  size_t visible_parts(const DepthBuffer& depth, size_t i, double *points,
+                       float *colours, bool& whole) const;
+  // The level of m_lods set_lods() describes, and how many pixels its
+  // error covers at most
+  size_t select_lod(double& pixels) const;
+  // View v's lines for the chunk go to chunks[v * stride]
+  void instance_chunk(size_t begin, size_t end, InstanceScratch& scratch,
+                      InstanceChunk *chunks, size_t stride);
+
+  // The mesh drawn: the set_mesh() one, m_source, or a level of m_lods
+  const Mesh *m_mesh;
+  const Mesh *m_source;
+  const LodChain *m_lods;
+  double m_lod_pixels;
+  const InstanceBuffer *m_instances;
+  Matrix4x4 m_M;
+  std::vector<Camera> m_cameras;
+  std::vector<View> m_views;
+  unsigned m_threads;
+  unsigned m_dirty;
+  // A count of the changes to the settings, when each kind of them
+  // last changed, and the leader's count when this last followed it
+  unsigned long m_clock;
+  unsigned long m_changed[DIRTY_KINDS];
+  unsigned long m_followed;
+  Precision m_precision;
+  bool m_merge;
+  bool m_hidden;
+  bool m_feature_edges;
+
+  // The mesh in single precision relative to m_origin, its bounding box
+  // centre
+  Point3D m_origin;
+  std::vector<float> m_fx, m_fy, m_fz;
+
+  // The mesh's edges in runs of CLUSTER_EDGES, each run's box and the
+  // first and last vertex it uses; the boxes of the instances under
+  // the model matrix; and the corners of either as they are built
+  BoxTree m_clusters;
+  std::vector<unsigned> m_cluster_first, m_cluster_last;
+  // Which blocks of VERTEX_BLOCK vertices hold a corner of a face, all
+  // needed when hiding lines
+  std::vector<unsigned char> m_face_blocks;
+  BoxTree m_instance_boxes;
+  std::vector<double> m_box_lower[3], m_box_upper[3];
+
+  // The faces around the mesh's edges, and the mesh they are of (null
+  // until found for the current one)
+  FeatureEdges m_features;
+  const Mesh *m_features_mesh;
+
+  // Per camera and per drawable view state; the arrays in them, the
+  // edge chunks of every view and where each chunk's lines start are
+  // per-frame scratch from m_arena.
+  std::vector<CameraPass> m_camera_passes;
+  std::vector<ViewPass> m_view_passes;
+  Arena m_arena;
+  EdgeChunk *m_chunks;
+  size_t *m_offsets;
+
+  // Instanced drawing: scratch per pool thread and output per chunk of
+  // instances and view
+  InstanceScratch *m_scratch;
+  InstanceChunk *m_instance_chunks;
+
+  // Hidden-line drawing: the 1/w of each end of each output line (per
+  // frame), a depth buffer per view, and the lines' visible parts
+  float *m_line_depths;
+  std::vector<DepthBuffer> m_depths;
+  LineList m_visible;
+
+  LineList m_out;
+  PipelineStats m_stats;
+};
+
+#endif
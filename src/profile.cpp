@@ -0,0 +1,258 @@
+//---------------------------------------------------------------------------
+//
+// profile.hpp/profile.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "profile.hpp"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+double now_ns()
+{
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A single-producer, single-consumer queue of timings.  The owning
+// thread advances "head" after writing a sample and end_frame()
+// advances "tail" after reading one; neither ever waits for the other.
+// A full ring drops new samples rather than block the recording thread.
+struct Profiler::Ring {
+  static const size_t SIZE = 1024;
+
+  struct Sample {
+    double ns;
+    unsigned stage;
+  };
+
+  Ring()
+    : head(0)
+    , tail(0)
+    , owned(true)
+  {
+  }
+
+  Sample samples[SIZE];
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  // False once the owning thread has exited, so another can take it
+  std::atomic<bool> owned;
+};
+
+const size_t Profiler::HISTORY;
+
+Profiler::Profiler()
+  : m_frames(0)
+{
+  for(int s = 0; s < PROFILE_STAGES; ++s) {
+    m_history[s].assign(HISTORY, 0.0);
+  }
+}
+
+Profiler::~Profiler()
+{
+  for(size_t i = 0; i < m_rings.size(); ++i) {
+    delete m_rings[i];
+  }
+}
+
+Profiler& Profiler::shared()
+{
+  // Never destroyed: pool threads can outlive any static, and they
+  // hand their rings back when they exit.
+  static Profiler *profiler = new Profiler;
+  return *profiler;
+}
+
+const char *Profiler::stage_name(ProfileStage stage)
+{
+  switch(stage) {
+  case PROFILE_FRAME: return "frame";
+  case PROFILE_TRANSFORM: return "transform";
+  case PROFILE_CLIP: return "clip";
+  case PROFILE_EMIT: return "emit";
+  case PROFILE_HIDE: return "hide";
+  case PROFILE_MERGE: return "merge";
+  case PROFILE_SUBMIT: return "submit";
+  case PROFILE_SWAP: return "swap";
+  default: break;
+  }
+  return "unknown";
+}
+
+// The calling thread's ring, found or made on its first record()
+Profiler::Ring *Profiler::thread_ring()
+{
+  struct Owner {
+    Profiler *profiler;
+    Ring *ring;
+
+    Owner()
+      : profiler(0)
+      , ring(0)
+    {
+    }
+    ~Owner()
+    {
+      if(ring) {
+        ring->owned.store(false, std::memory_order_release);
+      }
+    }
+  };
+  static thread_local Owner owner;
+
+  if(owner.profiler == this) {
+    return owner.ring;
+  }
+  if(owner.ring) {
+    owner.ring->owned.store(false, std::memory_order_release);
+  }
+
+  std::lock_guard<std::mutex> lock(m_rings_mutex);
+  Ring *ring = 0;
+  for(size_t i = 0; i < m_rings.size() && !ring; ++i) {
+    bool expected = false;
+    if(m_rings[i]->owned.compare_exchange_strong(expected, true)) {
+      ring = m_rings[i];
+    }
+  }
+  if(!ring) {
+    ring = new Ring;
+    m_rings.push_back(ring);
+  }
+  owner.profiler = this;
+  owner.ring = ring;
+  return ring;
+}
+
+void Profiler::record(ProfileStage stage, double ns)
+{
+  Ring *ring = thread_ring();
+  const uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if(head - ring->tail.load(std::memory_order_acquire) == Ring::SIZE) {
+    return;
+  }
+  Ring::Sample& sample = ring->samples[head % Ring::SIZE];
+  sample.ns = ns;
+  sample.stage = stage;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::end_frame()
+{
+  double totals[PROFILE_STAGES] = { 0 };
+
+  {
+    std::lock_guard<std::mutex> lock(m_rings_mutex);
+    for(size_t i = 0; i < m_rings.size(); ++i) {
+      Ring& ring = *m_rings[i];
+      const uint64_t head = ring.head.load(std::memory_order_acquire);
+      uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+      for(; tail != head; ++tail) {
+        const Ring::Sample& sample = ring.samples[tail % Ring::SIZE];
+        if(sample.stage < PROFILE_STAGES) {
+          totals[sample.stage] += sample.ns;
+        }
+      }
+      ring.tail.store(tail, std::memory_order_release);
+    }
+  }
+
+  const size_t slot = m_frames % HISTORY;
+  for(int s = 0; s < PROFILE_STAGES; ++s) {
+    m_history[s][slot] = totals[s];
+  }
+  ++m_frames;
+
+  if(m_csv.is_open()) {
+    m_csv << m_frames;
+    for(int s = 0; s < PROFILE_STAGES; ++s) {
+      m_csv << ',' << totals[s] / 1e6;
+    }
+    // Flushed every frame so the file is complete whenever the viewer
+    // stops
+    m_csv << std::endl;
+  }
+}
+
+double Profiler::average(ProfileStage stage) const
+{
+  const size_t count = std::min<size_t>(m_frames, HISTORY);
+  if(count == 0) {
+    return 0.0;
+  }
+  double sum = 0;
+  for(size_t i = 0; i < count; ++i) {
+    sum += m_history[stage][i];
+  }
+  return sum / count;
+}
+
+double Profiler::percentile(ProfileStage stage, double q) const
+{
+  const size_t count = std::min<size_t>(m_frames, HISTORY);
+  if(count == 0) {
+    return 0.0;
+  }
+  std::vector<double> samples(m_history[stage].begin(),
+                              m_history[stage].begin() + count);
+  const size_t k = std::min(count - 1, (size_t)(q * (count - 1) + 0.5));
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k];
+}
+
+std::string Profiler::summary() const
+{
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  for(int s = 0; s < PROFILE_STAGES; ++s) {
+    ProfileStage stage = ProfileStage(s);
+    if(s != 0) {
+      ss << "\n";
+    }
+    ss << stage_name(stage) << ":\t" << average(stage) / 1e6
+       << " ms\tp50 " << percentile(stage, 0.5) / 1e6
+       << "\tp95 " << percentile(stage, 0.95) / 1e6;
+  }
+  return ss.str();
+}
+
+bool Profiler::open_csv(const std::string& path, std::string& error)
+{
+  if(m_csv.is_open()) {
+    m_csv.close();
+  }
+  if(path.empty()) {
+    return true;
+  }
+
+  m_csv.open(path.c_str());
+  if(!m_csv) {
+    error = path + ": cannot open for writing";
+    return false;
+  }
+  m_csv << "frame";
+  for(int s = 0; s < PROFILE_STAGES; ++s) {
+    m_csv << ',' << stage_name(ProfileStage(s)) << "_ms";
+  }
+  m_csv << std::endl;
+  return true;
+}
+
+ScopedTimer::ScopedTimer(ProfileStage stage)
+  : m_stage(stage)
+  , m_start(now_ns())
+{
+}
+
+void ScopedTimer::stop()
+{
+  if(m_start >= 0) {
+    Profiler::shared().record(m_stage, now_ns() - m_start);
+    m_start = -1;
+  }
+}
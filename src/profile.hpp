@@ -0,0 +1,128 @@
+//---------------------------------------------------------------------------
+//
+// profile.hpp/profile.cpp
+//
+// Per-stage frame timing.  Each thread that records a timing writes it
+// to a ring buffer of its own, which only that thread writes and only
+// the thread ending the frame reads, so recording takes no locks.  At
+// the end of each frame the rings are drained into per-stage totals,
+// which are kept for a window of recent frames (for the averages and
+// percentiles the viewer shows) and optionally written to a CSV file,
+// one row per frame.
+//
+// Instrument code with the PROFILE_* macros.  Building with
+// CS488_NO_PROFILE defined turns them into nothing.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_PROFILE_HPP
+#define CS488_PROFILE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+// Nanoseconds on the monotonic clock, from an arbitrary starting point.
+// Everything that times itself uses this.
+double now_ns();
+
+// What a timing is for.  PROFILE_FRAME is the whole frame.
+enum ProfileStage {
+  PROFILE_FRAME,
+  // Model to clip space, outcodes and the divide for inside points
+  PROFILE_TRANSFORM,
+  // Edge assembly and clipping against the frustum and walls
+  PROFILE_CLIP,
+  // Writing the lines to the output
+  PROFILE_EMIT,
+  // Hiding lines behind faces with a software depth buffer
+  PROFILE_HIDE,
+  // Dropping lines that coincide on the pixel grid
+  PROFILE_MERGE,
+  // Handing the lines to OpenGL
+  PROFILE_SUBMIT,
+  PROFILE_SWAP,
+  PROFILE_STAGES
+};
+
+class Profiler {
+public:
+  // How many frames the averages and percentiles cover
+  static const size_t HISTORY = 120;
+
+  Profiler();
+  ~Profiler();
+
+  // The profiler everything in the viewer reports to
+  static Profiler& shared();
+
+  // Add "ns" to this frame's total for "stage".  Safe to call from any
+  // thread.
+  void record(ProfileStage stage, double ns);
+
+  // Collect everything recorded since the last call as one frame.
+  // Call from one thread only.
+  void end_frame();
+
+  // Rolling average and percentile q (in [0, 1]) of a stage's per-frame
+  // time, in nanoseconds, over the last HISTORY frames.
+  double average(ProfileStage stage) const;
+  double percentile(ProfileStage stage, double q) const;
+  unsigned long frames() const
+  {
+    return m_frames;
+  }
+
+  // One line per stage: average, p50 and p95 in milliseconds
+  std::string summary() const;
+
+  // Also write each frame's totals to "path" as CSV.  An empty path
+  // stops.  On failure returns false and describes why in "error".
+  bool open_csv(const std::string& path, std::string& error);
+
+  static const char *stage_name(ProfileStage stage);
+
+private:
+  struct Ring;
+  Ring *thread_ring();
+
+  std::mutex m_rings_mutex;
+  std::vector<Ring*> m_rings;
+
+  // Per stage: the last HISTORY frames' totals, oldest overwritten first
+  std::vector<double> m_history[PROFILE_STAGES];
+  unsigned long m_frames;
+
+  std::ofstream m_csv;
+};
+
+// Times from construction to destruction (or stop()) and records it
+class ScopedTimer {
+public:
+  explicit ScopedTimer(ProfileStage stage);
+  ~ScopedTimer()
+  {
+    stop();
+  }
+  void stop();
+
+private:
+  ProfileStage m_stage;
+  double m_start;
+};
+
+#ifndef CS488_NO_PROFILE
+#define PROFILE_SCOPE(timer, stage) ScopedTimer timer(stage)
+#define PROFILE_STOP(timer) timer.stop()
+#define PROFILE_RECORD(stage, ns) Profiler::shared().record(stage, ns)
+#define PROFILE_END_FRAME() Profiler::shared().end_frame()
+#else
+#define PROFILE_SCOPE(timer, stage) ((void)0)
+#define PROFILE_STOP(timer) ((void)0)
+#define PROFILE_RECORD(stage, ns) ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#endif
+
+#endif
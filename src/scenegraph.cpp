@@ -0,0 +1,187 @@
+//---------------------------------------------------------------------------
+//
+// scenegraph.hpp/scenegraph.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "scenegraph.hpp"
+#include <algorithm>
+
+const SceneGraph::Node SceneGraph::NONE;
+
+SceneGraph::SceneGraph()
+  : m_relayout(false)
+{
+}
+
+void SceneGraph::clear()
+{
+  m_parent_node.clear();
+  m_first_child.clear();
+  m_last_child.clear();
+  m_next_sibling.clear();
+  m_slot.clear();
+  m_parent.clear();
+  m_end.clear();
+  m_local.clear();
+  m_world.clear();
+  m_dirty.clear();
+  m_flagged.clear();
+  m_relayout = false;
+}
+
+SceneGraph::Node SceneGraph::add_node(Node parent, const Matrix4x4& local)
+{
+  const Node node = (Node)m_slot.size();
+  m_parent_node.push_back(parent);
+  m_first_child.push_back(NONE);
+  m_last_child.push_back(NONE);
+  m_next_sibling.push_back(NONE);
+  if(parent != NONE) {
+    if(m_last_child[parent] == NONE) {
+      m_first_child[parent] = node;
+    } else {
+      m_next_sibling[m_last_child[parent]] = node;
+    }
+    m_last_child[parent] = node;
+  }
+
+  // Park the node at the end until the next layout() puts it in place
+  m_slot.push_back((unsigned)node);
+  m_parent.push_back(NONE);
+  m_end.push_back((unsigned)node + 1);
+  m_local.push_back(local);
+  m_world.push_back(local);
+  m_flagged.push_back(0);
+  m_relayout = true;
+  return node;
+}
+
+void SceneGraph::set_local(Node node, const Matrix4x4& local)
+{
+  const unsigned slot = m_slot[node];
+  m_local[slot] = local;
+  if(!m_flagged[slot]) {
+    m_flagged[slot] = 1;
+    m_dirty.push_back(slot);
+  }
+}
+
+// Put the nodes in depth-first order, moving the local matrices along
+void SceneGraph::layout()
+{
+  const size_t count = m_slot.size();
+  std::vector<unsigned> slot(count);
+  std::vector<unsigned> parent(count);
+  std::vector<unsigned> end(count);
+  std::vector<Matrix4x4> local(count);
+
+  // Depth-first with an explicit stack, so deep hierarchies can't
+  // overflow the call stack
+  std::vector<Node> stack;
+  unsigned next = 0;
+  for(Node root = 0; root < count; ++root) {
+    if(m_parent_node[root] != NONE) {
+      continue;
+    }
+    stack.push_back(root);
+    while(!stack.empty()) {
+      const Node node = stack.back();
+      stack.pop_back();
+      const unsigned s = next++;
+      slot[node] = s;
+      const Node p = m_parent_node[node];
+      parent[s] = p == NONE ? NONE : slot[p];
+      local[s] = m_local[m_slot[node]];
+
+      // Push the children in reverse so the first comes out first
+      const size_t mark = stack.size();
+      for(Node c = m_first_child[node]; c != NONE; c = m_next_sibling[c]) {
+        stack.push_back(c);
+      }
+      std::reverse(stack.begin() + mark, stack.end());
+    }
+  }
+
+  // Subtree sizes, children first: every child's slot is after its
+  // parent's, so a backward sweep has finished a subtree before it
+  // reaches the subtree's root.
+  for(size_t s = 0; s < count; ++s) {
+    end[s] = 1;
+  }
+  for(size_t s = count; s-- > 0;) {
+    if(parent[s] != NONE) {
+      end[parent[s]] += end[s];
+    }
+  }
+  for(size_t s = 0; s < count; ++s) {
+    end[s] += (unsigned)s;
+  }
+
+  m_slot.swap(slot);
+  m_parent.swap(parent);
+  m_end.swap(end);
+  m_local.swap(local);
+  m_world.resize(count);
+  std::fill(m_flagged.begin(), m_flagged.end(), 0);
+  m_dirty.clear();
+  m_relayout = false;
+}
+
+// out = a * b.  Matrix4x4's operator* goes through row copies; this is
+// the same sum over raw arrays, which matters at one product per node.
+static void multiply(const Matrix4x4& a, const Matrix4x4& b, Matrix4x4& out)
+{
+  const double *x = a.begin(), *y = b.begin();
+  double *o = out[0];
+  for(size_t i = 0; i < 4; ++i) {
+    for(size_t j = 0; j < 4; ++j) {
+      o[4 * i + j] = x[4 * i] * y[j] + x[4 * i + 1] * y[4 + j] +
+        x[4 * i + 2] * y[8 + j] + x[4 * i + 3] * y[12 + j];
+    }
+  }
+  out.set_kind(std::max(a.kind(), b.kind()));
+}
+
+// Recompute slots [begin, end).  Parents come before their children
+// and the parent of "begin" is outside the run and up to date.
+void SceneGraph::update_range(size_t begin, size_t end)
+{
+  for(size_t s = begin; s < end; ++s) {
+    const unsigned p = m_parent[s];
+    if(p == NONE) {
+      m_world[s] = m_local[s];
+    } else {
+      multiply(m_world[p], m_local[s], m_world[s]);
+    }
+  }
+}
+
+size_t SceneGraph::update()
+{
+  if(m_relayout) {
+    layout();
+    update_range(0, m_slot.size());
+    return m_slot.size();
+  }
+  if(m_dirty.empty()) {
+    return 0;
+  }
+
+  // In slot order a dirty node inside an earlier dirty subtree is
+  // covered by that subtree's run and is skipped.
+  std::sort(m_dirty.begin(), m_dirty.end());
+  size_t covered = 0, count = 0;
+  for(size_t i = 0; i < m_dirty.size(); ++i) {
+    const unsigned s = m_dirty[i];
+    m_flagged[s] = 0;
+    if(s < covered) {
+      continue;
+    }
+    update_range(s, m_end[s]);
+    count += m_end[s] - s;
+    covered = m_end[s];
+  }
+  m_dirty.clear();
+  return count;
+}
@@ -0,0 +1,100 @@
+//---------------------------------------------------------------------------
+//
+// scenegraph.hpp/scenegraph.cpp
+//
+// A hierarchy of transform nodes.  Each node has a local matrix,
+// relative to its parent, and a cached world matrix (the product of the
+// local matrices from the root down).  Changing a local matrix only
+// marks the node's subtree out of date; world matrices are brought up
+// to date in one pass by update(), normally once per frame.
+//
+// Nodes are stored in depth-first order, so every subtree is one
+// contiguous run of the arrays that comes after its parent.  update()
+// walks those runs front to back, which touches only the dirty
+// subtrees and reads each parent's world matrix just before its
+// children need it.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_SCENEGRAPH_HPP
+#define CS488_SCENEGRAPH_HPP
+
+#include <vector>
+#include "algebra.hpp"
+
+class SceneGraph {
+public:
+  // Nodes are named by the order they were added in, starting at 0.
+  // Handles stay valid as the graph grows.
+  typedef unsigned Node;
+  static const Node NONE = ~0u;
+
+  SceneGraph();
+
+  // Add a node under "parent" (NONE for a new root).  Adding nodes
+  // changes the layout, so the next update() recomputes every world
+  // matrix; build the graph up front rather than every frame.
+  Node add_node(Node parent, const Matrix4x4& local = Matrix4x4());
+
+  // Remove every node
+  void clear();
+
+  size_t size() const
+  {
+    return m_slot.size();
+  }
+
+  Node parent(Node node) const
+  {
+    return m_parent_node[node];
+  }
+
+  const Matrix4x4& local(Node node) const
+  {
+    return m_local[m_slot[node]];
+  }
+  // Replace a node's local matrix and mark its subtree out of date
+  void set_local(Node node, const Matrix4x4& local);
+
+  // The world matrix as of the last update()
+  const Matrix4x4& world(Node node) const
+  {
+    return m_world[m_slot[node]];
+  }
+
+  // Recompute the world matrices of every dirty subtree.  Returns how
+  // many nodes were recomputed.
+  size_t update();
+
+  // True if set_local() or add_node() was called since the last update()
+  bool dirty() const
+  {
+    return m_relayout || !m_dirty.empty();
+  }
+
+private:
+  void layout();
+  void update_range(size_t begin, size_t end);
+
+  // By node: parent, first child and next sibling (NONE if there is
+  // none), and where the node sits in the depth-first arrays.
+  std::vector<Node> m_parent_node;
+  std::vector<Node> m_first_child, m_last_child, m_next_sibling;
+  std::vector<unsigned> m_slot;
+
+  // By depth-first slot: the parent's slot (NONE for roots), one past
+  // the last slot of the subtree, and the matrices.
+  std::vector<unsigned> m_parent;
+  std::vector<unsigned> m_end;
+  std::vector<Matrix4x4> m_local;
+  std::vector<Matrix4x4> m_world;
+
+  // Slots whose subtree needs recomputing, flagged so each is listed
+  // once
+  std::vector<unsigned> m_dirty;
+  std::vector<unsigned char> m_flagged;
+  // Nodes were added since the last layout()
+  bool m_relayout;
+};
+
+#endif
@@ -0,0 +1,539 @@
+//---------------------------------------------------------------------------
+//
+// softdraw.hpp/softdraw.cpp
+//
+// Software line rasterizer behind the draw.hpp interface.
+//
+//---------------------------------------------------------------------------
+
+#include "softdraw.hpp"
+#include "threadpool.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+struct SoftLine {
+  float x0, y0, x1, y1;
+  unsigned char rgba[4];
+};
+
+// Tiles are TILE x TILE pixels
+static const int TILE = 64;
+
+static std::vector<SoftLine> lines;
+static std::vector<unsigned char> framebuffer;
+static int fb_width = 0;
+static int fb_height = 0;
+static unsigned char current[4] = { 255, 255, 255, 255 };
+static unsigned num_threads = 0;
+static bool antialias = true;
+
+// bins[t][tile] holds, in submission order, copies of the lines binned
+// by thread t that touch the tile.  Copies rather than indices keep the
+// rasterizers reading memory sequentially.  Kept between frames to
+// avoid reallocating.
+static std::vector< std::vector< std::vector<SoftLine> > > bins;
+
+const unsigned char *soft_framebuffer()
+{
+  return framebuffer.empty() ? 0 : &framebuffer[0];
+}
+
+int soft_width()
+{
+  return fb_width;
+}
+
+int soft_height()
+{
+  return fb_height;
+}
+
+void soft_set_threads(unsigned threads)
+{
+  num_threads = threads;
+}
+
+void soft_set_antialias(bool on)
+{
+  antialias = on;
+}
+
+static inline unsigned char to_byte(double c)
+{
+  if(c <= 0.0) {
+    return 0;
+  }
+  if(c >= 1.0) {
+    return 255;
+  }
+  return (unsigned char)(c * 255.0 + 0.5);
+}
+
+static inline void add_line(const unsigned char *rgba, double x0, double y0,
+                            double x1, double y1)
+{
+  SoftLine l;
+  l.x0 = (float)x0;
+  l.y0 = (float)y0;
+  l.x1 = (float)x1;
+  l.y1 = (float)y1;
+  l.rgba[0] = rgba[0];
+  l.rgba[1] = rgba[1];
+  l.rgba[2] = rgba[2];
+  l.rgba[3] = 255;
+  lines.push_back(l);
+}
+
+void draw_line(const Point2D& p, const Point2D& q)
+{
+  add_line(current, p[0], p[1], q[0], q[1]);
+}
+
+void draw_lines(const double *points, const float *colours, size_t count)
+{
+  lines.reserve(lines.size() + count);
+
+  unsigned char rgba[4] = { current[0], current[1], current[2], 255 };
+  for(size_t i = 0; i < count; ++i) {
+    if(colours) {
+      rgba[0] = to_byte(colours[3 * i]);
+      rgba[1] = to_byte(colours[3 * i + 1]);
+      rgba[2] = to_byte(colours[3 * i + 2]);
+    }
+    add_line(rgba, points[4 * i], points[4 * i + 1],
+             points[4 * i + 2], points[4 * i + 3]);
+  }
+}
+
+void set_colour(const Colour& col)
+{
+  current[0] = to_byte(col.R());
+  current[1] = to_byte(col.G());
+  current[2] = to_byte(col.B());
+}
+
+void draw_init(int width, int height)
+{
+  fb_width = std::max(width, 0);
+  fb_height = std::max(height, 0);
+
+  // Same clear colour as the OpenGL backend
+  const unsigned char grey = to_byte(0.7);
+  const unsigned char clear[4] = { grey, grey, grey, 0 };
+  uint32_t pixel;
+  memcpy(&pixel, clear, 4);
+
+  size_t npixels = (size_t)fb_width * fb_height;
+  framebuffer.resize(npixels * 4);
+  if(npixels) {
+    uint32_t *p = (uint32_t*)&framebuffer[0];
+    std::fill(p, p + npixels, pixel);
+  }
+
+  lines.clear();
+}
+
+/*
+ * Rasterization
+ */
+
+struct TileRect {
+  int x0, y0, x1, y1;
+};
+
+// v / 255, exact for v <= 255 * 255 + 127
+static inline unsigned div255(unsigned v)
+{
+  return (v + 1 + (v >> 8)) >> 8;
+}
+
+// Blend colour c with coverage a (0-255) over the pixel, the same way
+// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) would.
+static inline void blend(unsigned char *px, const unsigned char *c, unsigned a)
+{
+  unsigned na = 255 - a;
+  px[0] = (unsigned char)div255(c[0] * a + px[0] * na + 127);
+  px[1] = (unsigned char)div255(c[1] * a + px[1] * na + 127);
+  px[2] = (unsigned char)div255(c[2] * a + px[2] * na + 127);
+  px[3] = (unsigned char)div255(a * a + px[3] * na + 127);
+}
+
+static inline void plot(const TileRect& r, bool steep, int major, int minor,
+                        const unsigned char *c, unsigned a)
+{
+  int x = steep ? minor : major;
+  int y = steep ? major : minor;
+  if(a == 0 || x < r.x0 || x >= r.x1 || y < r.y0 || y >= r.y1) {
+    return;
+  }
+  blend(&framebuffer[((size_t)y * fb_width + x) * 4], c, a);
+}
+
+// floor() without the libm call (needs |x| < 2^31)
+static inline int ifloor(double x)
+{
+  int i = (int)x;
+  return i - (x < i);
+}
+
+// Wu's antialiased line, restricted to the pixels of one tile.  Lines
+// have already been clipped to the screen by bin_line.
+static void raster_wu(const SoftLine& l, const TileRect& r)
+{
+  // Shift so pixel centres sit on integer coordinates
+  double x0 = l.x0 - 0.5, y0 = l.y0 - 0.5;
+  double x1 = l.x1 - 0.5, y1 = l.y1 - 0.5;
+
+  bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+  if(steep) {
+    std::swap(x0, y0);
+    std::swap(x1, y1);
+  }
+  if(x0 > x1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+
+  double dx = x1 - x0;
+  double gradient = (dx == 0.0) ? 0.0 : (y1 - y0) / dx;
+
+  int lo = ifloor(x0 + 0.5);
+  int hi = ifloor(x1 + 0.5);
+  lo = std::max(lo, steep ? r.y0 : r.x0);
+  hi = std::min(hi, (steep ? r.y1 : r.x1) - 1);
+
+  double y = y0 + gradient * (lo - x0);
+  for(int x = lo; x <= hi; ++x, y += gradient) {
+    int yi = ifloor(y);
+    unsigned a = (unsigned)((y - yi) * 255.0 + 0.5);
+    plot(r, steep, x, yi, l.rgba, 255 - a);
+    plot(r, steep, x, yi + 1, l.rgba, a);
+  }
+}
+
+// Integer Bresenham line, restricted to the pixels of one tile.  The
+// minor coordinate is computed directly from the major one so a tile
+// can start in the middle of a line.
+static void raster_bresenham(const SoftLine& l, const TileRect& r)
+{
+  int64_t x0 = ifloor(l.x0), y0 = ifloor(l.y0);
+  int64_t x1 = ifloor(l.x1), y1 = ifloor(l.y1);
+
+  bool steep = llabs(y1 - y0) > llabs(x1 - x0);
+  if(steep) {
+    std::swap(x0, y0);
+    std::swap(x1, y1);
+  }
+  if(x0 > x1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+
+  int64_t dx = x1 - x0;
+  int64_t dy = llabs(y1 - y0);
+  int64_t ystep = (y1 >= y0) ? 1 : -1;
+
+  int64_t lo = std::max<int64_t>(x0, steep ? r.y0 : r.x0);
+  int64_t hi = std::min<int64_t>(x1, (steep ? r.y1 : r.x1) - 1);
+
+  if(lo > hi) {
+    return;
+  }
+
+  // One division to find the starting row, then the usual error term
+  int64_t den = 2 * dx;
+  int64_t num = 2 * dy * (lo - x0) + dx;
+  int64_t step = den ? num / den : 0;
+  int64_t err = den ? num % den : 0;
+  for(int64_t x = lo; x <= hi; ++x) {
+    plot(r, steep, (int)x, (int)(y0 + ystep * step), l.rgba, 255);
+    err += 2 * dy;
+    if(err >= den) {
+      err -= den;
+      ++step;
+    }
+  }
+}
+
+// Clip l to the framebuffer (plus a pixel of margin for antialiasing).
+// Returns false if nothing is left.
+static bool clip_to_screen(const SoftLine& l, double& x0, double& y0,
+                           double& x1, double& y1)
+{
+  const double lo[2] = { -1.0, -1.0 };
+  const double hi[2] = { fb_width + 1.0, fb_height + 1.0 };
+  const double p0[2] = { l.x0, l.y0 };
+  const double d[2] = { (double)l.x1 - l.x0, (double)l.y1 - l.y0 };
+
+  double t0 = 0.0, t1 = 1.0;
+  for(int axis = 0; axis < 2; ++axis) {
+    if(d[axis] == 0.0) {
+      if(p0[axis] < lo[axis] || p0[axis] > hi[axis]) {
+        return false;
+      }
+      continue;
+    }
+    double ta = (lo[axis] - p0[axis]) / d[axis];
+    double tb = (hi[axis] - p0[axis]) / d[axis];
+    if(ta > tb) {
+      std::swap(ta, tb);
+    }
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    if(t0 > t1) {
+      return false;
+    }
+  }
+
+  x0 = p0[0] + t0 * d[0];
+  y0 = p0[1] + t0 * d[1];
+  x1 = p0[0] + t1 * d[0];
+  y1 = p0[1] + t1 * d[1];
+  return true;
+}
+
+// Clip a line to the screen, so the rasterizers only see screen-sized
+// coordinates, and add it to every tile it can touch.  Walks the tile
+// columns (or rows, for steep lines) the line crosses and adds the
+// tiles spanned by the line within each.
+static void bin_line(std::vector< std::vector<SoftLine> >& tbins,
+                     const SoftLine& line, int tiles_x, int tiles_y)
+{
+  double x0, y0, x1, y1;
+  if(!clip_to_screen(line, x0, y0, x1, y1)) {
+    return;
+  }
+  SoftLine l = line;
+  l.x0 = (float)x0;
+  l.y0 = (float)y0;
+  l.x1 = (float)x1;
+  l.y1 = (float)y1;
+
+  bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+  if(steep) {
+    std::swap(x0, y0);
+    std::swap(x1, y1);
+  }
+  if(x0 > x1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  double gradient = (x1 == x0) ? 0.0 : (y1 - y0) / (x1 - x0);
+
+  int major_tiles = steep ? tiles_y : tiles_x;
+  int minor_tiles = steep ? tiles_x : tiles_y;
+
+  int first = std::max(0, ifloor((x0 - 1.0) / TILE));
+  int last = std::min(major_tiles - 1, ifloor((x1 + 1.0) / TILE));
+  for(int t = first; t <= last; ++t) {
+    double a = std::max(x0, t * (double)TILE - 1.0);
+    double b = std::min(x1, (t + 1) * (double)TILE + 1.0);
+    double ya = y0 + gradient * (a - x0);
+    double yb = y0 + gradient * (b - x0);
+    if(ya > yb) {
+      std::swap(ya, yb);
+    }
+    int m0 = std::max(0, ifloor((ya - 1.5) / TILE));
+    int m1 = std::min(minor_tiles - 1, ifloor((yb + 1.5) / TILE));
+    for(int m = m0; m <= m1; ++m) {
+      int tx = steep ? m : t;
+      int ty = steep ? t : m;
+      tbins[ty * tiles_x + tx].push_back(l);
+    }
+  }
+}
+
+void draw_complete()
+{
+  if(lines.empty() || fb_width == 0 || fb_height == 0) {
+    return;
+  }
+
+  const int tiles_x = (fb_width + TILE - 1) / TILE;
+  const int tiles_y = (fb_height + TILE - 1) / TILE;
+  const unsigned ntiles = (unsigned)(tiles_x * tiles_y);
+
+  ThreadPool& pool = ThreadPool::shared();
+  unsigned threads = num_threads;
+  if(threads == 0) {
+    threads = pool.threads();
+  }
+  // A thread per 4096 lines at most; tiny frames stay single-threaded
+  threads = (unsigned)std::min<size_t>(threads, lines.size() / 4096 + 1);
+
+  bins.resize(std::max<size_t>(bins.size(), threads));
+  for(unsigned t = 0; t < threads; ++t) {
+    bins[t].resize(ntiles);
+    for(unsigned i = 0; i < ntiles; ++i) {
+      bins[t][i].clear();
+    }
+  }
+
+  // Bin contiguous ranges of lines, so visiting bins[0..threads) in
+  // order preserves submission order.
+  const size_t nlines = lines.size();
+  pool.run(threads, [&](unsigned t) {
+    size_t lo = nlines * t / threads;
+    size_t hi = nlines * (t + 1) / threads;
+    for(size_t i = lo; i < hi; ++i) {
+      bin_line(bins[t], lines[i], tiles_x, tiles_y);
+    }
+  }, threads);
+
+  // Tiles are handed out one at a time since line density varies a lot
+  pool.parallel_for(ntiles, 1, [&](size_t tile, size_t, unsigned) {
+    TileRect r;
+    r.x0 = (int)(tile % tiles_x) * TILE;
+    r.y0 = (int)(tile / tiles_x) * TILE;
+    r.x1 = std::min(r.x0 + TILE, fb_width);
+    r.y1 = std::min(r.y0 + TILE, fb_height);
+
+    for(unsigned t = 0; t < threads; ++t) {
+      const std::vector<SoftLine>& bin = bins[t][tile];
+      for(size_t i = 0; i < bin.size(); ++i) {
+        if(antialias) {
+          raster_wu(bin[i], r);
+        } else {
+          raster_bresenham(bin[i], r);
+        }
+      }
+    }
+  }, threads);
+}
+
+/*
+ * Image output
+ */
+
+bool soft_write_ppm(const std::string& path)
+{
+  FILE *f = fopen(path.c_str(), "wb");
+  if(!f) {
+    return false;
+  }
+
+  fprintf(f, "P6\n%d %d\n255\n", fb_width, fb_height);
+  std::vector<unsigned char> row((size_t)fb_width * 3);
+  for(int y = 0; y < fb_height; ++y) {
+    const unsigned char *src = &framebuffer[(size_t)y * fb_width * 4];
+    for(int x = 0; x < fb_width; ++x) {
+      row[3 * x] = src[4 * x];
+      row[3 * x + 1] = src[4 * x + 1];
+      row[3 * x + 2] = src[4 * x + 2];
+    }
+    if(!row.empty()) {
+      fwrite(&row[0], 1, row.size(), f);
+    }
+  }
+
+  return fclose(f) == 0;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char *p, size_t n)
+{
+  static uint32_t table[256];
+  static bool init = false;
+  if(!init) {
+    for(uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for(int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    init = true;
+  }
+
+  crc = ~crc;
+  for(size_t i = 0; i < n; ++i) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void put_be32(std::vector<unsigned char>& out, uint32_t v)
+{
+  out.push_back((unsigned char)(v >> 24));
+  out.push_back((unsigned char)(v >> 16));
+  out.push_back((unsigned char)(v >> 8));
+  out.push_back((unsigned char)v);
+}
+
+static void write_chunk(FILE *f, const char *type,
+                        const std::vector<unsigned char>& data)
+{
+  std::vector<unsigned char> chunk;
+  put_be32(chunk, (uint32_t)data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  put_be32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+  fwrite(&chunk[0], 1, chunk.size(), f);
+}
+
+// PNG without a compression library: the image data goes in
+// uncompressed ("stored") deflate blocks.
+bool soft_write_png(const std::string& path)
+{
+  FILE *f = fopen(path.c_str(), "wb");
+  if(!f) {
+    return false;
+  }
+
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+  };
+  fwrite(signature, 1, 8, f);
+
+  std::vector<unsigned char> ihdr;
+  put_be32(ihdr, (uint32_t)fb_width);
+  put_be32(ihdr, (uint32_t)fb_height);
+  ihdr.push_back(8);  // bit depth
+  ihdr.push_back(2);  // RGB
+  ihdr.push_back(0);  // deflate
+  ihdr.push_back(0);  // adaptive filtering
+  ihdr.push_back(0);  // no interlace
+  write_chunk(f, "IHDR", ihdr);
+
+  // Filter byte 0 (none) then RGB for every row
+  std::vector<unsigned char> raw;
+  raw.reserve((size_t)fb_height * (fb_width * 3 + 1));
+  for(int y = 0; y < fb_height; ++y) {
+    raw.push_back(0);
+    const unsigned char *src = &framebuffer[(size_t)y * fb_width * 4];
+    for(int x = 0; x < fb_width; ++x) {
+      raw.push_back(src[4 * x]);
+      raw.push_back(src[4 * x + 1]);
+      raw.push_back(src[4 * x + 2]);
+    }
+  }
+
+  std::vector<unsigned char> idat;
+  idat.push_back(0x78);
+  idat.push_back(0x01);
+  size_t pos = 0;
+  do {
+    size_t len = std::min<size_t>(raw.size() - pos, 65535);
+    idat.push_back(pos + len == raw.size() ? 1 : 0);
+    idat.push_back((unsigned char)len);
+    idat.push_back((unsigned char)(len >> 8));
+    idat.push_back((unsigned char)~len);
+    idat.push_back((unsigned char)(~len >> 8));
+    idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+    pos += len;
+  } while(pos < raw.size());
+
+  uint32_t a = 1, b = 0;
+  for(size_t i = 0; i < raw.size(); ++i) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_be32(idat, (b << 16) | a);
+  write_chunk(f, "IDAT", idat);
+  write_chunk(f, "IEND", std::vector<unsigned char>());
+
+  return fclose(f) == 0;
+}
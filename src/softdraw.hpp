@@ -0,0 +1,41 @@
+//---------------------------------------------------------------------------
+//
+// softdraw.hpp/softdraw.cpp
+//
+// A software implementation of the draw.hpp interface that needs no
+// OpenGL context or display.  Link softdraw.cpp instead of draw.cpp
+// and lines are rasterized into an in-memory RGBA framebuffer that can
+// be read back or written out as a PPM or PNG image.
+//
+// The framebuffer is split into tiles.  draw_complete bins each line
+// into the tiles it crosses and rasterizes the tiles in parallel; lines
+// are still blended in submission order within every pixel, so the
+// result does not depend on the thread count.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_SOFTDRAW_HPP
+#define CS488_SOFTDRAW_HPP
+
+#include <string>
+#include "draw.hpp"
+
+// The last completed frame: soft_width() * soft_height() RGBA pixels,
+// top row first.
+const unsigned char *soft_framebuffer();
+int soft_width();
+int soft_height();
+
+// Number of threads used to bin and rasterize (0, the default, means
+// every thread of the shared pool, see threadpool.hpp).
+void soft_set_threads(unsigned threads);
+
+// With antialiasing on (the default, like GL_LINE_SMOOTH) lines are
+// drawn with Wu's algorithm; with it off, with integer Bresenham.
+void soft_set_antialias(bool on);
+
+// Write the framebuffer out.  Return false if the file can't be written.
+bool soft_write_ppm(const std::string& path);
+bool soft_write_png(const std::string& path);
+
+#endif // CS488_SOFTDRAW_HPP
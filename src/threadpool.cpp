@@ -0,0 +1,164 @@
+//---------------------------------------------------------------------------
+//
+// threadpool.hpp/threadpool.cpp
+//
+//---------------------------------------------------------------------------
+
+#include "threadpool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads)
+  : m_threads(0)
+  , m_busy(false)
+  , m_generation(0)
+  , m_quit(false)
+  , m_call(0)
+  , m_fn(0)
+  , m_grain(1)
+  , m_active(0)
+  , m_pending(0)
+  , m_shares(0)
+{
+  start(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+  stop();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::set_threads(unsigned threads)
+{
+  stop();
+  start(threads);
+}
+
+void ThreadPool::start(unsigned threads)
+{
+  if(threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  m_threads = threads;
+  m_quit = false;
+  m_shares = new Share[threads];
+  // The caller is thread 0; the workers are 1 ... threads - 1.  They
+  // start out having seen every job so far.
+  for(unsigned t = 1; t < threads; ++t) {
+    m_workers.push_back(std::thread(&ThreadPool::worker, this, t,
+                                    m_generation));
+  }
+}
+
+void ThreadPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for(size_t i = 0; i < m_workers.size(); ++i) {
+    m_workers[i].join();
+  }
+  m_workers.clear();
+  delete [] m_shares;
+  m_shares = 0;
+}
+
+void ThreadPool::worker(unsigned thread, unsigned seen)
+{
+  for(;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(!m_quit && m_generation == seen) {
+        m_wake.wait(lock);
+      }
+      if(m_quit) {
+        return;
+      }
+      seen = m_generation;
+      if(thread >= m_active) {
+        continue;
+      }
+    }
+
+    work(thread);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(--m_pending == 0) {
+      m_done.notify_one();
+    }
+  }
+}
+
+// Drain our own share, then steal from the others in turn
+void ThreadPool::work(unsigned thread)
+{
+  for(unsigned k = 0; k < m_active; ++k) {
+    Share& share = m_shares[(thread + k) % m_active];
+    for(;;) {
+      size_t begin = share.next.fetch_add(m_grain);
+      if(begin >= share.end) {
+        break;
+      }
+      m_call(m_fn, begin, std::min(begin + m_grain, share.end), thread);
+    }
+  }
+}
+
+void ThreadPool::run_job(size_t count, size_t grain, unsigned max_threads,
+                         Call call, void *fn)
+{
+  if(count == 0) {
+    return;
+  }
+  grain = std::max<size_t>(grain, 1);
+
+  const size_t chunks = (count + grain - 1) / grain;
+  unsigned active = m_threads;
+  if(max_threads != 0) {
+    active = std::min(active, max_threads);
+  }
+  active = (unsigned)std::min<size_t>(active, chunks);
+
+  // Small jobs, and jobs that find the pool taken, run right here
+  if(active <= 1 || m_busy.exchange(true)) {
+    for(size_t begin = 0; begin < count; begin += grain) {
+      call(fn, begin, std::min(begin + grain, count), 0);
+    }
+    return;
+  }
+
+  // Hand each thread a contiguous run of whole chunks
+  for(unsigned t = 0; t < active; ++t) {
+    m_shares[t].next.store(chunks * t / active * grain,
+                           std::memory_order_relaxed);
+    m_shares[t].end = std::min(count, chunks * (t + 1) / active * grain);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_call = call;
+    m_fn = fn;
+    m_grain = grain;
+    m_active = active;
+    m_pending = active - 1;
+    ++m_generation;
+  }
+  m_wake.notify_all();
+
+  work(0);
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_pending != 0) {
+      m_done.wait(lock);
+    }
+  }
+  m_busy.store(false);
+}
@@ -0,0 +1,109 @@
+//---------------------------------------------------------------------------
+//
+// threadpool.hpp/threadpool.cpp
+//
+// A small pool of persistent worker threads for the data-parallel parts
+// of the viewer (mesh loading, the per-frame pipeline, the software
+// rasterizer).  Work is handed out as chunks of an index range: each
+// thread starts on its own share of the chunks and, once that runs dry,
+// steals chunks from the others, so uneven chunks don't leave cores
+// idle.
+//
+//---------------------------------------------------------------------------
+
+#ifndef CS488_THREADPOOL_HPP
+#define CS488_THREADPOOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+
+class ThreadPool {
+public:
+  // "threads" counts the calling thread; 0 means one per core.
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+
+  // Change the number of threads.  Must not be called while a job runs.
+  void set_threads(unsigned threads);
+  unsigned threads() const
+  {
+    return m_threads;
+  }
+
+  // Call fn(begin, end, thread) for consecutive chunks of at most
+  // "grain" indices covering [0, count), and wait for all of them.
+  // "thread" is in [0, threads()) and no two calls running at the same
+  // time share it, so it can index per-thread scratch.  At most
+  // "max_threads" threads take part (0 for all of them).
+  //
+  // A job started while another is running on the same pool (from a
+  // nested call or another thread) runs serially on its caller.
+  template<class F>
+  void parallel_for(size_t count, size_t grain, F fn,
+                    unsigned max_threads = 0)
+  {
+    run_job(count, grain, max_threads, &call<F>, &fn);
+  }
+
+  // Call fn(i) for each i in [0, n), one index per chunk.
+  template<class F>
+  void run(unsigned n, F fn, unsigned max_threads = 0)
+  {
+    parallel_for(n, 1, [&](size_t begin, size_t end, unsigned) {
+      for(size_t i = begin; i < end; ++i) {
+        fn((unsigned)i);
+      }
+    }, max_threads);
+  }
+
+  // The pool everything in the viewer shares
+  static ThreadPool& shared();
+
+private:
+  typedef void (*Call)(void *fn, size_t begin, size_t end, unsigned thread);
+
+  template<class F>
+  static void call(void *fn, size_t begin, size_t end, unsigned thread)
+  {
+    (*(F*)fn)(begin, end, thread);
+  }
+
+  // One thread's share of the chunks.  "next" is claimed with fetch_add
+  // by the owner and thieves alike, so every chunk runs exactly once.
+  struct Share {
+    std::atomic<size_t> next;
+    size_t end;
+    char pad[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  };
+
+  void start(unsigned threads);
+  void stop();
+  void worker(unsigned thread, unsigned seen);
+  void run_job(size_t count, size_t grain, unsigned max_threads,
+               Call call, void *fn);
+  void work(unsigned thread);
+
+  unsigned m_threads;
+  std::vector<std::thread> m_workers;
+  std::atomic<bool> m_busy;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  unsigned m_generation;
+  bool m_quit;
+
+  // The job being run
+  Call m_call;
+  void *m_fn;
+  size_t m_grain;
+  unsigned m_active;
+  unsigned m_pending;
+  Share *m_shares;
+};
+
+#endif
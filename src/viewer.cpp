@@ -1,13 +1,19 @@
 #include "viewer.hpp"
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include "draw.hpp"
+#include "a2.hpp"
+#include "profile.hpp"
+#include "inputlog.hpp"
+#include "meshcache.hpp"
+#include "meshlod.hpp"
 #include <math.h>
 
 #define DEFAULT_NEAR 6
-#define DEFAULT_FAR 16
+#define DEFAULT_FAR 20
 #define DEFAULT_FOV 31.6
 void Viewer::print (Matrix4x4 mat)
 {
@@ -66,33 +72,28 @@ Viewer::Viewer()
              Gdk::VISIBILITY_NOTIFY_MASK);
   
 	currMode = VIEW_ROTATE;
-	pointsOfCube = new Point3D[8];
- 	for (int i = 0;i<8;i++)
-	{
-		if (i%2 == 1)
-			pointsOfCube[i][0] = -1;
-		else
-			pointsOfCube[i][0] = 1;		
-	}
-	for (int i = 0;i<8;i++)
-	{
-		pointsOfCube[i][1] = 1;
-		if ((i > 1 && i < 4) || i > 5)
-			pointsOfCube[i][1] = -1;
-	}		
-	for (int i = 0;i<8;i++)
-	{
-		pointsOfCube[i][2] = 1;
-		if (i>3)
-			pointsOfCube[i][2] = -1;
-	}
-
-	tempPoints = new Point3D[8];
-	for (int i = 0;i<8;i++)
-	{
-		for (int j = 0; j<3;j++)
-			tempPoints[i][j] = pointsOfCube[i][j];
-	}
+	modelScale = Vector3D(1, 1, 1);
+	m_mesh = Mesh::cube();
+	m_pipeline.set_mesh(&m_mesh);
+	chunkBudget = (size_t)256 << 20;
+	chunkPaged.connect(sigc::mem_fun(*this, &Viewer::on_chunk_paged));
+	modelNode = scene.add_node(SceneGraph::NONE);
+	
+	// Nothing has been drawn yet
+	modelVersion = cameraVersion = viewportVersion = 1;
+	drawnModel = drawnCamera = drawnViewport = 0;
+	
+	pendingMotion = 0;
+	pendingDx = 0;
+	pendingScale = 1;
+	
+	replaying = false;
+	replayFast = false;
+	
+	quadView = false;
+	dragging = false;
+	dragButton = 0;
+	default_viewports();
 	
 	n = DEFAULT_NEAR;
 	f = DEFAULT_FAR;
@@ -116,9 +117,8 @@ Viewer::Viewer()
 
 Viewer::~Viewer()
 {
-	delete(pointsOfCube);
-	delete(tempPoints);
-	delete(walls);
+	frameTimer.disconnect();
+	replayTimer.disconnect();
 }
 
 void Viewer::invalidate()
@@ -131,44 +131,26 @@ void Viewer::invalidate()
 void Viewer::set_perspective(double fov, double aspect, double near, double far)
 {
 	// Construct the projection matrix
-	m_proj[0][0] = 1/(tan(fov / 2));
-	m_proj[0][0] /= aspect;
-	
-	for (int i = 1;i<4;i++)
-	{
-		m_proj[0][i] = 0;
-		m_proj[i][0] = 0;
-	}
-	
-	m_proj[1][1] = 1/(tan(fov/2));
-	m_proj[2][2] = (far + near) / (far - near);
-	m_proj[2][3] = (-2 * far * near)/(far-near);
-	m_proj[3][2] = 1;
-	m_proj[3][3] = 0;
-	for (int i = 2; i < 4; i++)
-	{
-		m_proj[1][i] = 0;
-		m_proj[i][1] = 0;
-	}
+	m_proj = perspective(fov, aspect, near, far);
 }
 
 void Viewer::reset_view()
 {
+	recorder.add(InputEvent::RESET);
+	
+	// Drop any movement not applied yet
+	pendingMotion = 0;
+	pendingDx = 0;
+	pendingScale = 1;
+	
 	n = DEFAULT_NEAR;
 	f = DEFAULT_FAR;
 	angle = DEFAULT_FOV;
 
-	m_M = identity;
+	modelRotation = Quaternion();
+	modelTranslation = Vector3D(0, 0, 0);
+	modelScale = Vector3D(1, 1, 1);
 
-	// Initialize Modelling Transformation
-	for (int i = 0;i<4;i++)
-	{
-		for (int j = 0;j<4;j++)
-		{
-			m_T[i][j] = 0;
-		}
-	}
-	
 	// Reset position of camera
 	lookFrom[0] = 0;
 	lookFrom[1] = 0;
@@ -185,19 +167,13 @@ void Viewer::reset_view()
 	// Reinitialize the viewing matrix
 	set_view();
 	
-	// Reset values for walls
-	walls[0][0] = 0.95 * get_width();
-	walls[0][1] = 0.5 * get_height();
-	
-	walls[1][0] = 0.05 * get_width();
-	walls[1][1] = 0.5 * get_height();
-	
-	walls[2][0] = 0.5 * get_width();
-	walls[2][1] = 0.95 * get_height();
-	
-	walls[3][0] = 0.5 * get_width();
-	walls[3][1] = 0.05 * get_height();
+	// Put the viewports back where they started
+	dragging = false;
+	default_viewports();
 	
+	++modelVersion;
+	++cameraVersion;
+	++viewportVersion;
 	invalidate();
 }
 
@@ -215,19 +191,8 @@ void Viewer::on_realize()
 	if (!gldrawable->gl_begin(get_gl_context()))
 	  return;
 	
-	// Specify default position of walls
-	walls = new Point2D[4];
-	walls[0][0] = 0.95 * get_width();
-	walls[0][1] = 0.5 * get_height();
-	
-	walls[1][0] = 0.05 * get_width();
-	walls[1][1] = 0.5 * get_height();
-	
-	walls[2][0] = 0.5 * get_width();
-	walls[2][1] = 0.95 * get_height();
-	
-	walls[3][0] = 0.5 * get_width();
-	walls[3][1] = 0.05 * get_height();
+	// The viewports are placed in the window now it has a size
+	++viewportVersion;
 	
 	gldrawable->gl_end();
 }
@@ -242,153 +207,129 @@ bool Viewer::on_expose_event(GdkEventExpose* event)
 	if (!gldrawable->gl_begin(get_gl_context()))
 		return false;
 	
+	PROFILE_SCOPE(frameTiming, PROFILE_FRAME);
+	if (replaying)
+		replayStats.begin_frame();
+	
 	double width = get_width();
 	double height = get_height();	
 	double aspectRatio = width / height;
 	
-	// Array of doubles used to store z-values BEFORE projection
-	double preProjZ[8];
-	
-	// Final Scaling matrix
-	m_T[0][0] = width / 2;
-	m_T[1][1] = height / 2;
-	m_T[2][2] = 1;
-	m_T[3][3] = 1;
-	m_T[0][3] = width / 2;
-	m_T[1][3] = height / 2;
-	m_T[2][3] = 1;
-	
-	// Store the points of the cube into a temp array
-	for (int i = 0;i<8;i++)
-	{
-		for (int j = 0; j<3;j++)
-			tempPoints[i][j] = pointsOfCube[i][j];
-	}
-	
 	// Here is where your drawing code should go.
 	draw_init(width, height);
 	
-	// Init projection matrix
-	set_perspective(angle, aspectRatio, n, f);	
-	
-	// Apply each transformation to the temp points
-	for (int i = 0;i<8;i++)
-	{	
-		tempPoints[i] = m_M * tempPoints[i];
-		tempPoints[i] = m_V * tempPoints[i];
+	// Only rebuild the matrices whose inputs changed since last frame
+	if (drawnCamera != cameraVersion)
+	{
+		// Init viewing and projection matrices
+		m_V = translation(viewTranslation) * viewRotation.to_matrix();
+		set_perspective(angle, aspectRatio, n, f);
 		
-		// Store the z values
-		preProjZ[i] = tempPoints[i][2];
+		Camera camera;
+		camera.view = m_V;
+		camera.proj = m_proj;
+		camera.near_plane = n;
+		camera.far_plane = f;
+		m_pipeline.set_camera(0, camera);
+		cameraViews[0] = m_V;
 		
-		tempPoints[i] = m_proj * tempPoints[i];		
+		// The quad view's other cameras: the model turned to face the
+		// main camera with its top, its side and a corner
+		const Matrix4x4 turns[3] = {
+			rotation(90, 'x'),
+			rotation(-90, 'y'),
+			rotation(45, 'y') * rotation(35, 'x')
+		};
+		for (unsigned k = 0; k < 3; ++k)
+		{
+			Camera turned = camera;
+			turned.view = m_V * turns[k];
+			m_pipeline.set_camera(k + 1, turned);
+			cameraViews[k + 1] = turned.view;
+		}
+		drawnCamera = cameraVersion;
 	}
 	
-	for (int i = 0;i<8;i++)
-	{	
-		// Normalize the x and y coordinates	
-		tempPoints[i][0] /= preProjZ[i];
-		tempPoints[i][1] /= preProjZ[i];		
-		
-		// Scale each point
-		tempPoints[i] = m_T * tempPoints[i];
+	if (drawnModel != modelVersion)
+	{
+		m_M = translation(modelTranslation) * modelRotation.to_matrix() *
+			scaling(modelScale);
+		scene.set_local(modelNode, m_M);
+		drawnModel = modelVersion;
 	}
 	
-	// Define sides of the cube	
-	Line sides[12];
-	
-	sides[0].pt1 = Point2D(tempPoints[0][0], tempPoints[0][1]);
-	sides[0].pt2 = Point2D(tempPoints[1][0], tempPoints[1][1]);
-
-	sides[1].pt1 = Point2D(tempPoints[0][0], tempPoints[0][1]);
-	sides[1].pt2 = Point2D(tempPoints[2][0], tempPoints[2][1]);
-	
-	sides[2].pt1 = Point2D(tempPoints[1][0], tempPoints[1][1]);
-	sides[2].pt2 = Point2D(tempPoints[3][0], tempPoints[3][1]);
-	
-	sides[3].pt1 = Point2D(tempPoints[2][0], tempPoints[2][1]);
-	sides[3].pt2 = Point2D(tempPoints[3][0], tempPoints[3][1]);
-	
-	sides[4].pt1 = Point2D(tempPoints[4][0], tempPoints[4][1]);
-	sides[4].pt2 = Point2D(tempPoints[5][0], tempPoints[5][1]);
-	
-	sides[5].pt1 = Point2D(tempPoints[4][0], tempPoints[4][1]);
-	sides[5].pt2 = Point2D(tempPoints[6][0], tempPoints[6][1]);
-	
-	sides[6].pt1 = Point2D(tempPoints[5][0], tempPoints[5][1]);
-	sides[6].pt2 = Point2D(tempPoints[7][0], tempPoints[7][1]);
+	// Bring the world matrices of whatever moved up to date
+	if (scene.update() != 0)
+		m_pipeline.set_model(scene.world(modelNode));
 	
-	sides[7].pt1 = Point2D(tempPoints[6][0], tempPoints[6][1]);
-	sides[7].pt2 = Point2D(tempPoints[7][0], tempPoints[7][1]);
-	
-	// Store the z values into each side
-	sides[0].z1 = tempPoints[0][2];
-	sides[1].z1 = tempPoints[0][2];
-	sides[2].z1 = tempPoints[1][2];
-	sides[3].z1 = tempPoints[2][2];
-	sides[4].z1 = tempPoints[4][2];
-	sides[5].z1 = tempPoints[4][2];
-	sides[6].z1 = tempPoints[5][2];
-	sides[7].z1 = tempPoints[6][2];
-	
-	sides[0].z2 = tempPoints[1][2];
-	sides[1].z2 = tempPoints[2][2];
-	sides[2].z2 = tempPoints[3][2];
-	sides[3].z2 = tempPoints[3][2];
-	sides[4].z2 = tempPoints[5][2];
-	sides[5].z2 = tempPoints[6][2];
-	sides[6].z2 = tempPoints[7][2];
-	sides[7].z2 = tempPoints[7][2];
-	
-	for (int i = 0; i < 4;i++)
+	if (drawnViewport != viewportVersion)
 	{
-		sides[i+8].pt1 = Point2D(tempPoints[i][0], tempPoints[i][1]);
-		sides[i+8].pt2 = Point2D(tempPoints[i+4][0], tempPoints[i+4][1]);
-		
-		sides[i+8].z1 = tempPoints[i][2];
-		sides[i+8].z2 = tempPoints[i+4][2];
+		// Each view is mapped onto its rectangle and clipped to it
+		m_views.resize(viewBoxes.size());
+		for (size_t i = 0; i < viewBoxes.size(); ++i)
+		{
+			const ViewBox& box = viewBoxes[i];
+			int x = (int)(box.left * width + 0.5);
+			int y = (int)(box.top * height + 0.5);
+			m_views[i] = View(box.camera, Viewport(x, y,
+				(int)(box.right * width + 0.5) - x,
+				(int)(box.bottom * height + 0.5) - y));
+		}
+		m_pipeline.set_views(m_views);
+		drawnViewport = viewportVersion;
 	}
-
-	// Assume each side can be drawn
-	for (int i = 0;i<12;i++)
-		sides[i].draw = true;
-	
-	// Clip points to the viewport
-	clip_sides(sides);
 	
-	// Draw the cube
-	for (int i = 0;i<4;i++)
+	if (m_pager)
+		draw_chunks();
+	else
 	{
-		// Back face
-		set_colour(Colour(0.1, 0.1, 0.1));
-		if (sides[i].draw)
-			draw_line (sides[i].pt1, sides[i].pt2);
-		
-		// Front face
-		set_colour(Colour(1, 0, 0));
-		if (sides[i+4].draw)
-			draw_line (sides[i+4].pt1, sides[i+4].pt2);
-		
-		// Side faces
-		set_colour(Colour(0.1, 0.1, 1));
-		if (sides[i+8].draw)
-			draw_line (sides[i+8].pt1, sides[i+8].pt2);
+		const LineList& lines = m_pipeline.run();
+		PROFILE_SCOPE(linesTiming, PROFILE_SUBMIT);
+		draw_lines(lines.points.data(), lines.colours.data(), lines.size());
 	}
 	
-	// Draw viewport
+	PROFILE_SCOPE(submitTiming, PROFILE_SUBMIT);
+	// Draw the viewports' borders
 	set_colour(Colour(0, 0.5, 1));
-	draw_line(	Point2D(0.05 * width, 0.05 * height), Point2D(0.05 * width, 0.95 * height) );
-	draw_line(	Point2D(0.05 * width, 0.05 * height), Point2D(0.95 * width, 0.05 * height) );
-	draw_line(	Point2D(0.95 * width, 0.05 * height), Point2D(0.95 * width, 0.95 * height) );
-	draw_line(	Point2D(0.05 * width, 0.95 * height), Point2D(0.95 * width, 0.95 * height) );
+	for (size_t i = 0; i < m_views.size(); ++i)
+	{
+		const Viewport& v = m_views[i].viewport;
+		draw_line(Point2D(v.left, v.top), Point2D(v.right, v.top));
+		draw_line(Point2D(v.right, v.top), Point2D(v.right, v.bottom));
+		draw_line(Point2D(v.right, v.bottom), Point2D(v.left, v.bottom));
+		draw_line(Point2D(v.left, v.bottom), Point2D(v.left, v.top));
+	}
+	
+	// And the one being dragged out
+	if (dragging)
+	{
+		set_colour(Colour(1, 1, 1));
+		draw_line(dragStart, Point2D(dragEnd[0], dragStart[1]));
+		draw_line(Point2D(dragEnd[0], dragStart[1]), dragEnd);
+		draw_line(dragEnd, Point2D(dragStart[0], dragEnd[1]));
+		draw_line(Point2D(dragStart[0], dragEnd[1]), dragStart);
+	}
 	
 	draw_complete();
+	PROFILE_STOP(submitTiming);
+	m_pipeline.end_frame();
+	for (auto i = chunkPipelines.begin(); i != chunkPipelines.end(); ++i)
+		i->second->end_frame();
 			
 	// Swap the contents of the front and back buffers so we see what we
 	// just drew. This should only be done if double buffering is enabled.
+	PROFILE_SCOPE(swapTiming, PROFILE_SWAP);
 	gldrawable->swap_buffers();
+	PROFILE_STOP(swapTiming);
 	
 	gldrawable->gl_end();
 	
+	PROFILE_STOP(frameTiming);
+	PROFILE_END_FRAME();
+	if (replaying)
+		replayStats.end_frame();
+	update_profile_label();
+	
 	return true;
 }
 
@@ -401,6 +342,10 @@ bool Viewer::on_configure_event(GdkEventConfigure* event)
   if (!gldrawable->gl_begin(get_gl_context()))
     return false;
 
+  // The aspect ratio and the window mapping both depend on the size
+  ++cameraVersion;
+  ++viewportVersion;
+
   gldrawable->gl_end();
 
   return true;
@@ -408,8 +353,34 @@ bool Viewer::on_configure_event(GdkEventConfigure* event)
 
 bool Viewer::on_button_press_event(GdkEventButton* event)
 {
+	recorder.add(InputEvent::PRESS, event->button, event->x, event->y);
+	
+	// Movement so far belongs to the old buttons
+	apply_motion();
+	
 	startPos[0] = event->x;
 	startPos[1] = event->y;
+	
+	if (currMode == VIEWPORT)
+	{
+		if (event->button == 3)
+		{
+			// Remove the viewport clicked, unless it's the last one
+			int i = viewport_at(event->x, event->y);
+			if (i >= 0 && viewBoxes.size() > 1)
+			{
+				viewBoxes.erase(viewBoxes.begin() + i);
+				++viewportVersion;
+			}
+		}
+		else if (!dragging)
+		{
+			dragging = true;
+			dragButton = event->button;
+			dragStart = dragEnd = startPos;
+		}
+	}
+	
 	if (event->button == 1)
 		mb1 = true;
 	else if (event->button == 2)
@@ -425,6 +396,17 @@ bool Viewer::on_button_press_event(GdkEventButton* event)
 
 bool Viewer::on_button_release_event(GdkEventButton* event)
 {
+	recorder.add(InputEvent::RELEASE, event->button, event->x, event->y);
+	
+	apply_motion();
+	
+	if (dragging && event->button == dragButton)
+	{
+		dragEnd = Point2D(event->x, event->y);
+		finish_drag();
+		invalidate();
+	}
+	
 	if (event->button == 1)
 		mb1 = false;
 	else if (event->button == 2)
@@ -435,73 +417,117 @@ bool Viewer::on_button_release_event(GdkEventButton* event)
 	return true;
 }
 
+// Map a mouse movement to a model scale factor
+static double scale_factor(double x2x1)
+{
+	x2x1 *= 5;
+	if (x2x1 >= 0 && x2x1 < 1)
+		x2x1 = 1.1;
+	else if (x2x1 <= 0 && x2x1 > -1)
+		x2x1 = 0.5;
+	else if (x2x1 < 0)
+		x2x1 = -1.0 / x2x1;
+	return x2x1;
+}
+
 bool Viewer::on_motion_notify_event(GdkEventMotion* event)
 {
-	Matrix4x4 temp;
-	// Change in x
-	double x2x1 = event->x - startPos[0];
+	recorder.add(InputEvent::MOTION, 0, event->x, event->y);
+	
+	if (currMode == VIEWPORT)
+	{
+		// Only the rectangle being dragged out moves; the next frame
+		// draws it
+		if (dragging)
+		{
+			dragEnd = Point2D(event->x, event->y);
+			if (frameClock.add_event())
+				frameTimer = Glib::signal_timeout().connect(
+					sigc::mem_fun(*this, &Viewer::on_frame),
+					frameClock.delay_ms());
+		}
+		return true;
+	}
+	
+	// Change in x, scaled down a bit
+	double x2x1 = (event->x - startPos[0]) / 10;
+	
+	// Only accumulate the movement here; on_frame applies it once per
+	// refresh however many events arrive in between. Rotations and
+	// translations add up, and scaling multiplies so each event still
+	// counts as a step of its own.
+	if (currMode == MODEL_SCALE)
+		pendingScale *= scale_factor(x2x1);
+	else
+		pendingDx += x2x1;
+	++pendingMotion;
+	
+	// Store the position of the cursor
+	startPos[0] = event->x;
+	startPos[1] = event->y;
+	
+	if (frameClock.add_event())
+		frameTimer = Glib::signal_timeout().connect(
+			sigc::mem_fun(*this, &Viewer::on_frame), frameClock.delay_ms());
+	return true;
+}
+
+bool Viewer::on_frame()
+{
+	apply_motion();
+	frameClock.frame_done();
+	update_labels();
+	
+	// Force render
+	invalidate();
+	
+	// One frame per timeout
+	return false;
+}
+
+// Apply the motion accumulated since the last frame
+void Viewer::apply_motion()
+{
+	if (pendingMotion == 0)
+		return;
+	
+	double x2x1 = pendingDx;
 	
-	// Scale it down a bit
-	x2x1 /= 10;
+	// The axis the held button works on: x, y and z for buttons 1, 2
+	// and 3, except that rotations go about x, z and y
+	static const int rotationAxis[3] = { 0, 2, 1 };
+	int i = 0;
+	if (mb1)
+		i = 0;
+	else if (mb2)
+		i = 1;
+	else if (mb3)
+		i = 2;
+	Vector3D axis;
+	axis[rotationAxis[i]] = 1;
 	
 	if (currMode == MODEL_TRANSLATE)
-	{		
-		int i = 0;
-		if (mb1)
-			i = 0;
-		else if (mb2)
-			i = 1;
-		else if (mb3)
-			i = 2;
-			
-		temp[i][3] -= x2x1;
+	{
+		// Move along the model's own (rotated and scaled) axes
+		Vector3D d;
+		d[i] = -x2x1 * modelScale[i];
+		modelTranslation = modelTranslation + modelRotation.rotate(d);
+		++modelVersion;
 	}
 	else if (currMode == MODEL_SCALE)
 	{
-		x2x1 *= 5;
-		if (x2x1 >= 0 && x2x1 < 1)
-			x2x1 = 1.1;
-		else if (x2x1 <= 0 && x2x1 > -1)
-			x2x1 = 0.5;
-		else if (x2x1 < 0)
-			x2x1 = -1.0 / x2x1;
-		
-		int i = 0;
-		if (mb1)
-			i = 0;
-		else if (mb2)
-			i = 1;
-		else if (mb3)
-			i = 2;
-		
-		m_M[i][i] *= x2x1;
+		modelScale[i] *= pendingScale;
+		++modelVersion;
 	}
 	else if (currMode == MODEL_ROTATE)
 	{
 		double anglePieces = get_width() / (2.0 * M_PI);
 		x2x1 /= anglePieces;
-		// Construct appropriate rotation matrix
-		if (mb1)
-		{
-			temp[1][2] = -1 * sin(x2x1);
-			temp[1][1] = cos(x2x1);
-			temp[2][2] = cos(x2x1);
-			temp[2][1] = sin(x2x1);
-		}
-		else if (mb2)
-		{
-			temp[0][1] = -1 * sin(x2x1);
-			temp[0][0] = cos(x2x1);
-			temp[1][1] = cos(x2x1);
-			temp[1][0] = sin(x2x1);
-		}
-		else if (mb3)
-		{
-			temp[2][0] = -1 * sin(x2x1);
-			temp[0][0] = cos(x2x1);
-			temp[2][2] = cos(x2x1);
-			temp[0][2] = sin(x2x1);
-		}
+		
+		// Rotate about the model's own axes
+		modelRotation = modelRotation * Quaternion::axis_angle(axis, x2x1);
+		modelRotation.normalize();
+		++modelVersion;
 	}
 	else if (currMode == VIEW_TRANSLATE)
 	{
@@ -519,39 +545,17 @@ bool Viewer::on_motion_notify_event(GdkEventMotion* event)
 	{
 		double anglePieces = get_width() / (2.0 * M_PI);
 		x2x1 /= anglePieces;
-		// Construct appropriate rotation matrix
-		if (mb1)
-		{
-			temp[1][2] = -1 * sin(x2x1);
-			temp[1][1] = cos(x2x1);
-			temp[2][2] = cos(x2x1);
-			temp[2][1] = sin(x2x1);
-			lookAt[0] += x2x1;
-		}
-		else if (mb2)
-		{
-			temp[0][1] = -1 * sin(x2x1);
-			temp[0][0] = cos(x2x1);
-			temp[1][1] = cos(x2x1);
-			temp[1][0] = sin(x2x1);
-			lookAt[1] += x2x1;
-		}
-		else if (mb3)
-		{
-			temp[2][0] = -1 * sin(x2x1);
-			temp[0][0] = cos(x2x1);
-			temp[2][2] = cos(x2x1);
-			temp[0][2] = sin(x2x1);
-			lookAt[2] += x2x1;
-		}
-
-		// Apply transformation
-		m_V = temp.invert() * m_V;
+		lookAt[i] += x2x1;
 		
-		// Set temp matrix back to identity
-		temp = identity;
+		// The inverse rotation is applied to the whole view transform,
+		// orientation and position alike
+		Quaternion inverse = Quaternion::axis_angle(axis, x2x1).conjugate();
+		viewRotation = inverse * viewRotation;
+		viewRotation.normalize();
+		viewTranslation = inverse.rotate(viewTranslation);
+		++cameraVersion;
 	}
-	else if (VIEW_PERSPECTIVE)
+	else if (currMode == VIEW_PERSPECTIVE)
 	{
 		if (mb1)
 			angle += x2x1;
@@ -566,24 +570,26 @@ bool Viewer::on_motion_notify_event(GdkEventMotion* event)
 		else if (angle > 160)
 			angle = 160;
 		
-		// Update on screen labels
-		update_labels();
+		++cameraVersion;
 	}
 	
-	// Apply the modelling matrix transformation
-	m_M = m_M * temp;
-	
-	// Store the position of the cursor
-	startPos[0] = event->x;
-	startPos[1] = event->y;
-	
-	// Force render
-	invalidate();
-	return true;
+	pendingMotion = 0;
+	pendingDx = 0;
+	pendingScale = 1;
 }
 
 void Viewer::set_mode(Mode newMode)
 {
+	recorder.add(InputEvent::MODE, newMode);
+	
+	// Movement so far belongs to the old mode
+	apply_motion();
+	if (dragging)
+	{
+		// A rectangle half dragged out is dropped
+		dragging = false;
+		invalidate();
+	}
 	currMode = newMode;
 	std::string str;
 	switch (newMode)
@@ -614,23 +620,91 @@ void Viewer::set_mode(Mode newMode)
 }
 
 
-void Viewer::set_labels(Gtk::Label *currentModel, Gtk::Label *nearFar)
+void Viewer::set_labels(Gtk::Label *currentModel, Gtk::Label *nearFar,
+	Gtk::Label *profile)
 {
 	currentModeLabel = currentModel;
 	nearFarLabel = nearFar;
+	profileLabel = profile;
 	
 	update_labels();
+	update_profile_label();
+}
+
+void Viewer::update_profile_label()
+{
+#ifndef CS488_NO_PROFILE
+	// Relaying out the label every frame would cost more than what it
+	// reports, so it follows the timings a few times a second
+	const Profiler& profiler = Profiler::shared();
+	if (profiler.frames() != 0 && profiler.frames() % 15 != 0)
+		return;
+	profileLabel->set_text(profiler.summary());
+#else
+	profileLabel->set_text("Frame timing compiled out");
+#endif
 }
 
 void Viewer::update_labels()
 {
 	// String streams used to print score and lines cleared	
-	std::stringstream ss, ss2;
+	std::stringstream ss, ss2, ss3, ss4;
 	
 	// Update the score
 	ss << n;
 	ss2 << f;
-	nearFarLabel->set_text("Near Plane:\t" + ss.str() + "\tFar Plane:\t" + ss2.str());
+	
+	// How many motion events the last frame absorbed
+	ss3 << frameClock.last_events();
+	// What the pipeline did last frame, over every chunk drawn for a
+	// chunk file
+	const PipelineStats& pipeStats = m_pager ? chunkStats :
+		m_pipeline.stats();
+	// And how many lines merging left out of the last frame
+	ss4 << pipeStats.merged;
+	// And how the culling boxes fell against the views
+	std::stringstream boxes;
+	boxes << pipeStats.boxes_culled << "/" << pipeStats.boxes_inside << "/" <<
+		pipeStats.boxes_partial;
+	// And, for a chunk file, how many chunks are in memory of those in
+	// view and in the file
+	std::string chunks;
+	if (m_pager)
+	{
+		PagerStats stats = m_pager->stats();
+		std::stringstream ss5;
+		ss5 << chunksReady.size() << "/" << stats.wanted << "/" <<
+			stats.chunks;
+		chunks = "\tChunks:\t" + ss5.str();
+	}
+	// Or which level of detail was drawn
+	else if (m_lods.size() != 0)
+	{
+		std::stringstream ss5;
+		ss5 << m_pipeline.stats().lod << "/" << m_lods.size() - 1;
+		chunks = "\tDetail Level:\t" + ss5.str();
+	}
+	// And how many lines the faces hid, when hiding them
+	std::string hidden;
+	if (m_pipeline.hidden_lines())
+	{
+		std::stringstream ss5;
+		ss5 << pipeStats.hidden;
+		hidden = "\tHidden:\t" + ss5.str();
+	}
+	// And how many edges were features and on a silhouette, when
+	// drawing only those
+	if (m_pipeline.feature_edges())
+	{
+		std::stringstream ss5;
+		ss5 << pipeStats.features << "/" << pipeStats.silhouettes;
+		hidden += "\tFeatures/Silhouette:\t" + ss5.str();
+	}
+	nearFarLabel->set_text("Near Plane:\t" + ss.str() + "\tFar Plane:\t" + ss2.str() +
+	                       "\tEvents/Frame:\t" + ss3.str() +
+	                       "\tDraw Calls Saved:\t" + ss4.str() +
+	                       "\tCulled/Inside/Partial:\t" + boxes.str() + hidden +
+	                       chunks);
 }
 
 void Viewer::set_view()
@@ -646,98 +720,410 @@ void Viewer::set_view()
 	vY = vZ.cross(vX);
 	vY.normalize();
 	
+	Matrix4x4 basis;
 	for (int i = 0;i<3;i++)
 	{
-		m_V[i][0] = vX[i];
-		m_V[i][1] = vY[i];
-		m_V[i][2] = vZ[i];
-		m_V[i][3] = lookFrom[i];
-		m_V[3][i] = 0;
+		basis[i][0] = vX[i];
+		basis[i][1] = vY[i];
+		basis[i][2] = vZ[i];
 	}
+	
+	// The view is kept as an orientation and a position; on_expose
+	// builds m_V from them when it changed
+	viewRotation = Quaternion::from_matrix(basis);
+	viewTranslation = Vector3D(lookFrom[0], lookFrom[1], lookFrom[2]);
+	++cameraVersion;
+}
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+	return s.size() > suffix.size() &&
+		s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
-void Viewer::clip_sides(Line *sides)
-{	
-	for (int i = 0; i < 12; i++)
+bool Viewer::load_mesh(const std::string& path, std::string& error)
+{
+	if (ends_with(path, ".a2chunks"))
 	{
-		for (int j = 0;j<4;j++)
-		{
-			double wecA, wecB;
-			// If we are dealing with the right and left walls determine difference in X
-			if (j < 2)
-			{
-				wecA = ((sides[i].pt1)[0] - walls[j][0]);
-				wecB = ((sides[i].pt2)[0] - walls[j][0]);	
-			}
-			// If we are dealing with the top and botom walls determine difference in X
-			else
-			{
-				wecA = ((sides[i].pt1)[1] - walls[j][1]);
-				wecB = ((sides[i].pt2)[1] - walls[j][1]);
-			}
-			
-			// If we are the right or top wall multiply by -1 to represent the normal
-			if (j%2 == 0)
-			{
-				wecA *= -1;
-				wecB *= -1;
-			}
+		std::unique_ptr<ChunkPager> pager(new ChunkPager);
+		pager->set_budget(chunkBudget);
+		if (!pager->open(path, error))
+			return false;
+		// Dispatcher::emit() is safe from any thread
+		pager->set_on_paged([this] { chunkPaged(); });
+		chunkPipelines.clear();
+		m_pager = std::move(pager);
+		m_pipeline.set_lods(0);
+		m_lods.levels.clear();
+		if (is_realized())
+			invalidate();
+		return true;
+	}
+	
+	if (ends_with(path, ".a2lod"))
+	{
+		LodChain lods;
+		if (!load_lod_chain(path, lods, error))
+			return false;
+		std::swap(m_lods, lods);
+		m_pipeline.set_lods(&m_lods);
+		chunkPipelines.clear();
+		m_pager.reset();
+		if (is_realized())
+			invalidate();
+		return true;
+	}
+	
+	// Large models are parsed once and mapped from their cache after
+	Mesh mesh;
+	if (!load_mesh_cached(path, mesh, error))
+		return false;
+	
+	std::swap(m_mesh, mesh);
+	m_pipeline.set_mesh(&m_mesh);
+	m_pipeline.set_lods(0);
+	m_lods.levels.clear();
+	chunkPipelines.clear();
+	m_pager.reset();
+	
+	if (is_realized())
+		invalidate();
+	return true;
+}
 
-			if (wecA < 0 && wecB < 0)
-			{
-				sides[i].draw = false;
-				break;
-			}
+void Viewer::set_chunk_budget(size_t bytes)
+{
+	chunkBudget = bytes;
+	if (m_pager)
+		m_pager->set_budget(bytes);
+}
 
-			if (wecA >= 0 && wecB >= 0)
-				continue;
+void Viewer::set_lod_pixels(double pixels)
+{
+	m_pipeline.set_lod_pixels(pixels);
+	if (is_realized())
+		invalidate();
+}
 
-			double t = wecA / (wecA - wecB);
-			if (wecA < 0)
-			{
-				(sides[i].pt1)[0] = (sides[i].pt1)[0] + t * ((sides[i].pt2)[0] - (sides[i].pt1)[0]);
-				(sides[i].pt1)[1] = (sides[i].pt1)[1] + t * ((sides[i].pt2)[1] - (sides[i].pt1)[1]);
-			}
-			else
-			{
-				(sides[i].pt2)[0] = (sides[i].pt1)[0] + t * ((sides[i].pt2)[0] - (sides[i].pt1)[0]);
-				(sides[i].pt2)[1] = (sides[i].pt1)[1] + t * ((sides[i].pt2)[1] - (sides[i].pt1)[1]);
-			}
+void Viewer::on_chunk_paged()
+{
+	update_labels();
+	if (is_realized())
+		invalidate();
+}
+
+// Draw the chunks in view that are in memory, and have the ones that
+// aren't read in for a later frame
+void Viewer::draw_chunks()
+{
+	// One frustum per camera in use
+	bool used[4] = { false, false, false, false };
+	const Matrix4x4& world = scene.world(modelNode);
+	chunkFrusta.clear();
+	for (size_t i = 0; i < m_views.size(); ++i)
+	{
+		unsigned camera = m_views[i].camera;
+		if (camera < 4 && !used[camera])
+		{
+			used[camera] = true;
+			chunkFrusta.push_back(m_proj * (cameraViews[camera] * world));
 		}
 	}
 	
-	// Near and far plane clipping
-	for (int i = 0; i<12;i++)
+	chunksInView.clear();
+	chunksReady.clear();
+	if (m_instances.size() > 1)
+	{
+		// Each copy places the chunks elsewhere; want them all
+		for (unsigned c = 0; c < m_pager->chunks(); ++c)
+			chunksInView.push_back(c);
+	}
+	else
+		m_pager->cull(chunkFrusta, chunksInView);
+	m_pager->request(chunksInView, chunksReady);
+	
+	// Each chunk keeps its pipeline, and with it its culling boxes,
+	// feature edges and last lines, for as long as it is drawn. A chunk
+	// is only evicted in a frame it isn't wanted in, so dropping the
+	// pipelines of those not drawn drops those of evicted chunks too.
+	std::map<unsigned, std::unique_ptr<RenderPipeline> > drawn;
+	chunkStats = PipelineStats();
+	for (size_t i = 0; i < chunksReady.size(); ++i)
 	{
-		for (int j = 0;j<2;j++)
+		unsigned c = chunksReady[i];
+		std::unique_ptr<RenderPipeline>& pipeline = drawn[c];
+		auto kept = chunkPipelines.find(c);
+		if (kept != chunkPipelines.end())
+			pipeline = std::move(kept->second);
+		else
 		{
-			double pointOnPlane = n;
-			
-			if (j == 1)
-				pointOnPlane = f;
-				
-			double wecA = (sides[i].z1 - pointOnPlane);
-			double wecB = (sides[i].z2 - pointOnPlane);
-			
-			if (wecA < 0 && wecB < 0)
-				sides[i].draw = false;
+			pipeline.reset(new RenderPipeline);
+			pipeline->set_mesh(&m_pager->mesh(c));
+		}
+		pipeline->follow(m_pipeline);
+		
+		const LineList& lines = pipeline->run();
+		if (i == 0)
+			chunkStats = pipeline->stats();
+		else
+			chunkStats.add(pipeline->stats());
+		PROFILE_SCOPE(linesTiming, PROFILE_SUBMIT);
+		draw_lines(lines.points.data(), lines.colours.data(), lines.size());
+	}
+	chunkPipelines.swap(drawn);
+}
+
+void Viewer::set_instances(unsigned count)
+{
+	m_instances.clear();
+	if (count <= 1)
+	{
+		m_pipeline.set_instances(0);
+		if (is_realized())
+			invalidate();
+		return;
+	}
+	
+	// The smallest cube of cells that holds them all
+	unsigned side = 1;
+	while (side * side * side < count)
+		++side;
+	double cell = 2.0 / side;
+	
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned cx = i % side, cy = i / side % side, cz = i / (side * side);
+		Vector3D centre(-1 + (cx + 0.5) * cell, -1 + (cy + 0.5) * cell,
+			-1 + (cz + 0.5) * cell);
+		Colour colour((cx + 1.0) / side, (cy + 1.0) / side, (cz + 1.0) / side);
+		m_instances.add(translation(centre) *
+			scaling(Vector3D(0.4 * cell, 0.4 * cell, 0.4 * cell)), colour);
+	}
+	m_pipeline.set_instances(&m_instances);
+	
+	if (is_realized())
+		invalidate();
+}
 
+void Viewer::set_merge_lines(bool merge)
+{
+	m_pipeline.set_merge_lines(merge);
+	if (is_realized())
+		invalidate();
+}
 
-			if (wecA >= 0 && wecB >= 0)
-				continue;
-			
-			double t = wecA / (wecA - wecB);
-			if (wecA < 0)
-			{
-				(sides[i].pt1)[0] = (sides[i].pt1)[0] + t * ((sides[i].pt2)[0] - (sides[i].pt1)[0]);
-				(sides[i].pt1)[1] = (sides[i].pt1)[1] + t * ((sides[i].pt2)[1] - (sides[i].pt1)[1]);
-			}
+void Viewer::set_hidden_lines(bool hidden)
+{
+	m_pipeline.set_hidden_lines(hidden);
+	if (is_realized())
+		invalidate();
+}
+
+void Viewer::set_feature_edges(bool features)
+{
+	m_pipeline.set_feature_edges(features);
+	if (is_realized())
+		invalidate();
+}
+
+void Viewer::set_precision(Precision precision)
+{
+	m_pipeline.set_precision(precision);
+	if (is_realized())
+		invalidate();
+}
+
+void Viewer::set_quad_view(bool quad)
+{
+	quadView = quad;
+	dragging = false;
+	default_viewports();
+	++viewportVersion;
+	
+	if (is_realized())
+		invalidate();
+}
+
+// One viewport walled 5% in from the window's edges or, for the quad
+// view, one in each quarter
+void Viewer::default_viewports()
+{
+	viewBoxes.clear();
+	if (!quadView)
+	{
+		ViewBox box = { 0, 0.05, 0.05, 0.95, 0.95 };
+		viewBoxes.push_back(box);
+		return;
+	}
+	for (unsigned q = 0; q < 4; ++q)
+	{
+		double left = 0.5 * (q % 2) + 0.025, top = 0.5 * (q / 2) + 0.025;
+		ViewBox box = { q, left, top, left + 0.45, top + 0.45 };
+		viewBoxes.push_back(box);
+	}
+}
+
+// The topmost (last drawn) viewport containing the window point x, y,
+// or -1 if none does
+int Viewer::viewport_at(double x, double y) const
+{
+	double fx = x / get_width(), fy = y / get_height();
+	for (size_t i = viewBoxes.size(); i-- > 0; )
+	{
+		const ViewBox& box = viewBoxes[i];
+		if (fx >= box.left && fx <= box.right &&
+			fy >= box.top && fy <= box.bottom)
+			return (int)i;
+	}
+	return -1;
+}
+
+// Turn the rectangle dragged out into a viewport: button 1 moves the
+// viewport the drag started in (or the first one) there, button 2 adds
+// a viewport there looking through the same camera
+void Viewer::finish_drag()
+{
+	dragging = false;
+	
+	double width = get_width(), height = get_height();
+	double x0 = std::min(dragStart[0], dragEnd[0]);
+	double x1 = std::max(dragStart[0], dragEnd[0]);
+	double y0 = std::min(dragStart[1], dragEnd[1]);
+	double y1 = std::max(dragStart[1], dragEnd[1]);
+	x0 = std::max(x0, 0.0);
+	y0 = std::max(y0, 0.0);
+	x1 = std::min(x1, width);
+	y1 = std::min(y1, height);
+	
+	// Too small to be anything but a stray click
+	if (x1 - x0 < 4 || y1 - y0 < 4)
+		return;
+	
+	int i = viewport_at(dragStart[0], dragStart[1]);
+	ViewBox box = viewBoxes[i < 0 ? 0 : i];
+	box.left = x0 / width;
+	box.right = x1 / width;
+	box.top = y0 / height;
+	box.bottom = y1 / height;
+	if (dragButton == 2)
+		viewBoxes.push_back(box);
+	else
+		viewBoxes[i < 0 ? 0 : i] = box;
+	++viewportVersion;
+}
+
+bool Viewer::record_input(const std::string& path, std::string& error)
+{
+	return recorder.open(path, error);
+}
+
+bool Viewer::replay_input(const std::string& path, bool fast,
+	std::string& error)
+{
+	if (!load_input_log(path, replayEvents, error))
+		return false;
+	
+	replaying = true;
+	replayFast = fast;
+	// Start once the main loop is running and the window is up
+	replayTimer = Glib::signal_idle().connect(
+		sigc::mem_fun(*this, &Viewer::on_replay_start));
+	return true;
+}
+
+// Feed one recorded event through the handler it came from
+void Viewer::replay_event(const InputEvent& event)
+{
+	switch (event.type)
+	{
+		case InputEvent::PRESS:
+		case InputEvent::RELEASE:
+		{
+			GdkEventButton button = GdkEventButton();
+			button.button = event.value;
+			button.x = event.x;
+			button.y = event.y;
+			if (event.type == InputEvent::PRESS)
+				on_button_press_event(&button);
 			else
-			{
-				(sides[i].pt2)[0] = (sides[i].pt1)[0] + t * ((sides[i].pt2)[0] - (sides[i].pt1)[0]);
-				(sides[i].pt2)[1] = (sides[i].pt1)[1] + t * ((sides[i].pt2)[1] - (sides[i].pt1)[1]);
-			}
-			
+				on_button_release_event(&button);
+			break;
+		}
+		case InputEvent::MOTION:
+		{
+			GdkEventMotion motion = GdkEventMotion();
+			motion.x = event.x;
+			motion.y = event.y;
+			on_motion_notify_event(&motion);
+			break;
 		}
+		case InputEvent::MODE:
+			// The log may be damaged or from another build
+			if (event.value <= VIEWPORT)
+				set_mode(Mode(event.value));
+			break;
+		case InputEvent::RESET:
+			reset_view();
+			break;
 	}
-}
\ No newline at end of file
+}
+
+bool Viewer::on_replay_start()
+{
+	// The clock starts once, here; from then on on_replay() only waits
+	// for it
+	replayStats.start();
+	replayPlayer.start(replayEvents);
+	return on_replay();
+}
+
+bool Viewer::on_replay()
+{
+	auto handle = [this](const InputEvent& event) { replay_event(event); };
+	
+	if (!replayFast)
+	{
+		// Everything that is due by now, then wait for the next event
+		replayStats.add_events(replayPlayer.play_due(handle));
+		
+		if (replayPlayer.done())
+		{
+			finish_replay();
+			return false;
+		}
+		replayTimer = Glib::signal_timeout().connect(
+			sigc::mem_fun(*this, &Viewer::on_replay),
+			(unsigned)(replayPlayer.wait_ns() / 1e6));
+		return false;
+	}
+	
+	// As fast as possible: the events of one recorded frame interval,
+	// then that frame, drawn right away rather than when the frame clock
+	// would have allowed
+	static const double FRAME_NS = 1e9 / 60;
+	if (!replayPlayer.done())
+	{
+		replayStats.add_events(replayPlayer.play_span(FRAME_NS, handle));
+		
+		frameTimer.disconnect();
+		on_frame();
+		get_window()->process_updates(false);
+	}
+	
+	if (replayPlayer.done())
+	{
+		finish_replay();
+		return false;
+	}
+	return true;
+}
+
+void Viewer::finish_replay()
+{
+	replaying = false;
+	replayEvents.clear();
+	std::cout << replayStats.summary() << std::endl;
+	
+	// A replay is a benchmark run: the numbers are out, so stop
+	Gtk::Main::quit();
+}
@@ -3,7 +3,17 @@
 
 #include <gtkmm.h>
 #include <gtkglmm.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
 #include "algebra.hpp"
+#include "mesh.hpp"
+#include "chunkedmesh.hpp"
+#include "pipeline.hpp"
+#include "scenegraph.hpp"
+#include "frameclock.hpp"
+#include "inputlog.hpp"
 
 // The "main" OpenGL widget
 class Viewer : public Gtk::GL::DrawingArea {
@@ -42,10 +52,63 @@ public:
 	
 	void set_mode(Mode newMode);
 
-	void set_labels(Gtk::Label *currentModel, Gtk::Label *nearFar);
+	void set_labels(Gtk::Label *currentModel, Gtk::Label *nearFar,
+		Gtk::Label *profile);
 	void update_labels();
+	// Show the per-stage frame timings (see profile.hpp)
+	void update_profile_label();
 	void set_view();
 
+	// Replace the displayed mesh with the OBJ/PLY file at "path", with
+	// the chunk file at "path" if it ends in .a2chunks (see
+	// chunkedmesh.hpp), or with the levels of detail at "path" if it
+	// ends in .a2lod (see meshlod.hpp). On failure the current mesh is
+	// kept and "error" says why.
+	bool load_mesh(const std::string& path, std::string& error);
+	
+	// The most memory the chunks of a chunk file may take (256 MiB by
+	// default)
+	void set_chunk_budget(size_t bytes);
+	// The most pixels the error of the level of detail drawn may cover
+	// (1 by default)
+	void set_lod_pixels(double pixels);
+	
+	// Draw "count" copies of the mesh, shrunk and laid out on a grid in
+	// the space the one copy took, each in its own colour. 0 or 1 goes
+	// back to a single copy.
+	void set_instances(unsigned count);
+	
+	// Transform the mesh in single or double precision (see
+	// pipeline.hpp)
+	void set_precision(Precision precision);
+	
+	// Draw only one of the lines that cover the same pixels (see
+	// RenderPipeline::set_merge_lines), or every line. On by default.
+	void set_merge_lines(bool merge);
+	
+	// Draw only the parts of lines the model's faces leave in view (see
+	// RenderPipeline::set_hidden_lines), or every line. Off by default.
+	void set_hidden_lines(bool hidden);
+	
+	// Draw only the model's boundaries, creases and silhouette (see
+	// RenderPipeline::set_feature_edges), or every edge. Off by default.
+	void set_feature_edges(bool features);
+	
+	// Split the window into four viewports: the camera the view modes
+	// move, and the same camera turned to look at the model from above,
+	// from the side and from a corner. False goes back to one viewport.
+	// Either way the viewports start out in their default places.
+	void set_quad_view(bool quad);
+	
+	// Write the input (mouse buttons and motion, mode switches and
+	// resets) to "path" as it happens, for replay_input().
+	bool record_input(const std::string& path, std::string& error);
+	// Play back a recording made by record_input(), at the speed it was
+	// recorded or, if "fast", as fast as frames can be drawn. When it
+	// ends the frame time statistics are printed and the program quits.
+	bool replay_input(const std::string& path, bool fast,
+		std::string& error);
+
 protected:
 
   // Events we implement
@@ -66,14 +129,31 @@ protected:
   virtual bool on_button_release_event(GdkEventButton* event);
   // Called when the mouse moves
   virtual bool on_motion_notify_event(GdkEventMotion* event);
+  // Called by frameTimer when a frame is due after input
+  bool on_frame();
+  // Called by replayTimer when the main loop is up, to start a replay
+  bool on_replay_start();
+  // Called by replayTimer to play back the next recorded events
+  bool on_replay();
+  // Called through chunkPaged when a chunk has been read in
+  void on_chunk_paged();
 
 private:
 
   // *** Fill me in ***
   // You will want to declare some more matrices here
 	Matrix4x4 m_proj;
-	Matrix4x4 m_M, m_T, m_V;
-	Matrix4x4 identity;
+	// Rebuilt from the state below when a frame needs them
+	Matrix4x4 m_M, m_V;
+	
+	// The model is scaled, then rotated, then translated. Rotations are
+	// accumulated as quaternions so they never drift from being pure
+	// rotations.
+	Quaternion modelRotation;
+	Vector3D modelTranslation, modelScale;
+	// The view transform is viewRotation followed by viewTranslation
+	Quaternion viewRotation;
+	Vector3D viewTranslation;
 	
 	Vector3D lookAt, up; 
 	Vector3D lookFrom;
@@ -82,24 +162,92 @@ private:
 	bool mb1, mb2, mb3;
 	
 	Point2D startPos;
-	Point3D *pointsOfCube;
-	Point3D *tempPoints;
-	Point2D *walls;
+	
+	// The viewports, each a camera's view mapped onto a rectangle of the
+	// window and clipped to it. The rectangles are kept as fractions of
+	// the window so they keep their place when it is resized. Camera 0
+	// is the one the view modes move; 1 to 3 are it turned as set_quad_view
+	// describes.
+	struct ViewBox
+	{
+		unsigned camera;
+		double left, top, right, bottom;
+	};
+	std::vector<ViewBox> viewBoxes;
+	std::vector<View> m_views;
+	bool quadView;
+	void default_viewports();
+	int viewport_at(double x, double y) const;
+	
+	// In VIEWPORT mode, button 1 drags out a new rectangle for the
+	// viewport the drag starts in, button 2 one for a new viewport
+	// sharing its camera, and button 3 removes the viewport clicked
+	bool dragging;
+	unsigned dragButton;
+	Point2D dragStart, dragEnd;
+	void finish_drag();
+
+	// The mesh being viewed and the pipeline that turns it into lines
+	Mesh m_mesh;
+	RenderPipeline m_pipeline;
+	InstanceBuffer m_instances;
+	// Levels of detail, drawn in place of m_mesh when there are any
+	LodChain m_lods;
+	// The view matrix of each camera, for culling chunks
+	Matrix4x4 cameraViews[4];
+	
+	// A chunk file, viewed in place of m_mesh when open. The paging
+	// thread tells the GTK thread a chunk is in through chunkPaged,
+	// which outlives it. Each chunk drawn has a pipeline of its own,
+	// following m_pipeline's settings, and chunkStats adds up what they
+	// did in the last frame.
+	Glib::Dispatcher chunkPaged;
+	std::unique_ptr<ChunkPager> m_pager;
+	size_t chunkBudget;
+	std::vector<Matrix4x4> chunkFrusta;
+	std::vector<unsigned> chunksInView, chunksReady;
+	std::map<unsigned, std::unique_ptr<RenderPipeline> > chunkPipelines;
+	PipelineStats chunkStats;
+	void draw_chunks();
+	
+	// The transform hierarchy. For now it holds the one model, whose
+	// local matrix is m_M.
+	SceneGraph scene;
+	SceneGraph::Node modelNode;
+	
+	// Bumped whenever the model matrix, the camera (view matrix or
+	// perspective parameters) or the window/walls change. on_expose
+	// only rebuilds and hands the pipeline what moved past the version
+	// it last drew, so an unchanged frame reuses the previous lines.
+	unsigned modelVersion, cameraVersion, viewportVersion;
+	unsigned drawnModel, drawnCamera, drawnViewport;
+	
+	// Mouse movement not applied yet: summed for translations and
+	// rotations, multiplied for scaling. Applied once per frame.
+	unsigned pendingMotion;
+	double pendingDx, pendingScale;
+	FrameClock frameClock;
+	sigc::connection frameTimer;
+	void apply_motion();
+	
+	// Input recording and replay
+	InputRecorder recorder;
+	std::vector<InputEvent> replayEvents;
+	InputReplay replayPlayer;
+	bool replaying, replayFast;
+	ReplayStats replayStats;
+	sigc::connection replayTimer;
+	void replay_event(const InputEvent& event);
+	void finish_replay();
 	
 	Gtk::Label *nearFarLabel;
+	Gtk::Label *profileLabel;
 	Gtk::Label *currentModeLabel;
 	double angle;
 	double n, f;
 
-	struct Line {
-		Point2D pt1, pt2;
-		double z1, z2;
-		bool draw;
-	};
-
 	Mode currMode;
   
-	void clip_sides(Line *sides);
 	void print (Matrix4x4 mat);
 	void print (Point3D pt);
 	void print (Vector3D vec);